@@ -75,7 +75,14 @@
 #define configUSE_RECURSIVE_MUTEXES             1
 #define configUSE_COUNTING_SEMAPHORES           1
 #define configQUEUE_REGISTRY_SIZE               10
+/* Queue sets are only used by the single task reactor of the Azure Device
+ * App, selected by AZURE_DEVICE_DEMO_SINGLE_TASK_REACTOR in the Makefile.
+ */
+#if defined(AZURE_DEVICE_DEMO_SINGLE_TASK_REACTOR) && ( AZURE_DEVICE_DEMO_SINGLE_TASK_REACTOR == 1 )
+#define configUSE_QUEUE_SETS                    1
+#else
 #define configUSE_QUEUE_SETS                    0
+#endif
 #define configUSE_TIME_SLICING                  1
 #define configENABLE_BACKWARD_COMPATIBILITY     0
 #define configNUM_THREAD_LOCAL_STORAGE_POINTERS 5
@@ -88,16 +95,29 @@
 
 /* Hook function related definitions. */
 #define configUSE_IDLE_HOOK                     0
-#define configUSE_TICK_HOOK                     0
+/* The tick hook extends the run time counter, see mqtt_iot_diagnostics.c */
+#define configUSE_TICK_HOOK                     configGENERATE_RUN_TIME_STATS
 #define configCHECK_FOR_STACK_OVERFLOW          2
 #define configUSE_MALLOC_FAILED_HOOK            1
 #define configUSE_DAEMON_TASK_STARTUP_HOOK      0
 
 /* Run time and task stats gathering related definitions. */
-#define configGENERATE_RUN_TIME_STATS           0
+#define configGENERATE_RUN_TIME_STATS           1
 #define configUSE_TRACE_FACILITY                1
 #define configUSE_STATS_FORMATTING_FUNCTIONS    0
 
+#if ( configGENERATE_RUN_TIME_STATS == 1 )
+/* The run time clock is the DWT cycle counter, extended to 64 bits and
+ * divided down to about 100 kHz, so that the 32-bit run time counters of the
+ * kernel wrap after hours rather than the 28 s of the cycle counter itself.
+ * The diag_cpu method reports usage since its previous invocation.
+ */
+extern void iot_diag_run_time_counter_init( void );
+extern uint32_t iot_diag_run_time_counter( void );
+#define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS()    iot_diag_run_time_counter_init()
+#define portGET_RUN_TIME_COUNTER_VALUE()            iot_diag_run_time_counter()
+#endif
+
 /* Co-routine related definitions. */
 #define configUSE_CO_ROUTINES                   0
 #define configMAX_CO_ROUTINE_PRIORITIES         1
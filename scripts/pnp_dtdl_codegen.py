@@ -0,0 +1,536 @@
+# Python script to generate the C tables of a PnP interface from its DTDL model:
+# the telemetry, property and command names, the desired property table for
+# iot_property_parse(), the reported property templates and the typed command
+# request parsers and response serializers.
+#
+# Usage:
+#   python pnp_dtdl_codegen.py <DTDL-interface-file> <output-file-without-extension>
+#
+# Example:
+#   python pnp_dtdl_codegen.py dtdl/Thermostat.json ../source/mqtt_iot_pnp_model
+#
+# The script writes <output>.h and <output>.c. A file whose content did not
+# change is not written again, so that the script can run before every build
+# without rebuilding the application.
+#
+# Supported DTDL subset: one Interface with Telemetry, Property and Command
+# contents. Schemas are double, float, integer, boolean, string, dateTime,
+# date, time and duration; a command request or response can also be an
+# Object of those. A writable property must be a number or a boolean.
+#
+import json
+import os
+import re
+import sys
+import textwrap
+
+LICENSE = """\
+ ********************************************************************************
+ * Copyright 2024, Cypress Semiconductor Corporation (an Infineon company) or
+ * an affiliate of Cypress Semiconductor Corporation.  All rights reserved.
+ *
+ * This software, including source code, documentation and related
+ * materials ("Software") is owned by Cypress Semiconductor Corporation
+ * or one of its affiliates ("Cypress") and is protected by and subject to
+ * worldwide patent protection (United States and foreign),
+ * United States copyright laws and international treaty provisions.
+ * Therefore, you may use this Software only as provided in the license
+ * agreement accompanying the software package from which you
+ * obtained this Software ("EULA").
+ * If no EULA applies, Cypress hereby grants you a personal, non-exclusive,
+ * non-transferable license to copy, modify, and compile the Software
+ * source code solely for use in connection with Cypress's
+ * integrated circuit products.  Any reproduction, modification, translation,
+ * compilation, or representation of this Software except as specified
+ * above is prohibited without the express written permission of Cypress.
+ *
+ * Disclaimer: THIS SOFTWARE IS PROVIDED AS-IS, WITH NO WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING, BUT NOT LIMITED TO, NONINFRINGEMENT, IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. Cypress
+ * reserves the right to make changes to the Software without notice. Cypress
+ * does not assume any liability arising out of the application or use of the
+ * Software or any product or circuit described in the Software. Cypress does
+ * not authorize its products for use in any products where a malfunction or
+ * failure of the Cypress product may reasonably be expected to result in
+ * significant property damage, injury or death ("High Risk Product"). By
+ * including Cypress's product in a High Risk Product, the manufacturer
+ * of such system or application assumes all risk of such use and in doing
+ * so agrees to indemnify Cypress against all liability.
+ *******************************************************************************/
+"""
+
+# Size of a string field of a command request, with its terminator
+STRING_SIZE = 64
+
+# DTDL schema: (kind, C type of a parsed value, property parser type, template slot)
+SCHEMAS = {
+    "double":   ("number", "double",  "IOT_PROPERTY_DOUBLE", "IOT_JSON_SLOT_NUMBER"),
+    "float":    ("number", "double",  "IOT_PROPERTY_DOUBLE", "IOT_JSON_SLOT_NUMBER"),
+    "integer":  ("int32",  "int32_t", "IOT_PROPERTY_INT32",  "IOT_JSON_SLOT_INT32"),
+    "boolean":  ("bool",   "bool",    "IOT_PROPERTY_BOOL",   "IOT_JSON_SLOT_NUMBER"),
+    "string":   ("string", "char",    None,                  "IOT_JSON_SLOT_STRING"),
+    "dateTime": ("string", "char",    None,                  "IOT_JSON_SLOT_STRING"),
+    "date":     ("string", "char",    None,                  "IOT_JSON_SLOT_STRING"),
+    "time":     ("string", "char",    None,                  "IOT_JSON_SLOT_STRING"),
+    "duration": ("string", "char",    None,                  "IOT_JSON_SLOT_STRING"),
+}
+
+# Reads a value of each kind from the current token of an az_json_reader
+TOKEN_GETTERS = {
+    "number": "az_json_token_get_double(&jr.token, &{out}->{field})",
+    "int32":  "az_json_token_get_int32(&jr.token, &{out}->{field})",
+    "bool":   "az_json_token_get_boolean(&jr.token, &{out}->{field})",
+    "string": "az_json_token_get_string(&jr.token, {out}->{field},\n{indent}        (int32_t)sizeof({out}->{field}), &{out}->{field}_len)",
+}
+
+NAME_PATTERN = re.compile(r"^[A-Za-z](?:[A-Za-z0-9_]*[A-Za-z0-9])?$")
+
+
+#Function that stops the script with an error about the model
+def fail(message):
+    sys.exit("pnp_dtdl_codegen: " + message)
+
+
+#Function that converts a DTDL name such as maxTempSinceLastReboot to max_temp_since_last_reboot
+def snake_case(name):
+    return re.sub(r"([a-z0-9])([A-Z])", r"\1_\2", name).lower()
+
+
+#Function that returns the DTDL types of a content, @type is a string or a list
+def content_types(content):
+    types = content.get("@type", [])
+    return [types] if isinstance(types, str) else types
+
+
+#Function that checks a name and returns it
+def checked_name(item, where):
+    name = item.get("name")
+    if not isinstance(name, str) or not NAME_PATTERN.match(name):
+        fail("invalid name %r in %s" % (name, where))
+    return name
+
+
+#Function that returns the kind tuple of a primitive schema
+def primitive(schema, where):
+    if not isinstance(schema, str) or schema not in SCHEMAS:
+        fail("unsupported schema %r in %s" % (schema, where))
+    return SCHEMAS[schema]
+
+
+#Function that returns the fields of a command request or response as (name, schema) pairs
+#and whether they are members of an object
+def payload_fields(payload, where):
+    schema = payload["schema"]
+    if isinstance(schema, dict):
+        if schema.get("@type") != "Object":
+            fail("unsupported schema %r in %s" % (schema.get("@type"), where))
+        fields = [(checked_name(f, where), f["schema"]) for f in schema.get("fields", [])]
+        if not fields or len(fields) > 32:
+            fail("%s must have between 1 and 32 fields" % where)
+        for name, field_schema in fields:
+            primitive(field_schema, where + "." + name)
+        return fields, True
+    primitive(schema, where)
+    return [(checked_name(payload, where), schema)], False
+
+
+#Function that formats a C comment block at the given indent
+def comment(text, indent=""):
+    lines = textwrap.wrap(text, 76 - len(indent), break_on_hyphens=False)
+    if len(lines) == 1:
+        return "%s/* %s */\n" % (indent, lines[0])
+    out = "%s/* %s\n" % (indent, lines[0])
+    for line in lines[1:]:
+        out += "%s * %s\n" % (indent, line)
+    return out + "%s */\n" % indent
+
+
+#Function that formats a #define with the value aligned like the rest of the sources
+def define(name, value):
+    return "#define %s%s\n" % (name.ljust(44), value)
+
+
+#Function that formats a C string literal of JSON text
+def c_string(text):
+    return '"' + text.replace("\\", "\\\\").replace('"', '\\"') + '"'
+
+
+#Function that loads the interface and sorts its contents
+def load_interface(path):
+    with open(path, "r") as fd:
+        model = json.load(fd)
+    if isinstance(model, list):
+        if len(model) != 1:
+            fail("%s must hold exactly one interface" % path)
+        model = model[0]
+    if model.get("@type") != "Interface":
+        fail("%s is not an Interface" % path)
+    model_id = model["@id"]
+    interface = re.match(r"^dtmi:(?:[A-Za-z0-9_]+:)*([A-Za-z][A-Za-z0-9_]*);[0-9]+$", model_id)
+    if interface is None:
+        fail("invalid @id %r" % model_id)
+
+    telemetry, writable, read_only, commands = [], [], [], []
+    for content in model.get("contents", []):
+        types = content_types(content)
+        name = checked_name(content, model_id)
+        if "Telemetry" in types:
+            telemetry.append(content)
+        elif "Property" in types:
+            kind = primitive(content["schema"], name)
+            if content.get("writable", False):
+                if kind[2] is None:
+                    fail("writable property %s must be a number or a boolean" % name)
+                writable.append(content)
+            else:
+                read_only.append(content)
+        elif "Command" in types:
+            commands.append(content)
+        else:
+            fail("unsupported content %s of type %r" % (name, types))
+
+    if len(writable) + len(read_only) > 32:
+        fail("more than 32 properties")
+    return {
+        "id": model_id,
+        "file": os.path.basename(path),
+        "prefix": "pnp_" + snake_case(interface.group(1)),
+        "description": model.get("description", model.get("displayName", interface.group(1))),
+        "telemetry": telemetry,
+        "properties": writable + read_only,
+        "writable_count": len(writable),
+        "commands": commands,
+    }
+
+
+#Function that returns the file header of a generated file
+def file_header(name, model, what):
+    text = "/******************************************************************************\n"
+    text += " * File Name: %s\n" % name
+    text += " *\n"
+    description = textwrap.wrap("Description: This file contains %s of the DTDL interface %s. %s"
+                                % (what, model["id"], model["description"]), 74)
+    for line in description:
+        text += " * %s\n" % line
+    text += " *\n"
+    for line in textwrap.wrap("Generated by scripts/pnp_dtdl_codegen.py from scripts/dtdl/%s, do not edit."
+                              % model["file"], 74):
+        text += " * %s\n" % line
+    text += " *\n"
+    return text + LICENSE
+
+
+#Function that returns the C names of a command request or response
+def payload_names(model, command, part):
+    base = "%s_%s_%s" % (model["prefix"], snake_case(command["name"]), part)
+    return base + "_t", base
+
+
+#Function that generates the header file
+def generate_header(model, name):
+    prefix = model["prefix"]
+    upper = prefix.upper()
+    guard = re.sub(r"[^A-Z0-9]", "_", name.upper()) + "_"
+    text = file_header(name, model, "the telemetry, property and command tables")
+    text += "\n#ifndef %s\n#define %s\n\n" % (guard, guard)
+    text += "#include <stdbool.h>\n#include <stddef.h>\n#include <stdint.h>\n\n"
+    text += "#include <az_core.h>\n"
+    text += "#include \"mqtt_iot_json_template.h\"\n"
+    text += "#include \"mqtt_iot_property_parser.h\"\n\n"
+
+    text += "/*******************************************************************************\n"
+    text += " * Macros\n"
+    text += " ********************************************************************************/\n"
+    text += define("%s_MODEL_ID" % upper, "\"%s\"" % model["id"]) + "\n"
+    text += comment("Writable properties come first in %s_property_t" % prefix)
+    text += define("%s_WRITABLE_PROPERTY_COUNT" % upper, "(%d)" % model["writable_count"]) + "\n"
+    text += comment("Size of a string field of a command request, with its terminator")
+    text += define("%s_STRING_SIZE" % upper, "(%d)" % STRING_SIZE)
+
+    if model["writable_count"] > 0:
+        text += "\n"
+        text += comment("Declares the writable properties of one interface instance for "
+                        "iot_property_parse(). prefix is \"\" for the default component or "
+                        "\"<component>.\", base is the offsetof() the %s_writable_t of the "
+                        "instance in the parse output. The application defines "
+                        "%s_<PROPERTY>_RANGE as \"has_range, min, max\" for each property."
+                        % (prefix, upper))
+        lines = ["#define %s_WRITABLE_PROPERTY_DEFS(prefix, base)" % upper]
+        writable = model["properties"][:model["writable_count"]]
+        for i, prop in enumerate(writable):
+            field = snake_case(prop["name"])
+            lines.append("    { prefix \"%s\", %s," % (prop["name"], SCHEMAS[prop["schema"]][2]))
+            lines.append("      (base) + offsetof(%s_writable_t, %s)," % (prefix, field))
+            lines.append("      %s_%s_RANGE }%s" % (upper, field.upper(), "," if i < len(writable) - 1 else ""))
+        width = max(len(line) for line in lines) + 1
+        text += "".join(line.ljust(width) + "\\\n" for line in lines[:-1]) + lines[-1] + "\n"
+
+    text += "\n/*******************************************************************************\n"
+    text += " * Global Variables\n"
+    text += " ********************************************************************************/\n"
+    for kind, items in (("telemetry", model["telemetry"]), ("property", model["properties"]),
+                        ("command", model["commands"])):
+        text += "typedef enum\n{\n"
+        members = ["%s_%s_%s%s" % (upper, kind.upper(), snake_case(item["name"]).upper(), " = 0," if i == 0 else ",")
+                   for i, item in enumerate(items)]
+        width = max([len(member) for member in members] + [0]) + 1
+        for member, item in zip(members, items):
+            if kind == "command":
+                note = ", ".join("%s %s" % (part, item[part]["name"]) for part in ("request", "response")
+                                 if part in item) or "no payload"
+            else:
+                note = item["schema"] if isinstance(item["schema"], str) else item["schema"].get("@type", "")
+            if "unit" in item:
+                note += ", " + item["unit"]
+            if item.get("writable", False):
+                note += ", writable"
+            text += "    %s/* %s */\n" % (member.ljust(width), note)
+        text += "    %s_%s_COUNT\n} %s_%s_t;\n\n" % (upper, kind.upper(), prefix, kind)
+
+    if model["writable_count"] > 0:
+        text += comment("Writable properties, the output of iot_property_parse()")
+        text += "typedef struct\n{\n"
+        for prop in model["properties"][:model["writable_count"]]:
+            text += "    %s %s;\n" % (SCHEMAS[prop["schema"]][1], snake_case(prop["name"]))
+        text += "} %s_writable_t;\n\n" % prefix
+
+    for command in model["commands"]:
+        if "request" in command:
+            type_name, _ = payload_names(model, command, "request")
+            fields, is_object = payload_fields(command["request"], command["name"] + " request")
+            text += comment(("Request of %s. %s" % (command["name"],
+                            command["request"].get("description", ""))).strip())
+            text += "typedef struct\n{\n"
+            for field, schema in fields:
+                kind, c_type = SCHEMAS[schema][0], SCHEMAS[schema][1]
+                if kind == "string":
+                    text += "    char %s[%s_STRING_SIZE];\n" % (snake_case(field), upper)
+                    text += "    int32_t %s_len;\n" % snake_case(field)
+                else:
+                    text += "    %s %s;\n" % (c_type, snake_case(field))
+            if is_object:
+                text += "    uint32_t found;                 /* Bit n set if field n was present */\n"
+            text += "} %s;\n\n" % type_name
+        if "response" in command:
+            type_name, _ = payload_names(model, command, "response")
+            fields, _ = payload_fields(command["response"], command["name"] + " response")
+            text += comment("Response of %s. Numbers and booleans are formatted JSON text, so "
+                            "that the caller chooses the format." % command["name"])
+            text += "typedef struct\n{\n"
+            for field, schema in fields:
+                c_type = "int32_t" if SCHEMAS[schema][0] == "int32" else "az_span"
+                text += "    %s %s;\n" % (c_type, snake_case(field))
+            text += "} %s;\n\n" % type_name
+
+    # C has no empty arrays, a table without entries is left out
+    for kind, items in (("telemetry", model["telemetry"]), ("property", model["properties"]),
+                        ("command", model["commands"])):
+        if items:
+            text += "extern az_span const %s_%s_names[%s_%s_COUNT];\n" % (prefix, kind, upper, kind.upper())
+    text += "\n"
+    if model["properties"]:
+        text += comment("Reported value of each property: \"<name>\":<value> with one slot for a "
+                        "read-only property, and \"<name>\":{\"value\":<value>,\"ac\":<code>,"
+                        "\"av\":<version>,\"ad\":<description>} with four slots for a writable one.")
+        text += "extern iot_json_template const %s_property_templates[%s_PROPERTY_COUNT];\n\n" % (prefix, upper)
+
+    text += "/******************************************************************************\n"
+    text += " * Function Prototypes\n"
+    text += " *******************************************************************************/\n"
+    for command in model["commands"]:
+        if "request" in command:
+            type_name, function = payload_names(model, command, "request")
+            text += "/*\n"
+            text += " * @brief Parses the request payload of %s.\n" % command["name"]
+            text += " * @param[in] payload Request payload.\n"
+            text += " * @param[out] out_request Request fields.\n"
+            text += " * @return false if the payload does not match the request schema.\n"
+            text += " */\n"
+            text += "bool %s_parse(az_span payload,\n        %s* out_request);\n\n" % (function, type_name)
+        if "response" in command:
+            type_name, function = payload_names(model, command, "response")
+            text += "/*\n"
+            text += " * @brief Writes the response payload of %s at the start of a buffer.\n" % command["name"]
+            text += " * @param[in] response Response fields.\n"
+            text += " * @param[in,out] remainder Buffer; on success, the part after the payload.\n"
+            text += " * @return AZ_OK, or AZ_ERROR_NOT_ENOUGH_SPACE if the buffer is too small.\n"
+            text += " */\n"
+            text += "az_result %s_append(\n        %s const* response, az_span* remainder);\n\n" % (function, type_name)
+
+    text += "#endif /* %s */\n\n/* [] END OF FILE */\n" % guard
+    return text
+
+
+#Function that returns a function doc block in the style of the sources
+def function_doc(function, summary, parameters, returns):
+    text = "/******************************************************************************\n"
+    text += " * Function Name: %s\n" % function
+    text += " ******************************************************************************\n"
+    text += " * Summary:\n"
+    for line in textwrap.wrap(summary, 74):
+        text += " *  %s\n" % line
+    text += " *\n * Parameters:\n"
+    for name, description in parameters:
+        text += " *  %s: %s\n" % (name, description)
+        text += " *\n"
+    text += " * Return:\n"
+    text += " *  %s\n" % returns
+    text += " *\n"
+    text += " ******************************************************************************/\n"
+    return text
+
+
+#Function that returns a template part array
+def template_parts(name, parts):
+    text = "static iot_json_template_part const %s[] =\n{\n" % name
+    text += ",\n".join("    IOT_JSON_TEMPLATE_PART(%s, %s)" % (c_string(literal), slot) for literal, slot in parts)
+    return text + "\n};\n"
+
+
+#Function that generates the request parser of a command
+def generate_parser(model, command):
+    type_name, function = payload_names(model, command, "request")
+    fields, is_object = payload_fields(command["request"], command["name"] + " request")
+    text = function_doc(function + "_parse",
+                        "Parses the request payload of %s." % command["name"]
+                        + (" Unknown members are skipped." if is_object else ""),
+                        [("payload", "Request payload."), ("out_request", "Request fields.")],
+                        "bool: false if the payload does not match the request schema.")
+    text += "bool %s_parse(az_span payload,\n        %s* out_request)\n{\n" % (function, type_name)
+    text += "    az_json_reader jr;\n"
+    text += "    az_result rc;\n\n"
+    text += "    memset(out_request, 0x00, sizeof(*out_request));\n"
+    text += "    rc = az_json_reader_init(&jr, payload, NULL);\n"
+    text += "    if (az_result_succeeded(rc))\n    {\n"
+    text += "        rc = az_json_reader_next_token(&jr);\n    }\n"
+    if not is_object:
+        field, schema = fields[0]
+        text += "    if (az_result_succeeded(rc))\n    {\n"
+        text += "        rc = %s;\n    }\n\n" % TOKEN_GETTERS[SCHEMAS[schema][0]].format(
+            out="out_request", field=snake_case(field), indent=" " * 8)
+        text += "    return az_result_succeeded(rc);\n}\n"
+        return text
+
+    text += "    if (az_result_failed(rc) || (jr.token.kind != AZ_JSON_TOKEN_BEGIN_OBJECT))\n    {\n"
+    text += "        return false;\n    }\n\n"
+    text += "    while (az_result_succeeded(rc = az_json_reader_next_token(&jr)) &&\n"
+    text += "           (jr.token.kind == AZ_JSON_TOKEN_PROPERTY_NAME))\n    {\n"
+    for i, (field, schema) in enumerate(fields):
+        text += "        %sif (az_json_token_is_text_equal(&jr.token, AZ_SPAN_FROM_STR(%s)))\n" \
+                % ("" if i == 0 else "else ", c_string(field))
+        text += "        {\n"
+        text += "            rc = az_json_reader_next_token(&jr);\n"
+        text += "            if (az_result_succeeded(rc))\n            {\n"
+        text += "                rc = %s;\n" % TOKEN_GETTERS[SCHEMAS[schema][0]].format(
+            out="out_request", field=snake_case(field), indent=" " * 16)
+        text += "                out_request->found |= (1UL << %d);\n" % i
+        text += "            }\n        }\n"
+    text += "        else\n        {\n"
+    text += "            rc = az_json_reader_next_token(&jr);\n"
+    text += "            if (az_result_succeeded(rc))\n            {\n"
+    text += "                rc = az_json_reader_skip_children(&jr);\n"
+    text += "            }\n        }\n"
+    text += "        if (az_result_failed(rc))\n        {\n"
+    text += "            return false;\n        }\n"
+    text += "    }\n\n"
+    text += "    return az_result_succeeded(rc) && (jr.token.kind == AZ_JSON_TOKEN_END_OBJECT);\n}\n"
+    return text
+
+
+#Function that generates the response template and serializer of a command
+def generate_serializer(model, command):
+    type_name, function = payload_names(model, command, "response")
+    fields, is_object = payload_fields(command["response"], command["name"] + " response")
+    base = "%s_response" % snake_case(command["name"])
+    if is_object:
+        parts = []
+        for i, (field, schema) in enumerate(fields):
+            parts.append(("%s\"%s\":" % ("{" if i == 0 else ",", field), SCHEMAS[schema][3]))
+        parts.append(("}", "IOT_JSON_SLOT_NONE"))
+    else:
+        parts = [("", SCHEMAS[fields[0][1]][3])]
+    text = template_parts(base + "_parts", parts)
+    text += "static iot_json_template const %s_template = IOT_JSON_TEMPLATE(%s_parts);\n\n" % (base, base)
+
+    text += function_doc(function + "_append",
+                         "Writes the response payload of %s at the start of a buffer." % command["name"],
+                         [("response", "Response fields."),
+                          ("remainder", "Buffer; on success, the part after the payload.")],
+                         "az_result: AZ_OK, or AZ_ERROR_NOT_ENOUGH_SPACE if the buffer is too small.")
+    text += "az_result %s_append(\n        %s const* response, az_span* remainder)\n{\n" % (function, type_name)
+    text += "    iot_json_slot slots[%d];\n\n" % len(fields)
+    for i, (field, schema) in enumerate(fields):
+        member = "i" if SCHEMAS[schema][0] == "int32" else "text"
+        text += "    slots[%d].%s = response->%s;\n" % (i, member, snake_case(field))
+    text += "\n    return iot_json_template_append(&%s_template, slots, remainder);\n}\n" % base
+    return text
+
+
+#Function that generates the source file
+def generate_source(model, name, header):
+    prefix = model["prefix"]
+    upper = prefix.upper()
+    text = file_header(name, model, "the telemetry, property and command tables, the request parsers "
+                       "and the response serializers")
+    text += "\n#include <string.h>\n\n#include \"%s\"\n\n" % header
+
+    text += "/*******************************************************************************\n"
+    text += " * Global Variables\n"
+    text += " ********************************************************************************/\n"
+    for kind, items in (("telemetry", model["telemetry"]), ("property", model["properties"]),
+                        ("command", model["commands"])):
+        if not items:
+            continue
+        text += "az_span const %s_%s_names[%s_%s_COUNT] =\n{\n" % (prefix, kind, upper, kind.upper())
+        text += ",\n".join("    AZ_SPAN_LITERAL_FROM_STR(\"%s\")" % item["name"] for item in items)
+        text += "\n};\n\n"
+
+    for i, prop in enumerate(model["properties"]):
+        slot = SCHEMAS[prop["schema"]][3]
+        if i < model["writable_count"]:
+            parts = [("\"%s\":{\"value\":" % prop["name"], slot),
+                     (",\"ac\":", "IOT_JSON_SLOT_INT32"),
+                     (",\"av\":", "IOT_JSON_SLOT_INT32"),
+                     (",\"ad\":", "IOT_JSON_SLOT_STRING"),
+                     ("}", "IOT_JSON_SLOT_NONE")]
+        else:
+            parts = [("\"%s\":" % prop["name"], slot)]
+        text += template_parts("%s_report_parts" % snake_case(prop["name"]), parts)
+    if model["properties"]:
+        text += "\niot_json_template const %s_property_templates[%s_PROPERTY_COUNT] =\n{\n" % (prefix, upper)
+        text += ",\n".join("    IOT_JSON_TEMPLATE(%s_report_parts)" % snake_case(prop["name"])
+                           for prop in model["properties"])
+        text += "\n};\n"
+
+    for command in model["commands"]:
+        if "request" in command:
+            text += "\n" + generate_parser(model, command)
+        if "response" in command:
+            text += "\n" + generate_serializer(model, command)
+
+    text += "\n/* [] END OF FILE */\n"
+    return text
+
+
+#Function that writes a file unless it already has the content
+def write_if_changed(path, text):
+    if os.path.exists(path):
+        with open(path, "r", newline="") as fd:
+            if fd.read() == text:
+                return
+    with open(path, "w", newline="\n") as fd:
+        fd.write(text)
+    print("Generated", path)
+
+
+#Main function. Execution starts here
+if __name__ == '__main__':
+
+    if len(sys.argv) != 3:
+        sys.exit("Usage: python pnp_dtdl_codegen.py <DTDL-interface-file> <output-file-without-extension>")
+
+    model = load_interface(sys.argv[1])
+    header = os.path.basename(sys.argv[2]) + ".h"
+    source = os.path.basename(sys.argv[2]) + ".c"
+    write_if_changed(sys.argv[2] + ".h", generate_header(model, header))
+    write_if_changed(sys.argv[2] + ".c", generate_source(model, source, header))
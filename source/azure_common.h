@@ -95,6 +95,7 @@
 #define AZURE_TASK_STACK_DEVICE_DEMO_APP        (1024 * 5)
 #define AZURE_TASK_STACK_METHODS                (1024 * 5)
 #define AZURE_TASK_STACK_TWIN                   (1024 * 5)
+#define AZURE_TASK_STACK_PNP_COMMANDS           (1024 * 2)
 
 /* Priorities for Azure features tasks */
 #define AZURE_TASK_PRIORITY_AZURE_DPS           (5)
@@ -103,6 +104,23 @@
 #define AZURE_TASK_PRIORITY_METHODS             (5)
 #define AZURE_TASK_PRIORITY_TWIN                (5)
 
+/* Deferred PnP commands run below the PnP task, so that telemetry and
+ * command dispatch are not delayed by them.
+ */
+#define AZURE_TASK_PRIORITY_PNP_COMMANDS        (AZURE_TASK_PRIORITY_PNP - 1)
+
+/* Macro value 0 runs the Azure Device App methods and device twin features in
+ * their own tasks.
+ * Macro value 1 runs all Azure Device App features in the Azure Device App task,
+ * which waits on a queue set of the feature event sources. The methods and
+ * device twin task stacks are then not allocated.
+ * The value is set in the Makefile, because it also selects
+ * configUSE_QUEUE_SETS of the kernel.
+ */
+#ifndef AZURE_DEVICE_DEMO_SINGLE_TASK_REACTOR
+#define AZURE_DEVICE_DEMO_SINGLE_TASK_REACTOR   0
+#endif
+
 /******************************************************************************
  * Global Variables
  *******************************************************************************/
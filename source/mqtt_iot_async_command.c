@@ -0,0 +1,442 @@
+/******************************************************************************
+ * File Name: mqtt_iot_async_command.c
+ *
+ * Description: This file contains the deferred command pool. Commands are
+ * copied into a fixed number of slots and run on a worker task; the task
+ * that received them publishes each response once it is ready, or a
+ * timeout response before the caller stops waiting.
+ *
+ ********************************************************************************
+ * Copyright 2024, Cypress Semiconductor Corporation (an Infineon company) or
+ * an affiliate of Cypress Semiconductor Corporation.  All rights reserved.
+ *
+ * This software, including source code, documentation and related
+ * materials ("Software") is owned by Cypress Semiconductor Corporation
+ * or one of its affiliates ("Cypress") and is protected by and subject to
+ * worldwide patent protection (United States and foreign),
+ * United States copyright laws and international treaty provisions.
+ * Therefore, you may use this Software only as provided in the license
+ * agreement accompanying the software package from which you
+ * obtained this Software ("EULA").
+ * If no EULA applies, Cypress hereby grants you a personal, non-exclusive,
+ * non-transferable license to copy, modify, and compile the Software
+ * source code solely for use in connection with Cypress's
+ * integrated circuit products.  Any reproduction, modification, translation,
+ * compilation, or representation of this Software except as specified
+ * above is prohibited without the express written permission of Cypress.
+ *
+ * Disclaimer: THIS SOFTWARE IS PROVIDED AS-IS, WITH NO WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING, BUT NOT LIMITED TO, NONINFRINGEMENT, IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. Cypress
+ * reserves the right to make changes to the Software without notice. Cypress
+ * does not assume any liability arising out of the application or use of the
+ * Software or any product or circuit described in the Software. Cypress does
+ * not authorize its products for use in any products where a malfunction or
+ * failure of the Cypress product may reasonably be expected to result in
+ * significant property damage, injury or death ("High Risk Product"). By
+ * including Cypress's product in a High Risk Product, the manufacturer
+ * of such system or application assumes all risk of such use and in doing
+ * so agrees to indemnify Cypress against all liability.
+ *******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "azure_common.h"
+#include "mqtt_iot_async_command.h"
+
+/*******************************************************************************
+ * Macros
+ ********************************************************************************/
+/* Work queue item that stops the worker */
+#define ASYNC_COMMAND_STOP                      ((uint8_t)IOT_ASYNC_COMMAND_SLOTS)
+
+/******************************************************************************
+ * Function Name: async_command_worker
+ ******************************************************************************
+ * Summary:
+ *  Worker task. Runs the queued commands one at a time until it receives
+ *  the stop item. A command answered on timeout while it was queued or
+ *  running is freed here without a response.
+ *
+ * Parameters:
+ *  arg: Command pool.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+static void async_command_worker(void* arg)
+{
+    iot_async_command_pool* pool = (iot_async_command_pool*)arg;
+    iot_async_command* command;
+    uint8_t index;
+    uint16_t status;
+    bool run;
+
+    for( ;; )
+    {
+        if( xQueueReceive( pool->work_queue, &index, portMAX_DELAY ) != pdPASS )
+        {
+            continue;
+        }
+        if( index >= IOT_ASYNC_COMMAND_SLOTS )
+        {
+            break;
+        }
+
+        command = &pool->commands[index];
+        taskENTER_CRITICAL();
+        run = ( command->state == IOT_ASYNC_COMMAND_QUEUED );
+        if( run )
+        {
+            command->state = IOT_ASYNC_COMMAND_RUNNING;
+            iot_event_latency_record( &pool->queue_wait, command->received_tick );
+        }
+        else
+        {
+            command->state = IOT_ASYNC_COMMAND_FREE;
+        }
+        taskEXIT_CRITICAL();
+
+        if( !run )
+        {
+            continue;
+        }
+
+        command->response_len = 0;
+        status = pool->ops->execute( pool->context, command );
+        if( command->response_len > sizeof(command->response) )
+        {
+            command->response_len = 0;
+        }
+
+        taskENTER_CRITICAL();
+        run = ( command->state == IOT_ASYNC_COMMAND_RUNNING );
+        if( run )
+        {
+            command->status = status;
+            command->state = IOT_ASYNC_COMMAND_DONE;
+        }
+        else
+        {
+            pool->late++;
+            command->state = IOT_ASYNC_COMMAND_FREE;
+        }
+        taskEXIT_CRITICAL();
+
+        if( run && (pool->ops->ready != NULL) )
+        {
+            pool->ops->ready( pool->context );
+        }
+    }
+
+    (void)xSemaphoreGive( pool->stopped );
+    vTaskDelete( NULL );
+}
+
+/******************************************************************************
+ * Function Name: iot_async_command_init
+ ******************************************************************************
+ * Summary:
+ *  Initializes an empty command pool and starts its worker task.
+ *
+ * Parameters:
+ *  pool: Command pool.
+ *
+ *  ops: Callbacks of the pool.
+ *
+ *  context: Passed to the callbacks.
+ *
+ *  name: Name of the worker task.
+ *
+ *  stack_size: Stack size of the worker task.
+ *
+ *  priority: Priority of the worker task.
+ *
+ * Return:
+ *  bool: false if the worker could not be created.
+ *
+ ******************************************************************************/
+bool iot_async_command_init(iot_async_command_pool* pool, iot_async_command_ops const* ops, void* context,
+        char const* name, uint32_t stack_size, UBaseType_t priority)
+{
+    memset( pool, 0x00, sizeof(iot_async_command_pool) );
+    pool->ops = ops;
+    pool->context = context;
+    pool->next_token = 1;
+
+    /* One item per slot and the stop item, a send never blocks */
+    pool->work_queue = xQueueCreate( IOT_ASYNC_COMMAND_SLOTS + 1, sizeof(uint8_t) );
+    pool->stopped = xSemaphoreCreateBinary();
+    if( (pool->work_queue != NULL) && (pool->stopped != NULL) &&
+        (xTaskCreate( async_command_worker, name, stack_size, pool, priority, NULL ) == pdPASS) )
+    {
+        return true;
+    }
+
+    if( pool->work_queue != NULL )
+    {
+        vQueueDelete( pool->work_queue );
+        pool->work_queue = NULL;
+    }
+    if( pool->stopped != NULL )
+    {
+        vSemaphoreDelete( pool->stopped );
+        pool->stopped = NULL;
+    }
+    return false;
+}
+
+/******************************************************************************
+ * Function Name: iot_async_command_deinit
+ ******************************************************************************
+ * Summary:
+ *  Stops the worker after the command it is running and drops the commands
+ *  that were not answered. Does nothing if the pool was not started.
+ *
+ * Parameters:
+ *  pool: Command pool.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_async_command_deinit(iot_async_command_pool* pool)
+{
+    uint8_t index = ASYNC_COMMAND_STOP;
+
+    if( pool->work_queue == NULL )
+    {
+        return;
+    }
+
+    /* Ahead of the queued commands, which are dropped anyway */
+    (void)xQueueSendToFront( pool->work_queue, &index, portMAX_DELAY );
+    (void)xSemaphoreTake( pool->stopped, portMAX_DELAY );
+
+    vQueueDelete( pool->work_queue );
+    vSemaphoreDelete( pool->stopped );
+    pool->work_queue = NULL;
+    pool->stopped = NULL;
+    for( uint8_t i = 0; i < IOT_ASYNC_COMMAND_SLOTS; i++ )
+    {
+        pool->commands[i].state = IOT_ASYNC_COMMAND_FREE;
+    }
+}
+
+/******************************************************************************
+ * Function Name: iot_async_command_submit
+ ******************************************************************************
+ * Summary:
+ *  Copies a command into a free slot and queues it for the worker.
+ *
+ * Parameters:
+ *  pool: Command pool.
+ *
+ *  request_id: Request ID of the command, not terminated.
+ *
+ *  request_id_len: Length of the request ID.
+ *
+ *  payload: Request payload.
+ *
+ *  payload_len: Length of the payload.
+ *
+ *  handler: Command of the application.
+ *
+ *  target: Object the command was invoked on.
+ *
+ *  timeout_msec: Time after which the command is answered with the timeout
+ *  status.
+ *
+ *  out_token: Token of the pending command, can be NULL.
+ *
+ * Return:
+ *  iot_async_command_submit_result: IOT_ASYNC_COMMAND_PENDING if the command
+ *  was queued.
+ *
+ ******************************************************************************/
+iot_async_command_submit_result iot_async_command_submit(iot_async_command_pool* pool,
+        char const* request_id, size_t request_id_len, uint8_t const* payload, size_t payload_len,
+        void const* handler, void const* target, uint32_t timeout_msec, uint32_t* out_token)
+{
+    iot_async_command* command = NULL;
+    uint8_t index = 0;
+
+    if( pool->work_queue == NULL )
+    {
+        return IOT_ASYNC_COMMAND_STOPPED;
+    }
+    if( (request_id_len > IOT_ASYNC_COMMAND_REQUEST_ID_SIZE) || (payload_len > IOT_ASYNC_COMMAND_PAYLOAD_SIZE) )
+    {
+        return IOT_ASYNC_COMMAND_TOO_LARGE;
+    }
+
+    /* Only the polling task frees DONE and timed out slots, but the worker
+     * frees abandoned ones.
+     */
+    taskENTER_CRITICAL();
+    for( ; index < IOT_ASYNC_COMMAND_SLOTS; index++ )
+    {
+        if( pool->commands[index].state == IOT_ASYNC_COMMAND_FREE )
+        {
+            command = &pool->commands[index];
+            command->state = IOT_ASYNC_COMMAND_QUEUED;
+            break;
+        }
+    }
+    if( command == NULL )
+    {
+        pool->busy++;
+    }
+    taskEXIT_CRITICAL();
+
+    if( command == NULL )
+    {
+        return IOT_ASYNC_COMMAND_BUSY;
+    }
+
+    command->token = pool->next_token++;
+    command->handler = handler;
+    command->target = target;
+    command->received_tick = xTaskGetTickCount();
+    command->timeout_ticks = pdMS_TO_TICKS( timeout_msec );
+    command->status = 0;
+    command->request_id_len = (uint8_t)request_id_len;
+    command->payload_len = (uint16_t)payload_len;
+    command->response_len = 0;
+    memcpy( command->request_id, request_id, request_id_len );
+    memcpy( command->payload, payload, payload_len );
+
+    if( xQueueSend( pool->work_queue, &index, 0 ) != pdPASS )
+    {
+        command->state = IOT_ASYNC_COMMAND_FREE;
+        pool->busy++;
+        return IOT_ASYNC_COMMAND_BUSY;
+    }
+
+    pool->submitted++;
+    if( out_token != NULL )
+    {
+        *out_token = command->token;
+    }
+    return IOT_ASYNC_COMMAND_PENDING;
+}
+
+/******************************************************************************
+ * Function Name: iot_async_command_poll
+ ******************************************************************************
+ * Summary:
+ *  Publishes the responses of finished commands and answers commands whose
+ *  timeout expired with the timeout status and an empty response. The
+ *  publish callback is invoked outside the critical section; the worker
+ *  does not touch a DONE or ABANDONED slot's request ID or response.
+ *
+ * Parameters:
+ *  pool: Command pool.
+ *
+ * Return:
+ *  TickType_t: Ticks until the next command timeout, portMAX_DELAY if no
+ *  command is in flight.
+ *
+ ******************************************************************************/
+TickType_t iot_async_command_poll(iot_async_command_pool* pool)
+{
+    TickType_t wait_ticks = portMAX_DELAY;
+    TickType_t elapsed;
+    iot_async_command* command;
+    iot_async_command_state state;
+    uint16_t status = 0;
+    size_t response_len = 0;
+    bool publish;
+
+    for( uint8_t i = 0; i < IOT_ASYNC_COMMAND_SLOTS; i++ )
+    {
+        command = &pool->commands[i];
+        publish = false;
+
+        taskENTER_CRITICAL();
+        state = command->state;
+        elapsed = xTaskGetTickCount() - command->received_tick;
+        if( state == IOT_ASYNC_COMMAND_DONE )
+        {
+            status = command->status;
+            response_len = command->response_len;
+            publish = true;
+        }
+        else if( (state != IOT_ASYNC_COMMAND_QUEUED) && (state != IOT_ASYNC_COMMAND_RUNNING) )
+        {
+            /* Free, or abandoned and waiting for the worker */
+        }
+        else if( elapsed < command->timeout_ticks )
+        {
+            if( (command->timeout_ticks - elapsed) < wait_ticks )
+            {
+                wait_ticks = command->timeout_ticks - elapsed;
+            }
+        }
+        else
+        {
+            command->state = IOT_ASYNC_COMMAND_ABANDONED;
+            pool->timed_out++;
+            status = pool->ops->timeout_status;
+            response_len = 0;
+            publish = true;
+        }
+        taskEXIT_CRITICAL();
+
+        if( !publish )
+        {
+            continue;
+        }
+
+        if( state != IOT_ASYNC_COMMAND_DONE )
+        {
+            TEST_INFO(( "Deferred command %lu timed out after %lu ms\n",
+                    (unsigned long)command->token, (unsigned long)( elapsed * portTICK_PERIOD_MS ) ));
+        }
+        pool->ops->publish( pool->context, command->request_id, command->request_id_len,
+                status, command->response, response_len );
+        iot_event_latency_record( &pool->latency, command->received_tick );
+
+        if( state == IOT_ASYNC_COMMAND_DONE )
+        {
+            pool->completed++;
+            command->state = IOT_ASYNC_COMMAND_FREE;
+        }
+    }
+
+    return wait_ticks;
+}
+
+/******************************************************************************
+ * Function Name: iot_async_command_log_stats
+ ******************************************************************************
+ * Summary:
+ *  Prints the command counters, the latency from receiving a command to
+ *  the worker starting it and the latency from receiving it to publishing
+ *  its response.
+ *
+ * Parameters:
+ *  name: Printable name of the pool.
+ *
+ *  pool: Command pool.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_async_command_log_stats(char const* name, iot_async_command_pool const* pool)
+{
+    TEST_INFO(( "\r\n%s deferred commands: %lu, answered: %lu, timed out: %lu, finished late: %lu, refused busy: %lu\n",
+            name,
+            (unsigned long)pool->submitted,
+            (unsigned long)pool->completed,
+            (unsigned long)pool->timed_out,
+            (unsigned long)pool->late,
+            (unsigned long)pool->busy ));
+    iot_event_latency_log( "cmd_wait", &pool->queue_wait );
+    iot_event_latency_log( "cmd_done", &pool->latency );
+}
+
+/* [] END OF FILE */
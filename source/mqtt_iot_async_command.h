@@ -0,0 +1,222 @@
+/******************************************************************************
+ * File Name: mqtt_iot_async_command.h
+ *
+ * Description: This file contains the declarations of the deferred command
+ * pool, which runs long commands on a worker task and publishes their
+ * responses later with the request ID of the original request.
+ *
+ ********************************************************************************
+ * Copyright 2024, Cypress Semiconductor Corporation (an Infineon company) or
+ * an affiliate of Cypress Semiconductor Corporation.  All rights reserved.
+ *
+ * This software, including source code, documentation and related
+ * materials ("Software") is owned by Cypress Semiconductor Corporation
+ * or one of its affiliates ("Cypress") and is protected by and subject to
+ * worldwide patent protection (United States and foreign),
+ * United States copyright laws and international treaty provisions.
+ * Therefore, you may use this Software only as provided in the license
+ * agreement accompanying the software package from which you
+ * obtained this Software ("EULA").
+ * If no EULA applies, Cypress hereby grants you a personal, non-exclusive,
+ * non-transferable license to copy, modify, and compile the Software
+ * source code solely for use in connection with Cypress's
+ * integrated circuit products.  Any reproduction, modification, translation,
+ * compilation, or representation of this Software except as specified
+ * above is prohibited without the express written permission of Cypress.
+ *
+ * Disclaimer: THIS SOFTWARE IS PROVIDED AS-IS, WITH NO WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING, BUT NOT LIMITED TO, NONINFRINGEMENT, IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. Cypress
+ * reserves the right to make changes to the Software without notice. Cypress
+ * does not assume any liability arising out of the application or use of the
+ * Software or any product or circuit described in the Software. Cypress does
+ * not authorize its products for use in any products where a malfunction or
+ * failure of the Cypress product may reasonably be expected to result in
+ * significant property damage, injury or death ("High Risk Product"). By
+ * including Cypress's product in a High Risk Product, the manufacturer
+ * of such system or application assumes all risk of such use and in doing
+ * so agrees to indemnify Cypress against all liability.
+ *******************************************************************************/
+
+#ifndef MQTT_IOT_ASYNC_COMMAND_H_
+#define MQTT_IOT_ASYNC_COMMAND_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cyabs_rtos.h"
+#include "mqtt_iot_event_queue.h"
+
+/*******************************************************************************
+ * Macros
+ ********************************************************************************/
+/* Maximum number of commands queued or running on the worker */
+#define IOT_ASYNC_COMMAND_SLOTS                 (2)
+
+/* Size of the copy of a request ID, IoT Hub request IDs are short hex strings */
+#define IOT_ASYNC_COMMAND_REQUEST_ID_SIZE       (32)
+
+/* Size of the copy of a request payload */
+#define IOT_ASYNC_COMMAND_PAYLOAD_SIZE          (128)
+
+/* Size of the response buffer of each command */
+#define IOT_ASYNC_COMMAND_RESPONSE_SIZE         (1024)
+
+/*******************************************************************************
+ * Global Variables
+ ********************************************************************************/
+/* Life cycle of a command slot. A slot is owned by the worker while it is
+ * RUNNING and by the task that polls the pool in every other state.
+ */
+typedef enum
+{
+    IOT_ASYNC_COMMAND_FREE = 0,
+    IOT_ASYNC_COMMAND_QUEUED,           /* Waiting for the worker */
+    IOT_ASYNC_COMMAND_RUNNING,          /* Executed by the worker */
+    IOT_ASYNC_COMMAND_DONE,             /* Response ready to be published */
+    IOT_ASYNC_COMMAND_ABANDONED         /* Answered on timeout, freed by the worker */
+} iot_async_command_state;
+
+/* Outcome of iot_async_command_submit() */
+typedef enum
+{
+    IOT_ASYNC_COMMAND_PENDING = 0,      /* Queued, the response follows later */
+    IOT_ASYNC_COMMAND_BUSY,             /* Every slot is in flight */
+    IOT_ASYNC_COMMAND_TOO_LARGE,        /* Request ID or payload does not fit a slot */
+    IOT_ASYNC_COMMAND_STOPPED           /* The worker is not running */
+} iot_async_command_submit_result;
+
+/* Deferred command and its response */
+typedef struct
+{
+    iot_async_command_state volatile state;
+    uint32_t    token;
+    void const* handler;                /* Command of the application */
+    void const* target;                 /* Object the command was invoked on */
+    TickType_t  received_tick;
+    TickType_t  timeout_ticks;
+    uint16_t    status;
+    uint8_t     request_id_len;
+    uint16_t    payload_len;
+    size_t      response_len;
+    char        request_id[IOT_ASYNC_COMMAND_REQUEST_ID_SIZE];
+    uint8_t     payload[IOT_ASYNC_COMMAND_PAYLOAD_SIZE];
+    uint8_t     response[IOT_ASYNC_COMMAND_RESPONSE_SIZE];
+} iot_async_command;
+
+/*
+ * @brief Runs a command on the worker task.
+ * @param[in] context Context passed to iot_async_command_init().
+ * @param[in,out] command Command to run. The callback writes the response to
+ * command->response and its length to command->response_len.
+ * @return Status code of the response.
+ */
+typedef uint16_t (*iot_async_command_execute)(void* context, iot_async_command* command);
+
+/*
+ * @brief Publishes the response of a command.
+ * @param[in] context Context passed to iot_async_command_init().
+ * @param[in] request_id Request ID of the command, not terminated.
+ * @param[in] request_id_len Length of \p request_id.
+ * @param[in] status Status code of the response.
+ * @param[in] response Response payload.
+ * @param[in] response_len Length of \p response.
+ */
+typedef void (*iot_async_command_publish)(void* context, char const* request_id, size_t request_id_len,
+        uint16_t status, uint8_t const* response, size_t response_len);
+
+/*
+ * @brief Tells the polling task that a response is ready, called on the worker.
+ * @param[in] context Context passed to iot_async_command_init().
+ */
+typedef void (*iot_async_command_ready)(void* context);
+
+/* Callbacks of a command pool */
+typedef struct
+{
+    iot_async_command_execute   execute;
+    iot_async_command_publish   publish;
+    iot_async_command_ready     ready;
+    uint16_t                    timeout_status; /* Status of a command answered on timeout */
+} iot_async_command_ops;
+
+typedef struct
+{
+    iot_async_command           commands[IOT_ASYNC_COMMAND_SLOTS];
+    iot_async_command_ops const* ops;
+    void*                       context;
+    QueueHandle_t               work_queue;     /* Slot indexes for the worker */
+    SemaphoreHandle_t           stopped;        /* Given by the worker when it exits */
+    uint32_t                    next_token;
+    uint32_t                    submitted;
+    uint32_t                    completed;
+    uint32_t                    busy;           /* Commands refused with every slot in flight */
+    uint32_t                    timed_out;
+    uint32_t                    late;           /* Commands that finished after their timeout */
+    iot_event_latency_stats     queue_wait;     /* Receive to worker start latency */
+    iot_event_latency_stats     latency;        /* Receive to response publish latency */
+} iot_async_command_pool;
+
+/******************************************************************************
+ * Function Prototypes
+ *******************************************************************************/
+/*
+ * @brief Initializes an empty command pool and starts its worker task.
+ * @param[out] pool Command pool.
+ * @param[in] ops Callbacks of the pool, must remain valid.
+ * @param[in] context Passed to the callbacks.
+ * @param[in] name Name of the worker task.
+ * @param[in] stack_size Stack size of the worker task.
+ * @param[in] priority Priority of the worker task.
+ * @return false if the worker could not be created.
+ */
+bool iot_async_command_init(iot_async_command_pool* pool, iot_async_command_ops const* ops, void* context,
+        char const* name, uint32_t stack_size, UBaseType_t priority);
+
+/*
+ * @brief Stops the worker after the command it is running and drops the
+ * commands that were not answered.
+ * @param[in] pool Command pool.
+ */
+void iot_async_command_deinit(iot_async_command_pool* pool);
+
+/*
+ * @brief Copies a command into a free slot and queues it for the worker.
+ * The caller answers the command itself unless the result is
+ * IOT_ASYNC_COMMAND_PENDING.
+ * @param[in] pool Command pool.
+ * @param[in] request_id Request ID of the command, not terminated.
+ * @param[in] request_id_len Length of \p request_id.
+ * @param[in] payload Request payload.
+ * @param[in] payload_len Length of \p payload.
+ * @param[in] handler Command of the application, passed to the execute callback.
+ * @param[in] target Object the command was invoked on.
+ * @param[in] timeout_msec Time after which the command is answered with the
+ * timeout status, shorter than the response timeout of the caller.
+ * @param[out] out_token Token of the pending command, can be NULL.
+ * @return IOT_ASYNC_COMMAND_PENDING if the command was queued.
+ */
+iot_async_command_submit_result iot_async_command_submit(iot_async_command_pool* pool,
+        char const* request_id, size_t request_id_len, uint8_t const* payload, size_t payload_len,
+        void const* handler, void const* target, uint32_t timeout_msec, uint32_t* out_token);
+
+/*
+ * @brief Publishes the responses of finished commands and answers commands
+ * whose timeout expired. Must be called from the task that submits commands.
+ * @param[in] pool Command pool.
+ * @return Ticks until the next command timeout, portMAX_DELAY if no command
+ * is in flight.
+ */
+TickType_t iot_async_command_poll(iot_async_command_pool* pool);
+
+/*
+ * @brief Prints the command counters and latencies.
+ * @param[in] name Printable name of the pool.
+ * @param[in] pool Command pool.
+ */
+void iot_async_command_log_stats(char const* name, iot_async_command_pool const* pool);
+
+#endif /* MQTT_IOT_ASYNC_COMMAND_H_ */
+
+/* [] END OF FILE */
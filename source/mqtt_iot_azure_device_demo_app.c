@@ -62,6 +62,16 @@
 #include <az_core.h>
 #include <az_iot.h>
 #include "mqtt_iot_common.h"
+#include "mqtt_iot_event_queue.h"
+#include "mqtt_iot_dedup_cache.h"
+#include "mqtt_iot_diagnostics.h"
+#include "mqtt_iot_json_path.h"
+#include "mqtt_iot_window_stats.h"
+#include "mqtt_iot_json_template.h"
+#include "mqtt_iot_channel_stats.h"
+#include "mqtt_iot_twin_store.h"
+#include "mqtt_iot_reported_writer.h"
+#include "mqtt_iot_request_tracker.h"
 
 /* Wi-Fi connection manager header files. */
 #include "cy_wcm.h"
@@ -98,10 +108,6 @@
 /* Defines for methods app */
 #define METHODS_RESPONSE_TOPIC_BUFFER_SIZE          (128)
 
-#define GET_QUEUE_TIMEOUT_MSEC                      (500)
-
-#define PUT_QUEUE_TIMEOUT_MSEC                      (500)
-
 #define METHOD_WAIT_LOOP_DURATION_MSEC              (120 * 1000)
 
 /* Defines for twin app */
@@ -113,14 +119,90 @@
 
 #define DEVICE_TWIN_WAIT_LOOP_DURATION_MSEC         (120 * 1000)
 
-#define DEVICE_TWIN_TIMEOUT_MSEC                    (500)
-
-#define TWIN_MESSAGE_WAIT_DELAY_MSEC                (1000)
-
 #define DEVICE_DEMO_APP_TIMEOUT_MSEC                (5)
 
 #define HUB_DIRECT_METHOD_EVENT_QUEUE_LENGTH        (10)
 
+/* Overflow policy of the direct method queue. The MQTT event callback never
+ * blocks; when the queue is full the oldest request, which is the closest to
+ * its IoT hub response timeout, is dropped to make room. A queue in a queue
+ * set cannot evict, so the single task reactor drops the newest instead.
+ */
+#if AZURE_DEVICE_DEMO_SINGLE_TASK_REACTOR
+#define HUB_DIRECT_METHOD_EVENT_OVERFLOW_POLICY     (IOT_EVENT_OVERFLOW_DROP_NEWEST)
+#else
+#define HUB_DIRECT_METHOD_EVENT_OVERFLOW_POLICY     (IOT_EVENT_OVERFLOW_DROP_OLDEST)
+#endif
+
+#if AZURE_DEVICE_DEMO_SINGLE_TASK_REACTOR && ( configUSE_QUEUE_SETS != 1 )
+#error "AZURE_DEVICE_DEMO_SINGLE_TASK_REACTOR requires configUSE_QUEUE_SETS, see configs/FreeRTOSConfig.h"
+#endif
+
+/* Queue set of the reactor: the direct method queue and the twin semaphore */
+#define DEVICE_DEMO_EVENT_SET_LENGTH                (HUB_DIRECT_METHOD_EVENT_QUEUE_LENGTH + 1)
+
+/* Macro value 1 saves the IDs of processed C2D messages in protected storage,
+ * so that redeliveries after a reset or crash are also suppressed. The MQTT
+ * event callback only records the IDs; the telemetry loop writes them to
+ * flash. Requires CY_TFM_PSA_SUPPORTED.
+ */
+#define C2D_DEDUP_CACHE_PERSIST                     (0)
+
+/* Minimum time between two saves of the C2D message IDs, which bounds the
+ * flash writes of a burst of messages. IDs recorded since the last save are
+ * written by the telemetry loop once the interval has passed, so a reset
+ * before that can let the IDs of one burst be processed again. Value 0 saves
+ * on every pass of the telemetry loop that finds new IDs.
+ */
+#define C2D_DEDUP_CACHE_SAVE_INTERVAL_MSEC          (5000)
+
+/* C2D messages are handled to completion inside the MQTT event callback, and
+ * the MQTT library sends the PUBACK only after the callback returns. No other
+ * message is read while the handler runs, so at most one C2D message is
+ * unacknowledged and the hub is flow controlled through TCP. The handler also
+ * holds up keep-alive processing, so handlers that take longer than this
+ * budget are reported.
+ */
+#define C2D_HANDLER_BUDGET_MSEC                     (1000)
+
+/* Macro value 1 registers the diagnostic direct methods (diag_heap,
+ * diag_stacks, diag_cpu, diag_queues, diag_publish and diag_connection) next
+ * to "ping". diag_cpu also needs configGENERATE_RUN_TIME_STATS, which is set
+ * in configs/FreeRTOSConfig.h.
+ */
+#define DIAGNOSTIC_METHODS_ENABLED                  (1)
+
+/* Macro value 1 also registers the benchmark methods (diag_json_path,
+ * diag_stats, diag_json_template and diag_channel_stats), for development
+ * only: each allocates up to about 23 KB of heap, blocks the method task for
+ * up to about one second, and links in modules of the PnP app.
+ */
+#define DIAGNOSTIC_BENCHMARK_METHODS_ENABLED        (0)
+
+/* Buffer for method responses built at run time, e.g. diagnostic reports */
+#define METHOD_RESPONSE_BUFFER_SIZE                 (768)
+
+/* Index of "Test_count" in twin_fields */
+#define TWIN_FIELD_TEST_COUNT                       (0)
+
+/* Reported property updates within this time after the first one are sent
+ * in one twin patch, and only one patch waits for the response of the hub.
+ */
+#define TWIN_REPORTED_DEBOUNCE_MSEC                 (1000)
+#define TWIN_REPORTED_RESPONSE_TIMEOUT_MSEC         (10 * 1000)
+
+/* Twin requests matched to their responses by the request tracker. A twin
+ * GET without a response is published again up to TWIN_GET_MAX_RETRIES
+ * times; lost reported property patches are resent by the reported
+ * property writer.
+ */
+#define TWIN_REQUEST_OP_GET                         (0)
+#define TWIN_REQUEST_OP_PATCH                       (1)
+#define TWIN_REQUEST_OP_COUNT                       (2)
+
+#define TWIN_GET_TIMEOUT_MSEC                       (10 * 1000)
+#define TWIN_GET_MAX_RETRIES                        (2)
+
 /*String that describes the MQTT handle that is being created in order to uniquely identify it*/
 #define MQTT_HANDLE_DESCRIPTOR                      "MQTThandleID"
 
@@ -130,13 +212,39 @@
 static az_span const method_ping_name = AZ_SPAN_LITERAL_FROM_STR("ping");
 static az_span const method_ping_response = AZ_SPAN_LITERAL_FROM_STR("{\"response\": \"pong\"}");
 static az_span const method_empty_response_payload = AZ_SPAN_LITERAL_FROM_STR("{}");
+#if DIAGNOSTIC_METHODS_ENABLED
+static az_span const method_diag_heap_name = AZ_SPAN_LITERAL_FROM_STR("diag_heap");
+static az_span const method_diag_stacks_name = AZ_SPAN_LITERAL_FROM_STR("diag_stacks");
+#if ( configGENERATE_RUN_TIME_STATS == 1 )
+static az_span const method_diag_cpu_name = AZ_SPAN_LITERAL_FROM_STR("diag_cpu");
+#endif
+static az_span const method_diag_queues_name = AZ_SPAN_LITERAL_FROM_STR("diag_queues");
+static az_span const method_diag_publish_name = AZ_SPAN_LITERAL_FROM_STR("diag_publish");
+static az_span const method_diag_connection_name = AZ_SPAN_LITERAL_FROM_STR("diag_connection");
+#endif
+#if DIAGNOSTIC_BENCHMARK_METHODS_ENABLED
+static az_span const method_diag_json_path_name = AZ_SPAN_LITERAL_FROM_STR("diag_json_path");
+static az_span const method_diag_stats_name = AZ_SPAN_LITERAL_FROM_STR("diag_stats");
+static az_span const method_diag_json_template_name = AZ_SPAN_LITERAL_FROM_STR("diag_json_template");
+static az_span const method_diag_channel_stats_name = AZ_SPAN_LITERAL_FROM_STR("diag_channel_stats");
+#endif
 
-static az_span const twin_document_topic_request_id = AZ_SPAN_LITERAL_FROM_STR("get_twin");
-static az_span const twin_patch_topic_request_id = AZ_SPAN_LITERAL_FROM_STR("reported_prop");
-static az_span const version_name = AZ_SPAN_LITERAL_FROM_STR("$version");
+static char const* const twin_request_op_names[TWIN_REQUEST_OP_COUNT] = { "twin_get", "twin_patch" };
 static az_span const desired_device_count_property_name = AZ_SPAN_LITERAL_FROM_STR("Test_count");
 static int32_t device_count_value = 0;
 
+/* Twin properties tracked by twin_store, indexed by TWIN_FIELD_* */
+static iot_property_def const twin_fields[] = {
+        { "Test_count", IOT_PROPERTY_INT32, 0, false, 0.0, 0.0 },
+};
+
+static az_span const c2d_message_id_name = AZ_SPAN_LITERAL_FROM_STR(AZ_IOT_MESSAGE_PROPERTIES_MESSAGE_ID);
+
+static char const* const telemetry_message_payloads[MAX_TELEMETRY_MESSAGE_COUNT] = {
+        "{\"message_number\":1}", "{\"message_number\":2}", "{\"message_number\":3}",
+        "{\"message_number\":4}", "{\"message_number\":5}",
+};
+
 /************************************************************
  * Static Variables
  ************************************************************/
@@ -147,9 +255,37 @@ static char                                mqtt_client_username_buffer[IOT_SAMPL
 static char                                mqtt_endpoint_buffer[IOT_SAMPLE_APP_BUFFER_SIZE_IN_BYTES];
 static volatile bool                       connect_state = false;
 
-static QueueHandle_t                       hub_direct_method_event_queue = NULL;
+static iot_event_queue                     hub_direct_method_event_queue;
+
+static iot_event_overflow_policy const     hub_direct_method_event_policy = HUB_DIRECT_METHOD_EVENT_OVERFLOW_POLICY;
+static char const* const                   hub_direct_method_event_class_name = "method";
 
 static cy_semaphore_t                      twin_app_sem = NULL;
+static iot_dedup_cache                     c2d_dedup_cache;
+#if ( C2D_DEDUP_CACHE_PERSIST && (defined CY_TFM_PSA_SUPPORTED) )
+/* Copy of the C2D message IDs written to flash outside the critical section */
+static iot_dedup_cache                     c2d_dedup_cache_saved;
+static TickType_t                          c2d_dedup_cache_save_tick = 0;
+#endif
+static uint32_t                            c2d_processed_count = 0;
+static uint32_t                            c2d_failed_count = 0;
+static uint32_t                            c2d_over_budget_count = 0;
+static TickType_t                          c2d_max_handler_ticks = 0;
+static volatile TickType_t                 twin_update_posted_tick = 0;
+
+/* Last known device twin. It is initialized on the first run only, so that
+ * later runs request the twin document only after a desired $version gap.
+ */
+static iot_twin_store                      twin_store;
+static bool                                twin_store_initialized = false;
+static int32_t                             reported_device_count_value = 0;
+static iot_reported_writer                 twin_reported_writer;
+static iot_request_tracker                 twin_request_tracker;
+static iot_event_latency_stats             twin_update_latency;
+
+#if AZURE_DEVICE_DEMO_SINGLE_TASK_REACTOR
+static QueueSetHandle_t                    device_demo_event_set = NULL;
+#endif
 
 #if SAS_TOKEN_AUTH
 static iot_sample_credentials              sas_credentials;
@@ -160,6 +296,41 @@ static char                                sas_token_buffer[IOT_SAMPLE_APP_BUFFE
 /* The network buffer must remain valid for the lifetime of the MQTT context. */
 static uint8_t                             *buffer = NULL;
 
+/* Method responses are built here, only the method consumer writes it */
+static uint8_t                             method_response_buffer[METHOD_RESPONSE_BUFFER_SIZE];
+
+/* Builds the response payload of a direct method */
+typedef az_result (*hub_method_handler_t)(az_span response_buffer, az_span* out_response);
+
+typedef struct
+{
+    az_span const*          name;
+    hub_method_handler_t    invoke;
+} hub_method_t;
+
+/******************************************************************************
+ * Function Name: publish_message
+ ******************************************************************************
+ * Summary:
+ *  Publishes a message and records its result and duration for the
+ *  diagnostic reports.
+ *
+ * Parameters:
+ *  pub_msg: Message to publish.
+ *
+ * Return:
+ *  cy_rslt_t: Result of cy_mqtt_publish().
+ *
+ ******************************************************************************/
+static cy_rslt_t publish_message(cy_mqtt_publish_info_t *pub_msg)
+{
+    TickType_t start_tick = xTaskGetTickCount();
+    cy_rslt_t result = cy_mqtt_publish( mqtthandle, pub_msg );
+
+    iot_diag_record_publish( (result == CY_RSLT_SUCCESS), xTaskGetTickCount() - start_tick );
+    return result;
+}
+
 /*******************************************************************************
  * Function Name: send_method_response
  *******************************************************************************
@@ -209,7 +380,7 @@ static cy_rslt_t send_method_response(az_iot_hub_client_method_request const* me
     pub_msg.payload = (const char *)response._internal.ptr;
     pub_msg.payload_len = (size_t)response._internal.size;
 
-    result = cy_mqtt_publish( mqtthandle, &pub_msg );
+    result = publish_message( &pub_msg );
     if( result == TEST_PASS )
     {
         TEST_INFO(( "\r\ncy_mqtt_publish completed........\n\r" ));
@@ -232,26 +403,50 @@ static cy_rslt_t send_method_response(az_iot_hub_client_method_request const* me
  *  Returns method response string.
  *
  * Parameters:
- *  void
+ *  response_buffer: Unused, the response is constant.
+ *
+ *  out_response: Method response payload.
  *
  * Return:
- *  az_span: Represents a "view" over a byte buffer that represents a
- *  contiguous region of memory. It contains a pointer to the start of the byte
- *  buffer and the buffer's size.
+ *  az_result: AZ_OK.
  *
  ******************************************************************************/
-static az_span invoke_ping(void)
+static az_result invoke_ping(az_span response_buffer, az_span* out_response)
 {
+    (void)response_buffer;
+
     TEST_INFO(( "\r\nPING.......!\r\n" ));
-    return method_ping_response;
+    *out_response = method_ping_response;
+    return AZ_OK;
 }
 
+static hub_method_t const hub_methods[] =
+{
+    { &method_ping_name,                invoke_ping },
+#if DIAGNOSTIC_METHODS_ENABLED
+    { &method_diag_heap_name,           iot_diag_build_heap_report },
+    { &method_diag_stacks_name,         iot_diag_build_stack_report },
+#if ( configGENERATE_RUN_TIME_STATS == 1 )
+    { &method_diag_cpu_name,            iot_diag_build_cpu_report },
+#endif
+    { &method_diag_queues_name,         iot_diag_build_queue_report },
+    { &method_diag_publish_name,        iot_diag_build_publish_report },
+    { &method_diag_connection_name,     iot_diag_build_connection_report },
+#endif
+#if DIAGNOSTIC_BENCHMARK_METHODS_ENABLED
+    { &method_diag_json_path_name,      iot_json_path_build_benchmark_report },
+    { &method_diag_stats_name,          iot_window_stats_build_benchmark_report },
+    { &method_diag_json_template_name,  iot_json_template_build_benchmark_report },
+    { &method_diag_channel_stats_name,  iot_channel_stats_build_benchmark_report },
+#endif
+};
+
 /******************************************************************************
  * Function Name: handle_method_request
  ******************************************************************************
  * Summary:
- *  Matches the method request name with required value - "ping" and handles
- *  the response accordingly.
+ *  Looks up the method request name in the method table, invokes the method
+ *  and sends its response.
  *
  * Parameters:
  *  method_request: A method request received from IoT Hub.
@@ -262,18 +457,29 @@ static az_span invoke_ping(void)
  ******************************************************************************/
 static void handle_method_request(az_iot_hub_client_method_request const* method_request)
 {
-    if( az_span_is_content_equal( method_ping_name, method_request->name ) )
-    {
-        /* Invoke method */
-        az_span response = invoke_ping();
-        TEST_INFO(( "\r\nClient invoked method 'ping'.\r\n" ));
-        send_method_response( method_request, AZ_IOT_STATUS_OK, response );
-    }
-    else
+    az_span response;
+    az_result rc;
+
+    for( uint32_t i = 0; i < sizeof(hub_methods) / sizeof(hub_methods[0]); i++ )
     {
-        TEST_INFO(( "\r\nMethod not supported :  %.*s\r\n", (int)(method_request->name._internal.size), (method_request->name._internal.ptr) ));
-        send_method_response( method_request, AZ_IOT_STATUS_NOT_FOUND, method_empty_response_payload );
+        if( az_span_is_content_equal( *hub_methods[i].name, method_request->name ) )
+        {
+            /* Invoke method */
+            rc = hub_methods[i].invoke( AZ_SPAN_FROM_BUFFER(method_response_buffer), &response );
+            TEST_INFO(( "\r\nClient invoked method '%.*s'.\r\n", (int)(method_request->name._internal.size), (method_request->name._internal.ptr) ));
+            if( az_result_failed(rc) )
+            {
+                TEST_INFO(( "\r\nMethod failed: az_result return code 0x%08x.\r\n", (unsigned int)rc ));
+                send_method_response( method_request, AZ_IOT_STATUS_SERVER_ERROR, method_empty_response_payload );
+                return;
+            }
+            send_method_response( method_request, AZ_IOT_STATUS_OK, response );
+            return;
+        }
     }
+
+    TEST_INFO(( "\r\nMethod not supported :  %.*s\r\n", (int)(method_request->name._internal.size), (method_request->name._internal.ptr) ));
+    send_method_response( method_request, AZ_IOT_STATUS_NOT_FOUND, method_empty_response_payload );
 }
 
 /******************************************************************************
@@ -287,7 +493,7 @@ static void handle_method_request(az_iot_hub_client_method_request const* method
  *
  *  topic_len: Length of topic of received message.
  *
- *  message: MQTT publish/receive information structure.
+ *  message_span: Payload of received message.
  *
  *  out_method_request: A method request received from IoT Hub.
  *
@@ -295,11 +501,10 @@ static void handle_method_request(az_iot_hub_client_method_request const* method
  *  cy_rslt_t: Provides the result of an operation as a structured bitfield.
  *
  ******************************************************************************/
-static cy_rslt_t parse_hub_method_message(char* topic, int topic_len, cy_mqtt_publish_info_t *message,
+static cy_rslt_t parse_hub_method_message(char* topic, int topic_len, az_span message_span,
         az_iot_hub_client_method_request* out_method_request)
 {
     az_span const topic_span = az_span_create((uint8_t*)topic, topic_len);
-    az_span const message_span = az_span_create((uint8_t*)message->payload, message->payload_len);
 
     /* Parse the message and retrieve the method_request info */
     az_result rc = az_iot_hub_client_methods_parse_received_topic( &hub_client, topic_span, out_method_request );
@@ -347,6 +552,9 @@ static void build_reported_property(
     IOT_SAMPLE_EXIT_IF_AZ_FAILED(az_json_writer_append_int32(&jw, device_count_value), log);
     IOT_SAMPLE_EXIT_IF_AZ_FAILED(az_json_writer_append_end_object(&jw), log);
 
+    /* Recorded in the twin store when the hub accepts the update */
+    reported_device_count_value = device_count_value;
+
     *out_reported_property_payload = az_json_writer_get_bytes_used_in_destination(&jw);
 }
 
@@ -354,17 +562,19 @@ static void build_reported_property(
  * Function Name: send_reported_property
  ******************************************************************************
  * Summary:
- *  Function to create and send the JSON format of the property that is to be
- *  reported.
+ *  Reported property writer callback to create and send the JSON format of
+ *  the property that is to be reported.
  *
  * Parameters:
- *  void
+ *  context: Unused.
+ *
+ *  fields: Fields to be reported, only "Test_count" is supported.
  *
  * Return:
- *  void
+ *  cy_rslt_t: Result of the publish.
  *
  ******************************************************************************/
-static void send_reported_property(void)
+static cy_rslt_t send_reported_property(void* context, uint32_t fields)
 {
     int rc;
     uint16_t topic_len = 0;
@@ -372,6 +582,10 @@ static void send_reported_property(void)
     cy_mqtt_publish_info_t pub_msg;
     char reported_property_payload_buffer[128];
     char twin_patch_topic_buffer[128];
+    char request_id[IOT_REQUEST_ID_SIZE];
+
+    (void)context;
+    (void)fields;
 
     memset( &pub_msg, 0x00, sizeof( cy_mqtt_publish_info_t ) );
     memset( &reported_property_payload_buffer, 0x00, sizeof( reported_property_payload_buffer ) );
@@ -379,17 +593,25 @@ static void send_reported_property(void)
 
     IOT_SAMPLE_LOG("\n\rClient sending reported property to service.");
 
+    if( !iot_request_tracker_begin( &twin_request_tracker, TWIN_REQUEST_OP_PATCH,
+            TWIN_REPORTED_RESPONSE_TIMEOUT_MSEC, 0, request_id ) )
+    {
+        IOT_SAMPLE_LOG_ERROR("\n\rNo free twin request ID.");
+        return TEST_FAIL;
+    }
+
     /* Get the Twin Patch topic to publish a reported property update */
     rc = az_iot_hub_client_twin_patch_get_publish_topic(
             &hub_client,
-            twin_patch_topic_request_id,
+            az_span_create_from_str( request_id ),
             twin_patch_topic_buffer,
             sizeof(twin_patch_topic_buffer),
             (size_t*)&topic_len);
     if (az_result_failed(rc))
     {
         IOT_SAMPLE_LOG_ERROR("\n\rFailed to get the Twin Patch topic: az_result return code 0x%08x.", rc);
-        return;
+        iot_request_tracker_cancel( &twin_request_tracker, request_id );
+        return TEST_FAIL;
     }
 
     az_span reported_property_payload = AZ_SPAN_FROM_BUFFER(reported_property_payload_buffer);
@@ -402,7 +624,7 @@ static void send_reported_property(void)
     pub_msg.payload_len = (size_t)reported_property_payload._internal.size;
 
     /* Publish the reported property update */
-    result = cy_mqtt_publish( mqtthandle, &pub_msg );
+    result = publish_message( &pub_msg );
     if( result == TEST_PASS )
     {
         TEST_INFO(( "\r\ncy_mqtt_publish completed........\n\r" ));
@@ -410,11 +632,13 @@ static void send_reported_property(void)
     else
     {
         TEST_INFO(( "\r\ncy_mqtt_publish failed with Error : [0x%X] ", (unsigned int)result ));
-        return;
+        iot_request_tracker_cancel( &twin_request_tracker, request_id );
+        return result;
     }
 
     TEST_INFO(( "\r\nClient published the Twin Patch reported property message." ));
     TEST_INFO(( "\r\nPayload: %.*s\r\n", (int)reported_property_payload._internal.size, reported_property_payload._internal.ptr ));
+    return result;
 }
 
 /******************************************************************************
@@ -441,87 +665,140 @@ static void update_device_count_property(int32_t device_count)
 }
 
 /******************************************************************************
- * Function Name: parse_desired_device_count_property
+ * Function Name: post_twin_update
  ******************************************************************************
  * Summary:
- *  Parse the message received from Azure Hub to retrieve desired "Test_count"
- *  property.
+ *  Wakes the device twin feature, which reports "Test_count" or requests
+ *  the full twin document.
  *
  * Parameters:
- *  message_span: Structure to hold the received message.
- *
- *  out_parsed_device_count: Used to store the received value of
- *  "Test_count".
+ *  void
  *
  * Return:
- *  bool
+ *  void
  *
  ******************************************************************************/
-static bool parse_desired_device_count_property(az_span message_span,
-        int32_t* out_parsed_device_count)
+static void post_twin_update(void)
 {
-    char const* const log = "Failed to parse for desired `%.*s` property";
-    az_span property = desired_device_count_property_name;
+    cy_rslt_t result;
 
-    bool property_found = false;
-    *out_parsed_device_count = 0;
-
-    /* Parse message_span */
-    az_json_reader jr;
-    IOT_SAMPLE_EXIT_IF_AZ_FAILED( az_json_reader_init(&jr, message_span, NULL), log, property );
-    IOT_SAMPLE_EXIT_IF_AZ_FAILED( az_json_reader_next_token(&jr), log, property );
-    if( jr.token.kind != AZ_JSON_TOKEN_BEGIN_OBJECT )
+    twin_update_posted_tick = xTaskGetTickCount();
+    result = xSemaphoreGive( twin_app_sem );
+    if( result != pdTRUE )
     {
-        TEST_INFO(( "\r\n`%.*s` property was not found in desired property response.",
-                (int)az_span_size(property),
-                az_span_ptr(property) ));
-        return false;
+        TEST_INFO(( "Releasing twin_app_sem failed with Error : [0x%X]\n", (unsigned int)result ));
     }
+}
+
+/******************************************************************************
+ * Function Name: on_device_count_changed
+ ******************************************************************************
+ * Summary:
+ *  Twin store subscription that applies a changed desired "Test_count"
+ *  locally.
+ *
+ * Parameters:
+ *  context: Unused.
+ *
+ *  field: TWIN_FIELD_TEST_COUNT.
+ *
+ *  old_value: Previous desired value, NULL if there was none.
+ *
+ *  new_value: New desired value, NULL if the property was removed.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+static void on_device_count_changed(void* context, uint8_t field, iot_twin_value const* old_value,
+        iot_twin_value const* new_value)
+{
+    (void)context;
+    (void)field;
 
-    IOT_SAMPLE_EXIT_IF_AZ_FAILED(az_json_reader_next_token(&jr), log, property);
-    while (!property_found && (jr.token.kind != AZ_JSON_TOKEN_END_OBJECT))
+    if( new_value == NULL )
     {
-        if( az_json_token_is_text_equal(&jr.token, desired_device_count_property_name) )
-        {
-            /* Move to the value token */
-            IOT_SAMPLE_EXIT_IF_AZ_FAILED( az_json_reader_next_token(&jr), log, property );
-            IOT_SAMPLE_EXIT_IF_AZ_FAILED( az_json_token_get_int32(&jr.token, out_parsed_device_count), log, property);
-            property_found = true;
-        }
-        else if( az_json_token_is_text_equal(&jr.token, version_name) )
-        {
-            break;
-        }
-        else
-        {
-            IOT_SAMPLE_EXIT_IF_AZ_FAILED(az_json_reader_skip_children(&jr), log, property);
-        }
-        IOT_SAMPLE_EXIT_IF_AZ_FAILED(az_json_reader_next_token(&jr), log, property);
+        IOT_SAMPLE_LOG( "`%.*s` property was removed from desired properties.",
+                (int)az_span_size(desired_device_count_property_name),
+                az_span_ptr(desired_device_count_property_name) );
+        return;
     }
 
-    if( property_found )
+    IOT_SAMPLE_LOG(" "); /* Formatting */
+    if( old_value != NULL )
     {
-        IOT_SAMPLE_LOG( "Parsed desired `%.*s`: %d",
-                (int)az_span_size(property),
-                az_span_ptr(property),
-                (int)*out_parsed_device_count );
+        IOT_SAMPLE_LOG( "Desired `%.*s` changed from %d to %d.",
+                (int)az_span_size(desired_device_count_property_name),
+                az_span_ptr(desired_device_count_property_name),
+                (int)old_value->i, (int)new_value->i );
     }
-    else
+    update_device_count_property( new_value->i );
+}
+
+/******************************************************************************
+ * Function Name: request_twin_resync
+ ******************************************************************************
+ * Summary:
+ *  Twin store callback for a desired $version gap. The device twin feature
+ *  requests the full twin document.
+ *
+ * Parameters:
+ *  context: Unused.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+static void request_twin_resync(void* context)
+{
+    (void)context;
+
+    IOT_SAMPLE_LOG( "Desired properties $version gap, requesting the twin document." );
+    post_twin_update();
+}
+
+/******************************************************************************
+ * Function Name: sync_device_count_property
+ ******************************************************************************
+ * Summary:
+ *  Posts a reported property update if the reported "Test_count" of the
+ *  twin store differs from the desired one.
+ *
+ * Parameters:
+ *  void
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+static void sync_device_count_property(void)
+{
+    iot_twin_value desired;
+    iot_twin_value reported;
+
+    if( !iot_twin_store_get( &twin_store.desired, TWIN_FIELD_TEST_COUNT, &desired ) )
     {
-        IOT_SAMPLE_LOG( "`%.*s` property was not found in desired property response.",
-                (int)az_span_size(property),
-                az_span_ptr(property) );
-        return false;
+        IOT_SAMPLE_LOG( "`%.*s` property was not found in desired properties.",
+                (int)az_span_size(desired_device_count_property_name),
+                az_span_ptr(desired_device_count_property_name) );
+        return;
     }
 
-    return true;
+    if( !iot_twin_store_get( &twin_store.reported, TWIN_FIELD_TEST_COUNT, &reported ) ||
+        ( reported.i != desired.i ) )
+    {
+        post_twin_update();
+    }
 }
 
 /******************************************************************************
  * Function Name: handle_device_twin_message
  ******************************************************************************
  * Summary:
- *  Handle for Device Twin type message.
+ *  Handle for Device Twin type message. The payload is applied to the twin
+ *  store: a GET response replaces the stored document, a desired property
+ *  patch is applied after its $version is checked. Changed properties are
+ *  applied by their twin store subscriptions.
  *
  * Parameters:
  *  message: MQTT publish information structure.
@@ -535,39 +812,98 @@ static bool parse_desired_device_count_property(az_span message_span,
 static void handle_device_twin_message(cy_mqtt_publish_info_t *message,
         az_iot_hub_client_twin_response const* twin_response)
 {
-    az_span const message_span = az_span_create((uint8_t*)message->payload, message->payload_len);
-    cy_rslt_t result = CY_RSLT_SUCCESS;
+    uint32_t changed = 0;
+    int32_t version = 0;
+    iot_twin_value reported;
+
+    /* Responses to GET and reported property requests carry the request ID.
+     * A response to an unknown, expired or already answered request changes
+     * no twin state: its document may be older than the stored one, and its
+     * reported version belongs to no update in flight.
+     */
+    if( ( twin_response->response_type != AZ_IOT_HUB_CLIENT_TWIN_RESPONSE_TYPE_DESIRED_PROPERTIES ) &&
+        !iot_request_tracker_complete( &twin_request_tracker,
+                (char const*)az_span_ptr( twin_response->request_id ),
+                (size_t)az_span_size( twin_response->request_id ), NULL ) )
+    {
+        IOT_SAMPLE_LOG( "Ignoring twin response to an unknown or expired request." );
+        return;
+    }
 
     /* Invoke the appropriate action per response type (3 types only) */
     switch( twin_response->response_type )
     {
     case AZ_IOT_HUB_CLIENT_TWIN_RESPONSE_TYPE_GET:
         IOT_SAMPLE_LOG("Message Type: GET");
+
+        if( twin_response->status != AZ_IOT_STATUS_OK )
+        {
+            break;
+        }
+        switch( iot_twin_store_apply_document( &twin_store, (uint8_t const*)message->payload,
+                message->payload_len, &changed ) )
+        {
+        case IOT_TWIN_PATCH_APPLIED:
+            sync_device_count_property();
+            break;
+
+        case IOT_TWIN_PATCH_STALE:
+            IOT_SAMPLE_LOG( "Ignoring twin document older than desired $version %ld.",
+                    (long)twin_store.desired.version );
+            break;
+
+        default:
+            IOT_SAMPLE_LOG_ERROR( "Failed to parse the twin document." );
+            break;
+        }
         break;
 
     case AZ_IOT_HUB_CLIENT_TWIN_RESPONSE_TYPE_REPORTED_PROPERTIES:
         IOT_SAMPLE_LOG("Message Type: Reported Properties");
+
+        /* The hub accepted the update sent by send_reported_property() */
+        if( az_iot_status_succeeded( twin_response->status ) &&
+            az_result_succeeded( az_span_atoi32( twin_response->version, &version ) ) )
+        {
+            reported.i = reported_device_count_value;
+            iot_twin_store_set_reported( &twin_store, TWIN_FIELD_TEST_COUNT, reported );
+            iot_twin_store_set_reported_version( &twin_store, version );
+        }
+
+        /* Updates made while the patch was in flight are pending */
+        if( iot_reported_writer_complete( &twin_reported_writer, az_iot_status_succeeded( twin_response->status ) ) )
+        {
+            post_twin_update();
+        }
         break;
 
     case AZ_IOT_HUB_CLIENT_TWIN_RESPONSE_TYPE_DESIRED_PROPERTIES:
         IOT_SAMPLE_LOG("Message Type: Desired Properties");
 
-        /* Parse for the device count property */
-        int32_t desired_device_count = 0;
-        if( parse_desired_device_count_property( message_span, &desired_device_count ) )
+        switch( iot_twin_store_apply_desired_patch( &twin_store, (uint8_t const*)message->payload,
+                message->payload_len, &changed ) )
         {
-            IOT_SAMPLE_LOG(" "); /* Formatting */
-            /* Update the device count locally and report the update to
-             * the server
-             */
-            update_device_count_property( desired_device_count );
-
-            result = xSemaphoreGive( twin_app_sem );
-            if( result != pdTRUE )
+        case IOT_TWIN_PATCH_APPLIED:
+            if( changed != 0 )
             {
-                TEST_INFO(( "Releasing twin_app_sem failed with Error : [0x%X]\n", (unsigned int)result ));
+                sync_device_count_property();
             }
+            break;
 
+        case IOT_TWIN_PATCH_STALE:
+            IOT_SAMPLE_LOG( "Ignoring desired properties patch older than $version %ld.",
+                    (long)twin_store.desired.version );
+            break;
+
+        case IOT_TWIN_PATCH_GAP:
+            /* Earlier patches were missed; the twin store requested the full
+             * document through request_twin_resync().
+             */
+            break;
+
+        case IOT_TWIN_PATCH_ERROR:
+            IOT_SAMPLE_LOG_ERROR( "Failed to parse the desired properties patch." );
+            break;
         }
         break;
     }
@@ -614,19 +950,19 @@ static void parse_device_twin_message(char* topic, int topic_len,
 }
 
 /******************************************************************************
- * Function Name: get_device_twin_document
+ * Function Name: publish_twin_document_request
  ******************************************************************************
  * Summary:
- *  Function to receive device twin document from Azure IoT hub.
+ *  Function to publish a device twin document request to Azure IoT hub.
  *
  * Parameters:
- *  void
+ *  request_id: Request ID allocated by the twin request tracker.
  *
  * Return:
- *  void
+ *  cy_rslt_t: Result of the publish.
  *
  ******************************************************************************/
-static void get_device_twin_document(void)
+static cy_rslt_t publish_twin_document_request(char const* request_id)
 {
     int rc;
     uint16_t topic_len = 0;
@@ -640,7 +976,7 @@ static void get_device_twin_document(void)
 
     rc = az_iot_hub_client_twin_document_get_publish_topic(
             &hub_client,
-            twin_document_topic_request_id,
+            az_span_create_from_str( (char*)request_id ),
             twin_document_topic_buffer,
             sizeof(twin_document_topic_buffer),
             (size_t *)&topic_len);
@@ -658,83 +994,388 @@ static void get_device_twin_document(void)
     pub_msg.payload_len = (size_t)0;
 
     /* Publish the twin document request */
-    result = cy_mqtt_publish( mqtthandle, &pub_msg );
+    result = publish_message( &pub_msg );
     if( result == TEST_PASS )
     {
         TEST_INFO(( "\r\ncy_mqtt_publish completed........\n\r" ));
     }
     else
     {
-        TEST_INFO(( "\r\ncy_mqtt_publish failed with Error : [0x%X] ", (unsigned int)result ));
+        TEST_INFO(( "\r\ncy_mqtt_publish failed with Error : [0x%X] ", (unsigned int)result ));
+    }
+    return result;
+}
+
+/******************************************************************************
+ * Function Name: get_device_twin_document
+ ******************************************************************************
+ * Summary:
+ *  Function to receive device twin document from Azure IoT hub. The request
+ *  is tracked, and published again if no response arrives in time.
+ *
+ * Parameters:
+ *  void
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+static void get_device_twin_document(void)
+{
+    char request_id[IOT_REQUEST_ID_SIZE];
+
+    if( !iot_request_tracker_begin( &twin_request_tracker, TWIN_REQUEST_OP_GET,
+            TWIN_GET_TIMEOUT_MSEC, TWIN_GET_MAX_RETRIES, request_id ) )
+    {
+        IOT_SAMPLE_LOG_ERROR("No free twin request ID.");
+        return;
+    }
+
+    if( publish_twin_document_request( request_id ) != CY_RSLT_SUCCESS )
+    {
+        iot_request_tracker_cancel( &twin_request_tracker, request_id );
+    }
+}
+
+/******************************************************************************
+ * Function Name: resend_twin_request
+ ******************************************************************************
+ * Summary:
+ *  Twin request tracker callback that publishes a twin GET again after its
+ *  response timed out. Reported property patches are resent by the reported
+ *  property writer instead, with the latest values.
+ *
+ * Parameters:
+ *  context: Unused.
+ *
+ *  op: TWIN_REQUEST_OP_* of the lost request.
+ *
+ *  request_id: Request ID of the lost request.
+ *
+ * Return:
+ *  cy_rslt_t: Result of the publish.
+ *
+ ******************************************************************************/
+static cy_rslt_t resend_twin_request(void* context, uint8_t op, char const* request_id)
+{
+    (void)context;
+
+    if( op != TWIN_REQUEST_OP_GET )
+    {
+        return TEST_FAIL;
+    }
+
+    return publish_twin_document_request( request_id );
+}
+
+#if !AZURE_DEVICE_DEMO_SINGLE_TASK_REACTOR
+/******************************************************************************
+ * Function Name: send_and_receive_device_twin_messages
+ ******************************************************************************
+ * Summary:
+ *  Function to send/receive device twin property between Azure Hub and device.
+ *  The twin document is requested only if the twin store is not in sync.
+ *
+ * Parameters:
+ *  void
+ *
+ * Return:
+ *  cy_rslt_t: Provides the result of an operation as a structured bitfield.
+ *
+ ******************************************************************************/
+static cy_rslt_t send_and_receive_device_twin_messages(void)
+{
+    cy_rslt_t result = CY_RSLT_SUCCESS;
+
+    /* The GET response posts a reported property update if the reported
+     * "Test_count" differs from the desired one.
+     */
+    if( iot_twin_store_needs_full_sync( &twin_store ) )
+    {
+        get_device_twin_document();
+        vTaskDelay(pdMS_TO_TICKS(MESSAGE_SEND_RECEIVE_INTERVAL_MSEC));
+    }
+    else
+    {
+        IOT_SAMPLE_LOG( "Device twin is up to date at desired $version %ld.", (long)twin_store.desired.version );
+    }
+
+    IOT_SAMPLE_LOG_SUCCESS("Client received messages.");
+    return result;
+}
+#endif /* !AZURE_DEVICE_DEMO_SINGLE_TASK_REACTOR */
+
+/******************************************************************************
+ * Function Name: parse_c2d_message
+ ******************************************************************************
+ * Summary:
+ *  Parse the message and retrieve the c2d_request information.
+ *
+ * Parameters:
+ *  topic: Topic of received MQTT message.
+ *
+ *  topic_len: Length of received message topic.
+ *
+ *  out_c2d_request: The Cloud-To-Device Request.
+ *
+ * Return:
+ *  cy_rslt_t: Provides the result of an operation as a structured bitfield.
+ *
+ ******************************************************************************/
+static cy_rslt_t parse_c2d_message(char* topic, uint16_t topic_len,
+        az_iot_hub_client_c2d_request* out_c2d_request)
+{
+    az_span const topic_span = az_span_create( (uint8_t*)topic, topic_len );
+
+    /* Parse the message and retrieve the c2d_request information */
+    az_result rc = az_iot_hub_client_c2d_parse_received_topic( &hub_client, topic_span, out_c2d_request );
+    if( az_result_failed(rc) )
+    {
+        TEST_INFO(( "\r\nMessage from unknown topic: az_result return code 0x%08x.", (unsigned int)rc ));
+        TEST_INFO(( "\r\nTopic : %.*s\r\n", (int)topic_span._internal.size, topic_span._internal.ptr ));
+        return ( (cy_rslt_t)TEST_FAIL );
+    }
+
+    TEST_INFO(( "\r\nClient received a valid topic response." ));
+    TEST_INFO(( "\r\nTopic : %.*s\r\n", (int)topic_span._internal.size, topic_span._internal.ptr ));
+    return CY_RSLT_SUCCESS;
+}
+
+/******************************************************************************
+ * Function Name: process_c2d_message
+ ******************************************************************************
+ * Summary:
+ *  Application handler of a C2D message. Runs before the message is
+ *  acknowledged.
+ *
+ * Parameters:
+ *  c2d_request: The Cloud-To-Device Request.
+ *
+ *  message_span: Payload of the message.
+ *
+ * Return:
+ *  cy_rslt_t: CY_RSLT_SUCCESS once the message was processed.
+ *
+ ******************************************************************************/
+static cy_rslt_t process_c2d_message(az_iot_hub_client_c2d_request const* c2d_request, az_span message_span)
+{
+    (void)c2d_request;
+
+    TEST_INFO(( "\r\nPayload: %.*s\r\n", (int)message_span._internal.size,  message_span._internal.ptr ));
+    return CY_RSLT_SUCCESS;
+}
+
+/******************************************************************************
+ * Function Name: lock_c2d_dedup_cache
+ ******************************************************************************
+ * Summary:
+ *  Takes the C2D message ID cache, if it is saved to protected storage and
+ *  so also used by the telemetry loop. A critical section rather than a
+ *  mutex, so that the MQTT event callback never blocks on the telemetry loop;
+ *  it is held only for a lookup, an insert or a copy of the cache.
+ *
+ * Parameters:
+ *  void
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+static void lock_c2d_dedup_cache(void)
+{
+#if ( C2D_DEDUP_CACHE_PERSIST && (defined CY_TFM_PSA_SUPPORTED) )
+    taskENTER_CRITICAL();
+#endif
+}
+
+/******************************************************************************
+ * Function Name: unlock_c2d_dedup_cache
+ ******************************************************************************
+ * Summary:
+ *  Releases the C2D message ID cache taken by lock_c2d_dedup_cache().
+ *
+ * Parameters:
+ *  void
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+static void unlock_c2d_dedup_cache(void)
+{
+#if ( C2D_DEDUP_CACHE_PERSIST && (defined CY_TFM_PSA_SUPPORTED) )
+    taskEXIT_CRITICAL();
+#endif
+}
+
+/******************************************************************************
+ * Function Name: save_c2d_dedup_cache
+ ******************************************************************************
+ * Summary:
+ *  Saves the C2D message IDs in protected storage if new IDs were recorded
+ *  and, unless forced, the last save is C2D_DEDUP_CACHE_SAVE_INTERVAL_MSEC
+ *  old. The cache is copied with the cache locked and the copy is written to
+ *  flash after the lock is released. Called from the app task only, never
+ *  from the MQTT event callback.
+ *
+ * Parameters:
+ *  force: true to save regardless of the interval, e.g. at the end.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+static void save_c2d_dedup_cache(bool force)
+{
+#if ( C2D_DEDUP_CACHE_PERSIST && (defined CY_TFM_PSA_SUPPORTED) )
+    psa_status_t status;
+
+    if( !force && ( c2d_dedup_cache_save_tick != 0 ) &&
+        ( ( xTaskGetTickCount() - c2d_dedup_cache_save_tick ) < pdMS_TO_TICKS( C2D_DEDUP_CACHE_SAVE_INTERVAL_MSEC ) ) )
+    {
+        return;
+    }
+
+    lock_c2d_dedup_cache();
+    if( !c2d_dedup_cache.dirty )
+    {
+        unlock_c2d_dedup_cache();
         return;
     }
+    c2d_dedup_cache_saved = c2d_dedup_cache;
+    c2d_dedup_cache.dirty = false;
+    unlock_c2d_dedup_cache();
+
+    status = iot_dedup_cache_save( &c2d_dedup_cache_saved, PSA_C2D_DEDUP_CACHE_UID );
+    c2d_dedup_cache_save_tick = xTaskGetTickCount();
+    if( status != PSA_SUCCESS )
+    {
+        /* Retried with the next save */
+        lock_c2d_dedup_cache();
+        c2d_dedup_cache.dirty = true;
+        unlock_c2d_dedup_cache();
+        TEST_INFO(( "Saving C2D message IDs failed with %d\n", (int)status ));
+    }
+#else
+    (void)force;
+#endif
 }
 
 /******************************************************************************
- * Function Name: send_and_receive_device_twin_messages
+ * Function Name: flush_c2d_dedup_cache
  ******************************************************************************
  * Summary:
- *  Function to send/receive device twin property between Azure Hub and device.
+ *  Saves the C2D message IDs recorded by the MQTT event callback once the
+ *  save interval has passed. Called by the telemetry loop.
  *
  * Parameters:
  *  void
  *
  * Return:
- *  cy_rslt_t: Provides the result of an operation as a structured bitfield.
+ *  void
  *
  ******************************************************************************/
-static cy_rslt_t send_and_receive_device_twin_messages(void)
+static void flush_c2d_dedup_cache(void)
 {
-    cy_rslt_t result = CY_RSLT_SUCCESS;
-    get_device_twin_document();
-
-    vTaskDelay(pdMS_TO_TICKS(MESSAGE_SEND_RECEIVE_INTERVAL_MSEC));
-
-    IOT_SAMPLE_LOG(" ");
-
-    send_reported_property();
-
-    IOT_SAMPLE_LOG_SUCCESS("Client received messages.");
-    return result;
+    save_c2d_dedup_cache( false );
 }
 
 /******************************************************************************
- * Function Name: parse_c2d_message
+ * Function Name: handle_c2d_message
  ******************************************************************************
  * Summary:
- *  Parse the message and retrieve the c2d_request information.
+ *  Processes a C2D message unless its message ID shows that it was already
+ *  processed. C2D messages are subscribed with QoS1 on a persistent session,
+ *  so the hub redelivers unacknowledged messages after a reconnect; a
+ *  duplicate is acknowledged without being processed again. The message ID is
+ *  recorded only after process_c2d_message() succeeds, so a message whose
+ *  processing failed or was interrupted is processed again when redelivered.
  *
  * Parameters:
- *  topic: Topic of received MQTT message.
- *
- *  topic_len: Length of received message topic.
+ *  c2d_request: The Cloud-To-Device Request.
  *
  *  message: MQTT publish/subscribe information structure.
  *
- *  out_c2d_request: The Cloud-To-Device Request.
- *
  * Return:
  *  void
  *
  ******************************************************************************/
-static void parse_c2d_message(char* topic, uint16_t topic_len,  cy_mqtt_publish_info_t *message,
-        az_iot_hub_client_c2d_request* out_c2d_request)
+static void handle_c2d_message(az_iot_hub_client_c2d_request* c2d_request, cy_mqtt_publish_info_t *message)
 {
-    az_span const topic_span = az_span_create( (uint8_t*)topic, topic_len );
     az_span const message_span = az_span_create( (uint8_t*)message->payload, message->payload_len );
+    az_span message_id;
+    bool has_message_id;
+    bool is_duplicate;
+    TickType_t start_tick;
+    TickType_t handler_ticks;
+    cy_rslt_t result;
+
+    has_message_id = az_result_succeeded( az_iot_message_properties_find( &c2d_request->properties,
+            c2d_message_id_name, &message_id ) );
+    lock_c2d_dedup_cache();
+    is_duplicate = has_message_id &&
+        iot_dedup_cache_contains( &c2d_dedup_cache, az_span_ptr(message_id), (size_t)az_span_size(message_id) );
+    unlock_c2d_dedup_cache();
+    if( is_duplicate )
+    {
+        TEST_INFO(( "\r\nDuplicate C2D message %.*s, not processed again.\r\n",
+                (int)az_span_size(message_id), az_span_ptr(message_id) ));
+        return;
+    }
 
-    /* Parse the message and retrieve the c2d_request information */
-    az_result rc = az_iot_hub_client_c2d_parse_received_topic( &hub_client, topic_span, out_c2d_request );
-    if( az_result_failed(rc) )
+    start_tick = xTaskGetTickCount();
+    result = process_c2d_message( c2d_request, message_span );
+    handler_ticks = xTaskGetTickCount() - start_tick;
+
+    if( handler_ticks > c2d_max_handler_ticks )
     {
-        TEST_INFO(( "\r\nMessage from unknown topic: az_result return code 0x%08x.", (unsigned int)rc ));
-        TEST_INFO(( "\r\nTopic : %.*s\r\n", (int)topic_span._internal.size, topic_span._internal.ptr ));
+        c2d_max_handler_ticks = handler_ticks;
+    }
+    if( handler_ticks > pdMS_TO_TICKS( C2D_HANDLER_BUDGET_MSEC ) )
+    {
+        c2d_over_budget_count++;
+        TEST_INFO(( "\r\nC2D handler took %u ms, PUBACK was held back as long\r\n",
+                (unsigned int)(handler_ticks * portTICK_PERIOD_MS) ));
+    }
+
+    if( result != CY_RSLT_SUCCESS )
+    {
+        c2d_failed_count++;
+        TEST_INFO(( "\r\nC2D message processing failed with Error : [0x%X]\r\n", (unsigned int)result ));
         return;
     }
 
-    TEST_INFO(( "\r\nClient received a valid topic response." ));
-    TEST_INFO(( "\r\nTopic : %.*s\r\n", (int)topic_span._internal.size, topic_span._internal.ptr ));
-    TEST_INFO(( "\r\nPayload: %.*s\r\n", (int)message_span._internal.size,  message_span._internal.ptr ));
+    c2d_processed_count++;
+    if( has_message_id )
+    {
+        /* Written to flash later by the telemetry loop, never from here */
+        lock_c2d_dedup_cache();
+        iot_dedup_cache_insert( &c2d_dedup_cache, az_span_ptr(message_id), (size_t)az_span_size(message_id) );
+        unlock_c2d_dedup_cache();
+    }
+}
+
+/******************************************************************************
+ * Function Name: wake_feature_tasks
+ ******************************************************************************
+ * Summary:
+ *  Wakes the method and device twin feature tasks so that they notice the
+ *  disconnection and end without waiting for their loop deadline.
+ *
+ * Parameters:
+ *  void
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+static void wake_feature_tasks(void)
+{
+    iot_event_queue_wake( &hub_direct_method_event_queue );
+    if( twin_app_sem != NULL )
+    {
+        xSemaphoreGive( twin_app_sem );
+    }
 }
 
 /******************************************************************************
@@ -757,6 +1398,7 @@ static void parse_c2d_message(char* topic, uint16_t topic_len,  cy_mqtt_publish_
 static void mqtt_event_cb(cy_mqtt_t mqtt_handle, cy_mqtt_event_t event, void *arg)
 {
     cy_mqtt_publish_info_t *received_msg;
+    iot_mqtt_message_event *method_event;
     az_iot_hub_client_c2d_request c2d_request;
 
     TEST_INFO(( "MQTT App callback with handle : %p \n", mqtt_handle ));
@@ -773,6 +1415,8 @@ static void mqtt_event_cb(cy_mqtt_t mqtt_handle, cy_mqtt_event_t event, void *ar
             TEST_INFO(( "CY_MQTT_DISCONN_REASON_NETWORK_DISCONNECTION .....\n" ));
         }
         connect_state = false;
+        iot_diag_record_disconnect();
+        wake_feature_tasks();
         break;
 
     case CY_MQTT_EVENT_TYPE_PUBLISH_RECEIVE :
@@ -782,21 +1426,30 @@ static void mqtt_event_cb(cy_mqtt_t mqtt_handle, cy_mqtt_event_t event, void *ar
         if( strstr((char*)received_msg->topic, "/messages/devicebound/") != NULL)
         {
             printf("\r\n##############\r\n Incoming C2D \r\n##############\n");
-            parse_c2d_message( (char*)received_msg->topic, received_msg->topic_len, received_msg , &c2d_request );
-            TEST_INFO(( "\r\nClient parsed C2D message." ));
+            if( parse_c2d_message( (char*)received_msg->topic, received_msg->topic_len, &c2d_request ) == CY_RSLT_SUCCESS )
+            {
+                TEST_INFO(( "\r\nClient parsed C2D message." ));
+                handle_c2d_message( &c2d_request, received_msg );
+            }
         }
 
         /* Case for Methods message */
         else if(strstr((char*)received_msg->topic, "$iothub/methods/POST/") != NULL)
         {
             printf("\r\n##############\r\n Incoming Methods \r\n##############\n");
-            /* Parse the method message and invoke the method */
-            az_iot_hub_client_method_request method_request;
-            parse_hub_method_message( (char*)received_msg->topic, received_msg->topic_len, received_msg, &method_request );
-            TEST_INFO(( "Client parsed method request." ));
+            /* The network buffer is reused once this callback returns, so the
+             * request is copied and handed to the method task without blocking.
+             */
+            method_event = iot_mqtt_message_event_create( 0, received_msg->topic, received_msg->topic_len,
+                    received_msg->payload, received_msg->payload_len );
+            if( method_event == NULL )
+            {
+                TEST_INFO(( "Memory not available for method request\n" ));
+                break;
+            }
             TEST_INFO(( "Pushing to direct method queue...." ));
 
-            if( xQueueSend( hub_direct_method_event_queue, (void *)&method_request, pdMS_TO_TICKS(PUT_QUEUE_TIMEOUT_MSEC) ) != pdPASS )
+            if( !iot_event_queue_post( &hub_direct_method_event_queue, 0, method_event ) )
             {
                 TEST_INFO(( "Pushing to hub_direct_method_event_queue failed\n"));
             }
@@ -849,6 +1502,7 @@ static cy_rslt_t disconnect_and_delete_mqtt_client(void)
         TEST_INFO(( "cy_mqtt_disconnect ----------------------- Fail \n" ));
     }
     connect_state = false;
+    wake_feature_tasks();
 
     result = cy_mqtt_delete( mqtthandle );
     if( result == TEST_PASS )
@@ -881,25 +1535,25 @@ static cy_rslt_t disconnect_and_delete_mqtt_client(void)
 }
 
 /******************************************************************************
- * Function Name: send_telemetry_messages_to_iot_hub
+ * Function Name: send_telemetry_message
  ******************************************************************************
  * Summary:
- *  Function to send device telemetry messages to Azure Hub.
+ *  Function to send one device telemetry message to Azure Hub.
  *
  * Parameters:
- *  void
+ *  message_count: Index of the telemetry message.
  *
  * Return:
  *  cy_rslt_t: Provides the result of an operation as a structured bitfield.
  *
  ******************************************************************************/
-static cy_rslt_t send_telemetry_messages_to_iot_hub(void)
+static cy_rslt_t send_telemetry_message(uint8_t message_count)
 {
     int rc;
     cy_rslt_t result = CY_RSLT_SUCCESS;
     size_t topic_len = 0;
     cy_mqtt_publish_info_t pub_msg;
-    uint8_t offset = 0;
+    uint8_t offset = ( message_count % MAX_TELEMETRY_MESSAGE_COUNT );
 
     /* Get the Telemetry topic to publish telemetry messages. */
     char telemetry_topic_buffer[TELEMETRY_TOPIC_BUFFER_SIZE];
@@ -915,38 +1569,57 @@ static cy_rslt_t send_telemetry_messages_to_iot_hub(void)
         return TEST_FAIL;
     }
 
-    char const* telemetry_message_payloads[MAX_TELEMETRY_MESSAGE_COUNT] = {
-            "{\"message_number\":1}", "{\"message_number\":2}", "{\"message_number\":3}",
-            "{\"message_number\":4}", "{\"message_number\":5}",
-    };
+    pub_msg.qos = (cy_mqtt_qos_t)CY_MQTT_QOS0;
+    pub_msg.topic = (const char *)&telemetry_topic_buffer;
+    pub_msg.topic_len = topic_len;
+    pub_msg.payload = (const char *)telemetry_message_payloads[offset];
+    pub_msg.payload_len = (size_t)( strlen(telemetry_message_payloads[offset]) );
+
+    /* Publish the telemetry message. */
+    result = publish_message( &pub_msg );
+    if( result == TEST_PASS )
+    {
+        TEST_INFO(( "cy_mqtt_publish completed........\n\r" ));
+        IOT_SAMPLE_LOG_SUCCESS( "Message #%d: Client published the Telemetry message.", message_count + 1);
+        IOT_SAMPLE_LOG( "Payload: %s\n", telemetry_message_payloads[offset] );
+    }
+    else
+    {
+        TEST_INFO(( "cy_mqtt_publish failed with Error : [0x%X] ", (unsigned int)result ));
+        return TEST_FAIL;
+    }
+    return CY_RSLT_SUCCESS;
+}
 
+#if !AZURE_DEVICE_DEMO_SINGLE_TASK_REACTOR
+/******************************************************************************
+ * Function Name: send_telemetry_messages_to_iot_hub
+ ******************************************************************************
+ * Summary:
+ *  Function to send device telemetry messages to Azure Hub.
+ *
+ * Parameters:
+ *  void
+ *
+ * Return:
+ *  cy_rslt_t: Provides the result of an operation as a structured bitfield.
+ *
+ ******************************************************************************/
+static cy_rslt_t send_telemetry_messages_to_iot_hub(void)
+{
     /* Publish the number of telemetry messages. */
     for( uint8_t message_count = 0; message_count < MAX_MESSAGE_COUNT; message_count++ )
     {
-        offset = ( message_count % MAX_TELEMETRY_MESSAGE_COUNT);
-        pub_msg.qos = (cy_mqtt_qos_t)CY_MQTT_QOS0;
-        pub_msg.topic = (const char *)&telemetry_topic_buffer;
-        pub_msg.topic_len = topic_len;
-        pub_msg.payload = (const char *)telemetry_message_payloads[offset];
-        pub_msg.payload_len = (size_t)( strlen(telemetry_message_payloads[offset]) );
-
-        /* Publish the reported property update. */
-        result = cy_mqtt_publish( mqtthandle, &pub_msg );
-        if( result == TEST_PASS )
-        {
-            TEST_INFO(( "cy_mqtt_publish completed........\n\r" ));
-            IOT_SAMPLE_LOG_SUCCESS( "Message #%d: Client published the Telemetry message.", message_count + 1);
-            IOT_SAMPLE_LOG( "Payload: %s\n", telemetry_message_payloads[offset] );
-        }
-        else
+        if( send_telemetry_message( message_count ) != CY_RSLT_SUCCESS )
         {
-            TEST_INFO(( "cy_mqtt_publish failed with Error : [0x%X] ", (unsigned int)result ));
             return TEST_FAIL;
         }
+        flush_c2d_dedup_cache();
         vTaskDelay(pdMS_TO_TICKS(TELEMETRY_SEND_INTERVAL_SEC * 1000));
     }
     return CY_RSLT_SUCCESS;
 }
+#endif /* !AZURE_DEVICE_DEMO_SINGLE_TASK_REACTOR */
 
 /******************************************************************************
  * Function Name: subscribe_azure_hub_features_topics
@@ -1070,10 +1743,12 @@ static cy_rslt_t connect_mqtt_client_to_iot_hub(void)
     {
         TEST_INFO(( "cy_mqtt_connect -------------------------- Pass \n" ));
         connect_state = true;
+        iot_diag_record_connect( true );
     }
     else
     {
         TEST_INFO(( "cy_mqtt_connect -------------------------- Fail \n" ));
+        iot_diag_record_connect( false );
         return TEST_FAIL;
     }
 
@@ -1218,51 +1893,109 @@ static cy_rslt_t configure_hub_environment_variables(void)
 }
 
 /******************************************************************************
- * Function Name: method_feature_task
+ * Function Name: handle_method_event
  ******************************************************************************
  * Summary:
- *  Task to run Azure IoT hub method feature. Handles method request and it's
- *  response.
+ *  Parses a queued direct method request, invokes the method and frees the
+ *  event.
  *
  * Parameters:
- *  arg
+ *  method_event: Direct method request event.
  *
  * Return:
  *  void
  *
  ******************************************************************************/
-void method_feature_task(void *arg)
+static void handle_method_event(iot_mqtt_message_event *method_event)
 {
-    uint32_t time_ms = 0;
     az_iot_hub_client_method_request method_request;
 
-    /*
-     * Initialize the queue for hub method events
+    /* The method request spans point into the event, keep it until the
+     * response is sent.
      */
-    hub_direct_method_event_queue = xQueueCreate( HUB_DIRECT_METHOD_EVENT_QUEUE_LENGTH, sizeof(az_iot_hub_client_method_request) );
-    if(hub_direct_method_event_queue != NULL)
+    if( parse_hub_method_message( method_event->topic, method_event->topic_len,
+            az_span_create( (uint8_t*)method_event->payload, (int32_t)method_event->payload_len ),
+            &method_request ) == CY_RSLT_SUCCESS )
     {
-        TEST_INFO(( "hub_direct_method_event_queue create for methods feature ----------- Pass\n" ));
+        TEST_INFO(( "Client parsed method request." ));
+        handle_method_request( &method_request );
+        TEST_INFO(( " " ));
+        TEST_INFO(( "Client received messages.\r\n" ));
     }
+    free( method_event );
+}
+
+/******************************************************************************
+ * Function Name: handle_twin_update
+ ******************************************************************************
+ * Summary:
+ *  Sets the device count property for the next reported property patch
+ *  after a desired property update, or requests the twin document after a
+ *  desired $version gap.
+ *
+ * Parameters:
+ *  void
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+static void handle_twin_update(void)
+{
+    iot_property_value value;
 
+    iot_event_latency_record( &twin_update_latency, twin_update_posted_tick );
+    if( iot_twin_store_needs_full_sync( &twin_store ) )
+    {
+        get_device_twin_document();
+    }
     else
     {
-        TEST_INFO(( "hub_direct_method_event_queue create for methods feature ----------- Fail\n" ));
+        value.i = device_count_value;
+        iot_reported_writer_set( &twin_reported_writer, TWIN_FIELD_TEST_COUNT, IOT_PROPERTY_INT32, value );
     }
+    TEST_INFO(( " " ));
+    TEST_INFO(( "Client received messages." ));
+}
+
+#if !AZURE_DEVICE_DEMO_SINGLE_TASK_REACTOR
+/******************************************************************************
+ * Function Name: method_feature_task
+ ******************************************************************************
+ * Summary:
+ *  Task to run Azure IoT hub method feature. Handles method request and it's
+ *  response.
+ *
+ * Parameters:
+ *  arg
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void method_feature_task(void *arg)
+{
+    TimeOut_t deadline;
+    TickType_t ticks_left = 0;
+    iot_mqtt_message_event *method_event;
 
-    time_ms = ( METHOD_WAIT_LOOP_DURATION_MSEC );
-    while( connect_state && (time_ms > 0) )
+    /* The task sleeps until a method request is posted, the client
+     * disconnects or the loop deadline expires.
+     */
+    iot_event_queue_set_consumer( &hub_direct_method_event_queue, xTaskGetCurrentTaskHandle() );
+    vTaskSetTimeOutState( &deadline );
+    ticks_left = pdMS_TO_TICKS( METHOD_WAIT_LOOP_DURATION_MSEC );
+    while( connect_state && (ticks_left > 0) )
     {
-        if(xQueueReceive(hub_direct_method_event_queue, (void *)&method_request, pdMS_TO_TICKS(GET_QUEUE_TIMEOUT_MSEC) ) == pdPASS)
+        method_event = iot_event_queue_wait( &hub_direct_method_event_queue, &deadline, &ticks_left, NULL );
+        if( method_event != NULL )
         {
-            handle_method_request( &method_request );
-            TEST_INFO(( " " ));
-            TEST_INFO(( "Client received messages.\r\n" ));
+            handle_method_event( method_event );
         }
-
-        time_ms = time_ms - GET_QUEUE_TIMEOUT_MSEC;
     }
 
+    iot_event_queue_log_stats( &hub_direct_method_event_queue, &hub_direct_method_event_class_name );
+
     vTaskSuspend(NULL);
 
 }
@@ -1284,7 +2017,10 @@ void method_feature_task(void *arg)
 void device_twin_feature_task(void *arg)
 {
     cy_rslt_t TestRes = TEST_PASS ;
-    uint32_t time_ms = 0;
+    TimeOut_t deadline;
+    TickType_t ticks_left = 0;
+    TickType_t wait_ticks = 0;
+    TickType_t poll_ticks = 0;
 
     TestRes = send_and_receive_device_twin_messages();
     if( TestRes == TEST_PASS )
@@ -1297,27 +2033,156 @@ void device_twin_feature_task(void *arg)
         goto exit_device_twin;
     }
 
-    time_ms = ( DEVICE_TWIN_WAIT_LOOP_DURATION_MSEC );
-    while( connect_state && (time_ms > 0))
+    /* The task sleeps until a desired property update is received, the
+     * client disconnects, the reported property patch is due or the loop
+     * deadline expires.
+     */
+    vTaskSetTimeOutState( &deadline );
+    ticks_left = pdMS_TO_TICKS( DEVICE_TWIN_WAIT_LOOP_DURATION_MSEC );
+    while( connect_state && (xTaskCheckForTimeOut( &deadline, &ticks_left ) == pdFALSE) )
     {
-
-        TestRes = xSemaphoreTake( twin_app_sem, portMAX_DELAY );
-        if( TestRes == pdTRUE )
+        wait_ticks = iot_reported_writer_poll( &twin_reported_writer );
+        poll_ticks = iot_request_tracker_poll( &twin_request_tracker );
+        if( poll_ticks < wait_ticks )
         {
-            send_reported_property();
-            TEST_INFO(( " " ));
-            TEST_INFO(( "Client received messages." ));
+            wait_ticks = poll_ticks;
+        }
+        if( wait_ticks > ticks_left )
+        {
+            wait_ticks = ticks_left;
+        }
+        TestRes = xSemaphoreTake( twin_app_sem, wait_ticks );
+        if( (TestRes == pdTRUE) && connect_state )
+        {
+            handle_twin_update();
         }
-
-        time_ms = time_ms - DEVICE_TWIN_TIMEOUT_MSEC;
-        vTaskDelay(pdMS_TO_TICKS(TWIN_MESSAGE_WAIT_DELAY_MSEC));
     }
 
+    iot_event_latency_log( "twin", &twin_update_latency );
+
     exit_device_twin:
     vTaskSuspend(NULL);
 
 }
 
+#else
+/******************************************************************************
+ * Function Name: ticks_until
+ ******************************************************************************
+ * Summary:
+ *  Returns the number of ticks from now until a due tick count.
+ *
+ * Parameters:
+ *  due_tick: Tick count at which an action is due.
+ *
+ * Return:
+ *  TickType_t: Ticks until due_tick, 0 if it has passed.
+ *
+ ******************************************************************************/
+static TickType_t ticks_until(TickType_t due_tick)
+{
+    TickType_t remaining = due_tick - xTaskGetTickCount();
+
+    /* Differences beyond half the tick range are due ticks in the past. */
+    return ( remaining > ( portMAX_DELAY / 2 ) ) ? 0 : remaining;
+}
+
+/******************************************************************************
+ * Function Name: run_device_demo_reactor
+ ******************************************************************************
+ * Summary:
+ *  Runs the telemetry, methods and device twin features in the calling task.
+ *  The task waits on a queue set of the direct method queue and the twin
+ *  semaphore, and dispatches each event to its handler. The telemetry
+ *  interval is driven by the wait timeout.
+ *
+ * Parameters:
+ *  void
+ *
+ * Return:
+ *  cy_rslt_t: Provides the result of an operation as a structured bitfield.
+ *
+ ******************************************************************************/
+static cy_rslt_t run_device_demo_reactor(void)
+{
+    cy_rslt_t result = TEST_PASS;
+    QueueSetMemberHandle_t member;
+    iot_mqtt_message_event *method_event;
+    TickType_t telemetry_due_tick;
+    TickType_t end_tick = 0;
+    TickType_t wait_ticks;
+    TickType_t poll_ticks;
+    bool telemetry_done = false;
+    uint8_t message_count = 0;
+
+    /* The GET response posts a reported property update if needed */
+    if( iot_twin_store_needs_full_sync( &twin_store ) )
+    {
+        get_device_twin_document();
+    }
+
+    telemetry_due_tick = xTaskGetTickCount();
+
+    while( connect_state )
+    {
+        if( !telemetry_done && ( ticks_until( telemetry_due_tick ) == 0 ) )
+        {
+            if( send_telemetry_message( message_count ) != CY_RSLT_SUCCESS )
+            {
+                result = TEST_FAIL;
+                break;
+            }
+            message_count++;
+            flush_c2d_dedup_cache();
+            telemetry_due_tick += pdMS_TO_TICKS( TELEMETRY_SEND_INTERVAL_SEC * 1000 );
+            if( message_count >= MAX_MESSAGE_COUNT )
+            {
+                telemetry_done = true;
+                end_tick = xTaskGetTickCount() + pdMS_TO_TICKS( MESSAGE_WAIT_DELAY_MSEC );
+            }
+        }
+
+        wait_ticks = telemetry_done ? ticks_until( end_tick ) : ticks_until( telemetry_due_tick );
+        if( telemetry_done && ( wait_ticks == 0 ) )
+        {
+            break;
+        }
+        poll_ticks = iot_reported_writer_poll( &twin_reported_writer );
+        if( poll_ticks < wait_ticks )
+        {
+            wait_ticks = poll_ticks;
+        }
+        poll_ticks = iot_request_tracker_poll( &twin_request_tracker );
+        if( poll_ticks < wait_ticks )
+        {
+            wait_ticks = poll_ticks;
+        }
+
+        member = xQueueSelectFromSet( device_demo_event_set, wait_ticks );
+        if( member == (QueueSetMemberHandle_t)twin_app_sem )
+        {
+            if( ( xSemaphoreTake( twin_app_sem, 0 ) == pdTRUE ) && connect_state )
+            {
+                handle_twin_update();
+            }
+        }
+        else if( ( member != NULL ) && iot_event_queue_is_set_member( &hub_direct_method_event_queue, member ) )
+        {
+            method_event = iot_event_queue_receive( &hub_direct_method_event_queue, 0, NULL );
+            if( method_event != NULL )
+            {
+                handle_method_event( method_event );
+            }
+        }
+    }
+
+    iot_event_queue_log_stats( &hub_direct_method_event_queue, &hub_direct_method_event_class_name );
+    iot_event_latency_log( "twin", &twin_update_latency );
+
+    return result;
+}
+#endif /* AZURE_DEVICE_DEMO_SINGLE_TASK_REACTOR */
+
 /******************************************************************************
  * Function Name: Azure_Device_Demo_app
  ******************************************************************************
@@ -1334,7 +2199,10 @@ void device_twin_feature_task(void *arg)
 void Azure_Device_Demo_app(void *arg)
 {
     cy_rslt_t TestRes = TEST_PASS ;
-    uint8_t Failcount = 0, Passcount = 0, time_sec = 0;
+    uint8_t Failcount = 0, Passcount = 0;
+#if !AZURE_DEVICE_DEMO_SINGLE_TASK_REACTOR
+    uint8_t time_sec = 0;
+#endif
 
 #ifdef CY_TFM_PSA_SUPPORTED
     psa_status_t uxStatus = PSA_SUCCESS;
@@ -1343,6 +2211,8 @@ void Azure_Device_Demo_app(void *arg)
     (void)read_len;
 #endif
 
+    iot_diag_init();
+
     /* Initialize the semaphore for hub methods events */
     twin_app_sem = xSemaphoreCreateCounting( 1, 0 );
     if( twin_app_sem != NULL )
@@ -1355,6 +2225,66 @@ void Azure_Device_Demo_app(void *arg)
         goto exit;
     }
 
+    /* Initialize the queue for hub method events before subscribing, so that
+     * no request can arrive ahead of it.
+     */
+    if( iot_event_queue_init( &hub_direct_method_event_queue, HUB_DIRECT_METHOD_EVENT_QUEUE_LENGTH,
+            &hub_direct_method_event_policy, 1 ) )
+    {
+        TEST_INFO(( "hub_direct_method_event_queue create for methods feature ----------- Pass\n" ));
+    }
+    else
+    {
+        TEST_INFO(( "hub_direct_method_event_queue create for methods feature ----------- Fail\n" ));
+        goto exit;
+    }
+
+    iot_diag_register_queue( hub_direct_method_event_class_name, hub_direct_method_event_queue.queue );
+    iot_diag_register_queue( "twin", twin_app_sem );
+
+    /* The twin store outlives the connection; a full twin GET is needed
+     * only on the first run or after a desired $version gap.
+     */
+    if( !twin_store_initialized )
+    {
+        twin_store_initialized = iot_twin_store_init( &twin_store, twin_fields,
+                (uint8_t)(sizeof(twin_fields) / sizeof(twin_fields[0])) ) &&
+                iot_twin_store_subscribe( &twin_store, "Test_count", on_device_count_changed, NULL );
+        iot_twin_store_set_resync( &twin_store, request_twin_resync, NULL );
+    }
+
+    iot_reported_writer_init( &twin_reported_writer, TWIN_REPORTED_DEBOUNCE_MSEC,
+            TWIN_REPORTED_RESPONSE_TIMEOUT_MSEC, send_reported_property, NULL );
+    (void)iot_request_tracker_init( &twin_request_tracker, twin_request_op_names, TWIN_REQUEST_OP_COUNT,
+            resend_twin_request, NULL );
+
+    /* Remember processed C2D message IDs across redeliveries */
+    iot_dedup_cache_init( &c2d_dedup_cache );
+#if ( C2D_DEDUP_CACHE_PERSIST && (defined CY_TFM_PSA_SUPPORTED) )
+    c2d_dedup_cache_save_tick = 0;
+    uxStatus = iot_dedup_cache_load( &c2d_dedup_cache, PSA_C2D_DEDUP_CACHE_UID );
+    if( uxStatus != PSA_SUCCESS )
+    {
+        TEST_INFO(( "No saved C2D message IDs restored, status %d\n", (int)uxStatus ));
+    }
+#endif
+
+#if AZURE_DEVICE_DEMO_SINGLE_TASK_REACTOR
+    /* Queue set of all feature event sources, waited on by the reactor */
+    device_demo_event_set = xQueueCreateSet( DEVICE_DEMO_EVENT_SET_LENGTH );
+    if( ( device_demo_event_set != NULL ) &&
+            iot_event_queue_add_to_set( &hub_direct_method_event_queue, device_demo_event_set ) &&
+            ( xQueueAddToSet( twin_app_sem, device_demo_event_set ) == pdPASS ) )
+    {
+        TEST_INFO(( "device_demo_event_set create for reactor ----------- Pass\n" ));
+    }
+    else
+    {
+        TEST_INFO(( "device_demo_event_set create for reactor ----------- Fail\n" ));
+        goto exit;
+    }
+#endif
+
 #if SAS_TOKEN_AUTH
     (void)device_id_buffer;
     (void)sas_token_buffer;
@@ -1456,6 +2386,19 @@ void Azure_Device_Demo_app(void *arg)
         Failcount++;
     }
 
+#if AZURE_DEVICE_DEMO_SINGLE_TASK_REACTOR
+    TestRes = run_device_demo_reactor();
+    if( TestRes == TEST_PASS )
+    {
+        TEST_INFO(( "run_device_demo_reactor ----------- Pass\n" ));
+        Passcount++;
+    }
+    else
+    {
+        TEST_INFO(( "run_device_demo_reactor ----------- Fail\n" ));
+        Failcount++;
+    }
+#else
     /* Method feature task creation */
     xTaskCreate(method_feature_task, "method_feature_task",
             AZURE_TASK_STACK_METHODS, NULL, AZURE_TASK_PRIORITY_METHODS, NULL);
@@ -1483,6 +2426,7 @@ void Azure_Device_Demo_app(void *arg)
         vTaskDelay(pdMS_TO_TICKS(MESSAGE_WAIT_DELAY_MSEC));
         time_sec = time_sec - DEVICE_DEMO_APP_TIMEOUT_MSEC;
     }
+#endif /* AZURE_DEVICE_DEMO_SINGLE_TASK_REACTOR */
 
     exit:
 
@@ -1504,6 +2448,16 @@ void Azure_Device_Demo_app(void *arg)
         goto exit;
     }
 
+    TEST_INFO(( "C2D messages: %u processed, %u failed, %u over budget, max handler time %u ms\n",
+            (unsigned int)c2d_processed_count, (unsigned int)c2d_failed_count,
+            (unsigned int)c2d_over_budget_count, (unsigned int)(c2d_max_handler_ticks * portTICK_PERIOD_MS) ));
+    iot_dedup_cache_log_stats( "C2D", &c2d_dedup_cache );
+    iot_twin_store_log_stats( "Device", &twin_store );
+    iot_reported_writer_log_stats( "Device", &twin_reported_writer );
+    iot_request_tracker_log_stats( &twin_request_tracker );
+    /* IDs whose save was deferred by the save interval */
+    save_c2d_dedup_cache( true );
+
     TEST_INFO(( "Completed MQTT Client Test Cases --------------------------\n" ));
     TEST_INFO(( "Total Test Cases   ---------------------- %d\n", ( Failcount + Passcount ) ));
     TEST_INFO(( "Test Cases passed  ---------------------- %d\n", Passcount ));
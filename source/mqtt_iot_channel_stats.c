@@ -0,0 +1,463 @@
+/******************************************************************************
+ * File Name: mqtt_iot_channel_stats.c
+ *
+ * Description: This file contains the multi-channel statistics that
+ * keep the latest value, minimum, maximum and sum of many sensor channels
+ * as structure of arrays, updated by vectorizable kernels.
+ *
+ ********************************************************************************
+ * Copyright 2024, Cypress Semiconductor Corporation (an Infineon company) or
+ * an affiliate of Cypress Semiconductor Corporation.  All rights reserved.
+ *
+ * This software, including source code, documentation and related
+ * materials ("Software") is owned by Cypress Semiconductor Corporation
+ * or one of its affiliates ("Cypress") and is protected by and subject to
+ * worldwide patent protection (United States and foreign),
+ * United States copyright laws and international treaty provisions.
+ * Therefore, you may use this Software only as provided in the license
+ * agreement accompanying the software package from which you
+ * obtained this Software ("EULA").
+ * If no EULA applies, Cypress hereby grants you a personal, non-exclusive,
+ * non-transferable license to copy, modify, and compile the Software
+ * source code solely for use in connection with Cypress's
+ * integrated circuit products.  Any reproduction, modification, translation,
+ * compilation, or representation of this Software except as specified
+ * above is prohibited without the express written permission of Cypress.
+ *
+ * Disclaimer: THIS SOFTWARE IS PROVIDED AS-IS, WITH NO WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING, BUT NOT LIMITED TO, NONINFRINGEMENT, IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. Cypress
+ * reserves the right to make changes to the Software without notice. Cypress
+ * does not assume any liability arising out of the application or use of the
+ * Software or any product or circuit described in the Software. Cypress does
+ * not authorize its products for use in any products where a malfunction or
+ * failure of the Cypress product may reasonably be expected to result in
+ * significant property damage, injury or death ("High Risk Product"). By
+ * including Cypress's product in a High Risk Product, the manufacturer
+ * of such system or application assumes all risk of such use and in doing
+ * so agrees to indemnify Cypress against all liability.
+ *******************************************************************************/
+
+#include <float.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mqtt_iot_common.h"
+#include "mqtt_iot_channel_stats.h"
+
+/*******************************************************************************
+ * Macros
+ ********************************************************************************/
+/* Minimum and maximum of a channel without samples */
+#if IOT_STATS_FIXED_POINT
+#define CHANNEL_STATS_EMPTY_MIN             (INT32_MAX)
+#define CHANNEL_STATS_EMPTY_MAX             (INT32_MIN)
+#else
+#define CHANNEL_STATS_EMPTY_MIN             (DBL_MAX)
+#define CHANNEL_STATS_EMPTY_MAX             (-DBL_MAX)
+#endif
+
+/* Update ticks that are measured for each number of channels */
+#define CHANNEL_STATS_BENCHMARK_TICKS       (100)
+#define CHANNEL_STATS_BENCHMARK_SIZES       (sizeof(channel_stats_benchmark_channels) / \
+                                             sizeof(channel_stats_benchmark_channels[0]))
+/* Sample rows of the benchmark, used in turn by the ticks */
+#define CHANNEL_STATS_BENCHMARK_ROWS        (2)
+
+/*******************************************************************************
+ * Global Variables
+ ********************************************************************************/
+/* Both layouts of the benchmark and their samples, allocated for one report */
+typedef struct
+{
+    iot_channel_stats   soa;
+    iot_running_stats   aos[IOT_CHANNEL_STATS_MAX_CHANNELS];
+    iot_stats_value     samples[CHANNEL_STATS_BENCHMARK_ROWS][IOT_CHANNEL_STATS_MAX_CHANNELS];
+} channel_stats_benchmark_t;
+
+/* Channels of the benchmark; the ones above IOT_CHANNEL_STATS_MAX_CHANNELS
+ * are skipped.
+ */
+static uint16_t const channel_stats_benchmark_channels[] = { 8, 16, 32, 64, 128, 256 };
+
+/******************************************************************************
+ * Function Name: channel_stats_mean
+ ******************************************************************************
+ * Summary:
+ *  Divides a sum of samples by their count; in Q16.16, rounded to nearest
+ *  as iot_running_stats_mean().
+ *
+ * Parameters:
+ *  sum: Sum of the samples.
+ *
+ *  count: Number of samples, greater than 0.
+ *
+ * Return:
+ *  iot_stats_value: Mean.
+ *
+ ******************************************************************************/
+static iot_stats_value channel_stats_mean(iot_channel_sum sum, uint64_t count)
+{
+#if IOT_STATS_FIXED_POINT
+    int64_t half = (int64_t)( count / 2 );
+
+    return (int32_t)( ( ( sum < 0 ) ? ( sum - half ) : ( sum + half ) ) / (int64_t)count );
+#else
+    return sum / (double)count;
+#endif
+}
+
+/******************************************************************************
+ * Function Name: iot_channel_stats_init
+ ******************************************************************************
+ * Summary:
+ *  Clears the statistics of every channel.
+ *
+ * Parameters:
+ *  stats: Channel statistics.
+ *
+ *  channels: Number of channels.
+ *
+ * Return:
+ *  bool: false if the number of channels is out of range.
+ *
+ ******************************************************************************/
+bool iot_channel_stats_init(iot_channel_stats* stats, uint16_t channels)
+{
+    if( ( channels == 0 ) || ( channels > IOT_CHANNEL_STATS_MAX_CHANNELS ) )
+    {
+        return false;
+    }
+
+    stats->channels = channels;
+    for( uint16_t i = 0; i < channels; i++ )
+    {
+        iot_channel_stats_reset_channel( stats, i );
+    }
+    return true;
+}
+
+/******************************************************************************
+ * Function Name: iot_channel_stats_reset_channel
+ ******************************************************************************
+ * Summary:
+ *  Clears the statistics of one channel.
+ *
+ * Parameters:
+ *  stats: Channel statistics.
+ *
+ *  channel: Channel index.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_channel_stats_reset_channel(iot_channel_stats* stats, uint16_t channel)
+{
+    if( channel >= stats->channels )
+    {
+        return;
+    }
+
+    stats->values[channel] = 0;
+    stats->mins[channel] = CHANNEL_STATS_EMPTY_MIN;
+    stats->maxes[channel] = CHANNEL_STATS_EMPTY_MAX;
+    stats->sums[channel] = 0;
+    stats->counts[channel] = 0;
+}
+
+/******************************************************************************
+ * Function Name: channel_stats_add_kernel
+ ******************************************************************************
+ * Summary:
+ *  Adds one sample to each of n channels. Every field is walked with unit
+ *  stride through restrict parameters, and the minimum and maximum are
+ *  selects rather than branches, so GCC vectorizes the loop on a host
+ *  without a run-time aliasing check. The Cortex-M4 has no SIMD lanes of
+ *  32 or 64 bits, so there the loop gains from the sequential accesses
+ *  and, in Q16.16, from conditional execution instead of branches.
+ *
+ * Parameters:
+ *  n: Number of channels.
+ *
+ *  samples: One sample per channel.
+ *
+ *  values: Latest samples.
+ *
+ *  mins: Minimums.
+ *
+ *  maxes: Maximums.
+ *
+ *  sums: Sums.
+ *
+ *  counts: Numbers of samples.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+static void channel_stats_add_kernel(uint32_t n, iot_stats_value const* restrict samples,
+        iot_stats_value* restrict values, iot_stats_value* restrict mins, iot_stats_value* restrict maxes,
+        iot_channel_sum* restrict sums, uint32_t* restrict counts)
+{
+    for( uint32_t i = 0; i < n; i++ )
+    {
+        iot_stats_value const sample = samples[i];
+
+        values[i] = sample;
+        mins[i] = ( sample < mins[i] ) ? sample : mins[i];
+        maxes[i] = ( sample > maxes[i] ) ? sample : maxes[i];
+        sums[i] += (iot_channel_sum)sample;
+        counts[i]++;
+    }
+}
+
+/******************************************************************************
+ * Function Name: iot_channel_stats_add
+ ******************************************************************************
+ * Summary:
+ *  Adds one sample to each channel of a range that is in use.
+ *
+ * Parameters:
+ *  stats: Channel statistics.
+ *
+ *  first: Index of the first channel.
+ *
+ *  count: Number of channels.
+ *
+ *  samples: One sample per channel.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_channel_stats_add(iot_channel_stats* stats, uint16_t first, uint16_t count,
+        iot_stats_value const samples[])
+{
+    uint32_t n;
+
+    if( first >= stats->channels )
+    {
+        return;
+    }
+
+    n = ( count > ( stats->channels - first ) ) ? (uint32_t)( stats->channels - first ) : count;
+    channel_stats_add_kernel( n, samples, &stats->values[first], &stats->mins[first], &stats->maxes[first],
+                              &stats->sums[first], &stats->counts[first] );
+}
+
+/******************************************************************************
+ * Function Name: iot_channel_stats_means
+ ******************************************************************************
+ * Summary:
+ *  Computes the mean of every channel.
+ *
+ * Parameters:
+ *  stats: Channel statistics.
+ *
+ *  out_means: One mean per channel in use.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_channel_stats_means(iot_channel_stats const* stats, iot_stats_value out_means[])
+{
+    for( uint32_t i = 0; i < stats->channels; i++ )
+    {
+        out_means[i] = ( stats->counts[i] == 0 ) ? 0 : channel_stats_mean( stats->sums[i], stats->counts[i] );
+    }
+}
+
+/******************************************************************************
+ * Function Name: iot_channel_stats_summary
+ ******************************************************************************
+ * Summary:
+ *  Combines all channels with one reduction per field. A channel without
+ *  samples holds the largest value as minimum and the smallest as maximum,
+ *  so it takes part without a test. The count is summed in 64 bits, so the
+ *  mean stays exact after any number of ticks.
+ *
+ * Parameters:
+ *  stats: Channel statistics.
+ *
+ *  out_min: Smallest sample.
+ *
+ *  out_max: Largest sample.
+ *
+ *  out_mean: Mean of the samples.
+ *
+ * Return:
+ *  bool: false if no channel has samples.
+ *
+ ******************************************************************************/
+bool iot_channel_stats_summary(iot_channel_stats const* stats, iot_stats_value* out_min,
+        iot_stats_value* out_max, iot_stats_value* out_mean)
+{
+    iot_stats_value min = CHANNEL_STATS_EMPTY_MIN;
+    iot_stats_value max = CHANNEL_STATS_EMPTY_MAX;
+    iot_channel_sum sum = 0;
+    uint64_t count = 0;
+
+    for( uint32_t i = 0; i < stats->channels; i++ )
+    {
+        min = ( stats->mins[i] < min ) ? stats->mins[i] : min;
+        max = ( stats->maxes[i] > max ) ? stats->maxes[i] : max;
+        sum += stats->sums[i];
+        count += stats->counts[i];
+    }
+
+    if( count == 0 )
+    {
+        return false;
+    }
+
+    *out_min = min;
+    *out_max = max;
+    *out_mean = channel_stats_mean( sum, count );
+    return true;
+}
+
+/******************************************************************************
+ * Function Name: iot_channel_stats_build_benchmark_report
+ ******************************************************************************
+ * Summary:
+ *  Counts the CPU cycles of CHANNEL_STATS_BENCHMARK_TICKS update ticks of
+ *  each number of channels with the DWT cycle counter, with the structure
+ *  of arrays and with an array of iot_running_stats, and of as many
+ *  summaries, and reports the average cycles of each. A preemption
+ *  inflates only the loop it hits, so compare soaCycles with aosCycles of
+ *  the same number of channels.
+ *
+ * Parameters:
+ *  buffer: Destination buffer.
+ *
+ *  out_report: JSON text written to the buffer.
+ *
+ * Return:
+ *  az_result: AZ_OK, AZ_ERROR_NOT_ENOUGH_SPACE or AZ_ERROR_OUT_OF_MEMORY.
+ *
+ ******************************************************************************/
+az_result iot_channel_stats_build_benchmark_report(az_span buffer, az_span* out_report)
+{
+    uint32_t soa_cycles[CHANNEL_STATS_BENCHMARK_SIZES];
+    uint32_t aos_cycles[CHANNEL_STATS_BENCHMARK_SIZES];
+    uint32_t summary_cycles[CHANNEL_STATS_BENCHMARK_SIZES];
+    uint8_t sizes = 0;
+    bool match = true;
+    iot_stats_value min;
+    iot_stats_value max;
+    iot_stats_value mean;
+    channel_stats_benchmark_t* bench;
+    uint32_t start;
+    az_json_writer jw;
+
+    bench = (channel_stats_benchmark_t*)malloc( sizeof(*bench) );
+    if( bench == NULL )
+    {
+        return AZ_ERROR_OUT_OF_MEMORY;
+    }
+
+    /* Thermostats between 21.5 and 22.375 degrees Celsius */
+    for( uint8_t r = 0; r < CHANNEL_STATS_BENCHMARK_ROWS; r++ )
+    {
+        for( uint32_t i = 0; i < IOT_CHANNEL_STATS_MAX_CHANNELS; i++ )
+        {
+            bench->samples[r][i] = IOT_STATS_VALUE_FROM_DOUBLE( 21.5 + 0.125 * (double)( ( i * 3 + r ) % 8 ) );
+        }
+    }
+
+    IOT_CYCLE_COUNTER_START();
+
+    for( uint8_t s = 0; s < CHANNEL_STATS_BENCHMARK_SIZES; s++ )
+    {
+        uint16_t const channels = channel_stats_benchmark_channels[s];
+
+        if( channels > IOT_CHANNEL_STATS_MAX_CHANNELS )
+        {
+            break;
+        }
+
+        (void)iot_channel_stats_init( &bench->soa, channels );
+        start = IOT_CYCLE_COUNT();
+        for( uint32_t t = 0; t < CHANNEL_STATS_BENCHMARK_TICKS; t++ )
+        {
+            iot_channel_stats_add( &bench->soa, 0, channels, bench->samples[t % CHANNEL_STATS_BENCHMARK_ROWS] );
+        }
+        soa_cycles[s] = ( IOT_CYCLE_COUNT() - start ) / CHANNEL_STATS_BENCHMARK_TICKS;
+
+        for( uint16_t i = 0; i < channels; i++ )
+        {
+            iot_running_stats_reset( &bench->aos[i] );
+        }
+        start = IOT_CYCLE_COUNT();
+        for( uint32_t t = 0; t < CHANNEL_STATS_BENCHMARK_TICKS; t++ )
+        {
+            for( uint16_t i = 0; i < channels; i++ )
+            {
+                iot_running_stats_add( &bench->aos[i], bench->samples[t % CHANNEL_STATS_BENCHMARK_ROWS][i] );
+            }
+        }
+        aos_cycles[s] = ( IOT_CYCLE_COUNT() - start ) / CHANNEL_STATS_BENCHMARK_TICKS;
+
+        start = IOT_CYCLE_COUNT();
+        for( uint32_t t = 0; t < CHANNEL_STATS_BENCHMARK_TICKS; t++ )
+        {
+            match = iot_channel_stats_summary( &bench->soa, &min, &max, &mean ) && match;
+        }
+        summary_cycles[s] = ( IOT_CYCLE_COUNT() - start ) / CHANNEL_STATS_BENCHMARK_TICKS;
+
+        for( uint16_t i = 0; i < channels; i++ )
+        {
+            match = match && ( bench->soa.counts[i] == bench->aos[i].count ) &&
+                    ( bench->soa.mins[i] == bench->aos[i].min ) && ( bench->soa.maxes[i] == bench->aos[i].max );
+        }
+        sizes++;
+    }
+
+    free( bench );
+
+    IOT_RETURN_IF_FAILED( az_json_writer_init( &jw, buffer, NULL ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_begin_object( &jw ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("mode") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_string( &jw,
+                          IOT_STATS_FIXED_POINT ? AZ_SPAN_FROM_STR("q16") : AZ_SPAN_FROM_STR("double") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("ticks") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_int32( &jw, CHANNEL_STATS_BENCHMARK_TICKS ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("channels") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_begin_array( &jw ) );
+    for( uint8_t s = 0; s < sizes; s++ )
+    {
+        IOT_RETURN_IF_FAILED( az_json_writer_append_int32( &jw, channel_stats_benchmark_channels[s] ) );
+    }
+    IOT_RETURN_IF_FAILED( az_json_writer_append_end_array( &jw ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("soaCycles") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_begin_array( &jw ) );
+    for( uint8_t s = 0; s < sizes; s++ )
+    {
+        IOT_RETURN_IF_FAILED( az_json_writer_append_int32( &jw, (int32_t)soa_cycles[s] ) );
+    }
+    IOT_RETURN_IF_FAILED( az_json_writer_append_end_array( &jw ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("aosCycles") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_begin_array( &jw ) );
+    for( uint8_t s = 0; s < sizes; s++ )
+    {
+        IOT_RETURN_IF_FAILED( az_json_writer_append_int32( &jw, (int32_t)aos_cycles[s] ) );
+    }
+    IOT_RETURN_IF_FAILED( az_json_writer_append_end_array( &jw ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("summaryCycles") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_begin_array( &jw ) );
+    for( uint8_t s = 0; s < sizes; s++ )
+    {
+        IOT_RETURN_IF_FAILED( az_json_writer_append_int32( &jw, (int32_t)summary_cycles[s] ) );
+    }
+    IOT_RETURN_IF_FAILED( az_json_writer_append_end_array( &jw ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("match") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_bool( &jw, match ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_end_object( &jw ) );
+
+    *out_report = az_json_writer_get_bytes_used_in_destination( &jw );
+    return AZ_OK;
+}
+
+/* [] END OF FILE */
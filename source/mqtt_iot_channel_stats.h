@@ -0,0 +1,154 @@
+/******************************************************************************
+ * File Name: mqtt_iot_channel_stats.h
+ *
+ * Description: This file contains the declarations of the multi-channel
+ * statistics that keep the latest value, minimum, maximum and sum of many
+ * sensor channels as structure of arrays, updated by vectorizable kernels.
+ *
+ ********************************************************************************
+ * Copyright 2024, Cypress Semiconductor Corporation (an Infineon company) or
+ * an affiliate of Cypress Semiconductor Corporation.  All rights reserved.
+ *
+ * This software, including source code, documentation and related
+ * materials ("Software") is owned by Cypress Semiconductor Corporation
+ * or one of its affiliates ("Cypress") and is protected by and subject to
+ * worldwide patent protection (United States and foreign),
+ * United States copyright laws and international treaty provisions.
+ * Therefore, you may use this Software only as provided in the license
+ * agreement accompanying the software package from which you
+ * obtained this Software ("EULA").
+ * If no EULA applies, Cypress hereby grants you a personal, non-exclusive,
+ * non-transferable license to copy, modify, and compile the Software
+ * source code solely for use in connection with Cypress's
+ * integrated circuit products.  Any reproduction, modification, translation,
+ * compilation, or representation of this Software except as specified
+ * above is prohibited without the express written permission of Cypress.
+ *
+ * Disclaimer: THIS SOFTWARE IS PROVIDED AS-IS, WITH NO WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING, BUT NOT LIMITED TO, NONINFRINGEMENT, IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. Cypress
+ * reserves the right to make changes to the Software without notice. Cypress
+ * does not assume any liability arising out of the application or use of the
+ * Software or any product or circuit described in the Software. Cypress does
+ * not authorize its products for use in any products where a malfunction or
+ * failure of the Cypress product may reasonably be expected to result in
+ * significant property damage, injury or death ("High Risk Product"). By
+ * including Cypress's product in a High Risk Product, the manufacturer
+ * of such system or application assumes all risk of such use and in doing
+ * so agrees to indemnify Cypress against all liability.
+ *******************************************************************************/
+
+#ifndef MQTT_IOT_CHANNEL_STATS_H_
+#define MQTT_IOT_CHANNEL_STATS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <az_core.h>
+
+#include "mqtt_iot_window_stats.h"
+
+/*******************************************************************************
+ * Macros
+ ********************************************************************************/
+/* Channels of one iot_channel_stats, e.g. the thermostats behind a gateway */
+#ifndef IOT_CHANNEL_STATS_MAX_CHANNELS
+#define IOT_CHANNEL_STATS_MAX_CHANNELS          (256)
+#endif
+
+/*******************************************************************************
+ * Global Variables
+ ********************************************************************************/
+/* Exact sum of the samples of a channel, in the representation selected by
+ * IOT_STATS_FIXED_POINT.
+ */
+#if IOT_STATS_FIXED_POINT
+typedef int64_t                     iot_channel_sum;
+#else
+typedef double                      iot_channel_sum;
+#endif
+
+/* Statistics of many channels as one array per field, so that a kernel
+ * walks each field with unit stride, and the compiler can keep several
+ * channels in one SSE, AVX or NEON register on a host. The minimum and
+ * maximum of a channel without samples are the largest and the smallest
+ * value, so the kernels need no test of the count.
+ */
+typedef struct
+{
+    uint16_t            channels;       /* Channels in use */
+    iot_stats_value     values[IOT_CHANNEL_STATS_MAX_CHANNELS];     /* Latest sample */
+    iot_stats_value     mins[IOT_CHANNEL_STATS_MAX_CHANNELS];
+    iot_stats_value     maxes[IOT_CHANNEL_STATS_MAX_CHANNELS];
+    iot_channel_sum     sums[IOT_CHANNEL_STATS_MAX_CHANNELS];
+    uint32_t            counts[IOT_CHANNEL_STATS_MAX_CHANNELS];
+} iot_channel_stats;
+
+/******************************************************************************
+ * Function Prototypes
+ *******************************************************************************/
+/*
+ * @brief Clears the statistics of every channel.
+ * @param[out] stats Channel statistics.
+ * @param[in] channels Number of channels, 1 to IOT_CHANNEL_STATS_MAX_CHANNELS.
+ * @return false if \p channels is out of range.
+ */
+bool iot_channel_stats_init(iot_channel_stats* stats, uint16_t channels);
+
+/*
+ * @brief Clears the statistics of one channel, e.g. when its sensor is
+ * replaced.
+ * @param[in,out] stats Channel statistics.
+ * @param[in] channel Channel index.
+ */
+void iot_channel_stats_reset_channel(iot_channel_stats* stats, uint16_t channel);
+
+/*
+ * @brief Adds one sample to each of the channels \p first to
+ * \p first + \p count - 1, typically all channels of an update tick.
+ * Samples out of the channels in use are ignored.
+ * @param[in,out] stats Channel statistics.
+ * @param[in] first Index of the first channel.
+ * @param[in] count Number of channels.
+ * @param[in] samples One sample per channel, \p samples[0] is of \p first.
+ */
+void iot_channel_stats_add(iot_channel_stats* stats, uint16_t first, uint16_t count,
+        iot_stats_value const samples[]);
+
+/*
+ * @brief Computes the mean of every channel.
+ * @param[in] stats Channel statistics.
+ * @param[out] out_means One mean per channel in use, 0 for a channel
+ * without samples.
+ */
+void iot_channel_stats_means(iot_channel_stats const* stats, iot_stats_value out_means[]);
+
+/*
+ * @brief Combines all channels: the smallest minimum, the largest maximum,
+ * and the mean of every sample of every channel.
+ * @param[in] stats Channel statistics.
+ * @param[out] out_min Smallest sample.
+ * @param[out] out_max Largest sample.
+ * @param[out] out_mean Mean of the samples.
+ * @return false if no channel has samples.
+ */
+bool iot_channel_stats_summary(iot_channel_stats const* stats, iot_stats_value* out_min,
+        iot_stats_value* out_max, iot_stats_value* out_mean);
+
+/*
+ * @brief Measures the CPU cycles of one update tick of 8 to 256 channels,
+ * with iot_channel_stats and with an array of iot_running_stats, and of
+ * iot_channel_stats_summary(), and writes the report, e.g.
+ * {"mode":"q16","ticks":100,"channels":[8,16,32,64,128,256],
+ * "soaCycles":[...],"aosCycles":[...],"summaryCycles":[...],"match":true}.
+ * match tells whether both layouts end with the same count, minimum and
+ * maximum in every channel.
+ * @param[in] buffer Destination buffer.
+ * @param[out] out_report JSON text written to \p buffer.
+ * @return AZ_OK, AZ_ERROR_NOT_ENOUGH_SPACE or AZ_ERROR_OUT_OF_MEMORY.
+ */
+az_result iot_channel_stats_build_benchmark_report(az_span buffer, az_span* out_report);
+
+#endif /* MQTT_IOT_CHANNEL_STATS_H_ */
+
+/* [] END OF FILE */
@@ -121,6 +121,34 @@ bool get_az_span(az_span* out_span, char const* const error_message, ...);
     }                                                                                      \
   } while (0)
 
+/* Returns the az_result of exp from the calling function if it failed */
+#define IOT_RETURN_IF_FAILED(exp)    \
+  do                                 \
+  {                                  \
+    az_result const _rc = (exp);     \
+    if (az_result_failed(_rc))       \
+    {                                \
+      return _rc;                    \
+    }                                \
+  } while (0)
+
+/* Benchmarks */
+/* Cycle counter of the diagnostic benchmarks, the DWT cycle counter of the
+ * core. Define IOT_CYCLE_COUNT() as a clock of the host, e.g. __rdtsc(), to
+ * run the benchmarks off target. */
+#ifndef IOT_CYCLE_COUNT
+#include "cyhal.h"
+#define IOT_CYCLE_COUNT() (DWT->CYCCNT)
+#define IOT_CYCLE_COUNTER_START()                   \
+  do                                                \
+  {                                                 \
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk; \
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;            \
+  } while (0)
+#else
+#define IOT_CYCLE_COUNTER_START()
+#endif
+
 /***********************************************************
 * Global Variables
 ************************************************************/
@@ -0,0 +1,412 @@
+/******************************************************************************
+ * File Name: mqtt_iot_dedup_cache.c
+ *
+ * Description: This file contains the bounded cache of recently processed message IDs
+ * used to suppress duplicate deliveries of QoS1 messages.
+ *
+ ********************************************************************************
+ * Copyright 2024, Cypress Semiconductor Corporation (an Infineon company) or
+ * an affiliate of Cypress Semiconductor Corporation.  All rights reserved.
+ *
+ * This software, including source code, documentation and related
+ * materials ("Software") is owned by Cypress Semiconductor Corporation
+ * or one of its affiliates ("Cypress") and is protected by and subject to
+ * worldwide patent protection (United States and foreign),
+ * United States copyright laws and international treaty provisions.
+ * Therefore, you may use this Software only as provided in the license
+ * agreement accompanying the software package from which you
+ * obtained this Software ("EULA").
+ * If no EULA applies, Cypress hereby grants you a personal, non-exclusive,
+ * non-transferable license to copy, modify, and compile the Software
+ * source code solely for use in connection with Cypress's
+ * integrated circuit products.  Any reproduction, modification, translation,
+ * compilation, or representation of this Software except as specified
+ * above is prohibited without the express written permission of Cypress.
+ *
+ * Disclaimer: THIS SOFTWARE IS PROVIDED AS-IS, WITH NO WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING, BUT NOT LIMITED TO, NONINFRINGEMENT, IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. Cypress
+ * reserves the right to make changes to the Software without notice. Cypress
+ * does not assume any liability arising out of the application or use of the
+ * Software or any product or circuit described in the Software. Cypress does
+ * not authorize its products for use in any products where a malfunction or
+ * failure of the Cypress product may reasonably be expected to result in
+ * significant property damage, injury or death ("High Risk Product"). By
+ * including Cypress's product in a High Risk Product, the manufacturer
+ * of such system or application assumes all risk of such use and in doing
+ * so agrees to indemnify Cypress against all liability.
+ *******************************************************************************/
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "azure_common.h"
+#include "mqtt_iot_dedup_cache.h"
+
+/*******************************************************************************
+ * Macros
+ ********************************************************************************/
+#define FNV1A_64_OFFSET_BASIS               (0xcbf29ce484222325ULL)
+#define FNV1A_64_PRIME                      (0x00000100000001b3ULL)
+
+#define DEDUP_CACHE_SLOT_MASK               (IOT_DEDUP_CACHE_SLOTS - 1)
+
+/******************************************************************************
+ * Function Name: hash_id
+ ******************************************************************************
+ * Summary:
+ *  Computes the 64-bit FNV-1a hash of a message ID.
+ *
+ * Parameters:
+ *  id: Message ID.
+ *
+ *  id_len: Length of the message ID.
+ *
+ * Return:
+ *  uint64_t: Hash of the message ID.
+ *
+ ******************************************************************************/
+static uint64_t hash_id(uint8_t const* id, size_t id_len)
+{
+    uint64_t hash = FNV1A_64_OFFSET_BASIS;
+
+    for( size_t i = 0; i < id_len; i++ )
+    {
+        hash ^= id[i];
+        hash *= FNV1A_64_PRIME;
+    }
+
+    return hash;
+}
+
+/******************************************************************************
+ * Function Name: home_slot
+ ******************************************************************************
+ * Summary:
+ *  Returns the first hash table slot probed for a key.
+ *
+ * Parameters:
+ *  key: Hash of the message ID.
+ *
+ * Return:
+ *  uint32_t: Slot index.
+ *
+ ******************************************************************************/
+static uint32_t home_slot(uint64_t key)
+{
+    return (uint32_t)( key ^ ( key >> 32 ) ) & DEDUP_CACHE_SLOT_MASK;
+}
+
+/******************************************************************************
+ * Function Name: probe
+ ******************************************************************************
+ * Summary:
+ *  Linear probe for a key.
+ *
+ * Parameters:
+ *  cache: Cache.
+ *
+ *  key: Hash of the message ID.
+ *
+ *  out_found: Set to true if the key is in the cache.
+ *
+ * Return:
+ *  uint32_t: Slot holding the key, or the empty slot ending the probe.
+ *
+ ******************************************************************************/
+static uint32_t probe(iot_dedup_cache const* cache, uint64_t key, bool* out_found)
+{
+    uint32_t slot = home_slot( key );
+
+    /* The table is at most half full, so an empty slot is always reached. */
+    while( cache->slots[slot] != 0 )
+    {
+        if( cache->entries[cache->slots[slot] - 1].key == key )
+        {
+            *out_found = true;
+            return slot;
+        }
+        slot = ( slot + 1 ) & DEDUP_CACHE_SLOT_MASK;
+    }
+
+    *out_found = false;
+    return slot;
+}
+
+/******************************************************************************
+ * Function Name: remove_slot
+ ******************************************************************************
+ * Summary:
+ *  Empties a slot and shifts the following slots of the probe sequence back,
+ *  so that no tombstones are needed.
+ *
+ * Parameters:
+ *  cache: Cache.
+ *
+ *  slot: Slot to empty.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+static void remove_slot(iot_dedup_cache* cache, uint32_t slot)
+{
+    uint32_t hole = slot;
+    uint32_t next = ( slot + 1 ) & DEDUP_CACHE_SLOT_MASK;
+
+    cache->slots[hole] = 0;
+    while( cache->slots[next] != 0 )
+    {
+        uint32_t home = home_slot( cache->entries[cache->slots[next] - 1].key );
+
+        /* Move the key into the hole unless its home lies between them. */
+        if( ( ( next - home ) & DEDUP_CACHE_SLOT_MASK ) >= ( ( next - hole ) & DEDUP_CACHE_SLOT_MASK ) )
+        {
+            cache->slots[hole] = cache->slots[next];
+            cache->slots[next] = 0;
+            hole = next;
+        }
+        next = ( next + 1 ) & DEDUP_CACHE_SLOT_MASK;
+    }
+}
+
+/******************************************************************************
+ * Function Name: insert_key
+ ******************************************************************************
+ * Summary:
+ *  Adds a key that is not in the cache, evicting the least recently seen key
+ *  when the cache is full.
+ *
+ * Parameters:
+ *  cache: Cache.
+ *
+ *  key: Hash of the message ID.
+ *
+ *  last_seen: Value of the cache clock when the key was seen.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+static void insert_key(iot_dedup_cache* cache, uint64_t key, uint32_t last_seen)
+{
+    uint8_t index;
+    bool found;
+
+    if( cache->count < IOT_DEDUP_CACHE_CAPACITY )
+    {
+        index = cache->count++;
+    }
+    else
+    {
+        index = 0;
+        for( uint8_t i = 1; i < IOT_DEDUP_CACHE_CAPACITY; i++ )
+        {
+            if( cache->entries[i].last_seen < cache->entries[index].last_seen )
+            {
+                index = i;
+            }
+        }
+        remove_slot( cache, probe( cache, cache->entries[index].key, &found ) );
+        cache->evictions++;
+    }
+
+    cache->entries[index].key = key;
+    cache->entries[index].last_seen = last_seen;
+    cache->slots[probe( cache, key, &found )] = index + 1;
+}
+
+/******************************************************************************
+ * Function Name: iot_dedup_cache_init
+ ******************************************************************************
+ * Summary:
+ *  Empties the cache and clears its counters.
+ *
+ * Parameters:
+ *  cache: Cache to initialize.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_dedup_cache_init(iot_dedup_cache* cache)
+{
+    memset( cache, 0x00, sizeof(iot_dedup_cache) );
+}
+
+/******************************************************************************
+ * Function Name: iot_dedup_cache_contains
+ ******************************************************************************
+ * Summary:
+ *  Looks up a message ID and marks it as recently seen if it is present.
+ *
+ * Parameters:
+ *  cache: Cache.
+ *
+ *  id: Message ID.
+ *
+ *  id_len: Length of the message ID.
+ *
+ * Return:
+ *  bool: true if the message ID is a duplicate.
+ *
+ ******************************************************************************/
+bool iot_dedup_cache_contains(iot_dedup_cache* cache, uint8_t const* id, size_t id_len)
+{
+    uint64_t key = hash_id( id, id_len );
+    uint32_t slot;
+    bool found;
+
+    cache->lookups++;
+
+    slot = probe( cache, key, &found );
+    if( found )
+    {
+        cache->clock++;
+        cache->entries[cache->slots[slot] - 1].last_seen = cache->clock;
+        cache->hits++;
+    }
+
+    return found;
+}
+
+/******************************************************************************
+ * Function Name: iot_dedup_cache_insert
+ ******************************************************************************
+ * Summary:
+ *  Remembers a message ID, evicting the least recently seen ID if the cache
+ *  is full. An ID that is already present is only marked as recently seen
+ *  and does not make the cache dirty.
+ *
+ * Parameters:
+ *  cache: Cache.
+ *
+ *  id: Message ID.
+ *
+ *  id_len: Length of the message ID.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_dedup_cache_insert(iot_dedup_cache* cache, uint8_t const* id, size_t id_len)
+{
+    uint64_t key = hash_id( id, id_len );
+    uint32_t slot;
+    bool found;
+
+    cache->clock++;
+
+    slot = probe( cache, key, &found );
+    if( found )
+    {
+        cache->entries[cache->slots[slot] - 1].last_seen = cache->clock;
+        return;
+    }
+
+    insert_key( cache, key, cache->clock );
+    cache->dirty = true;
+}
+
+/******************************************************************************
+ * Function Name: iot_dedup_cache_log_stats
+ ******************************************************************************
+ * Summary:
+ *  Prints the lookup, hit and eviction counters and the hit rate.
+ *
+ * Parameters:
+ *  name: Printable name of the cache.
+ *
+ *  cache: Cache.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_dedup_cache_log_stats(char const* name, iot_dedup_cache const* cache)
+{
+    TEST_INFO(( "\r\n%s dedup cache lookups: %lu, duplicates: %lu (%lu%%), evictions: %lu\n",
+            name,
+            (unsigned long)cache->lookups,
+            (unsigned long)cache->hits,
+            (unsigned long)( ( cache->lookups == 0 ) ? 0 : ( cache->hits * 100UL ) / cache->lookups ),
+            (unsigned long)cache->evictions ));
+}
+
+#ifdef CY_TFM_PSA_SUPPORTED
+/******************************************************************************
+ * Function Name: iot_dedup_cache_load
+ ******************************************************************************
+ * Summary:
+ *  Restores the message IDs saved in protected storage.
+ *
+ * Parameters:
+ *  cache: Initialized, empty cache.
+ *
+ *  uid: Protected storage UID.
+ *
+ * Return:
+ *  psa_status_t: PSA_SUCCESS, or the protected storage error.
+ *
+ ******************************************************************************/
+psa_status_t iot_dedup_cache_load(iot_dedup_cache* cache, psa_storage_uid_t uid)
+{
+    iot_dedup_entry saved[IOT_DEDUP_CACHE_CAPACITY];
+    size_t read_len = 0;
+    psa_status_t status;
+
+    status = psa_ps_get( uid, 0, sizeof(saved), saved, &read_len );
+    if( status != PSA_SUCCESS )
+    {
+        return status;
+    }
+
+    for( size_t i = 0; i < ( read_len / sizeof(iot_dedup_entry) ); i++ )
+    {
+        insert_key( cache, saved[i].key, saved[i].last_seen );
+        if( saved[i].last_seen > cache->clock )
+        {
+            cache->clock = saved[i].last_seen;
+        }
+    }
+    cache->dirty = false;
+
+    return PSA_SUCCESS;
+}
+
+/******************************************************************************
+ * Function Name: iot_dedup_cache_save
+ ******************************************************************************
+ * Summary:
+ *  Saves the message IDs in protected storage if they changed.
+ *
+ * Parameters:
+ *  cache: Cache.
+ *
+ *  uid: Protected storage UID.
+ *
+ * Return:
+ *  psa_status_t: PSA_SUCCESS, or the protected storage error.
+ *
+ ******************************************************************************/
+psa_status_t iot_dedup_cache_save(iot_dedup_cache* cache, psa_storage_uid_t uid)
+{
+    psa_status_t status;
+
+    if( !cache->dirty || ( cache->count == 0 ) )
+    {
+        return PSA_SUCCESS;
+    }
+
+    status = psa_ps_set( uid, cache->count * sizeof(iot_dedup_entry), cache->entries, PSA_STORAGE_FLAG_NONE );
+    if( status == PSA_SUCCESS )
+    {
+        cache->dirty = false;
+    }
+
+    return status;
+}
+#endif /* CY_TFM_PSA_SUPPORTED */
+
+/* [] END OF FILE */
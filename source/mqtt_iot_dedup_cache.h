@@ -0,0 +1,149 @@
+/******************************************************************************
+ * File Name: mqtt_iot_dedup_cache.h
+ *
+ * Description: Contains the interfaces of the bounded cache of recently processed
+ * message IDs used to suppress duplicate deliveries of QoS1 messages.
+ *
+ ********************************************************************************
+ * Copyright 2024, Cypress Semiconductor Corporation (an Infineon company) or
+ * an affiliate of Cypress Semiconductor Corporation.  All rights reserved.
+ *
+ * This software, including source code, documentation and related
+ * materials ("Software") is owned by Cypress Semiconductor Corporation
+ * or one of its affiliates ("Cypress") and is protected by and subject to
+ * worldwide patent protection (United States and foreign),
+ * United States copyright laws and international treaty provisions.
+ * Therefore, you may use this Software only as provided in the license
+ * agreement accompanying the software package from which you
+ * obtained this Software ("EULA").
+ * If no EULA applies, Cypress hereby grants you a personal, non-exclusive,
+ * non-transferable license to copy, modify, and compile the Software
+ * source code solely for use in connection with Cypress's
+ * integrated circuit products.  Any reproduction, modification, translation,
+ * compilation, or representation of this Software except as specified
+ * above is prohibited without the express written permission of Cypress.
+ *
+ * Disclaimer: THIS SOFTWARE IS PROVIDED AS-IS, WITH NO WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING, BUT NOT LIMITED TO, NONINFRINGEMENT, IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. Cypress
+ * reserves the right to make changes to the Software without notice. Cypress
+ * does not assume any liability arising out of the application or use of the
+ * Software or any product or circuit described in the Software. Cypress does
+ * not authorize its products for use in any products where a malfunction or
+ * failure of the Cypress product may reasonably be expected to result in
+ * significant property damage, injury or death ("High Risk Product"). By
+ * including Cypress's product in a High Risk Product, the manufacturer
+ * of such system or application assumes all risk of such use and in doing
+ * so agrees to indemnify Cypress against all liability.
+ *******************************************************************************/
+
+
+#ifndef MQTT_IOT_DEDUP_CACHE_H_
+#define MQTT_IOT_DEDUP_CACHE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef CY_TFM_PSA_SUPPORTED
+#include "psa/protected_storage.h"
+#endif
+
+/*******************************************************************************
+ * Macros
+ ********************************************************************************/
+/* Number of message IDs remembered, the least recently seen ID is evicted */
+#define IOT_DEDUP_CACHE_CAPACITY                (16)
+
+/* Hash table slots, a power of two at least twice the capacity */
+#define IOT_DEDUP_CACHE_SLOTS                   (32)
+
+/*******************************************************************************
+ * Global Variables
+ ********************************************************************************/
+/* Remembered message ID, stored as its 64-bit FNV-1a hash */
+typedef struct
+{
+    uint64_t    key;
+    uint32_t    last_seen;
+} iot_dedup_entry;
+
+/* Open addressing hash set of message IDs with LRU eviction */
+typedef struct
+{
+    iot_dedup_entry entries[IOT_DEDUP_CACHE_CAPACITY];
+    uint8_t         slots[IOT_DEDUP_CACHE_SLOTS];   /* Entry index + 1, 0 if empty */
+    uint8_t         count;
+    uint32_t        clock;
+    uint32_t        lookups;
+    uint32_t        hits;
+    uint32_t        evictions;
+    bool            dirty;                          /* ID added since the last load or save */
+} iot_dedup_cache;
+
+/******************************************************************************
+ * Function Prototypes
+ *******************************************************************************/
+/*
+ * @brief Empties the cache and clears its counters.
+ *
+ * @param[out] cache Cache to initialize.
+ */
+void iot_dedup_cache_init(iot_dedup_cache* cache);
+
+/*
+ * @brief Looks up a message ID.
+ *
+ * @param[in] cache Cache.
+ * @param[in] id Message ID.
+ * @param[in] id_len Length of \p id.
+ *
+ * @return true if the ID is in the cache, i.e. the message is a duplicate
+ * delivery.
+ */
+bool iot_dedup_cache_contains(iot_dedup_cache* cache, uint8_t const* id, size_t id_len);
+
+/*
+ * @brief Remembers a message ID. Call it once the message was processed, so
+ * that a redelivery after a failed or interrupted attempt is processed again.
+ *
+ * @param[in] cache Cache.
+ * @param[in] id Message ID.
+ * @param[in] id_len Length of \p id.
+ */
+void iot_dedup_cache_insert(iot_dedup_cache* cache, uint8_t const* id, size_t id_len);
+
+/*
+ * @brief Prints the lookup, hit and eviction counters and the hit rate.
+ *
+ * @param[in] name Printable name of the cache.
+ * @param[in] cache Cache.
+ */
+void iot_dedup_cache_log_stats(char const* name, iot_dedup_cache const* cache);
+
+#ifdef CY_TFM_PSA_SUPPORTED
+/*
+ * @brief Restores the message IDs saved by iot_dedup_cache_save().
+ *
+ * @param[in] cache Initialized, empty cache.
+ * @param[in] uid Protected storage UID.
+ *
+ * @return PSA_SUCCESS, or the protected storage error.
+ */
+psa_status_t iot_dedup_cache_load(iot_dedup_cache* cache, psa_storage_uid_t uid);
+
+/*
+ * @brief Saves the message IDs in protected storage if they changed. Writes
+ * flash, so limit how often it is called, e.g. to one save per interval.
+ *
+ * @param[in] cache Cache.
+ * @param[in] uid Protected storage UID.
+ *
+ * @return PSA_SUCCESS, or the protected storage error.
+ */
+psa_status_t iot_dedup_cache_save(iot_dedup_cache* cache, psa_storage_uid_t uid);
+#endif /* CY_TFM_PSA_SUPPORTED */
+
+#endif /* MQTT_IOT_DEDUP_CACHE_H_ */
+
+/* [] END OF FILE */
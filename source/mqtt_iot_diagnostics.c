@@ -0,0 +1,652 @@
+/******************************************************************************
+ * File Name: mqtt_iot_diagnostics.c
+ *
+ * Description: This file contains the runtime counters and the JSON report
+ * builders behind the diagnostic direct methods. Reports are written into
+ * the caller's buffer, and task snapshots into static storage.
+ *
+ ********************************************************************************
+ * Copyright 2024, Cypress Semiconductor Corporation (an Infineon company) or
+ * an affiliate of Cypress Semiconductor Corporation.  All rights reserved.
+ *
+ * This software, including source code, documentation and related
+ * materials ("Software") is owned by Cypress Semiconductor Corporation
+ * or one of its affiliates ("Cypress") and is protected by and subject to
+ * worldwide patent protection (United States and foreign),
+ * United States copyright laws and international treaty provisions.
+ * Therefore, you may use this Software only as provided in the license
+ * agreement accompanying the software package from which you
+ * obtained this Software ("EULA").
+ * If no EULA applies, Cypress hereby grants you a personal, non-exclusive,
+ * non-transferable license to copy, modify, and compile the Software
+ * source code solely for use in connection with Cypress's
+ * integrated circuit products.  Any reproduction, modification, translation,
+ * compilation, or representation of this Software except as specified
+ * above is prohibited without the express written permission of Cypress.
+ *
+ * Disclaimer: THIS SOFTWARE IS PROVIDED AS-IS, WITH NO WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING, BUT NOT LIMITED TO, NONINFRINGEMENT, IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. Cypress
+ * reserves the right to make changes to the Software without notice. Cypress
+ * does not assume any liability arising out of the application or use of the
+ * Software or any product or circuit described in the Software. Cypress does
+ * not authorize its products for use in any products where a malfunction or
+ * failure of the Cypress product may reasonably be expected to result in
+ * significant property damage, injury or death ("High Risk Product"). By
+ * including Cypress's product in a High Risk Product, the manufacturer
+ * of such system or application assumes all risk of such use and in doing
+ * so agrees to indemnify Cypress against all liability.
+ *******************************************************************************/
+
+#include <malloc.h>
+#include <string.h>
+
+#include "mqtt_iot_common.h"
+#include "mqtt_iot_diagnostics.h"
+
+/*******************************************************************************
+ * Macros
+ ********************************************************************************/
+#define PERCENT                             (100)
+#define MSEC_PER_SEC                        (1000)
+
+/* The run time counter counts 2^DIAG_RUN_TIME_SHIFT CPU cycles, about 10 us
+ * at 100 MHz. The 32-bit task counters of the kernel then wrap after about
+ * 12 hours at 100 MHz.
+ */
+#define DIAG_RUN_TIME_SHIFT                 (10)
+
+/* newlib of the Arm toolchain provides mallinfo(). glibc 2.33 and later
+ * deprecate it for mallinfo2(), which has the same fields as size_t, so host
+ * builds use that.
+ */
+#if defined(__GLIBC__) && ( (__GLIBC__ > 2) || ((__GLIBC__ == 2) && (__GLIBC_MINOR__ >= 33)) )
+#define DIAG_MALLINFO                       mallinfo2
+#else
+#define DIAG_MALLINFO                       mallinfo
+#endif
+
+/*******************************************************************************
+ * Global Variables
+ ********************************************************************************/
+typedef struct
+{
+    TickType_t      start_tick;
+    uint32_t        connects;
+    uint32_t        connect_failures;
+    uint32_t        disconnects;
+    uint32_t        published;
+    uint32_t        publish_failures;
+    uint32_t        latency_count[IOT_DIAG_LATENCY_BUCKETS];
+    uint8_t         queue_count;
+    char const*     queue_name[IOT_DIAG_MAX_QUEUES];
+    QueueHandle_t   queue[IOT_DIAG_MAX_QUEUES];
+} iot_diag_state;
+
+static iot_diag_state diag;
+
+/* Upper bound of every latency bucket but the last */
+static uint16_t const latency_bucket_le_msec[IOT_DIAG_LATENCY_BUCKETS - 1] =
+{
+    10, 25, 50, 100, 250, 500, 1000, 2500
+};
+
+/* Task snapshot, static to keep the reports off the method task stack */
+static TaskStatus_t diag_task_status[IOT_DIAG_MAX_TASKS];
+
+#if ( configGENERATE_RUN_TIME_STATS == 1 )
+/* Run time counters of the previous CPU report */
+static TaskHandle_t cpu_prev_handle[IOT_DIAG_MAX_TASKS];
+static uint32_t     cpu_prev_run_time[IOT_DIAG_MAX_TASKS];
+static uint32_t     cpu_prev_total;
+
+/* Cycle counter extended to 64 bits */
+static uint64_t     run_time_cycles;
+static uint32_t     run_time_prev_cyccnt;
+#endif
+
+#if ( configGENERATE_RUN_TIME_STATS == 1 )
+/******************************************************************************
+ * Function Name: update_run_time_cycles
+ ******************************************************************************
+ * Summary:
+ *  Adds the cycles counted since the previous call to the 64-bit cycle
+ *  count. Must be called at least once per wrap of the 32-bit DWT cycle
+ *  counter, about 28 s at 150 MHz, which the tick hook guarantees. Masks interrupts, as it runs from
+ *  the tick interrupt, the context switch and tasks.
+ *
+ * Parameters:
+ *  void
+ *
+ * Return:
+ *  uint64_t: Cycles since iot_diag_run_time_counter_init().
+ *
+ ******************************************************************************/
+static uint64_t update_run_time_cycles(void)
+{
+    UBaseType_t saved_mask = taskENTER_CRITICAL_FROM_ISR();
+    uint32_t const cyccnt = (uint32_t)IOT_CYCLE_COUNT();
+    uint64_t cycles;
+
+    run_time_cycles += (uint32_t)( cyccnt - run_time_prev_cyccnt );
+    run_time_prev_cyccnt = cyccnt;
+    cycles = run_time_cycles;
+    taskEXIT_CRITICAL_FROM_ISR( saved_mask );
+
+    return cycles;
+}
+
+/******************************************************************************
+ * Function Name: iot_diag_run_time_counter_init
+ ******************************************************************************
+ * Summary:
+ *  Starts the DWT cycle counter. Called by the kernel through
+ *  portCONFIGURE_TIMER_FOR_RUN_TIME_STATS() when the scheduler starts.
+ *
+ * Parameters:
+ *  void
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_diag_run_time_counter_init(void)
+{
+    IOT_CYCLE_COUNTER_START();
+    run_time_cycles = 0;
+    run_time_prev_cyccnt = (uint32_t)IOT_CYCLE_COUNT();
+}
+
+/******************************************************************************
+ * Function Name: iot_diag_run_time_counter
+ ******************************************************************************
+ * Summary:
+ *  Run time clock of the kernel, read through
+ *  portGET_RUN_TIME_COUNTER_VALUE().
+ *
+ * Parameters:
+ *  void
+ *
+ * Return:
+ *  uint32_t: 64-bit cycle count divided by 2^DIAG_RUN_TIME_SHIFT.
+ *
+ ******************************************************************************/
+uint32_t iot_diag_run_time_counter(void)
+{
+    return (uint32_t)( update_run_time_cycles() >> DIAG_RUN_TIME_SHIFT );
+}
+
+/******************************************************************************
+ * Function Name: vApplicationTickHook
+ ******************************************************************************
+ * Summary:
+ *  Kernel tick hook. Samples the DWT cycle counter every tick, so that no
+ *  wrap of it is missed while no context switch reads the run time clock.
+ *
+ * Parameters:
+ *  void
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void vApplicationTickHook(void)
+{
+    (void)update_run_time_cycles();
+}
+#endif /* configGENERATE_RUN_TIME_STATS */
+
+/******************************************************************************
+ * Function Name: iot_diag_init
+ ******************************************************************************
+ * Summary:
+ *  Clears the counters and the queue registrations.
+ *
+ * Parameters:
+ *  void
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_diag_init(void)
+{
+    memset( &diag, 0x00, sizeof(diag) );
+    diag.start_tick = xTaskGetTickCount();
+}
+
+/******************************************************************************
+ * Function Name: iot_diag_register_queue
+ ******************************************************************************
+ * Summary:
+ *  Registers a queue or semaphore whose depth is reported.
+ *
+ * Parameters:
+ *  name: Printable name of the queue.
+ *
+ *  queue: Queue or semaphore handle.
+ *
+ * Return:
+ *  bool: false if no registration is left.
+ *
+ ******************************************************************************/
+bool iot_diag_register_queue(char const* name, QueueHandle_t queue)
+{
+    if( (diag.queue_count >= IOT_DIAG_MAX_QUEUES) || (queue == NULL) )
+    {
+        return false;
+    }
+
+    diag.queue_name[diag.queue_count] = name;
+    diag.queue[diag.queue_count] = queue;
+    diag.queue_count++;
+    return true;
+}
+
+/******************************************************************************
+ * Function Name: iot_diag_record_connect
+ ******************************************************************************
+ * Summary:
+ *  Counts a connection attempt.
+ *
+ * Parameters:
+ *  success: true if the client connected.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_diag_record_connect(bool success)
+{
+    taskENTER_CRITICAL();
+    if( success )
+    {
+        diag.connects++;
+    }
+    else
+    {
+        diag.connect_failures++;
+    }
+    taskEXIT_CRITICAL();
+}
+
+/******************************************************************************
+ * Function Name: iot_diag_record_disconnect
+ ******************************************************************************
+ * Summary:
+ *  Counts a disconnection.
+ *
+ * Parameters:
+ *  void
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_diag_record_disconnect(void)
+{
+    taskENTER_CRITICAL();
+    diag.disconnects++;
+    taskEXIT_CRITICAL();
+}
+
+/******************************************************************************
+ * Function Name: iot_diag_record_publish
+ ******************************************************************************
+ * Summary:
+ *  Counts a publish and adds its duration to the latency histogram.
+ *
+ * Parameters:
+ *  success: true if the publish succeeded.
+ *
+ *  latency_ticks: Time spent in the publish call.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_diag_record_publish(bool success, TickType_t latency_ticks)
+{
+    uint32_t latency_msec = (uint32_t)latency_ticks * portTICK_PERIOD_MS;
+    uint32_t bucket = 0;
+
+    while( (bucket < (IOT_DIAG_LATENCY_BUCKETS - 1)) && (latency_msec > latency_bucket_le_msec[bucket]) )
+    {
+        bucket++;
+    }
+
+    taskENTER_CRITICAL();
+    if( success )
+    {
+        diag.published++;
+        diag.latency_count[bucket]++;
+    }
+    else
+    {
+        diag.publish_failures++;
+    }
+    taskEXIT_CRITICAL();
+}
+
+/******************************************************************************
+ * Function Name: take_task_snapshot
+ ******************************************************************************
+ * Summary:
+ *  Fills the static task snapshot.
+ *
+ * Parameters:
+ *  out_total_run_time: Run time counter at the snapshot, can be NULL.
+ *
+ * Return:
+ *  UBaseType_t: Number of tasks, 0 if there are more than IOT_DIAG_MAX_TASKS.
+ *
+ ******************************************************************************/
+static UBaseType_t take_task_snapshot(uint32_t* out_total_run_time)
+{
+    return uxTaskGetSystemState( diag_task_status, IOT_DIAG_MAX_TASKS, out_total_run_time );
+}
+
+/******************************************************************************
+ * Function Name: iot_diag_build_heap_report
+ ******************************************************************************
+ * Summary:
+ *  Builds the heap report. The FreeRTOS heap is the C library heap
+ *  (heap_3), so the figures come from mallinfo(), or mallinfo2() on glibc.
+ *
+ * Parameters:
+ *  buffer: Destination buffer.
+ *
+ *  out_report: JSON text written to the buffer.
+ *
+ * Return:
+ *  az_result: AZ_OK, or AZ_ERROR_NOT_ENOUGH_SPACE.
+ *
+ ******************************************************************************/
+az_result iot_diag_build_heap_report(az_span buffer, az_span* out_report)
+{
+    struct DIAG_MALLINFO heap = DIAG_MALLINFO();
+    az_json_writer jw;
+
+    IOT_RETURN_IF_FAILED( az_json_writer_init( &jw, buffer, NULL ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_begin_object( &jw ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("arena") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_int32( &jw, (int32_t)heap.arena ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("used") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_int32( &jw, (int32_t)heap.uordblks ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("free") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_int32( &jw, (int32_t)heap.fordblks ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_end_object( &jw ) );
+
+    *out_report = az_json_writer_get_bytes_used_in_destination( &jw );
+    return AZ_OK;
+}
+
+/******************************************************************************
+ * Function Name: iot_diag_build_stack_report
+ ******************************************************************************
+ * Summary:
+ *  Builds the stack high water mark report.
+ *
+ * Parameters:
+ *  buffer: Destination buffer.
+ *
+ *  out_report: JSON text written to the buffer.
+ *
+ * Return:
+ *  az_result: AZ_OK, or an error if the buffer or the task snapshot is too
+ *  small.
+ *
+ ******************************************************************************/
+az_result iot_diag_build_stack_report(az_span buffer, az_span* out_report)
+{
+    UBaseType_t task_count = take_task_snapshot( NULL );
+    az_json_writer jw;
+
+    if( task_count == 0 )
+    {
+        return AZ_ERROR_NOT_ENOUGH_SPACE;
+    }
+
+    IOT_RETURN_IF_FAILED( az_json_writer_init( &jw, buffer, NULL ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_begin_object( &jw ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("tasks") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_begin_array( &jw ) );
+    for( UBaseType_t i = 0; i < task_count; i++ )
+    {
+        IOT_RETURN_IF_FAILED( az_json_writer_append_begin_object( &jw ) );
+        IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("name") ) );
+        IOT_RETURN_IF_FAILED( az_json_writer_append_string( &jw,
+                az_span_create_from_str( (char*)diag_task_status[i].pcTaskName ) ) );
+        IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("stackFree") ) );
+        IOT_RETURN_IF_FAILED( az_json_writer_append_int32( &jw,
+                (int32_t)(diag_task_status[i].usStackHighWaterMark * sizeof(StackType_t)) ) );
+        IOT_RETURN_IF_FAILED( az_json_writer_append_end_object( &jw ) );
+    }
+    IOT_RETURN_IF_FAILED( az_json_writer_append_end_array( &jw ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_end_object( &jw ) );
+
+    *out_report = az_json_writer_get_bytes_used_in_destination( &jw );
+    return AZ_OK;
+}
+
+#if ( configGENERATE_RUN_TIME_STATS == 1 )
+/******************************************************************************
+ * Function Name: iot_diag_build_cpu_report
+ ******************************************************************************
+ * Summary:
+ *  Builds the CPU usage report. The run time counters of the kernel are 32
+ *  bits and wrap after about 12 hours, so the usage is computed from the
+ *  difference to the previous report, which is exact as long as the reports
+ *  are less than one counter period apart. The first report covers the time
+ *  since the scheduler started.
+ *
+ * Parameters:
+ *  buffer: Destination buffer.
+ *
+ *  out_report: JSON text written to the buffer.
+ *
+ * Return:
+ *  az_result: AZ_OK, or an error if the buffer or the task snapshot is too
+ *  small.
+ *
+ ******************************************************************************/
+az_result iot_diag_build_cpu_report(az_span buffer, az_span* out_report)
+{
+    static TickType_t prev_tick = 0;
+    uint32_t total_run_time = 0;
+    uint32_t window;
+    uint32_t task_run_time;
+    UBaseType_t task_count = take_task_snapshot( &total_run_time );
+    TickType_t now = xTaskGetTickCount();
+    az_json_writer jw;
+
+    if( task_count == 0 )
+    {
+        return AZ_ERROR_NOT_ENOUGH_SPACE;
+    }
+
+    window = total_run_time - cpu_prev_total;
+
+    IOT_RETURN_IF_FAILED( az_json_writer_init( &jw, buffer, NULL ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_begin_object( &jw ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("windowMs") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_int32( &jw, (int32_t)((now - prev_tick) * portTICK_PERIOD_MS) ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("tasks") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_begin_array( &jw ) );
+    for( UBaseType_t i = 0; i < task_count; i++ )
+    {
+        task_run_time = diag_task_status[i].ulRunTimeCounter;
+        for( UBaseType_t j = 0; j < IOT_DIAG_MAX_TASKS; j++ )
+        {
+            if( cpu_prev_handle[j] == diag_task_status[i].xHandle )
+            {
+                task_run_time -= cpu_prev_run_time[j];
+                break;
+            }
+        }
+
+        IOT_RETURN_IF_FAILED( az_json_writer_append_begin_object( &jw ) );
+        IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("name") ) );
+        IOT_RETURN_IF_FAILED( az_json_writer_append_string( &jw,
+                az_span_create_from_str( (char*)diag_task_status[i].pcTaskName ) ) );
+        IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("cpu") ) );
+        IOT_RETURN_IF_FAILED( az_json_writer_append_double( &jw,
+                ( window == 0 ) ? 0.0 : ( (double)task_run_time * PERCENT ) / window, 1 ) );
+        IOT_RETURN_IF_FAILED( az_json_writer_append_end_object( &jw ) );
+    }
+    IOT_RETURN_IF_FAILED( az_json_writer_append_end_array( &jw ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_end_object( &jw ) );
+
+    /* The window of the next report starts here. */
+    memset( cpu_prev_handle, 0x00, sizeof(cpu_prev_handle) );
+    for( UBaseType_t i = 0; i < task_count; i++ )
+    {
+        cpu_prev_handle[i] = diag_task_status[i].xHandle;
+        cpu_prev_run_time[i] = diag_task_status[i].ulRunTimeCounter;
+    }
+    cpu_prev_total = total_run_time;
+    prev_tick = now;
+
+    *out_report = az_json_writer_get_bytes_used_in_destination( &jw );
+    return AZ_OK;
+}
+#endif /* configGENERATE_RUN_TIME_STATS */
+
+/******************************************************************************
+ * Function Name: iot_diag_build_queue_report
+ ******************************************************************************
+ * Summary:
+ *  Builds the depth report of the registered queues.
+ *
+ * Parameters:
+ *  buffer: Destination buffer.
+ *
+ *  out_report: JSON text written to the buffer.
+ *
+ * Return:
+ *  az_result: AZ_OK, or AZ_ERROR_NOT_ENOUGH_SPACE.
+ *
+ ******************************************************************************/
+az_result iot_diag_build_queue_report(az_span buffer, az_span* out_report)
+{
+    az_json_writer jw;
+
+    IOT_RETURN_IF_FAILED( az_json_writer_init( &jw, buffer, NULL ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_begin_object( &jw ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("queues") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_begin_array( &jw ) );
+    for( uint8_t i = 0; i < diag.queue_count; i++ )
+    {
+        IOT_RETURN_IF_FAILED( az_json_writer_append_begin_object( &jw ) );
+        IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("name") ) );
+        IOT_RETURN_IF_FAILED( az_json_writer_append_string( &jw,
+                az_span_create_from_str( (char*)diag.queue_name[i] ) ) );
+        IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("depth") ) );
+        IOT_RETURN_IF_FAILED( az_json_writer_append_int32( &jw, (int32_t)uxQueueMessagesWaiting( diag.queue[i] ) ) );
+        IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("free") ) );
+        IOT_RETURN_IF_FAILED( az_json_writer_append_int32( &jw, (int32_t)uxQueueSpacesAvailable( diag.queue[i] ) ) );
+        IOT_RETURN_IF_FAILED( az_json_writer_append_end_object( &jw ) );
+    }
+    IOT_RETURN_IF_FAILED( az_json_writer_append_end_array( &jw ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_end_object( &jw ) );
+
+    *out_report = az_json_writer_get_bytes_used_in_destination( &jw );
+    return AZ_OK;
+}
+
+/******************************************************************************
+ * Function Name: iot_diag_build_publish_report
+ ******************************************************************************
+ * Summary:
+ *  Builds the publish latency histogram report.
+ *
+ * Parameters:
+ *  buffer: Destination buffer.
+ *
+ *  out_report: JSON text written to the buffer.
+ *
+ * Return:
+ *  az_result: AZ_OK, or AZ_ERROR_NOT_ENOUGH_SPACE.
+ *
+ ******************************************************************************/
+az_result iot_diag_build_publish_report(az_span buffer, az_span* out_report)
+{
+    uint32_t latency_count[IOT_DIAG_LATENCY_BUCKETS];
+    uint32_t publish_failures;
+    az_json_writer jw;
+
+    taskENTER_CRITICAL();
+    memcpy( latency_count, diag.latency_count, sizeof(latency_count) );
+    publish_failures = diag.publish_failures;
+    taskEXIT_CRITICAL();
+
+    IOT_RETURN_IF_FAILED( az_json_writer_init( &jw, buffer, NULL ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_begin_object( &jw ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("leMs") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_begin_array( &jw ) );
+    for( uint32_t i = 0; i < (IOT_DIAG_LATENCY_BUCKETS - 1); i++ )
+    {
+        IOT_RETURN_IF_FAILED( az_json_writer_append_int32( &jw, (int32_t)latency_bucket_le_msec[i] ) );
+    }
+    IOT_RETURN_IF_FAILED( az_json_writer_append_end_array( &jw ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("count") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_begin_array( &jw ) );
+    for( uint32_t i = 0; i < IOT_DIAG_LATENCY_BUCKETS; i++ )
+    {
+        IOT_RETURN_IF_FAILED( az_json_writer_append_int32( &jw, (int32_t)latency_count[i] ) );
+    }
+    IOT_RETURN_IF_FAILED( az_json_writer_append_end_array( &jw ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("failed") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_int32( &jw, (int32_t)publish_failures ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_end_object( &jw ) );
+
+    *out_report = az_json_writer_get_bytes_used_in_destination( &jw );
+    return AZ_OK;
+}
+
+/******************************************************************************
+ * Function Name: iot_diag_build_connection_report
+ ******************************************************************************
+ * Summary:
+ *  Builds the connection counter report.
+ *
+ * Parameters:
+ *  buffer: Destination buffer.
+ *
+ *  out_report: JSON text written to the buffer.
+ *
+ * Return:
+ *  az_result: AZ_OK, or AZ_ERROR_NOT_ENOUGH_SPACE.
+ *
+ ******************************************************************************/
+az_result iot_diag_build_connection_report(az_span buffer, az_span* out_report)
+{
+    iot_diag_state counters;
+    az_json_writer jw;
+
+    taskENTER_CRITICAL();
+    memcpy( &counters, &diag, sizeof(counters) );
+    taskEXIT_CRITICAL();
+
+    IOT_RETURN_IF_FAILED( az_json_writer_init( &jw, buffer, NULL ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_begin_object( &jw ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("uptimeS") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_int32( &jw,
+            (int32_t)(((xTaskGetTickCount() - counters.start_tick) * portTICK_PERIOD_MS) / MSEC_PER_SEC) ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("connects") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_int32( &jw, (int32_t)counters.connects ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("connectFailures") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_int32( &jw, (int32_t)counters.connect_failures ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("disconnects") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_int32( &jw, (int32_t)counters.disconnects ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("published") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_int32( &jw, (int32_t)counters.published ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("publishFailures") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_int32( &jw, (int32_t)counters.publish_failures ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_end_object( &jw ) );
+
+    *out_report = az_json_writer_get_bytes_used_in_destination( &jw );
+    return AZ_OK;
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,142 @@
+/******************************************************************************
+ * File Name: mqtt_iot_diagnostics.h
+ *
+ * Description: This file contains the declarations of the runtime counters
+ * and the JSON report builders behind the diagnostic direct methods.
+ *
+ ********************************************************************************
+ * Copyright 2024, Cypress Semiconductor Corporation (an Infineon company) or
+ * an affiliate of Cypress Semiconductor Corporation.  All rights reserved.
+ *
+ * This software, including source code, documentation and related
+ * materials ("Software") is owned by Cypress Semiconductor Corporation
+ * or one of its affiliates ("Cypress") and is protected by and subject to
+ * worldwide patent protection (United States and foreign),
+ * United States copyright laws and international treaty provisions.
+ * Therefore, you may use this Software only as provided in the license
+ * agreement accompanying the software package from which you
+ * obtained this Software ("EULA").
+ * If no EULA applies, Cypress hereby grants you a personal, non-exclusive,
+ * non-transferable license to copy, modify, and compile the Software
+ * source code solely for use in connection with Cypress's
+ * integrated circuit products.  Any reproduction, modification, translation,
+ * compilation, or representation of this Software except as specified
+ * above is prohibited without the express written permission of Cypress.
+ *
+ * Disclaimer: THIS SOFTWARE IS PROVIDED AS-IS, WITH NO WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING, BUT NOT LIMITED TO, NONINFRINGEMENT, IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. Cypress
+ * reserves the right to make changes to the Software without notice. Cypress
+ * does not assume any liability arising out of the application or use of the
+ * Software or any product or circuit described in the Software. Cypress does
+ * not authorize its products for use in any products where a malfunction or
+ * failure of the Cypress product may reasonably be expected to result in
+ * significant property damage, injury or death ("High Risk Product"). By
+ * including Cypress's product in a High Risk Product, the manufacturer
+ * of such system or application assumes all risk of such use and in doing
+ * so agrees to indemnify Cypress against all liability.
+ *******************************************************************************/
+
+#ifndef MQTT_IOT_DIAGNOSTICS_H_
+#define MQTT_IOT_DIAGNOSTICS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cyabs_rtos.h"
+#include <az_core.h>
+
+/*******************************************************************************
+ * Macros
+ ********************************************************************************/
+/* Size of the task snapshot, must be at least the number of tasks */
+#define IOT_DIAG_MAX_TASKS                      (16)
+
+/* Maximum number of queues that can be registered */
+#define IOT_DIAG_MAX_QUEUES                     (4)
+
+/* Number of publish latency buckets, the last one has no upper bound */
+#define IOT_DIAG_LATENCY_BUCKETS                (9)
+
+/*******************************************************************************
+ * Global Variables
+ ********************************************************************************/
+/* Builder of a diagnostic report, writes compact JSON into the buffer */
+typedef az_result (*iot_diag_report_builder)(az_span buffer, az_span* out_report);
+
+/******************************************************************************
+ * Function Prototypes
+ *******************************************************************************/
+/*
+ * @brief Clears the counters and the queue registrations, and starts the
+ * uptime reported by the connection report.
+ */
+void iot_diag_init(void);
+
+/*
+ * @brief Registers a queue or semaphore whose depth is reported.
+ * @param[in] name Printable name, must remain valid.
+ * @param[in] queue Queue or semaphore handle.
+ * @return false if IOT_DIAG_MAX_QUEUES queues are already registered.
+ */
+bool iot_diag_register_queue(char const* name, QueueHandle_t queue);
+
+/*
+ * @brief Counts a connection attempt to the hub.
+ * @param[in] success true if the client connected.
+ */
+void iot_diag_record_connect(bool success);
+
+/*
+ * @brief Counts a disconnection reported by the MQTT library.
+ */
+void iot_diag_record_disconnect(void);
+
+/*
+ * @brief Counts a publish and adds its duration to the latency histogram.
+ * For QoS1 the duration includes the wait for the PUBACK.
+ * @param[in] success true if the publish succeeded.
+ * @param[in] latency_ticks Time spent in the publish call.
+ */
+void iot_diag_record_publish(bool success, TickType_t latency_ticks);
+
+/*
+ * @brief Builds {"arena":..,"used":..,"free":..} from the C library heap, in bytes.
+ */
+az_result iot_diag_build_heap_report(az_span buffer, az_span* out_report);
+
+/*
+ * @brief Builds {"tasks":[{"name":..,"stackFree":..},..]}, with the stack high
+ * water mark of every task in bytes.
+ */
+az_result iot_diag_build_stack_report(az_span buffer, az_span* out_report);
+
+#if ( configGENERATE_RUN_TIME_STATS == 1 )
+/*
+ * @brief Builds {"windowMs":..,"tasks":[{"name":..,"cpu":..},..]}, with the
+ * CPU share of every task in percent since the previous call.
+ */
+az_result iot_diag_build_cpu_report(az_span buffer, az_span* out_report);
+#endif
+
+/*
+ * @brief Builds {"queues":[{"name":..,"depth":..,"free":..},..]} for the
+ * registered queues.
+ */
+az_result iot_diag_build_queue_report(az_span buffer, az_span* out_report);
+
+/*
+ * @brief Builds {"leMs":[..],"count":[..],"failed":..}, the publish latency
+ * histogram with the upper bound of each bucket.
+ */
+az_result iot_diag_build_publish_report(az_span buffer, az_span* out_report);
+
+/*
+ * @brief Builds {"uptimeS":..,"connects":..,"connectFailures":..,
+ * "disconnects":..,"published":..,"publishFailures":..}.
+ */
+az_result iot_diag_build_connection_report(az_span buffer, az_span* out_report);
+
+#endif /* MQTT_IOT_DIAGNOSTICS_H_ */
+
+/* [] END OF FILE */
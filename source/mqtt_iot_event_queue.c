@@ -0,0 +1,641 @@
+/******************************************************************************
+ * File Name: mqtt_iot_event_queue.c
+ *
+ * Description: This file contains the non-blocking event queue used to hand
+ * MQTT messages from the MQTT event callback to the Azure feature tasks.
+ *
+ ********************************************************************************
+ * Copyright 2024, Cypress Semiconductor Corporation (an Infineon company) or
+ * an affiliate of Cypress Semiconductor Corporation.  All rights reserved.
+ *
+ * This software, including source code, documentation and related
+ * materials ("Software") is owned by Cypress Semiconductor Corporation
+ * or one of its affiliates ("Cypress") and is protected by and subject to
+ * worldwide patent protection (United States and foreign),
+ * United States copyright laws and international treaty provisions.
+ * Therefore, you may use this Software only as provided in the license
+ * agreement accompanying the software package from which you
+ * obtained this Software ("EULA").
+ * If no EULA applies, Cypress hereby grants you a personal, non-exclusive,
+ * non-transferable license to copy, modify, and compile the Software
+ * source code solely for use in connection with Cypress's
+ * integrated circuit products.  Any reproduction, modification, translation,
+ * compilation, or representation of this Software except as specified
+ * above is prohibited without the express written permission of Cypress.
+ *
+ * Disclaimer: THIS SOFTWARE IS PROVIDED AS-IS, WITH NO WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING, BUT NOT LIMITED TO, NONINFRINGEMENT, IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. Cypress
+ * reserves the right to make changes to the Software without notice. Cypress
+ * does not assume any liability arising out of the application or use of the
+ * Software or any product or circuit described in the Software. Cypress does
+ * not authorize its products for use in any products where a malfunction or
+ * failure of the Cypress product may reasonably be expected to result in
+ * significant property damage, injury or death ("High Risk Product"). By
+ * including Cypress's product in a High Risk Product, the manufacturer
+ * of such system or application assumes all risk of such use and in doing
+ * so agrees to indemnify Cypress against all liability.
+ *******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "azure_common.h"
+#include "mqtt_iot_event_queue.h"
+
+/*******************************************************************************
+ * Macros
+ ********************************************************************************/
+#define MSEC_PER_MINUTE                     (60 * 1000)
+
+/*******************************************************************************
+ * Global Variables
+ ********************************************************************************/
+/* Item carried by the RTOS queue. For coalescing classes the event is NULL and
+ * the latest event is held in the coalesce slot of the class instead.
+ */
+typedef struct
+{
+    uint8_t     event_class;
+    TickType_t  posted_tick;
+    void*       event;
+} iot_event_queue_item;
+
+/******************************************************************************
+ * Function Name: take_coalesced_event
+ ******************************************************************************
+ * Summary:
+ *  Removes the pending event from the coalesce slot of a message class.
+ *
+ * Parameters:
+ *  event_queue: Event queue.
+ *
+ *  event_class: Message class of the slot.
+ *
+ * Return:
+ *  void*: Pending event, or NULL if the slot is empty.
+ *
+ ******************************************************************************/
+static void* take_coalesced_event(iot_event_queue* event_queue, uint8_t event_class)
+{
+    void* event;
+
+    taskENTER_CRITICAL();
+    event = event_queue->coalesce_slot[event_class];
+    event_queue->coalesce_slot[event_class] = NULL;
+    taskEXIT_CRITICAL();
+
+    return event;
+}
+
+/******************************************************************************
+ * Function Name: notify_consumer
+ ******************************************************************************
+ * Summary:
+ *  Sends a direct task notification to the consumer task, if one is set.
+ *
+ * Parameters:
+ *  event_queue: Event queue.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+static void notify_consumer(iot_event_queue* event_queue)
+{
+    TaskHandle_t consumer = event_queue->consumer;
+
+    if( consumer != NULL )
+    {
+        xTaskNotifyGive( consumer );
+    }
+}
+
+/******************************************************************************
+ * Function Name: evict_oldest_event
+ ******************************************************************************
+ * Summary:
+ *  Removes the oldest item from a full queue and frees its event.
+ *
+ * Parameters:
+ *  event_queue: Event queue.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+static void evict_oldest_event(iot_event_queue* event_queue)
+{
+    iot_event_queue_item item;
+
+    if( xQueueReceive( event_queue->queue, &item, 0 ) != pdPASS )
+    {
+        return;
+    }
+
+    if( item.event == NULL )
+    {
+        item.event = take_coalesced_event( event_queue, item.event_class );
+    }
+
+    free( item.event );
+    event_queue->stats[item.event_class].dropped_oldest++;
+}
+
+/******************************************************************************
+ * Function Name: iot_event_queue_init
+ ******************************************************************************
+ * Summary:
+ *  Creates the RTOS queue and records the overflow policy of each class.
+ *
+ * Parameters:
+ *  event_queue: Event queue to initialize.
+ *
+ *  length: Maximum number of events held by the queue.
+ *
+ *  policies: Overflow policy of each message class.
+ *
+ *  class_count: Number of message classes.
+ *
+ * Return:
+ *  bool: true on success.
+ *
+ ******************************************************************************/
+bool iot_event_queue_init(iot_event_queue* event_queue, uint32_t length,
+        iot_event_overflow_policy const* policies, uint8_t class_count)
+{
+    if( (class_count == 0) || (class_count > IOT_EVENT_QUEUE_MAX_CLASSES) )
+    {
+        return false;
+    }
+
+    memset( event_queue, 0x00, sizeof(iot_event_queue) );
+    event_queue->class_count = class_count;
+    memcpy( event_queue->policy, policies, class_count * sizeof(iot_event_overflow_policy) );
+
+    event_queue->start_tick = xTaskGetTickCount();
+    event_queue->queue = xQueueCreate( length, sizeof(iot_event_queue_item) );
+
+    return ( event_queue->queue != NULL );
+}
+
+/******************************************************************************
+ * Function Name: iot_event_queue_deinit
+ ******************************************************************************
+ * Summary:
+ *  Frees every pending event and deletes the RTOS queue.
+ *
+ * Parameters:
+ *  event_queue: Event queue to delete.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_event_queue_deinit(iot_event_queue* event_queue)
+{
+    iot_event_queue_item item;
+
+    if( event_queue->queue == NULL )
+    {
+        return;
+    }
+
+    while( xQueueReceive( event_queue->queue, &item, 0 ) == pdPASS )
+    {
+        free( item.event );
+    }
+
+    for( uint8_t i = 0; i < event_queue->class_count; i++ )
+    {
+        free( take_coalesced_event( event_queue, i ) );
+    }
+
+    vQueueDelete( event_queue->queue );
+    event_queue->queue = NULL;
+}
+
+/******************************************************************************
+ * Function Name: iot_event_queue_post
+ ******************************************************************************
+ * Summary:
+ *  Posts an event without blocking and applies the overflow policy of its
+ *  class when the queue is full. Safe to call from the MQTT event callback.
+ *
+ * Parameters:
+ *  event_queue: Event queue to post to.
+ *
+ *  event_class: Message class of the event.
+ *
+ *  event: Event allocated with malloc(). Ownership passes to the queue.
+ *
+ * Return:
+ *  bool: true if the event was queued or coalesced.
+ *
+ ******************************************************************************/
+bool iot_event_queue_post(iot_event_queue* event_queue, uint8_t event_class, void* event)
+{
+    iot_event_queue_item item;
+    iot_event_class_stats* stats;
+    void* pending;
+
+    if( (event_queue->queue == NULL) || (event_class >= event_queue->class_count) )
+    {
+        free( event );
+        return false;
+    }
+
+    stats = &event_queue->stats[event_class];
+    item.event_class = event_class;
+    item.posted_tick = xTaskGetTickCount();
+    item.event = event;
+
+    if( event_queue->policy[event_class] == IOT_EVENT_OVERFLOW_COALESCE )
+    {
+        taskENTER_CRITICAL();
+        pending = event_queue->coalesce_slot[event_class];
+        event_queue->coalesce_slot[event_class] = event;
+        taskEXIT_CRITICAL();
+
+        if( pending != NULL )
+        {
+            /* A queue item already refers to the slot, it now picks up this event. */
+            free( pending );
+            stats->coalesced++;
+            return true;
+        }
+
+        item.event = NULL;
+        if( xQueueSend( event_queue->queue, &item, 0 ) != pdPASS )
+        {
+            free( take_coalesced_event( event_queue, event_class ) );
+            stats->dropped_newest++;
+            return false;
+        }
+
+        stats->posted++;
+        notify_consumer( event_queue );
+        return true;
+    }
+
+    if( xQueueSend( event_queue->queue, &item, 0 ) == pdPASS )
+    {
+        stats->posted++;
+        notify_consumer( event_queue );
+        return true;
+    }
+
+    if( event_queue->policy[event_class] == IOT_EVENT_OVERFLOW_DROP_OLDEST )
+    {
+        evict_oldest_event( event_queue );
+        if( xQueueSend( event_queue->queue, &item, 0 ) == pdPASS )
+        {
+            stats->posted++;
+            notify_consumer( event_queue );
+            return true;
+        }
+    }
+
+    free( event );
+    stats->dropped_newest++;
+    return false;
+}
+
+/******************************************************************************
+ * Function Name: iot_event_queue_receive
+ ******************************************************************************
+ * Summary:
+ *  Waits for the next event of any class.
+ *
+ * Parameters:
+ *  event_queue: Event queue to receive from.
+ *
+ *  ticks_to_wait: Maximum time to block.
+ *
+ *  out_event_class: Message class of the returned event, can be NULL.
+ *
+ * Return:
+ *  void*: Event owned by the caller, or NULL on timeout.
+ *
+ ******************************************************************************/
+void* iot_event_queue_receive(iot_event_queue* event_queue, TickType_t ticks_to_wait,
+        uint8_t* out_event_class)
+{
+    iot_event_queue_item item;
+
+    if( xQueueReceive( event_queue->queue, &item, ticks_to_wait ) != pdPASS )
+    {
+        return NULL;
+    }
+
+    if( item.event == NULL )
+    {
+        item.event = take_coalesced_event( event_queue, item.event_class );
+    }
+
+    iot_event_latency_record( &event_queue->stats[item.event_class].latency, item.posted_tick );
+
+    if( out_event_class != NULL )
+    {
+        *out_event_class = item.event_class;
+    }
+
+    return item.event;
+}
+
+/******************************************************************************
+ * Function Name: iot_event_queue_set_consumer
+ ******************************************************************************
+ * Summary:
+ *  Registers the task that is notified on every accepted post.
+ *
+ * Parameters:
+ *  event_queue: Event queue.
+ *
+ *  consumer: Consumer task.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_event_queue_set_consumer(iot_event_queue* event_queue, TaskHandle_t consumer)
+{
+    event_queue->consumer = consumer;
+}
+
+/******************************************************************************
+ * Function Name: iot_event_queue_wake
+ ******************************************************************************
+ * Summary:
+ *  Wakes the consumer task so that it re-checks its exit conditions.
+ *
+ * Parameters:
+ *  event_queue: Event queue.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_event_queue_wake(iot_event_queue* event_queue)
+{
+    notify_consumer( event_queue );
+}
+
+/******************************************************************************
+ * Function Name: iot_event_queue_wait
+ ******************************************************************************
+ * Summary:
+ *  Returns the next pending event, or blocks on the task notification of the
+ *  consumer until an event is posted, the queue is woken, or the deadline
+ *  expires. The task only runs when there is something to do.
+ *
+ * Parameters:
+ *  event_queue: Event queue to receive from.
+ *
+ *  deadline: Time-out state of the wait period.
+ *
+ *  ticks_left: Ticks remaining until the deadline.
+ *
+ *  out_event_class: Message class of the returned event, can be NULL.
+ *
+ * Return:
+ *  void*: Event owned by the caller, or NULL on deadline or wake.
+ *
+ ******************************************************************************/
+void* iot_event_queue_wait(iot_event_queue* event_queue, TimeOut_t* deadline,
+        TickType_t* ticks_left, uint8_t* out_event_class)
+{
+    void* event;
+
+    /* Events posted while the consumer was busy are drained first. A post
+     * that races with this check leaves the notification pending, so the
+     * take below returns at once.
+     */
+    event = iot_event_queue_receive( event_queue, 0, out_event_class );
+    if( event != NULL )
+    {
+        return event;
+    }
+
+    if( xTaskCheckForTimeOut( deadline, ticks_left ) != pdFALSE )
+    {
+        *ticks_left = 0;
+        return NULL;
+    }
+
+    ulTaskNotifyTake( pdTRUE, *ticks_left );
+    event_queue->wakeups++;
+
+    event = iot_event_queue_receive( event_queue, 0, out_event_class );
+    if( event == NULL )
+    {
+        event_queue->idle_wakeups++;
+        if( xTaskCheckForTimeOut( deadline, ticks_left ) != pdFALSE )
+        {
+            *ticks_left = 0;
+        }
+    }
+
+    return event;
+}
+
+#if ( configUSE_QUEUE_SETS == 1 )
+/******************************************************************************
+ * Function Name: iot_event_queue_add_to_set
+ ******************************************************************************
+ * Summary:
+ *  Adds the underlying RTOS queue to a queue set.
+ *
+ * Parameters:
+ *  event_queue: Event queue, must be empty.
+ *
+ *  queue_set: Queue set.
+ *
+ * Return:
+ *  bool: true on success.
+ *
+ ******************************************************************************/
+bool iot_event_queue_add_to_set(iot_event_queue* event_queue, QueueSetHandle_t queue_set)
+{
+    for( uint8_t i = 0; i < event_queue->class_count; i++ )
+    {
+        if( event_queue->policy[i] == IOT_EVENT_OVERFLOW_DROP_OLDEST )
+        {
+            return false;
+        }
+    }
+
+    return ( xQueueAddToSet( event_queue->queue, queue_set ) == pdPASS );
+}
+
+/******************************************************************************
+ * Function Name: iot_event_queue_is_set_member
+ ******************************************************************************
+ * Summary:
+ *  Checks whether a selected queue set member is the event queue.
+ *
+ * Parameters:
+ *  event_queue: Event queue.
+ *
+ *  member: Queue set member.
+ *
+ * Return:
+ *  bool: true if the member is the underlying RTOS queue.
+ *
+ ******************************************************************************/
+bool iot_event_queue_is_set_member(iot_event_queue const* event_queue, QueueSetMemberHandle_t member)
+{
+    return ( (QueueSetMemberHandle_t)event_queue->queue == member );
+}
+#endif /* configUSE_QUEUE_SETS */
+
+/******************************************************************************
+ * Function Name: iot_event_latency_record
+ ******************************************************************************
+ * Summary:
+ *  Adds one post to dispatch latency sample.
+ *
+ * Parameters:
+ *  latency: Latency statistics.
+ *
+ *  posted_tick: Tick count at which the event was posted.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_event_latency_record(iot_event_latency_stats* latency, TickType_t posted_tick)
+{
+    TickType_t ticks = xTaskGetTickCount() - posted_tick;
+
+    latency->count++;
+    latency->total_ticks += ticks;
+    if( ticks > latency->max_ticks )
+    {
+        latency->max_ticks = ticks;
+    }
+}
+
+/******************************************************************************
+ * Function Name: iot_event_latency_log
+ ******************************************************************************
+ * Summary:
+ *  Prints the average and maximum post to dispatch latency.
+ *
+ * Parameters:
+ *  name: Printable name of the event source.
+ *
+ *  latency: Latency statistics.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_event_latency_log(char const* name, iot_event_latency_stats const* latency)
+{
+    if( latency->count == 0 )
+    {
+        return;
+    }
+
+    TEST_INFO(( "\r\n%-10s latency over %lu events, avg: %lu ms, max: %lu ms\n",
+            name,
+            (unsigned long)latency->count,
+            (unsigned long)( ( latency->total_ticks / latency->count ) * portTICK_PERIOD_MS ),
+            (unsigned long)( latency->max_ticks * portTICK_PERIOD_MS ) ));
+}
+
+/******************************************************************************
+ * Function Name: iot_event_queue_log_stats
+ ******************************************************************************
+ * Summary:
+ *  Prints the counters of every message class and the number of consumer
+ *  wakeups that delivered no event, per minute since the queue was created.
+ *
+ * Parameters:
+ *  event_queue: Event queue.
+ *
+ *  class_names: Printable name of each message class.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_event_queue_log_stats(iot_event_queue const* event_queue, char const* const* class_names)
+{
+    uint32_t elapsed_ms;
+
+    for( uint8_t i = 0; i < event_queue->class_count; i++ )
+    {
+        iot_event_class_stats const* stats = &event_queue->stats[i];
+
+        TEST_INFO(( "\r\n%-10s posted: %lu, dropped newest: %lu, dropped oldest: %lu, coalesced: %lu\n",
+                class_names[i],
+                (unsigned long)stats->posted,
+                (unsigned long)stats->dropped_newest,
+                (unsigned long)stats->dropped_oldest,
+                (unsigned long)stats->coalesced ));
+        iot_event_latency_log( class_names[i], &stats->latency );
+    }
+
+    elapsed_ms = (uint32_t)( xTaskGetTickCount() - event_queue->start_tick ) * portTICK_PERIOD_MS;
+    if( elapsed_ms > 0 )
+    {
+        TEST_INFO(( "\r\nConsumer wakeups: %lu, idle wakeups: %lu (%lu per minute over %lu ms)\n",
+                (unsigned long)event_queue->wakeups,
+                (unsigned long)event_queue->idle_wakeups,
+                (unsigned long)( ( (uint64_t)event_queue->idle_wakeups * MSEC_PER_MINUTE ) / elapsed_ms ),
+                (unsigned long)elapsed_ms ));
+    }
+}
+
+/******************************************************************************
+ * Function Name: iot_mqtt_message_event_create
+ ******************************************************************************
+ * Summary:
+ *  Allocates a message event and copies the topic and payload into it, so the
+ *  event stays valid after the MQTT network buffer is reused.
+ *
+ * Parameters:
+ *  event_class: Message class of the event.
+ *
+ *  topic: Topic of the received message.
+ *
+ *  topic_len: Length of the topic.
+ *
+ *  payload: Payload of the received message.
+ *
+ *  payload_len: Length of the payload.
+ *
+ * Return:
+ *  iot_mqtt_message_event*: Event, or NULL if no memory is available.
+ *
+ ******************************************************************************/
+iot_mqtt_message_event* iot_mqtt_message_event_create(uint8_t event_class,
+        char const* topic, uint16_t topic_len, char const* payload, size_t payload_len)
+{
+    iot_mqtt_message_event* event;
+
+    event = (iot_mqtt_message_event *) malloc( sizeof(iot_mqtt_message_event) + topic_len + payload_len );
+    if( event == NULL )
+    {
+        return NULL;
+    }
+
+    event->event_class = event_class;
+    event->topic_len = topic_len;
+    event->payload_len = payload_len;
+    event->topic = (char *)(event + 1);
+    event->payload = event->topic + topic_len;
+
+    memcpy( event->topic, topic, topic_len );
+    if( payload_len > 0 )
+    {
+        memcpy( event->payload, payload, payload_len );
+    }
+
+    return event;
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,257 @@
+/******************************************************************************
+ * File Name: mqtt_iot_event_queue.h
+ *
+ * Description: Contains the interfaces of the non-blocking event queue used to
+ * hand MQTT messages from the MQTT event callback to the Azure feature tasks.
+ *
+ ********************************************************************************
+ * Copyright 2024, Cypress Semiconductor Corporation (an Infineon company) or
+ * an affiliate of Cypress Semiconductor Corporation.  All rights reserved.
+ *
+ * This software, including source code, documentation and related
+ * materials ("Software") is owned by Cypress Semiconductor Corporation
+ * or one of its affiliates ("Cypress") and is protected by and subject to
+ * worldwide patent protection (United States and foreign),
+ * United States copyright laws and international treaty provisions.
+ * Therefore, you may use this Software only as provided in the license
+ * agreement accompanying the software package from which you
+ * obtained this Software ("EULA").
+ * If no EULA applies, Cypress hereby grants you a personal, non-exclusive,
+ * non-transferable license to copy, modify, and compile the Software
+ * source code solely for use in connection with Cypress's
+ * integrated circuit products.  Any reproduction, modification, translation,
+ * compilation, or representation of this Software except as specified
+ * above is prohibited without the express written permission of Cypress.
+ *
+ * Disclaimer: THIS SOFTWARE IS PROVIDED AS-IS, WITH NO WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING, BUT NOT LIMITED TO, NONINFRINGEMENT, IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. Cypress
+ * reserves the right to make changes to the Software without notice. Cypress
+ * does not assume any liability arising out of the application or use of the
+ * Software or any product or circuit described in the Software. Cypress does
+ * not authorize its products for use in any products where a malfunction or
+ * failure of the Cypress product may reasonably be expected to result in
+ * significant property damage, injury or death ("High Risk Product"). By
+ * including Cypress's product in a High Risk Product, the manufacturer
+ * of such system or application assumes all risk of such use and in doing
+ * so agrees to indemnify Cypress against all liability.
+ *******************************************************************************/
+
+#ifndef MQTT_IOT_EVENT_QUEUE_H_
+#define MQTT_IOT_EVENT_QUEUE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cyabs_rtos.h"
+
+/*******************************************************************************
+ * Macros
+ ********************************************************************************/
+/* Maximum number of message classes that can share one event queue */
+#define IOT_EVENT_QUEUE_MAX_CLASSES             (4)
+
+/*******************************************************************************
+ * Global Variables
+ ********************************************************************************/
+/* Action taken when an event is posted to a full queue */
+typedef enum
+{
+    IOT_EVENT_OVERFLOW_DROP_NEWEST,     /* Discard the event being posted */
+    IOT_EVENT_OVERFLOW_DROP_OLDEST,     /* Evict the oldest queued event to make room */
+    IOT_EVENT_OVERFLOW_COALESCE         /* Keep only the latest pending event of the class */
+} iot_event_overflow_policy;
+
+/* Time from posting an event to its dispatch by the consumer */
+typedef struct
+{
+    uint32_t    count;
+    uint32_t    total_ticks;
+    TickType_t  max_ticks;
+} iot_event_latency_stats;
+
+/* Per-class event counters */
+typedef struct
+{
+    uint32_t posted;                    /* Events accepted into the queue */
+    uint32_t dropped_newest;            /* Events discarded on post */
+    uint32_t dropped_oldest;            /* Queued events evicted to make room */
+    uint32_t coalesced;                 /* Pending events replaced by a newer one */
+    iot_event_latency_stats latency;    /* Post to receive latency */
+} iot_event_class_stats;
+
+/* Copy of a received MQTT message, topic and payload bytes follow the struct */
+typedef struct
+{
+    uint8_t     event_class;
+    uint16_t    topic_len;
+    size_t      payload_len;
+    char*       topic;
+    char*       payload;
+} iot_mqtt_message_event;
+
+/* Event queue shared by one producer (MQTT callback) and one consumer task */
+typedef struct
+{
+    QueueHandle_t               queue;
+    uint8_t                     class_count;
+    iot_event_overflow_policy   policy[IOT_EVENT_QUEUE_MAX_CLASSES];
+    void* volatile              coalesce_slot[IOT_EVENT_QUEUE_MAX_CLASSES];
+    iot_event_class_stats       stats[IOT_EVENT_QUEUE_MAX_CLASSES];
+    TaskHandle_t volatile       consumer;       /* Task notified on every post */
+    TickType_t                  start_tick;
+    uint32_t                    wakeups;        /* Times the consumer returned from its wait */
+    uint32_t                    idle_wakeups;   /* Wakeups that delivered no event */
+} iot_event_queue;
+
+/******************************************************************************
+ * Function Prototypes
+ *******************************************************************************/
+/*
+ * @brief Creates the event queue.
+ *
+ * @param[out] event_queue Event queue to initialize.
+ * @param[in] length Maximum number of events held by the queue.
+ * @param[in] policies Overflow policy of each message class.
+ * @param[in] class_count Number of message classes in \p policies.
+ *
+ * @return true on success.
+ */
+bool iot_event_queue_init(iot_event_queue* event_queue, uint32_t length,
+        iot_event_overflow_policy const* policies, uint8_t class_count);
+
+/*
+ * @brief Deletes the event queue and frees every event still pending.
+ *
+ * @param[in] event_queue Event queue to delete.
+ */
+void iot_event_queue_deinit(iot_event_queue* event_queue);
+
+/*
+ * @brief Posts a heap allocated event without blocking. The queue takes
+ * ownership of the event; events that are dropped are freed.
+ *
+ * @param[in] event_queue Event queue to post to.
+ * @param[in] event_class Message class of the event.
+ * @param[in] event Event allocated with malloc().
+ *
+ * @return true if the event was queued or coalesced into a pending event.
+ */
+bool iot_event_queue_post(iot_event_queue* event_queue, uint8_t event_class, void* event);
+
+/*
+ * @brief Waits for the next event. The caller owns the returned event and
+ * must free() it.
+ *
+ * @param[in] event_queue Event queue to receive from.
+ * @param[in] ticks_to_wait Maximum time to block.
+ * @param[out] out_event_class Message class of the returned event, can be NULL.
+ *
+ * @return Event, or NULL if none arrived within \p ticks_to_wait.
+ */
+void* iot_event_queue_receive(iot_event_queue* event_queue, TickType_t ticks_to_wait,
+        uint8_t* out_event_class);
+
+/*
+ * @brief Registers the task that consumes the queue. Every accepted post and
+ * every call to iot_event_queue_wake() sends it a direct task notification.
+ *
+ * @param[in] event_queue Event queue.
+ * @param[in] consumer Consumer task, usually xTaskGetCurrentTaskHandle().
+ */
+void iot_event_queue_set_consumer(iot_event_queue* event_queue, TaskHandle_t consumer);
+
+/*
+ * @brief Wakes the consumer task without posting an event, e.g. on disconnect.
+ *
+ * @param[in] event_queue Event queue.
+ */
+void iot_event_queue_wake(iot_event_queue* event_queue);
+
+/*
+ * @brief Blocks the consumer task on its task notification until an event is
+ * available, the queue is woken, or the absolute deadline expires. Must be
+ * called from the consumer task. The caller owns the returned event and must
+ * free() it.
+ *
+ * @param[in] event_queue Event queue to receive from.
+ * @param[in] deadline Time-out state set by vTaskSetTimeOutState() at the
+ * start of the wait period.
+ * @param[in,out] ticks_left Ticks remaining until the deadline, updated on return.
+ * @param[out] out_event_class Message class of the returned event, can be NULL.
+ *
+ * @return Event, or NULL if the deadline expired or the consumer was woken
+ * without an event.
+ */
+void* iot_event_queue_wait(iot_event_queue* event_queue, TimeOut_t* deadline,
+        TickType_t* ticks_left, uint8_t* out_event_class);
+
+#if ( configUSE_QUEUE_SETS == 1 )
+/*
+ * @brief Adds the underlying RTOS queue to a queue set, so that the consumer
+ * can wait on it together with other event sources. When the set selects the
+ * queue, read exactly one event with iot_event_queue_receive() and a zero
+ * timeout. Queues with a drop oldest class cannot be added, as the eviction
+ * would leave a stale entry in the set.
+ *
+ * @param[in] event_queue Event queue.
+ * @param[in] queue_set Queue set created with xQueueCreateSet().
+ *
+ * @return true on success.
+ */
+bool iot_event_queue_add_to_set(iot_event_queue* event_queue, QueueSetHandle_t queue_set);
+
+/*
+ * @brief Checks whether a queue set member returned by xQueueSelectFromSet()
+ * is the underlying queue of the event queue.
+ *
+ * @param[in] event_queue Event queue.
+ * @param[in] member Queue set member.
+ *
+ * @return true if \p member belongs to \p event_queue.
+ */
+bool iot_event_queue_is_set_member(iot_event_queue const* event_queue, QueueSetMemberHandle_t member);
+#endif /* configUSE_QUEUE_SETS */
+
+/*
+ * @brief Records the latency of an event posted at \p posted_tick.
+ *
+ * @param[in] latency Latency statistics to update.
+ * @param[in] posted_tick Tick count at which the event was posted.
+ */
+void iot_event_latency_record(iot_event_latency_stats* latency, TickType_t posted_tick);
+
+/*
+ * @brief Prints the average and maximum latency.
+ *
+ * @param[in] name Printable name of the event source.
+ * @param[in] latency Latency statistics.
+ */
+void iot_event_latency_log(char const* name, iot_event_latency_stats const* latency);
+
+/*
+ * @brief Prints the counters of every message class.
+ *
+ * @param[in] event_queue Event queue.
+ * @param[in] class_names Printable name of each message class.
+ */
+void iot_event_queue_log_stats(iot_event_queue const* event_queue, char const* const* class_names);
+
+/*
+ * @brief Allocates a message event holding copies of the topic and payload.
+ *
+ * @param[in] event_class Message class of the event.
+ * @param[in] topic Topic of the received message.
+ * @param[in] topic_len Length of \p topic.
+ * @param[in] payload Payload of the received message.
+ * @param[in] payload_len Length of \p payload.
+ *
+ * @return Event allocated with malloc(), or NULL if no memory is available.
+ */
+iot_mqtt_message_event* iot_mqtt_message_event_create(uint8_t event_class,
+        char const* topic, uint16_t topic_len, char const* payload, size_t payload_len);
+
+#endif /* MQTT_IOT_EVENT_QUEUE_H_ */
+
+/* [] END OF FILE */
@@ -40,6 +40,7 @@
 #include "azure_common.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include "cyhal.h"
 #include "cybsp.h"
 #include "cy_log.h"
@@ -60,6 +61,19 @@
 #include <az_core.h>
 #include <az_iot.h>
 #include "mqtt_iot_common.h"
+#include "mqtt_iot_event_queue.h"
+#include "mqtt_iot_property_parser.h"
+#include "mqtt_iot_method_cache.h"
+#include "mqtt_iot_reported_writer.h"
+#include "mqtt_iot_request_tracker.h"
+#include "mqtt_iot_twin_store.h"
+#include "mqtt_iot_window_stats.h"
+#include "mqtt_iot_channel_stats.h"
+#include "mqtt_iot_time_series.h"
+#include "mqtt_iot_time_sync.h"
+#include "mqtt_iot_json_template.h"
+#include "mqtt_iot_async_command.h"
+#include "mqtt_iot_pnp_model.h"
 
 #ifdef CY_TFM_PSA_SUPPORTED
 #include "tfm_multi_core_api.h"
@@ -71,32 +85,197 @@
 /*******************************************************************************
  * Macros
  ********************************************************************************/
-#define DEFAULT_START_TEMP_COUNT                    (1)
 #define DEFAULT_START_TEMP_CELSIUS                  (22.0)
 #define DOUBLE_DECIMAL_PLACE_DIGITS                 (2)
 
-/* Wait duration between messages, should be in multiples of 500 */
+/* Longest temperature formatted for a JSON template slot */
+#define PNP_TEMPERATURE_TEXT_SIZE                   (24)
+
+/* Duration for which the PnP app task handles messages before it ends */
 #define MESSAGE_WAIT_LOOP_DURATION_MSEC             (500 * 500)
 
 #define SAS_KEY_DURATION_MINUTES                    (240)
 
 #define MQTT_CLIENT_ID_BUFFER_SIZE                  (128)
 
-#define CONNECTION_REQUEST_ID_BUFFER_SIZE           (16)
-
 #define COMMAND_START_TIME_VALUE_BUFFER_SIZE        (64)
 #define COMMAND_END_TIME_VALUE_BUFFER_SIZE          (64)
-#define COMMAND_RESPONSE_PAYLOAD_BUFFER_SIZE        (256)
+#define COMMAND_RESPONSE_PAYLOAD_BUFFER_SIZE        (1024)
 #define METHODS_RESPONSE_TOPIC_BUFFER_SIZE          (128)
 
-#define GET_QUEUE_TIMEOUT_MSEC                      (500)
-
-#define PNP_APP_TIMEOUT_MSEC                        (500)
+/* Thermostat instances of the PnP model, each with its own temperature
+ * statistics, desired targetTemperature and reported properties. Macro value
+ * 0 runs one thermostat as the default component of the
+ * dtmi:com:example:Thermostat;1 model. Macro value 1 runs the thermostat1 and
+ * thermostat2 components of the dtmi:com:example:TemperatureController;2
+ * model: the properties of a component are members of an object named after
+ * it, and its commands are invoked as <component>*<command>.
+ */
+#define PNP_COMPONENT_MODEL_ENABLE                  (0)
+
+#if PNP_COMPONENT_MODEL_ENABLE
+#define PNP_MODEL_ID                                "dtmi:com:example:TemperatureController;2"
+#define PNP_THERMOSTAT1_COMPONENT                   "thermostat1"
+#define PNP_THERMOSTAT2_COMPONENT                   "thermostat2"
+#define PNP_THERMOSTAT_COUNT                        (2)
+#else
+#define PNP_MODEL_ID                                PNP_THERMOSTAT_MODEL_ID
+#define PNP_THERMOSTAT_COUNT                        (1)
+#endif
 
-#define PNP_MSG_EVENT_QUEUE_MSEC                    (500)
+/* Separates the component from the command in a method name */
+#define PNP_COMPONENT_COMMAND_SEPARATOR             "*"
+#define PNP_COMMAND_NAME_BUFFER_SIZE                (64)
+
+/* All components are reported in one patch */
+#define REPORTED_PROPERTY_PAYLOAD_BUFFER_SIZE       (256 * PNP_THERMOSTAT_COUNT)
+
+/* Interval of the temperature telemetry of each thermostat. The message
+ * topics are built once and every sample is serialized into the same
+ * buffer. A publish that is late by a whole interval, e.g. behind a burst of
+ * commands, skips the missed samples instead of sending them back to back.
+ * Macro value 0 disables telemetry.
+ */
+#define PNP_TELEMETRY_INTERVAL_MSEC                 (5 * 1000)
+#define PNP_TELEMETRY_TOPIC_BUFFER_SIZE             (128)
+#define PNP_TELEMETRY_PAYLOAD_BUFFER_SIZE           (64)
+#define PNP_TELEMETRY_PROPERTIES_BUFFER_SIZE        (32)
+
+/* Message property that names the component of a telemetry message */
+#define PNP_TELEMETRY_COMPONENT_PROPERTY            "$.sub"
+
+/* The simulated sensor moves each sample this fraction of the way to the
+ * targetTemperature, with up to PNP_SIMULATED_SENSOR_NOISE_CELSIUS of noise.
+ */
+#define PNP_SIMULATED_SENSOR_TRACKING               (0.25)
+#define PNP_SIMULATED_SENSOR_NOISE_CELSIUS          (0.1)
+
+/* Overflow policy of each PnP message class when the event queue is full.
+ * The MQTT event callback never blocks: a twin GET response or command that
+ * does not fit is dropped (the hub times the command out). A desired
+ * property patch only carries the properties that changed, so replacing a
+ * pending patch would lose the changes of the one it replaces; a patch that
+ * does not fit is dropped and the PnP task requests the full twin document
+ * instead.
+ */
+#define PNP_TWIN_GET_EVENT_OVERFLOW_POLICY          (IOT_EVENT_OVERFLOW_DROP_NEWEST)
+#define PNP_TWIN_DESIRED_EVENT_OVERFLOW_POLICY      (IOT_EVENT_OVERFLOW_DROP_NEWEST)
+#define PNP_COMMAND_EVENT_OVERFLOW_POLICY           (IOT_EVENT_OVERFLOW_DROP_NEWEST)
 
 #define PNP_MSG_EVENT_QUEUE_LENGTH                  (10)
 
+/* Time for which a getMaxMinReport response is answered from the response
+ * cache when the command is invoked again with the same payload, e.g. by a
+ * retry. The cache is invalidated whenever the temperature statistics
+ * change. Macro value 0 disables caching of the command.
+ */
+#define PNP_GETMAXMINREPORT_CACHE_TTL_MSEC          (10 * 1000)
+
+/* Reported properties changed within this time after the first change are
+ * sent in one twin patch. Changes made while a patch waits for the response
+ * of the hub are sent with the next one.
+ */
+#define PNP_REPORTED_DEBOUNCE_MSEC                  (1000)
+#define PNP_REPORTED_RESPONSE_TIMEOUT_MSEC          (10 * 1000)
+
+/* Duration of a bucket of the temperature statistics. getMaxMinReport
+ * windows are rounded out to whole buckets; IOT_WINDOW_STATS_BUCKETS buckets
+ * with updates are kept, a window that starts before the first update is
+ * answered from the statistics since boot. A window that reaches past the
+ * oldest bucket kept is answered from the buckets kept, with their start as
+ * startTime.
+ */
+#define PNP_STATS_BUCKET_SEC                        (30 * 60)
+
+/* The statistics are kept in seconds of uptime, and the UTC times of
+ * getMaxMinReport are converted with the offset from this SNTP server,
+ * queried once before the hub connection. Without an answer the kit clock
+ * is not known, and getMaxMinReport reports the statistics since boot.
+ */
+#define PNP_TIME_SYNC_SERVER                        "pool.ntp.org"
+
+/* getHistory answers from the telemetry samples of the last
+ * PNP_HISTORY_DEFAULT_SEC unless its payload asks for another duration, in
+ * at most PNP_HISTORY_MAX_POINTS steps so that the response fits its
+ * buffer. Samples are stored in hundredths of a degree.
+ */
+#define PNP_HISTORY_DEFAULT_SEC                     (60 * 60)
+#define PNP_HISTORY_MAX_POINTS                      (30)
+#define PNP_HISTORY_VALUE_SCALE                     (100)
+
+/* Deferred commands (getHistory) run on the command worker and are answered
+ * when they finish. IoT Hub waits 30 s for a direct method response by
+ * default; a deferred command still queued or running after this time is
+ * answered with status 504 so that the caller gets the device's answer.
+ */
+#define PNP_COMMAND_ASYNC_TIMEOUT_MSEC              (25 * 1000)
+
+/* Accepted range of the desired targetTemperature, other values are ignored */
+#define PNP_TARGET_TEMPERATURE_MIN_CELSIUS          (-40.0)
+#define PNP_TARGET_TEMPERATURE_MAX_CELSIUS          (125.0)
+
+/* Range of the writable properties in PNP_THERMOSTAT_WRITABLE_PROPERTY_DEFS,
+ * the DTDL model has none.
+ */
+#define PNP_THERMOSTAT_TARGET_TEMPERATURE_RANGE     true, PNP_TARGET_TEMPERATURE_MIN_CELSIUS, PNP_TARGET_TEMPERATURE_MAX_CELSIUS
+
+/* Desired properties are routed to their thermostat by the bit of their
+ * table entry, one bit per thermostat.
+ */
+#if PNP_THERMOSTAT_WRITABLE_PROPERTY_COUNT != 1
+#error "The desired property handling expects one writable property per thermostat"
+#endif
+
+
+/* Twin requests matched to their responses by the request tracker. A twin
+ * GET without a response is published again up to PNP_TWIN_GET_MAX_RETRIES
+ * times; lost reported property patches are resent by the reported
+ * property writer.
+ */
+#define PNP_REQUEST_OP_TWIN_GET                     (0)
+#define PNP_REQUEST_OP_TWIN_PATCH                   (1)
+#define PNP_REQUEST_OP_COUNT                        (2)
+
+#define PNP_TWIN_GET_TIMEOUT_MSEC                   (10 * 1000)
+#define PNP_TWIN_GET_MAX_RETRIES                    (2)
+
+/* The desired section of pnp_twin_store, which tracks the twin $version
+ * in RAM, is kept as a snapshot in protected storage and saved after every
+ * applied document or patch. A run that starts with a snapshot applies its
+ * targetTemperature values right away, and still requests the twin
+ * document, since the hub does not replay the desired property patches sent
+ * while the device was offline; the document then applies only the values
+ * that differ from the snapshot. Macro value 0 starts without the snapshot.
+ * Requires CY_TFM_PSA_SUPPORTED: the app runs once per boot, so a snapshot
+ * kept in RAM would never be used.
+ */
+#define PNP_TWIN_SNAPSHOT_ENABLE                    (1)
+#define PNP_TWIN_SNAPSHOT_FORMAT                    (0x504E5033UL) /* "PNP3" */
+
+#if ( PNP_TWIN_SNAPSHOT_ENABLE && (defined CY_TFM_PSA_SUPPORTED) )
+#define PNP_TWIN_SNAPSHOT_PERSIST                   (1)
+#else
+#define PNP_TWIN_SNAPSHOT_PERSIST                   (0)
+#endif
+
+/* Fields of the reported properties managed by the reported property
+ * writer, PNP_REPORTED_FIELDS_PER_THERMOSTAT for each thermostat. The writer
+ * sends only the fields that differ from the values last acknowledged by the
+ * hub; the targetTemperature acknowledgement is identified by its ack
+ * version.
+ */
+#define PNP_REPORTED_FIELD_TARGET_TEMPERATURE       (0)
+#define PNP_REPORTED_FIELD_MAX_TEMPERATURE          (1)
+#define PNP_REPORTED_FIELDS_PER_THERMOSTAT          (2)
+
+#define PNP_REPORTED_FIELD(thermostat, field)       ((uint8_t)((thermostat) * PNP_REPORTED_FIELDS_PER_THERMOSTAT + (field)))
+
+#if ( (PNP_THERMOSTAT_COUNT * PNP_REPORTED_FIELDS_PER_THERMOSTAT) > IOT_REPORTED_WRITER_MAX_FIELDS ) || \
+    ( PNP_THERMOSTAT_COUNT > IOT_PROPERTY_TABLE_MAX_NESTED ) || \
+    ( PNP_THERMOSTAT_COUNT > IOT_TWIN_STORE_MAX_FIELDS )
+#error "Too many PnP thermostat components"
+#endif
+
 /*String that describes the MQTT handle that is being created in order to uniquely identify it*/
 #define MQTT_HANDLE_DESCRIPTOR                      "MQTThandleID"
 
@@ -109,8 +288,8 @@ static az_iot_hub_client                   hub_client;
 static char                                mqtt_client_username_buffer[IOT_SAMPLE_APP_BUFFER_SIZE_IN_BYTES];
 static char                                mqtt_endpoint_buffer[IOT_SAMPLE_APP_BUFFER_SIZE_IN_BYTES];
 static volatile bool                       connect_state = false;
-static uint32_t                            connection_request_id_int = 0;
-static char                                connection_request_id_buffer[CONNECTION_REQUEST_ID_BUFFER_SIZE];
+/* Set by the MQTT event callback when a desired property patch is dropped */
+static volatile bool                       pnp_twin_desired_dropped = false;
 
 #if SAS_TOKEN_AUTH
 static iot_sample_credentials              sas_credentials;
@@ -121,27 +300,37 @@ static char                                sas_token_buffer[IOT_SAMPLE_APP_BUFFE
 /***********************************************************
  * Constants
  ************************************************************/
+/* Property, telemetry and command names of the Thermostat interface, and the
+ * templates of its reported properties and getMaxMinReport response, are
+ * generated from scripts/dtdl/Thermostat.json in mqtt_iot_pnp_model.c.
+ */
+
 /* IoT Hub Device Twin Values */
-static az_span const twin_desired_name = AZ_SPAN_LITERAL_FROM_STR("desired");
 static az_span const twin_version_name = AZ_SPAN_LITERAL_FROM_STR("$version");
 static az_span const twin_success_name = AZ_SPAN_LITERAL_FROM_STR("success");
-static az_span const twin_value_name = AZ_SPAN_LITERAL_FROM_STR("value");
-static az_span const twin_ack_code_name = AZ_SPAN_LITERAL_FROM_STR("ac");
-static az_span const twin_ack_version_name = AZ_SPAN_LITERAL_FROM_STR("av");
-static az_span const twin_ack_description_name = AZ_SPAN_LITERAL_FROM_STR("ad");
-static az_span const twin_desired_temperature_property_name = AZ_SPAN_LITERAL_FROM_STR("targetTemperature");
-static az_span const twin_reported_maximum_temperature_property_name = AZ_SPAN_LITERAL_FROM_STR("maxTempSinceLastReboot");
-
-/* IoT Hub Method (Command) Values */
-static az_span const command_getMaxMinReport_name = AZ_SPAN_LITERAL_FROM_STR("getMaxMinReport");
-static az_span const command_max_temp_name = AZ_SPAN_LITERAL_FROM_STR("maxTemp");
-static az_span const command_min_temp_name = AZ_SPAN_LITERAL_FROM_STR("minTemp");
-static az_span const command_avg_temp_name = AZ_SPAN_LITERAL_FROM_STR("avgTemp");
+
+/* getHistory is an extension of this device, not part of the model. */
 static az_span const command_start_time_name = AZ_SPAN_LITERAL_FROM_STR("startTime");
 static az_span const command_end_time_name = AZ_SPAN_LITERAL_FROM_STR("endTime");
+static az_span const command_getHistory_name = AZ_SPAN_LITERAL_FROM_STR("getHistory");
+static az_span const command_seconds_name = AZ_SPAN_LITERAL_FROM_STR("seconds");
+static az_span const command_step_name = AZ_SPAN_LITERAL_FROM_STR("step");
+static az_span const command_points_name = AZ_SPAN_LITERAL_FROM_STR("points");
 static az_span const command_empty_response_payload = AZ_SPAN_LITERAL_FROM_STR("{}");
 
-/* IoT Hub Telemetry Values */
+/* Component wrapper of the reported properties as a precompiled JSON
+ * template: only the component name is written at run time.
+ */
+static iot_json_template_part const pnp_component_begin_parts[] =
+{
+    IOT_JSON_TEMPLATE_PART("", IOT_JSON_SLOT_STRING),
+    IOT_JSON_TEMPLATE_PART(":{\"__t\":\"c\"", IOT_JSON_SLOT_NONE)
+};
+static iot_json_template const pnp_component_begin_template = IOT_JSON_TEMPLATE(pnp_component_begin_parts);
+static az_span const json_begin_object = AZ_SPAN_LITERAL_FROM_STR("{");
+static az_span const json_member_separator = AZ_SPAN_LITERAL_FROM_STR(",");
+static az_span const json_end_object = AZ_SPAN_LITERAL_FROM_STR("}");
+
 /* ISO8601 Time Format */
 static char const iso_spec_time_format[] = "%Y-%m-%dT%H:%M:%S%z";
 
@@ -149,69 +338,156 @@ static char const iso_spec_time_format[] = "%Y-%m-%dT%H:%M:%S%z";
  * Global Variables
  ********************************************************************************/
 /* IoT Hub Method (Command) Buffers */
-static char command_start_time_value_buffer[COMMAND_START_TIME_VALUE_BUFFER_SIZE];
 static char command_end_time_value_buffer[COMMAND_END_TIME_VALUE_BUFFER_SIZE];
 static char command_response_payload_buffer[COMMAND_RESPONSE_PAYLOAD_BUFFER_SIZE];
 
-/* PnP Device Values */
-static double device_current_temperature = DEFAULT_START_TEMP_CELSIUS;
-static double device_maximum_temperature = DEFAULT_START_TEMP_CELSIUS;
-static double device_minimum_temperature = DEFAULT_START_TEMP_CELSIUS;
-static double device_temperature_summation = DEFAULT_START_TEMP_CELSIUS;
-static uint32_t device_temperature_count = DEFAULT_START_TEMP_COUNT;
-static double device_average_temperature = DEFAULT_START_TEMP_CELSIUS;
+/* PnP Device Values, one set for each thermostat instance */
+typedef struct pnp_thermostat
+{
+    char const* component;          /* NULL for the default component */
+    iot_stats_value current_temperature;
+    iot_window_stats stats;         /* Every current temperature since boot */
+    int32_t reported_target_temperature_version;
+    iot_stats_value sensor_temperature; /* Last sample of the temperature sensor */
+    iot_time_series history;        /* Telemetry samples, in hundredths of a degree */
+}pnp_thermostat_t;
+
+#define PNP_THERMOSTAT_INIT(name)                                           \
+    { .component = (name),                                                  \
+      .current_temperature = IOT_STATS_VALUE_FROM_DOUBLE(DEFAULT_START_TEMP_CELSIUS), \
+      .sensor_temperature = IOT_STATS_VALUE_FROM_DOUBLE(DEFAULT_START_TEMP_CELSIUS) }
+
+static pnp_thermostat_t pnp_thermostats[PNP_THERMOSTAT_COUNT] =
+{
+#if PNP_COMPONENT_MODEL_ENABLE
+    PNP_THERMOSTAT_INIT(PNP_THERMOSTAT1_COMPONENT),
+    PNP_THERMOSTAT_INIT(PNP_THERMOSTAT2_COMPONENT)
+#else
+    PNP_THERMOSTAT_INIT(NULL)
+#endif
+};
 
-static QueueHandle_t              pnp_msg_event_queue = NULL;
+static iot_event_queue                      pnp_msg_event_queue;
 
-typedef enum pnp_msg_type
+typedef enum pnp_msg_class
 {
-    device_twin_message = 0,
-    device_command_request = 1
-}pnp_msg_type_t;
+    PNP_MSG_CLASS_TWIN_GET = 0,
+    PNP_MSG_CLASS_TWIN_DESIRED = 1,
+    PNP_MSG_CLASS_COMMAND = 2,
+    PNP_MSG_CLASS_COUNT
+}pnp_msg_class_t;
 
-typedef struct pnp_msg_event
+static iot_event_overflow_policy const pnp_msg_class_policy[PNP_MSG_CLASS_COUNT] =
 {
-    pnp_msg_type_t  msg_type;
-    az_iot_status status;
-    bool is_twin_get;
-    az_span command_response_payload;
-    az_span message_span;
-    az_iot_hub_client_method_request *method_req;
-}pnp_msg_event_t;
+    PNP_TWIN_GET_EVENT_OVERFLOW_POLICY,
+    PNP_TWIN_DESIRED_EVENT_OVERFLOW_POLICY,
+    PNP_COMMAND_EVENT_OVERFLOW_POLICY
+};
+
+/* Desired properties tracked by pnp_twin_store. Entry n is the
+ * targetTemperature of thermostat n, so field n of the store routes a value
+ * to its thermostat. The targetTemperature of a component is a nested path
+ * under the component. The store keeps the values, the offsets are unused.
+ */
+static iot_property_def const pnp_desired_properties[PNP_THERMOSTAT_COUNT] =
+{
+#if PNP_COMPONENT_MODEL_ENABLE
+    PNP_THERMOSTAT_WRITABLE_PROPERTY_DEFS(PNP_THERMOSTAT1_COMPONENT ".", 0),
+    PNP_THERMOSTAT_WRITABLE_PROPERTY_DEFS(PNP_THERMOSTAT2_COMPONENT ".", 0)
+#else
+    PNP_THERMOSTAT_WRITABLE_PROPERTY_DEFS("", 0)
+#endif
+};
 
-/* The network buffer must remain valid for the lifetime of the MQTT context. */
-static uint8_t                             *buffer = NULL;
+/* Last known desired state and twin $version of the PnP device */
+static iot_twin_store                       pnp_twin_store;
 
-/******************************************************************************
- * Function Name: get_request_id
- ******************************************************************************
- * Summary:
- *  Function to get request ID, used during send/receive operations for device
- *  twin property.
- *
- * Parameters:
- *  void
- *
- * Return:
- *  az_span: Represents a "view" over a byte buffer that represents a contiguous
- *  region of memory. It contains a pointer to the start of the byte buffer and
- *  the buffer's size.
- *
- ******************************************************************************/
-static az_span get_request_id(void)
+static char const* const pnp_msg_class_name[PNP_MSG_CLASS_COUNT] =
 {
-    az_span remainder;
-    az_span out_span = az_span_create(
-            (uint8_t*)connection_request_id_buffer, sizeof(connection_request_id_buffer));
+    "twin_get",
+    "twin_desired",
+    "command"
+};
+
+/* Builds the response payload of a command of a thermostat, returns false on
+ * a bad request
+ */
+typedef bool (*pnp_command_handler_t)(pnp_thermostat_t const* thermostat, az_span payload,
+        az_span response, az_span* out_response);
+
+/* Commands of the PnP model. Commands with a cache TTL are idempotent within
+ * that time and their responses are served from the response cache.
+ * Deferred commands run on the command worker and are answered later; they
+ * are not cached.
+ */
+typedef struct pnp_command
+{
+    az_span const* name;
+    pnp_command_handler_t handler;
+    uint32_t cache_ttl_msec;
+    bool deferred;
+}pnp_command_t;
+
+/* Rows of a getHistory response while the history is downsampled */
+typedef struct pnp_history_response
+{
+    az_json_writer* jw;
+    time_t start;                   /* Time of row offset 0 */
+    az_result rc;
+}pnp_history_response_t;
 
-    az_result rc = az_span_u32toa(out_span, connection_request_id_int++, &remainder);
-    if (az_result_failed(rc))
-    {
-        IOT_SAMPLE_LOG_ERROR("\r\nFailed to get request id: az_result return code 0x%08x.", (unsigned int)rc);
-        return (remainder);
-    }
-    return az_span_slice(out_span, 0, az_span_size(out_span) - az_span_size(remainder));
-}
+static iot_method_cache                     pnp_command_response_cache;
+
+static iot_async_command_pool               pnp_async_commands;
+
+/* Guards the telemetry history, which deferred commands read on the worker */
+static SemaphoreHandle_t                    pnp_history_mutex = NULL;
+
+static iot_reported_writer                  pnp_reported_writer;
+
+static iot_request_tracker                  pnp_request_tracker;
+static char const* const                    pnp_request_op_names[PNP_REQUEST_OP_COUNT] = { "twin_get", "twin_patch" };
+
+#if PNP_TWIN_SNAPSHOT_PERSIST
+/* Desired state applied last, saved as a snapshot after every change */
+typedef struct pnp_twin_snapshot
+{
+    uint32_t format;
+    iot_twin_section desired;       /* Desired section of pnp_twin_store */
+    int32_t target_temperature_version[PNP_THERMOSTAT_COUNT];
+}pnp_twin_snapshot_t;
+
+static pnp_twin_snapshot_t                  pnp_twin_snapshot;
+#endif
+
+/* Telemetry topic of each thermostat and the payload buffer, built before
+ * the first sample.
+ */
+static char                                 pnp_telemetry_topic[PNP_THERMOSTAT_COUNT][PNP_TELEMETRY_TOPIC_BUFFER_SIZE];
+static uint16_t                             pnp_telemetry_topic_len[PNP_THERMOSTAT_COUNT];
+static uint8_t                              pnp_telemetry_payload_buffer[PNP_TELEMETRY_PAYLOAD_BUFFER_SIZE];
+
+/* Lateness of each telemetry publish behind its schedule, split by whether
+ * a command was handled since the previous publish.
+ */
+typedef enum pnp_telemetry_jitter_class
+{
+    PNP_TELEMETRY_JITTER_IDLE = 0,
+    PNP_TELEMETRY_JITTER_COMMANDS = 1,
+    PNP_TELEMETRY_JITTER_COUNT
+}pnp_telemetry_jitter_class_t;
+
+static iot_event_latency_stats              pnp_telemetry_jitter[PNP_TELEMETRY_JITTER_COUNT];
+static uint32_t                             pnp_telemetry_skipped = 0;
+
+/* Telemetry samples with one channel per thermostat, summarized when the
+ * app ends. It is sized for IOT_CHANNEL_STATS_MAX_CHANNELS channels, so it
+ * is allocated only while telemetry is enabled.
+ */
+static iot_channel_stats*                   pnp_channel_stats = NULL;
+
+/* The network buffer must remain valid for the lifetime of the MQTT context. */
+static uint8_t                             *buffer = NULL;
 
 /******************************************************************************
  * Function Name: send_command_response
@@ -220,7 +496,7 @@ static az_span get_request_id(void)
  *  Send methods response to Azure hub.
  *
  * Parameters:
- *  command_request: A method request received from IoT Hub.
+ *  request_id: Request ID of the method request received from IoT Hub.
  *
  *  status: Azure IoT service status codes.
  *
@@ -232,7 +508,7 @@ static az_span get_request_id(void)
  *  void
  ******************************************************************************/
 static void send_command_response(
-        az_iot_hub_client_method_request const* command_request,
+        az_span request_id,
         az_iot_status status,
         az_span response)
 {
@@ -245,7 +521,7 @@ static void send_command_response(
     char methods_response_topic_buffer[METHODS_RESPONSE_TOPIC_BUFFER_SIZE];
     rc = az_iot_hub_client_methods_response_get_publish_topic(
             &hub_client,
-            command_request->request_id,
+            request_id,
             (uint16_t)status,
             methods_response_topic_buffer,
             sizeof(methods_response_topic_buffer),
@@ -282,102 +558,113 @@ static void send_command_response(
 }
 
 /******************************************************************************
- * Function Name: build_property_payload
+ * Function Name: append_temperature
  ******************************************************************************
  * Summary:
- *  Function to build JSON format of properties for method feature response.
+ *  Function to append a temperature to a JSON payload. A Q16.16 temperature
+ *  (IOT_STATS_FIXED_POINT) is formatted with integer math.
  *
  * Parameters:
- *  property_count: Number of properties to be reported.
- *
- *  names: Names of properties to be reported.
+ *  jw: JSON writer.
  *
- *  values: Values of properties to be reported.
+ *  temperature: Temperature in degrees Celsius.
  *
- *  times: Start and end time duration.
+ * Return:
+ *  az_result: AZ_OK on success.
  *
- *  property_payload: Response message payload.
+ ******************************************************************************/
+static az_result append_temperature(az_json_writer* jw, iot_stats_value temperature)
+{
+#if IOT_STATS_FIXED_POINT
+    char text[IOT_STATS_Q16_TEXT_SIZE];
+    size_t length = iot_stats_format_q16(temperature, DOUBLE_DECIMAL_PLACE_DIGITS, text);
+
+    return az_json_writer_append_json_text(jw, az_span_create((uint8_t*)text, (int32_t)length));
+#else
+    return az_json_writer_append_double(jw, temperature, DOUBLE_DECIMAL_PLACE_DIGITS);
+#endif
+}
+
+/******************************************************************************
+ * Function Name: temperature_to_history_value
+ ******************************************************************************
+ * Summary:
+ *  Function to convert a temperature to hundredths of a degree for the
+ *  history, rounded to nearest.
  *
- *  out_property_payload: Response message payload.
+ * Parameters:
+ *  temperature: Temperature in degrees Celsius.
  *
  * Return:
- *  void
+ *  int32_t: Temperature in hundredths of a degree.
  *
  ******************************************************************************/
-static void build_property_payload(
-        uint8_t property_count,
-        az_span const names[],
-        double const values[],
-        az_span const times[],
-        az_span property_payload,
-        az_span* out_property_payload)
+static int32_t temperature_to_history_value(iot_stats_value temperature)
 {
-    az_json_writer jw;
-    az_result rc;
+#if IOT_STATS_FIXED_POINT
+    int64_t scaled = (int64_t)temperature * PNP_HISTORY_VALUE_SCALE;
 
-    rc = az_json_writer_init(&jw, property_payload, NULL);
-    if (az_result_failed(rc))
-    {
-        IOT_SAMPLE_LOG_ERROR("Failed to build property payload");
-        return;
-    }
-    rc = az_json_writer_append_begin_object(&jw);
-    if (az_result_failed(rc))
-    {
-        IOT_SAMPLE_LOG_ERROR("Failed to build property payload");
-        return;
-    }
-    for (uint8_t i = 0; i < property_count; i++)
-    {
-        rc = az_json_writer_append_property_name(&jw, names[i]);
-        if (az_result_failed(rc))
-        {
-            IOT_SAMPLE_LOG_ERROR("Failed to build property payload");
-            return;
-        }
-        rc = az_json_writer_append_double(&jw, values[i], DOUBLE_DECIMAL_PLACE_DIGITS);
-        if (az_result_failed(rc))
-        {
-            IOT_SAMPLE_LOG_ERROR("Failed to build property payload");
-            return;
-        }
-    }
+    return (int32_t)(((scaled < 0) ? (scaled - IOT_STATS_Q16_ONE / 2) : (scaled + IOT_STATS_Q16_ONE / 2)) /
+            IOT_STATS_Q16_ONE);
+#else
+    return (int32_t)((temperature * PNP_HISTORY_VALUE_SCALE) + ((temperature < 0) ? -0.5 : 0.5));
+#endif
+}
 
-    if (times != NULL)
-    {
-        rc = az_json_writer_append_property_name(&jw, command_start_time_name);
-        if (az_result_failed(rc))
-        {
-            IOT_SAMPLE_LOG_ERROR("Failed to build property payload");
-            return;
-        }
-        rc = az_json_writer_append_string(&jw, times[0]);
-        if (az_result_failed(rc))
-        {
-            IOT_SAMPLE_LOG_ERROR("Failed to build property payload");
-            return;
-        }
-        rc = az_json_writer_append_property_name(&jw, command_end_time_name);
-        if (az_result_failed(rc))
-        {
-            IOT_SAMPLE_LOG_ERROR("Failed to build property payload");
-            return;
-        }
-        rc = az_json_writer_append_string(&jw, times[1]);
-        if (az_result_failed(rc))
-        {
-            IOT_SAMPLE_LOG_ERROR("Failed to build property payload");
-            return;
-        }
-    }
+/******************************************************************************
+ * Function Name: history_value_to_temperature
+ ******************************************************************************
+ * Summary:
+ *  Function to convert hundredths of a degree from the history to a
+ *  temperature.
+ *
+ * Parameters:
+ *  value: Temperature in hundredths of a degree.
+ *
+ * Return:
+ *  iot_stats_value: Temperature in degrees Celsius.
+ *
+ ******************************************************************************/
+static iot_stats_value history_value_to_temperature(int32_t value)
+{
+#if IOT_STATS_FIXED_POINT
+    return (int32_t)(((int64_t)value * IOT_STATS_Q16_ONE) / PNP_HISTORY_VALUE_SCALE);
+#else
+    return (double)value / PNP_HISTORY_VALUE_SCALE;
+#endif
+}
 
-    rc = az_json_writer_append_end_object(&jw);
-    if (az_result_failed(rc))
-    {
-        IOT_SAMPLE_LOG_ERROR("Failed to build property payload");
-        return;
-    }
-    *out_property_payload = az_json_writer_get_bytes_used_in_destination(&jw);
+/******************************************************************************
+ * Function Name: format_temperature
+ ******************************************************************************
+ * Summary:
+ *  Function to format a temperature for a JSON template slot, as
+ *  append_temperature() writes it.
+ *
+ * Parameters:
+ *  temperature: Temperature in degrees Celsius.
+ *
+ *  text: Destination, PNP_TEMPERATURE_TEXT_SIZE bytes.
+ *
+ *  out_text: Formatted temperature in the destination.
+ *
+ * Return:
+ *  az_result: AZ_OK on success.
+ *
+ ******************************************************************************/
+static az_result format_temperature(iot_stats_value temperature, uint8_t* text, az_span* out_text)
+{
+#if IOT_STATS_FIXED_POINT
+    *out_text = az_span_create(text, (int32_t)iot_stats_format_q16(temperature, DOUBLE_DECIMAL_PLACE_DIGITS, (char*)text));
+    return AZ_OK;
+#else
+    az_span remainder;
+    az_result rc = az_span_dtoa(az_span_create(text, PNP_TEMPERATURE_TEXT_SIZE), temperature,
+            DOUBLE_DECIMAL_PLACE_DIGITS, &remainder);
+
+    *out_text = az_span_create(text, PNP_TEMPERATURE_TEXT_SIZE - az_span_size(remainder));
+    return rc;
+#endif
 }
 
 /******************************************************************************
@@ -387,6 +674,8 @@ static void build_property_payload(
  *  Function to build method response payload for command invoked by Azure Hub.
  *
  * Parameters:
+ *  thermostat: Thermostat the command was invoked on.
+ *
  *  payload: Payload of message received from Azure hub method invocation.
  *
  *  response: Response message payload.
@@ -397,750 +686,1606 @@ static void build_property_payload(
  *  bool
  *
  ******************************************************************************/
-static bool invoke_getMaxMinReport(az_span payload, az_span response, az_span* out_response)
+static bool invoke_getMaxMinReport(pnp_thermostat_t const* thermostat, az_span payload,
+        az_span response, az_span* out_response)
 {
-    int32_t incoming_since_value_len = 0;
-    az_result rc;
+    pnp_thermostat_get_max_min_report_request_t request;
+    pnp_thermostat_get_max_min_report_response_t report;
+    az_result rc = AZ_OK;
+    time_t since;
+    time_t window_start;
+    time_t start;
+    time_t now;
+    struct tm timeinfo;
+    size_t length;
+    char start_time_buffer[COMMAND_START_TIME_VALUE_BUFFER_SIZE];
+    iot_running_stats window;
 
     /* Parse the `since` field in the payload. */
-    az_json_reader jr;
-    rc = az_json_reader_init(&jr, payload, NULL);
-    if (az_result_failed(rc))
+    if (!pnp_thermostat_get_max_min_report_request_parse(payload, &request))
     {
-        IOT_SAMPLE_LOG_ERROR("Failed az_json_reader_init: az_result return code 0x%08x.", (unsigned int)rc);
-        return false;
-    }
-    rc = az_json_reader_next_token(&jr);
-    if (az_result_failed(rc))
-    {
-        IOT_SAMPLE_LOG_ERROR("Failed az_json_reader_next_token: az_result return code 0x%08x.", (unsigned int)rc);
+        IOT_SAMPLE_LOG_ERROR("Failed to parse the getMaxMinReport payload.");
+        *out_response = command_empty_response_payload;
         return false;
     }
-    rc = az_json_token_get_string(
-            &jr.token,
-            command_start_time_value_buffer,
-            sizeof(command_start_time_value_buffer),
-            &incoming_since_value_len);
-    if (az_result_failed(rc))
+
+    /* Set the response payload to error if the `since` value was empty or
+     * is not a time.
+     */
+    if ((request.since_len == 0) ||
+        !iot_window_stats_parse_iso8601(request.since, (size_t)request.since_len, &since))
     {
-        IOT_SAMPLE_LOG_ERROR("Failed az_json_token_get_string: az_result return code 0x%08x.", (unsigned int)rc);
+        *out_response = command_empty_response_payload;
         return false;
     }
 
-    /* Set the response payload to error if the `since` value was empty. */
-    if (incoming_since_value_len == 0)
+    report.start_time = az_span_create((uint8_t*)request.since, request.since_len);
+
+    /* The statistics are kept in uptime. Without a synchronized clock the
+     * window cannot be placed in it, so the statistics since boot are
+     * reported, up to the kit time.
+     */
+    if (!iot_time_sync_to_uptime(since, &window_start))
     {
-        *out_response = command_empty_response_payload;
-        return false;
+        IOT_SAMPLE_LOG("Clock not synchronized, reporting the statistics since boot.");
+        window = thermostat->stats.lifetime;
+        now = time(NULL);
     }
+    else
+    {
+        /* Without an update in the window, the temperature was the current
+         * one throughout.
+         */
+        if (!iot_window_stats_query(&thermostat->stats, window_start, &window, &window_start))
+        {
+            iot_running_stats_add(&window, thermostat->current_temperature);
+        }
 
-    az_span start_time_span
-    = az_span_create((uint8_t*)command_start_time_value_buffer, incoming_since_value_len);
+        /* The older buckets of a truncated window were replaced, so the
+         * window reported starts at the oldest bucket kept.
+         */
+        (void)iot_time_sync_to_utc(window_start, &start);
+        if (start > since)
+        {
+            (void)localtime_r(&start, &timeinfo);
+            length = strftime(start_time_buffer, sizeof(start_time_buffer), iso_spec_time_format, &timeinfo);
+            report.start_time = az_span_create((uint8_t*)start_time_buffer, (int32_t)length);
+        }
+        (void)iot_time_sync_to_utc(iot_time_sync_uptime(), &now);
+    }
 
-    IOT_SAMPLE_LOG_AZ_SPAN("Start time:", start_time_span);
+    IOT_SAMPLE_LOG_AZ_SPAN("Start time:", report.start_time);
 
     /* Get the current time as a string. */
-    time_t rawtime;
-    struct tm* timeinfo;
-    time(&rawtime);
-    timeinfo = localtime(&rawtime);
-    size_t length = strftime(
-            command_end_time_value_buffer,
-            sizeof(command_end_time_value_buffer),
-            iso_spec_time_format,
-            timeinfo);
-    az_span end_time_span = az_span_create((uint8_t*)command_end_time_value_buffer, (int32_t)length);
-
-    IOT_SAMPLE_LOG_AZ_SPAN("End Time:", end_time_span);
+    (void)localtime_r(&now, &timeinfo);
+    length = strftime(command_end_time_value_buffer, sizeof(command_end_time_value_buffer),
+            iso_spec_time_format, &timeinfo);
+    report.end_time = az_span_create((uint8_t*)command_end_time_value_buffer, (int32_t)length);
+
+    IOT_SAMPLE_LOG_AZ_SPAN("End Time:", report.end_time);
 
     /* Build command response message. */
-    uint8_t count = 3;
-    az_span const names[3] = { command_max_temp_name, command_min_temp_name, command_avg_temp_name };
-    double const values[3] = { device_maximum_temperature, device_minimum_temperature, device_average_temperature };
-    az_span const times[2] = { start_time_span, end_time_span };
+    uint8_t temperature_text[3][PNP_TEMPERATURE_TEXT_SIZE];
+    az_span remainder = response;
 
-    build_property_payload(count, names, values, times, response, out_response);
+    rc = format_temperature(window.max, temperature_text[0], &report.max_temp);
+    if (az_result_succeeded(rc))
+    {
+        rc = format_temperature(window.min, temperature_text[1], &report.min_temp);
+    }
+    if (az_result_succeeded(rc))
+    {
+        rc = format_temperature(iot_running_stats_mean(&window), temperature_text[2], &report.avg_temp);
+    }
+    if (az_result_succeeded(rc))
+    {
+        rc = pnp_thermostat_get_max_min_report_response_append(&report, &remainder);
+    }
+    if (az_result_failed(rc))
+    {
+        IOT_SAMPLE_LOG_ERROR("Failed to build property payload");
+        *out_response = command_empty_response_payload;
+        return false;
+    }
 
+    *out_response = az_span_slice(response, 0, az_span_size(response) - az_span_size(remainder));
     return true;
 }
 
 /******************************************************************************
- * Function Name: handle_command_request
+ * Function Name: append_history_point
  ******************************************************************************
  * Summary:
- *  Handle for Azure hub method invocation.
+ *  Time series callback to append a downsampled step to a getHistory
+ *  response as [offset, average, minimum, maximum].
  *
  * Parameters:
- *  message: MQTT publish/receive information structure.
+ *  context: getHistory response.
  *
- *  command_request: A method request received from IoT Hub.
+ *  bucket: Samples of the step.
  *
  * Return:
- *  void
+ *  bool: false if the response buffer is full.
  *
  ******************************************************************************/
-static void handle_command_request(cy_mqtt_publish_info_t *message,
-        az_iot_hub_client_method_request * command_request)
+static bool append_history_point(void* context, iot_time_series_bucket const* bucket)
 {
-    az_span message_span = az_span_create((uint8_t*)message->payload, message->payload_len);
-    pnp_msg_event_t *msg_event = NULL;
+    pnp_history_response_t* history = (pnp_history_response_t*)context;
+    int64_t half = (int64_t)(bucket->count / 2);
+    int32_t average = (int32_t)(((bucket->sum < 0) ? (bucket->sum - half) : (bucket->sum + half)) /
+            (int64_t)bucket->count);
+    az_result rc;
 
-    msg_event = (pnp_msg_event_t *) malloc(sizeof(pnp_msg_event_t));
-    if(msg_event == NULL)
+    rc = az_json_writer_append_begin_array(history->jw);
+    if (az_result_succeeded(rc))
     {
-        IOT_SAMPLE_LOG("Memory not available...");
-        return;
+        rc = az_json_writer_append_int32(history->jw, (int32_t)(bucket->start - history->start));
     }
-    msg_event->msg_type = device_command_request;
-
-    if (az_span_is_content_equal(command_getMaxMinReport_name, command_request->name))
+    if (az_result_succeeded(rc))
     {
-        az_iot_status status;
-        az_span command_response_payload = AZ_SPAN_FROM_BUFFER(command_response_payload_buffer);
-
-        /* Invoke command. */
-        if (invoke_getMaxMinReport(message_span, command_response_payload, &command_response_payload))
-        {
-            status = AZ_IOT_STATUS_BAD_REQUEST;
-        }
-        else
-        {
-            status = AZ_IOT_STATUS_OK;
-        }
-        IOT_SAMPLE_LOG_SUCCESS("Client invoked command 'getMaxMinReport'.");
-        msg_event->method_req = command_request;
-        msg_event->status = status;
-        memcpy(&(msg_event->command_response_payload), &command_response_payload, sizeof(az_span));
+        rc = append_temperature(history->jw, history_value_to_temperature(average));
     }
-    else
+    if (az_result_succeeded(rc))
     {
-        IOT_SAMPLE_LOG_AZ_SPAN("Command not supported:", command_request->name);
-        msg_event->method_req = command_request;
-        msg_event->status = AZ_IOT_STATUS_NOT_FOUND;
-        memcpy(&(msg_event->command_response_payload), &command_empty_response_payload, sizeof(az_span));
+        rc = append_temperature(history->jw, history_value_to_temperature(bucket->min));
     }
-
-    TEST_INFO(("Pushing to PNP message (device_command_request) event queue...\n"));
-    if( xQueueSend( pnp_msg_event_queue, (void *)&msg_event, pdMS_TO_TICKS(PNP_MSG_EVENT_QUEUE_MSEC) ) != pdPASS )
+    if (az_result_succeeded(rc))
     {
-        TEST_INFO(("Pushing to PNP message event queue failed\n"));
-        free(msg_event);
-        return;
+        rc = append_temperature(history->jw, history_value_to_temperature(bucket->max));
     }
-    TEST_INFO(("Message (device_command_request) queued to PNP message event queue...\n"));
+    if (az_result_succeeded(rc))
+    {
+        rc = az_json_writer_append_end_array(history->jw);
+    }
+
+    history->rc = rc;
+    return az_result_succeeded(rc);
 }
 
 /******************************************************************************
- * Function Name: build_property_payload_with_status
+ * Function Name: invoke_getHistory
  ******************************************************************************
  * Summary:
- *  Function to build JSON format of properties for twin feature response.
+ *  Function to build the response of the getHistory command from the
+ *  telemetry samples of a thermostat. The optional payload
+ *  {"seconds":3600,"step":120} selects the duration before now and the step
+ *  of the points; each point is [offset from startTime, average, minimum,
+ *  maximum] of a step with samples. Runs on the command worker, so it uses
+ *  no buffers shared with the PnP task and reads the history under
+ *  pnp_history_mutex.
  *
  * Parameters:
- *  name: Names of properties to be reported.
+ *  thermostat: Thermostat the command was invoked on.
  *
- *  value: Values of properties to be reported.
- *
- *  ack_code_value: Value of acknowledgment code.
- *
- *  ack_version_value: Value of acknowledgment version.
- *
- *  ack_description_value: Acknowledgment message value.
+ *  payload: Payload of message received from Azure hub method invocation.
  *
- *  property_payload: Message payload for property to be reported.
+ *  response: Response message payload.
  *
- *  out_property_payload: Message payload for property to be reported.
+ *  out_response: Response message payload.
  *
  * Return:
- *  void
+ *  bool: false on a bad request.
  *
  ******************************************************************************/
-static void build_property_payload_with_status(
-        az_span name,
-        double value,
-        int32_t ack_code_value,
-        int32_t ack_version_value,
-        az_span ack_description_value,
-        az_span property_payload,
-        az_span* out_property_payload)
+static bool invoke_getHistory(pnp_thermostat_t const* thermostat, az_span payload,
+        az_span response, az_span* out_response)
 {
+    uint32_t seconds = PNP_HISTORY_DEFAULT_SEC;
+    uint32_t step = 0;
+    uint32_t* field;
+    pnp_history_response_t history;
+    az_json_reader jr;
     az_json_writer jw;
-    az_result rc;
+    az_result rc = AZ_OK;
+    time_t now = time(NULL);
+    size_t length;
+    struct tm timeinfo;
+    char start_time_buffer[COMMAND_START_TIME_VALUE_BUFFER_SIZE];
+    char end_time_buffer[COMMAND_END_TIME_VALUE_BUFFER_SIZE];
+
+    *out_response = command_empty_response_payload;
+
+    /* Parse the optional `seconds` and `step` fields of the payload. */
+    if ((az_span_size(payload) > 0) &&
+        az_result_succeeded(az_json_reader_init(&jr, payload, NULL)) &&
+        az_result_succeeded(az_json_reader_next_token(&jr)) &&
+        (jr.token.kind == AZ_JSON_TOKEN_BEGIN_OBJECT))
+    {
+        while (az_result_succeeded(rc = az_json_reader_next_token(&jr)) &&
+               (jr.token.kind == AZ_JSON_TOKEN_PROPERTY_NAME))
+        {
+            field = NULL;
+            if (az_json_token_is_text_equal(&jr.token, command_seconds_name))
+            {
+                field = &seconds;
+            }
+            else if (az_json_token_is_text_equal(&jr.token, command_step_name))
+            {
+                field = &step;
+            }
 
-    rc = az_json_writer_init(&jw, property_payload, NULL);
-    if (az_result_failed(rc))
-    {
-        IOT_SAMPLE_LOG_ERROR("Failed to build property payload with status");
-        return;
+            rc = az_json_reader_next_token(&jr);
+            if (az_result_succeeded(rc))
+            {
+                rc = (field != NULL) ? az_json_token_get_uint32(&jr.token, field) : az_json_reader_skip_children(&jr);
+            }
+            if (az_result_failed(rc))
+            {
+                break;
+            }
+        }
+        if (az_result_failed(rc) || (seconds == 0))
+        {
+            IOT_SAMPLE_LOG_ERROR("Invalid getHistory payload.");
+            return false;
+        }
     }
 
-    rc = az_json_writer_append_begin_object(&jw);
-    if (az_result_failed(rc))
-    {
-        IOT_SAMPLE_LOG_ERROR("Failed to build property payload with status");
-        return;
-    }
-    rc = az_json_writer_append_property_name(&jw, name);
-    if (az_result_failed(rc))
+    /* At most PNP_HISTORY_MAX_POINTS points fit the response. */
+    if (step < ((seconds + PNP_HISTORY_MAX_POINTS - 1) / PNP_HISTORY_MAX_POINTS))
     {
-        IOT_SAMPLE_LOG_ERROR("Failed to build property payload with status");
-        return;
+        step = (seconds + PNP_HISTORY_MAX_POINTS - 1) / PNP_HISTORY_MAX_POINTS;
     }
-    rc = az_json_writer_append_begin_object(&jw);
-    if (az_result_failed(rc))
+
+    history.jw = &jw;
+    history.start = now - (time_t)seconds;
+    history.rc = AZ_OK;
+
+    (void)localtime_r(&history.start, &timeinfo);
+    length = strftime(start_time_buffer, sizeof(start_time_buffer), iso_spec_time_format, &timeinfo);
+    az_span start_time_span = az_span_create((uint8_t*)start_time_buffer, (int32_t)length);
+    (void)localtime_r(&now, &timeinfo);
+    length = strftime(end_time_buffer, sizeof(end_time_buffer), iso_spec_time_format, &timeinfo);
+    az_span end_time_span = az_span_create((uint8_t*)end_time_buffer, (int32_t)length);
+
+    /* Build command response message. */
+    rc = az_json_writer_init(&jw, response, NULL);
+    if (az_result_succeeded(rc))
     {
-        IOT_SAMPLE_LOG_ERROR("Failed to build property payload with status");
-        return;
+        rc = az_json_writer_append_begin_object(&jw);
     }
-    rc = az_json_writer_append_property_name(&jw, twin_value_name);
-    if (az_result_failed(rc))
+    if (az_result_succeeded(rc))
     {
-        IOT_SAMPLE_LOG_ERROR("Failed to build property payload with status");
-        return;
+        rc = az_json_writer_append_property_name(&jw, command_start_time_name);
     }
-    rc =  az_json_writer_append_double(&jw, value, DOUBLE_DECIMAL_PLACE_DIGITS);
-    if (az_result_failed(rc))
+    if (az_result_succeeded(rc))
     {
-        IOT_SAMPLE_LOG_ERROR("Failed to build property payload with status");
-        return;
+        rc = az_json_writer_append_string(&jw, start_time_span);
     }
-    rc = az_json_writer_append_property_name(&jw, twin_ack_code_name);
-    if (az_result_failed(rc))
+    if (az_result_succeeded(rc))
     {
-        IOT_SAMPLE_LOG_ERROR("Failed to build property payload with status");
-        return;
+        rc = az_json_writer_append_property_name(&jw, command_end_time_name);
     }
-    rc = az_json_writer_append_int32(&jw, ack_code_value);
-    if (az_result_failed(rc))
+    if (az_result_succeeded(rc))
     {
-        IOT_SAMPLE_LOG_ERROR("Failed to build property payload with status");
-        return;
+        rc = az_json_writer_append_string(&jw, end_time_span);
     }
-    rc = az_json_writer_append_property_name(&jw, twin_ack_version_name);
-    if (az_result_failed(rc))
+    if (az_result_succeeded(rc))
     {
-        IOT_SAMPLE_LOG_ERROR("Failed to build property payload with status");
-        return;
+        rc = az_json_writer_append_property_name(&jw, command_step_name);
     }
-    rc = az_json_writer_append_int32(&jw, ack_version_value);
-    if (az_result_failed(rc))
+    if (az_result_succeeded(rc))
     {
-        IOT_SAMPLE_LOG_ERROR("Failed to build property payload with status");
-        return;
+        rc = az_json_writer_append_int32(&jw, (int32_t)step);
     }
-    rc = az_json_writer_append_property_name(&jw, twin_ack_description_name);
-    if (az_result_failed(rc))
+    if (az_result_succeeded(rc))
     {
-        IOT_SAMPLE_LOG_ERROR("Failed to build property payload with status");
-        return;
+        rc = az_json_writer_append_property_name(&jw, command_points_name);
     }
-    rc = az_json_writer_append_string(&jw, ack_description_value);
-    if (az_result_failed(rc))
+    if (az_result_succeeded(rc))
     {
-        IOT_SAMPLE_LOG_ERROR("Failed to build property payload with status");
-        return;
+        rc = az_json_writer_append_begin_array(&jw);
     }
-    rc = az_json_writer_append_end_object(&jw);
-    if (az_result_failed(rc))
+    if (az_result_succeeded(rc))
     {
-        IOT_SAMPLE_LOG_ERROR("Failed to build property payload with status");
-        return;
+        /* Samples up to and including now */
+        (void)xSemaphoreTake(pnp_history_mutex, portMAX_DELAY);
+        (void)iot_time_series_downsample(&thermostat->history, history.start, now + 1, step,
+                append_history_point, &history);
+        (void)xSemaphoreGive(pnp_history_mutex);
+        rc = history.rc;
+    }
+    if (az_result_succeeded(rc))
+    {
+        rc = az_json_writer_append_end_array(&jw);
+    }
+    if (az_result_succeeded(rc))
+    {
+        rc = az_json_writer_append_end_object(&jw);
     }
-    rc = az_json_writer_append_end_object(&jw);
     if (az_result_failed(rc))
     {
-        IOT_SAMPLE_LOG_ERROR("Failed to build property payload with status");
-        return;
+        IOT_SAMPLE_LOG_ERROR("Failed to build getHistory response: az_result return code 0x%08x.", (unsigned int)rc);
+        return false;
     }
 
-    *out_property_payload = az_json_writer_get_bytes_used_in_destination(&jw);
+    *out_response = az_json_writer_get_bytes_used_in_destination(&jw);
+    return true;
+}
+
+static pnp_command_t const pnp_commands[] =
+{
+    { &pnp_thermostat_command_names[PNP_THERMOSTAT_COMMAND_GET_MAX_MIN_REPORT], invoke_getMaxMinReport,
+      PNP_GETMAXMINREPORT_CACHE_TTL_MSEC, false },
+    { &command_getHistory_name, invoke_getHistory, 0, true }
+};
+
+/******************************************************************************
+ * Function Name: pnp_thermostat_name
+ ******************************************************************************
+ * Summary:
+ *  Function to get the name of a thermostat for the log.
+ *
+ * Parameters:
+ *  thermostat: Thermostat instance.
+ *
+ * Return:
+ *  char const*: Component name, or a placeholder for the default component.
+ *
+ ******************************************************************************/
+static char const* pnp_thermostat_name(pnp_thermostat_t const* thermostat)
+{
+    return (thermostat->component != NULL) ? thermostat->component : "default component";
 }
 
 /******************************************************************************
- * Function Name: send_reported_property
+ * Function Name: find_thermostat
  ******************************************************************************
  * Summary:
- *  Function to get device twin topic and report updated property to Azure.
+ *  Function to find the thermostat instance of a component.
  *
  * Parameters:
- *  name: Name of the device twin property to be sent.
+ *  component: Component name, empty for the default component.
+ *
+ * Return:
+ *  pnp_thermostat_t*: Thermostat of the component, NULL if there is none.
  *
- *  value: Value of the device twin property to be sent.
+ ******************************************************************************/
+static pnp_thermostat_t* find_thermostat(az_span component)
+{
+    for (uint32_t i = 0; i < PNP_THERMOSTAT_COUNT; i++)
+    {
+        if (pnp_thermostats[i].component == NULL)
+        {
+            if (az_span_size(component) == 0)
+            {
+                return &pnp_thermostats[i];
+            }
+        }
+        else if (az_span_is_content_equal(az_span_create_from_str((char*)pnp_thermostats[i].component), component))
+        {
+            return &pnp_thermostats[i];
+        }
+    }
+    return NULL;
+}
+
+/******************************************************************************
+ * Function Name: invalidate_cached_command
+ ******************************************************************************
+ * Summary:
+ *  Function to drop the cached responses of a command of a thermostat. The
+ *  responses are cached under the method name, <component>*<command> for a
+ *  component.
  *
- *  version: Device twin version.
+ * Parameters:
+ *  thermostat: Thermostat instance.
  *
- *  confirm
+ *  command: Command name without the component.
  *
  * Return:
  *  void
  *
  ******************************************************************************/
-static void send_reported_property(az_span name, double value, int32_t version, bool confirm)
+static void invalidate_cached_command(pnp_thermostat_t const* thermostat, az_span command)
 {
-    az_result rc;
-    size_t topic_len = 0;
-    cy_rslt_t result = CY_RSLT_SUCCESS;
-    cy_mqtt_publish_info_t pub_msg;
+    char method_name[PNP_COMMAND_NAME_BUFFER_SIZE];
+    int len;
 
-    /* Get the Twin Patch topic to send a reported property update. */
-    char twin_patch_topic_buffer[128];
-    rc = az_iot_hub_client_twin_patch_get_publish_topic(
-            &hub_client,
-            get_request_id(),
-            twin_patch_topic_buffer,
-            sizeof(twin_patch_topic_buffer),
-            &topic_len);
-    if (az_result_failed(rc))
+    if (thermostat->component == NULL)
     {
-        IOT_SAMPLE_LOG_ERROR("Failed to get the Twin Patch topic: az_result return code 0x%08x.", (unsigned int)rc);
+        iot_method_cache_invalidate(&pnp_command_response_cache,
+                az_span_ptr(command), (size_t)az_span_size(command));
         return;
     }
 
-    /* Build the updated reported property message. */
-    char reported_property_payload_buffer[128];
-    az_span reported_property_payload = AZ_SPAN_FROM_BUFFER(reported_property_payload_buffer);
-
-    if (confirm)
+    len = snprintf(method_name, sizeof(method_name), "%s%s%.*s", thermostat->component,
+            PNP_COMPONENT_COMMAND_SEPARATOR, (int)az_span_size(command), az_span_ptr(command));
+    if ((len > 0) && ((size_t)len < sizeof(method_name)))
     {
-        build_property_payload_with_status(
-                name,
-                value,
-                AZ_IOT_STATUS_OK,
-                version,
-                twin_success_name,
-                reported_property_payload,
-                &reported_property_payload);
+        iot_method_cache_invalidate(&pnp_command_response_cache, (uint8_t const*)method_name, (size_t)len);
     }
-    else
-    {
-        uint8_t count = 1;
-        az_span const names[1] = { name };
-        double const values[1] = { value };
+}
 
-        build_property_payload(count, names, values, NULL, reported_property_payload, &reported_property_payload);
-    }
+/******************************************************************************
+ * Function Name: execute_deferred_command
+ ******************************************************************************
+ * Summary:
+ *  Command worker callback. Invokes a deferred command on the copy of its
+ *  payload and builds the response in the buffer of its slot.
+ *
+ * Parameters:
+ *  context: Unused.
+ *
+ *  command: Deferred command, its handler is a pnp_command_t and its target
+ *  the thermostat the command was invoked on.
+ *
+ * Return:
+ *  uint16_t: Status of the command response.
+ *
+ ******************************************************************************/
+static uint16_t execute_deferred_command(void* context, iot_async_command* command)
+{
+    pnp_command_t const* pnp_command = (pnp_command_t const*)command->handler;
+    az_span response = AZ_SPAN_FROM_BUFFER(command->response);
+    az_iot_status status = AZ_IOT_STATUS_OK;
 
-    /* Publish the reported property update. */
-    memset(&pub_msg, 0x00, sizeof(cy_mqtt_publish_info_t));
+    (void)context;
 
-    pub_msg.qos = (cy_mqtt_qos_t)CY_MQTT_QOS0;
-    pub_msg.topic = (const char *)&twin_patch_topic_buffer;
-    pub_msg.topic_len = (uint16_t)topic_len;
-    pub_msg.payload = (const char *)reported_property_payload._internal.ptr;
-    pub_msg.payload_len = (size_t)reported_property_payload._internal.size;
+    if (!pnp_command->handler((pnp_thermostat_t const*)command->target,
+            az_span_create(command->payload, (int32_t)command->payload_len), response, &response))
+    {
+        status = AZ_IOT_STATUS_BAD_REQUEST;
+    }
 
-    /* Publish the reported property update. */
-    result = cy_mqtt_publish(mqtthandle, &pub_msg);
-    if(result == TEST_PASS)
+    /* A bad request is answered with a constant payload outside the slot. */
+    if (az_span_ptr(response) != command->response)
     {
-        TEST_INFO(("\r\ncy_mqtt_publish completed........\n\r"));
-        IOT_SAMPLE_LOG_SUCCESS("\r\nClient published the Twin Patch reported property message.");
-        IOT_SAMPLE_LOG_AZ_SPAN("\r\nPayload:", reported_property_payload);
+        response = az_span_copy(AZ_SPAN_FROM_BUFFER(command->response), response);
+        command->response_len = sizeof(command->response) - (size_t)az_span_size(response);
     }
     else
     {
-        TEST_INFO(("\r\ncy_mqtt_publish failed with Error : [0x%X] ", (unsigned int)result));
-        return;
+        command->response_len = (size_t)az_span_size(response);
     }
+
+    return (uint16_t)status;
 }
 
 /******************************************************************************
- * Function Name: update_device_temperature_property
+ * Function Name: publish_deferred_command_response
  ******************************************************************************
  * Summary:
- *  Function to update device temperature property based on device twin message
- *  from Azure Hub.
+ *  Command pool callback. Publishes the response of a deferred command with
+ *  the request ID of its method request.
  *
  * Parameters:
- *  temperature: Value of temperature property.
+ *  context: Unused.
  *
- *  out_is_max_temp_changed: Flag for temperature change limit.
+ *  request_id: Request ID of the method request.
+ *
+ *  request_id_len: Length of the request ID.
+ *
+ *  status: Status of the command response.
+ *
+ *  response: Response payload, empty for a command answered on timeout.
+ *
+ *  response_len: Length of the response payload.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+static void publish_deferred_command_response(void* context, char const* request_id, size_t request_id_len,
+        uint16_t status, uint8_t const* response, size_t response_len)
+{
+    (void)context;
+
+    send_command_response(az_span_create((uint8_t*)request_id, (int32_t)request_id_len), (az_iot_status)status,
+            (response_len > 0) ? az_span_create((uint8_t*)response, (int32_t)response_len)
+                               : command_empty_response_payload);
+}
+
+/******************************************************************************
+ * Function Name: wake_on_deferred_command
+ ******************************************************************************
+ * Summary:
+ *  Command worker callback. Wakes the PnP task to publish a finished
+ *  deferred command.
+ *
+ * Parameters:
+ *  context: Unused.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+static void wake_on_deferred_command(void* context)
+{
+    (void)context;
+
+    iot_event_queue_wake(&pnp_msg_event_queue);
+}
+
+static iot_async_command_ops const pnp_async_command_ops =
+{
+    .execute = execute_deferred_command,
+    .publish = publish_deferred_command_response,
+    .ready = wake_on_deferred_command,
+    .timeout_status = (uint16_t)AZ_IOT_STATUS_TIMEOUT
+};
+
+/******************************************************************************
+ * Function Name: handle_command_request
+ ******************************************************************************
+ * Summary:
+ *  Handle for Azure hub method invocation. Routes the command to the
+ *  thermostat of the component in a <component>*<command> method name, or
+ *  to the default component, invokes it and publishes the command response.
+ *  A command with a cache TTL that is invoked again with the same payload is
+ *  answered from the response cache without running its handler. A deferred
+ *  command is queued for the command worker and left pending; its response
+ *  is published by iot_async_command_poll() when it finishes.
+ *
+ * Parameters:
+ *  message_span: Payload of the command request.
+ *
+ *  command_request: A method request received from IoT Hub.
  *
  * Return:
  *  void
  *
  ******************************************************************************/
-static void update_device_temperature_property(double temperature, bool* out_is_max_temp_changed)
+static void handle_command_request(az_span message_span,
+        az_iot_hub_client_method_request const* command_request)
 {
-    if (device_maximum_temperature < device_minimum_temperature)
+    pnp_command_t const* command = NULL;
+    pnp_thermostat_t const* thermostat;
+    iot_method_cache_entry const* cached;
+    az_iot_status status;
+    az_span command_response_payload = AZ_SPAN_FROM_BUFFER(command_response_payload_buffer);
+    az_span component = AZ_SPAN_EMPTY;
+    az_span command_name = command_request->name;
+    int32_t separator;
+    iot_async_command_submit_result submitted;
+    uint32_t token = 0;
+
+    /* Split <component>*<command>, a name without a component addresses the
+     * default component.
+     */
+    separator = az_span_find(command_name, AZ_SPAN_FROM_STR(PNP_COMPONENT_COMMAND_SEPARATOR));
+    if (separator >= 0)
     {
-        IOT_SAMPLE_LOG("\r\ndevice_maximum_temperature is less then device_minimum_temperature");
-        return;
+        component = az_span_slice(command_name, 0, separator);
+        command_name = az_span_slice_to_end(command_name, separator + 1);
     }
 
-    *out_is_max_temp_changed = false;
-    device_current_temperature = temperature;
+    thermostat = find_thermostat(component);
+    if (thermostat != NULL)
+    {
+        for (uint32_t i = 0; i < sizeof(pnp_commands) / sizeof(pnp_commands[0]); i++)
+        {
+            if (az_span_is_content_equal(*pnp_commands[i].name, command_name))
+            {
+                command = &pnp_commands[i];
+                break;
+            }
+        }
+    }
 
-    /* Update maximum or minimum temperatures. */
-    if (device_current_temperature > device_maximum_temperature)
+    if (command == NULL)
     {
-        device_maximum_temperature = device_current_temperature;
-        *out_is_max_temp_changed = true;
+        IOT_SAMPLE_LOG_AZ_SPAN("Command not supported:", command_request->name);
+        send_command_response(command_request->request_id, AZ_IOT_STATUS_NOT_FOUND, command_empty_response_payload);
+        return;
     }
-    else if (device_current_temperature < device_minimum_temperature)
+
+    if (command->cache_ttl_msec > 0)
     {
-        device_minimum_temperature = device_current_temperature;
+        cached = iot_method_cache_lookup(&pnp_command_response_cache,
+                az_span_ptr(command_request->name), (size_t)az_span_size(command_request->name),
+                az_span_ptr(message_span), (size_t)az_span_size(message_span));
+        if (cached != NULL)
+        {
+            IOT_SAMPLE_LOG_SUCCESS("Client answered command '%.*s' from the response cache.",
+                    (int)az_span_size(command_request->name), az_span_ptr(command_request->name));
+            send_command_response(command_request->request_id, (az_iot_status)cached->status,
+                    az_span_create((uint8_t*)cached->response, cached->response_len));
+            return;
+        }
     }
 
-    /* Calculate the new average temperature. */
-    device_temperature_count++;
-    device_temperature_summation += device_current_temperature;
-    device_average_temperature = device_temperature_summation / device_temperature_count;
+    if (command->deferred)
+    {
+        submitted = iot_async_command_submit(&pnp_async_commands,
+                (char const*)az_span_ptr(command_request->request_id), (size_t)az_span_size(command_request->request_id),
+                az_span_ptr(message_span), (size_t)az_span_size(message_span),
+                command, thermostat, PNP_COMMAND_ASYNC_TIMEOUT_MSEC, &token);
+        if (submitted == IOT_ASYNC_COMMAND_PENDING)
+        {
+            IOT_SAMPLE_LOG_SUCCESS("Client deferred command '%.*s', token %lu.",
+                    (int)az_span_size(command_request->name), az_span_ptr(command_request->name),
+                    (unsigned long)token);
+            return;
+        }
 
-    IOT_SAMPLE_LOG_SUCCESS("Client updated desired temperature variables locally.");
-    IOT_SAMPLE_LOG("Current Temperature: %2f", device_current_temperature);
-    IOT_SAMPLE_LOG("Maximum Temperature: %2f", device_maximum_temperature);
-    IOT_SAMPLE_LOG("Minimum Temperature: %2f", device_minimum_temperature);
-    IOT_SAMPLE_LOG("Average Temperature: %2f", device_average_temperature);
+        /* Every slot in flight, or a request that does not fit one */
+        IOT_SAMPLE_LOG_ERROR("Failed to defer command '%.*s': %d.",
+                (int)az_span_size(command_request->name), az_span_ptr(command_request->name), (int)submitted);
+        status = (submitted == IOT_ASYNC_COMMAND_BUSY) ? AZ_IOT_STATUS_THROTTLED :
+                 (submitted == IOT_ASYNC_COMMAND_TOO_LARGE) ? AZ_IOT_STATUS_REQUEST_TOO_LARGE :
+                 AZ_IOT_STATUS_SERVICE_UNAVAILABLE;
+        send_command_response(command_request->request_id, status, command_empty_response_payload);
+        return;
+    }
+
+    /* Invoke command. */
+    if (command->handler(thermostat, message_span, command_response_payload, &command_response_payload))
+    {
+        status = AZ_IOT_STATUS_OK;
+        if (command->cache_ttl_msec > 0)
+        {
+            (void)iot_method_cache_store(&pnp_command_response_cache,
+                    az_span_ptr(command_request->name), (size_t)az_span_size(command_request->name),
+                    az_span_ptr(message_span), (size_t)az_span_size(message_span),
+                    command->cache_ttl_msec, (uint16_t)status,
+                    az_span_ptr(command_response_payload), (size_t)az_span_size(command_response_payload));
+        }
+    }
+    else
+    {
+        status = AZ_IOT_STATUS_BAD_REQUEST;
+    }
+    IOT_SAMPLE_LOG_SUCCESS("Client invoked command '%.*s'.",
+            (int)az_span_size(command_request->name), az_span_ptr(command_request->name));
+    send_command_response(command_request->request_id, status, command_response_payload);
 }
 
 /******************************************************************************
- * Function Name: parse_desired_temperature_property
+ * Function Name: append_thermostat_properties
  ******************************************************************************
  * Summary:
- *  Function to process desired temperature property from the device twin
- *  message received from the Azure Hub.
+ *  Function to append the pending reported properties of one thermostat
+ *  from their templates. The properties of a component are wrapped in an
+ *  object named after the component and marked with "__t": "c".
  *
  * Parameters:
- *  message_span: Structure to hold the received message.
- *
- *  is_twin_get: Flag for message event.
+ *  thermostat: Thermostat instance.
  *
- *  out_parsed_temperature: Stores temperature value locally.
+ *  fields: Bit PNP_REPORTED_FIELD_* set for each property of the thermostat
+ *  to be reported.
  *
- *  out_parsed_version_number: Stores device twin version number.
+ *  remainder: Reported property payload buffer, advanced past the
+ *  properties.
  *
  * Return:
- *  bool
+ *  az_result: AZ_OK if the properties were appended.
  *
  ******************************************************************************/
-static bool parse_desired_temperature_property(
-        az_span message_span,
-        bool is_twin_get,
-        double* out_parsed_temperature,
-        int32_t* out_parsed_version_number)
+static az_result append_thermostat_properties(
+        pnp_thermostat_t const* thermostat,
+        uint32_t fields,
+        az_span* remainder)
 {
-    az_span property = twin_desired_temperature_property_name;
-
-    *out_parsed_temperature = 0.0;
-    *out_parsed_version_number = 0;
-
-    /* Parse message_span. */
-    az_json_reader jr;
-    az_result rc;
+    uint8_t temperature_text[PNP_TEMPERATURE_TEXT_SIZE];
+    iot_json_slot slots[4];
+    bool first_member = true;
+    az_result rc = AZ_OK;
 
-    rc = az_json_reader_init(&jr, message_span, NULL);
-    if (az_result_failed(rc))
+    if (thermostat->component != NULL)
     {
-        IOT_SAMPLE_LOG_ERROR("Failed to parse_desired_temperature_property");
-        return false;
+        slots[0].text = az_span_create_from_str((char*)thermostat->component);
+        rc = iot_json_template_append(&pnp_component_begin_template, slots, remainder);
+        first_member = false;
     }
-    rc = az_json_reader_next_token(&jr);
-    if (az_result_failed(rc))
+    if (az_result_succeeded(rc) && (fields & (1UL << PNP_REPORTED_FIELD_TARGET_TEMPERATURE)))
     {
-        IOT_SAMPLE_LOG_ERROR("Failed to parse_desired_temperature_property");
-        return false;
+        if (!first_member)
+        {
+            rc = iot_json_template_append_text(json_member_separator, remainder);
+        }
+        if (az_result_succeeded(rc))
+        {
+            rc = format_temperature(thermostat->current_temperature, temperature_text, &slots[0].text);
+        }
+        if (az_result_succeeded(rc))
+        {
+            slots[1].i = AZ_IOT_STATUS_OK;
+            slots[2].i = thermostat->reported_target_temperature_version;
+            slots[3].text = twin_success_name;
+            rc = iot_json_template_append(
+                    &pnp_thermostat_property_templates[PNP_THERMOSTAT_PROPERTY_TARGET_TEMPERATURE], slots, remainder);
+        }
+        first_member = false;
     }
-    if (jr.token.kind != AZ_JSON_TOKEN_BEGIN_OBJECT)
+    if (az_result_succeeded(rc) && (fields & (1UL << PNP_REPORTED_FIELD_MAX_TEMPERATURE)))
     {
-        IOT_SAMPLE_LOG(
-                "`%.*s` property object not found in device twin GET response.",
-                (int)az_span_size(twin_desired_name),
-                az_span_ptr(twin_desired_name));
-        return false;
+        if (!first_member)
+        {
+            rc = iot_json_template_append_text(json_member_separator, remainder);
+        }
+        if (az_result_succeeded(rc))
+        {
+            rc = format_temperature(thermostat->stats.lifetime.max, temperature_text, &slots[0].text);
+        }
+        if (az_result_succeeded(rc))
+        {
+            rc = iot_json_template_append(
+                    &pnp_thermostat_property_templates[PNP_THERMOSTAT_PROPERTY_MAX_TEMP_SINCE_LAST_REBOOT], slots, remainder);
+        }
+    }
+    if (az_result_succeeded(rc) && (thermostat->component != NULL))
+    {
+        rc = iot_json_template_append_text(json_end_object, remainder);
     }
+    return rc;
+}
 
-    /* Device twin GET response: Parse to the "desired" wrapper if it exists. */
-    bool desired_found = false;
-    if (is_twin_get)
+/******************************************************************************
+ * Function Name: build_reported_property_payload
+ ******************************************************************************
+ * Summary:
+ *  Function to build one reported property patch with every pending
+ *  property of every thermostat: the acknowledged targetTemperature and
+ *  maxTempSinceLastReboot.
+ *
+ * Parameters:
+ *  fields: Bit PNP_REPORTED_FIELD(thermostat, PNP_REPORTED_FIELD_*) set for
+ *  each property to be reported.
+ *
+ *  property_payload: Message payload for properties to be reported.
+ *
+ *  out_property_payload: Message payload for properties to be reported.
+ *
+ * Return:
+ *  bool: true if the payload was built.
+ *
+ ******************************************************************************/
+static bool build_reported_property_payload(
+        uint32_t fields,
+        az_span property_payload,
+        az_span* out_property_payload)
+{
+    az_span remainder = property_payload;
+    bool first_member = true;
+    az_result rc;
+    uint32_t thermostat_fields;
+
+    rc = iot_json_template_append_text(json_begin_object, &remainder);
+    for (uint32_t i = 0; (i < PNP_THERMOSTAT_COUNT) && az_result_succeeded(rc); i++)
     {
-        rc = az_json_reader_next_token(&jr);
-        if (az_result_failed(rc))
-        {
-            IOT_SAMPLE_LOG_ERROR("Failed to parse_desired_temperature_property");
-            return false;
-        }
-        while (jr.token.kind != AZ_JSON_TOKEN_END_OBJECT)
+        thermostat_fields = (fields >> PNP_REPORTED_FIELD(i, 0)) & ((1UL << PNP_REPORTED_FIELDS_PER_THERMOSTAT) - 1);
+        if (thermostat_fields != 0)
         {
-            if (az_json_token_is_text_equal(&jr.token, twin_desired_name))
-            {
-                rc = az_json_reader_next_token(&jr);
-                if (az_result_failed(rc))
-                {
-                    IOT_SAMPLE_LOG_ERROR("Failed to parse_desired_temperature_property");
-                    return false;
-                }
-                desired_found = true;
-                break;
-            }
-            else
+            if (!first_member)
             {
-                rc = az_json_reader_skip_children(&jr);
-                if (az_result_failed(rc))
-                {
-                    IOT_SAMPLE_LOG_ERROR("Failed to parse_desired_temperature_property");
-                    return false;
-                }
+                rc = iot_json_template_append_text(json_member_separator, &remainder);
             }
-            rc = az_json_reader_next_token(&jr);
-            if (az_result_failed(rc))
+            if (az_result_succeeded(rc))
             {
-                IOT_SAMPLE_LOG_ERROR("Failed to parse_desired_temperature_property");
-                return false;
+                rc = append_thermostat_properties(&pnp_thermostats[i], thermostat_fields, &remainder);
             }
+            first_member = false;
         }
+    }
+    if (az_result_succeeded(rc))
+    {
+        rc = iot_json_template_append_text(json_end_object, &remainder);
+    }
+    if (az_result_failed(rc))
+    {
+        IOT_SAMPLE_LOG_ERROR("Failed to build reported property payload");
+        return false;
+    }
+
+    *out_property_payload = az_span_slice(property_payload, 0,
+            az_span_size(property_payload) - az_span_size(remainder));
+    return true;
+}
+
+/******************************************************************************
+ * Function Name: send_reported_properties
+ ******************************************************************************
+ * Summary:
+ *  Reported property writer callback to get device twin topic and report
+ *  the pending properties to Azure in one patch.
+ *
+ * Parameters:
+ *  context: Unused.
+ *
+ *  fields: Bit PNP_REPORTED_FIELD(thermostat, PNP_REPORTED_FIELD_*) set for
+ *  each property to be reported.
+ *
+ * Return:
+ *  cy_rslt_t: Result of the publish.
+ *
+ ******************************************************************************/
+static cy_rslt_t send_reported_properties(void* context, uint32_t fields)
+{
+    az_result rc;
+    size_t topic_len = 0;
+    cy_rslt_t result = CY_RSLT_SUCCESS;
+    cy_mqtt_publish_info_t pub_msg;
+    char request_id[IOT_REQUEST_ID_SIZE];
+
+    (void)context;
+
+    /* Build the updated reported property message. */
+    char reported_property_payload_buffer[REPORTED_PROPERTY_PAYLOAD_BUFFER_SIZE];
+    az_span reported_property_payload = AZ_SPAN_FROM_BUFFER(reported_property_payload_buffer);
+
+    if (!build_reported_property_payload(fields, reported_property_payload, &reported_property_payload))
+    {
+        return TEST_FAIL;
+    }
 
-        if (!desired_found)
+    if (!iot_request_tracker_begin(&pnp_request_tracker, PNP_REQUEST_OP_TWIN_PATCH,
+            PNP_REPORTED_RESPONSE_TIMEOUT_MSEC, 0, request_id))
+    {
+        IOT_SAMPLE_LOG_ERROR("No free twin request ID.");
+        return TEST_FAIL;
+    }
+
+    /* Get the Twin Patch topic to send a reported property update. */
+    char twin_patch_topic_buffer[128];
+    rc = az_iot_hub_client_twin_patch_get_publish_topic(
+            &hub_client,
+            az_span_create_from_str(request_id),
+            twin_patch_topic_buffer,
+            sizeof(twin_patch_topic_buffer),
+            &topic_len);
+    if (az_result_failed(rc))
+    {
+        IOT_SAMPLE_LOG_ERROR("Failed to get the Twin Patch topic: az_result return code 0x%08x.", (unsigned int)rc);
+        iot_request_tracker_cancel(&pnp_request_tracker, request_id);
+        return TEST_FAIL;
+    }
+
+    /* Publish the reported property update. */
+    memset(&pub_msg, 0x00, sizeof(cy_mqtt_publish_info_t));
+
+    pub_msg.qos = (cy_mqtt_qos_t)CY_MQTT_QOS0;
+    pub_msg.topic = (const char *)&twin_patch_topic_buffer;
+    pub_msg.topic_len = (uint16_t)topic_len;
+    pub_msg.payload = (const char *)reported_property_payload._internal.ptr;
+    pub_msg.payload_len = (size_t)reported_property_payload._internal.size;
+
+    /* Publish the reported property update. */
+    result = cy_mqtt_publish(mqtthandle, &pub_msg);
+    if(result == TEST_PASS)
+    {
+        TEST_INFO(("\r\ncy_mqtt_publish completed........\n\r"));
+        IOT_SAMPLE_LOG_SUCCESS("\r\nClient published the Twin Patch reported property message.");
+        IOT_SAMPLE_LOG_AZ_SPAN("\r\nPayload:", reported_property_payload);
+    }
+    else
+    {
+        TEST_INFO(("\r\ncy_mqtt_publish failed with Error : [0x%X] ", (unsigned int)result));
+        iot_request_tracker_cancel(&pnp_request_tracker, request_id);
+    }
+
+    return result;
+}
+
+/******************************************************************************
+ * Function Name: ticks_until
+ ******************************************************************************
+ * Summary:
+ *  Returns the number of ticks from now until a due tick count.
+ *
+ * Parameters:
+ *  due_tick: Tick count at which an action is due.
+ *
+ * Return:
+ *  TickType_t: Ticks until due_tick, 0 if it has passed.
+ *
+ ******************************************************************************/
+static TickType_t ticks_until(TickType_t due_tick)
+{
+    TickType_t remaining = due_tick - xTaskGetTickCount();
+
+    /* Differences beyond half the tick range are due ticks in the past. */
+    return (remaining > (portMAX_DELAY / 2)) ? 0 : remaining;
+}
+
+/******************************************************************************
+ * Function Name: read_temperature_sensor
+ ******************************************************************************
+ * Summary:
+ *  Function to sample the temperature of a thermostat. The kit has no
+ *  temperature sensor, so the reading is simulated: it approaches the
+ *  targetTemperature with every sample, with some noise. Replace the body
+ *  to read a real sensor.
+ *
+ * Parameters:
+ *  thermostat: Thermostat instance.
+ *
+ * Return:
+ *  iot_stats_value: Temperature in degrees Celsius.
+ *
+ ******************************************************************************/
+static iot_stats_value read_temperature_sensor(pnp_thermostat_t* thermostat)
+{
+#if IOT_STATS_FIXED_POINT
+    int32_t const noise_range = IOT_STATS_Q16_FROM_DOUBLE(PNP_SIMULATED_SENSOR_NOISE_CELSIUS);
+    int32_t noise = (int32_t)(rand() % (2 * noise_range + 1)) - noise_range;
+    int64_t step = (int64_t)(thermostat->current_temperature - thermostat->sensor_temperature) *
+            IOT_STATS_Q16_FROM_DOUBLE(PNP_SIMULATED_SENSOR_TRACKING);
+
+    thermostat->sensor_temperature += (int32_t)(step / IOT_STATS_Q16_ONE) + noise;
+#else
+    double noise = (((double)rand() / (double)RAND_MAX) * 2.0 - 1.0) * PNP_SIMULATED_SENSOR_NOISE_CELSIUS;
+
+    thermostat->sensor_temperature +=
+            (thermostat->current_temperature - thermostat->sensor_temperature) * PNP_SIMULATED_SENSOR_TRACKING + noise;
+#endif
+    return thermostat->sensor_temperature;
+}
+
+/******************************************************************************
+ * Function Name: init_telemetry_topics
+ ******************************************************************************
+ * Summary:
+ *  Function to build the telemetry topic of every thermostat once. The
+ *  topic of a component carries the component name as a message property.
+ *
+ * Parameters:
+ *  void
+ *
+ * Return:
+ *  cy_rslt_t: Provides the result of an operation as a structured bitfield.
+ *
+ ******************************************************************************/
+static cy_rslt_t init_telemetry_topics(void)
+{
+    az_result rc = AZ_OK;
+    az_iot_message_properties properties;
+    az_iot_message_properties* topic_properties;
+    uint8_t properties_buffer[PNP_TELEMETRY_PROPERTIES_BUFFER_SIZE];
+    size_t topic_len = 0;
+
+    for (uint32_t i = 0; i < PNP_THERMOSTAT_COUNT; i++)
+    {
+        topic_properties = NULL;
+        if (pnp_thermostats[i].component != NULL)
         {
-            IOT_SAMPLE_LOG(
-                    "`%.*s` property object not found in device twin GET response.",
-                    (int)az_span_size(twin_desired_name),
-                    az_span_ptr(twin_desired_name));
-            return false;
+            rc = az_iot_message_properties_init(&properties, AZ_SPAN_FROM_BUFFER(properties_buffer), 0);
+            if (az_result_succeeded(rc))
+            {
+                rc = az_iot_message_properties_append(&properties, AZ_SPAN_FROM_STR(PNP_TELEMETRY_COMPONENT_PROPERTY),
+                        az_span_create_from_str((char*)pnp_thermostats[i].component));
+            }
+            topic_properties = &properties;
+        }
+        if (az_result_succeeded(rc))
+        {
+            rc = az_iot_hub_client_telemetry_get_publish_topic(&hub_client, topic_properties,
+                    pnp_telemetry_topic[i], sizeof(pnp_telemetry_topic[i]), &topic_len);
+        }
+        if (az_result_failed(rc))
+        {
+            IOT_SAMPLE_LOG_ERROR("Failed to get the Telemetry topic: az_result return code 0x%08x.", (unsigned int)rc);
+            return TEST_FAIL;
         }
+        pnp_telemetry_topic_len[i] = (uint16_t)topic_len;
     }
+    return CY_RSLT_SUCCESS;
+}
+
+/******************************************************************************
+ * Function Name: set_reported_max_temperature
+ ******************************************************************************
+ * Summary:
+ *  Function to queue the maxTempSinceLastReboot of a thermostat for the
+ *  reported property writer, which sends it only if it differs from the
+ *  value the hub acknowledged.
+ *
+ * Parameters:
+ *  thermostat: Index of the thermostat in pnp_thermostats.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+static void set_reported_max_temperature(uint32_t thermostat)
+{
+    iot_property_value value;
+
+#if IOT_STATS_FIXED_POINT
+    value.i = pnp_thermostats[thermostat].stats.lifetime.max;
+    iot_reported_writer_set(&pnp_reported_writer,
+            PNP_REPORTED_FIELD(thermostat, PNP_REPORTED_FIELD_MAX_TEMPERATURE), IOT_PROPERTY_INT32, value);
+#else
+    value.d = pnp_thermostats[thermostat].stats.lifetime.max;
+    iot_reported_writer_set(&pnp_reported_writer,
+            PNP_REPORTED_FIELD(thermostat, PNP_REPORTED_FIELD_MAX_TEMPERATURE), IOT_PROPERTY_DOUBLE, value);
+#endif
+}
+
+/******************************************************************************
+ * Function Name: send_telemetry_message
+ ******************************************************************************
+ * Summary:
+ *  Function to sample the temperature of a thermostat, add it to the
+ *  statistics and the history, and publish it as telemetry. The message is
+ *  published with QoS 0 and does not wait for the hub.
+ *
+ * Parameters:
+ *  thermostat: Index of the thermostat in pnp_thermostats.
+ *
+ * Return:
+ *  cy_rslt_t: Result of the publish.
+ *
+ ******************************************************************************/
+static cy_rslt_t send_telemetry_message(uint32_t thermostat)
+{
+    az_json_writer jw;
+    az_result rc;
+    az_span payload;
+    cy_rslt_t result;
+    cy_mqtt_publish_info_t pub_msg;
+    iot_stats_value temperature = read_temperature_sensor(&pnp_thermostats[thermostat]);
+    iot_stats_value previous_maximum = pnp_thermostats[thermostat].stats.lifetime.max;
+
+    /* The samples feed the getMaxMinReport statistics and the
+     * maxTempSinceLastReboot property like the desired temperatures.
+     */
+    iot_window_stats_add(&pnp_thermostats[thermostat].stats, iot_time_sync_uptime(), temperature);
+    invalidate_cached_command(&pnp_thermostats[thermostat],
+            pnp_thermostat_command_names[PNP_THERMOSTAT_COMMAND_GET_MAX_MIN_REPORT]);
+    if (pnp_thermostats[thermostat].stats.lifetime.max > previous_maximum)
+    {
+        set_reported_max_temperature(thermostat);
+    }
+
+    (void)xSemaphoreTake(pnp_history_mutex, portMAX_DELAY);
+    (void)iot_time_series_append(&pnp_thermostats[thermostat].history, time(NULL),
+            temperature_to_history_value(temperature));
+    (void)xSemaphoreGive(pnp_history_mutex);
+
+    rc = az_json_writer_init(&jw, AZ_SPAN_FROM_BUFFER(pnp_telemetry_payload_buffer), NULL);
+    if (az_result_succeeded(rc))
+    {
+        rc = az_json_writer_append_begin_object(&jw);
+    }
+    if (az_result_succeeded(rc))
+    {
+        rc = az_json_writer_append_property_name(&jw,
+                pnp_thermostat_telemetry_names[PNP_THERMOSTAT_TELEMETRY_TEMPERATURE]);
+    }
+    if (az_result_succeeded(rc))
+    {
+        rc = append_temperature(&jw, temperature);
+    }
+    if (az_result_succeeded(rc))
+    {
+        rc = az_json_writer_append_end_object(&jw);
+    }
+    if (az_result_failed(rc))
+    {
+        IOT_SAMPLE_LOG_ERROR("Failed to build telemetry payload");
+        return TEST_FAIL;
+    }
+    payload = az_json_writer_get_bytes_used_in_destination(&jw);
+
+    memset(&pub_msg, 0x00, sizeof(cy_mqtt_publish_info_t));
+    pub_msg.qos = (cy_mqtt_qos_t)CY_MQTT_QOS0;
+    pub_msg.topic = (const char *)pnp_telemetry_topic[thermostat];
+    pub_msg.topic_len = pnp_telemetry_topic_len[thermostat];
+    pub_msg.payload = (const char *)az_span_ptr(payload);
+    pub_msg.payload_len = (size_t)az_span_size(payload);
+
+    result = cy_mqtt_publish(mqtthandle, &pub_msg);
+    if(result == CY_RSLT_SUCCESS)
+    {
+        IOT_SAMPLE_LOG_SUCCESS("Client published the telemetry of %s.",
+                pnp_thermostat_name(&pnp_thermostats[thermostat]));
+        IOT_SAMPLE_LOG_AZ_SPAN("Payload:", payload);
+    }
+    else
+    {
+        TEST_INFO(("\r\ncy_mqtt_publish failed with Error : [0x%X] ", (unsigned int)result));
+    }
+    return result;
+}
+
+/******************************************************************************
+ * Function Name: send_scheduled_telemetry
+ ******************************************************************************
+ * Summary:
+ *  Function to publish the telemetry of every thermostat that is due at
+ *  due_tick, to add the samples of the tick to the channel statistics, and
+ *  to record how late it was published.
+ *
+ * Parameters:
+ *  due_tick: Tick count at which the telemetry was due.
+ *
+ *  commands_handled: true if a command was handled since the previous
+ *  telemetry.
+ *
+ * Return:
+ *  TickType_t: Tick count at which the next telemetry is due.
+ *
+ ******************************************************************************/
+static TickType_t send_scheduled_telemetry(TickType_t due_tick, bool commands_handled)
+{
+    TickType_t interval = pdMS_TO_TICKS(PNP_TELEMETRY_INTERVAL_MSEC);
+    iot_stats_value samples[PNP_THERMOSTAT_COUNT];
+
+    iot_event_latency_record(&pnp_telemetry_jitter[commands_handled ? PNP_TELEMETRY_JITTER_COMMANDS :
+            PNP_TELEMETRY_JITTER_IDLE], due_tick);
+
+    for (uint32_t i = 0; i < PNP_THERMOSTAT_COUNT; i++)
+    {
+        (void)send_telemetry_message(i);
+        samples[i] = pnp_thermostats[i].sensor_temperature;
+    }
+    if (pnp_channel_stats != NULL)
+    {
+        iot_channel_stats_add(pnp_channel_stats, 0, PNP_THERMOSTAT_COUNT, samples);
+    }
+
+    /* Samples missed while the task was busy are skipped */
+    due_tick += interval;
+    while (ticks_until(due_tick) == 0)
+    {
+        due_tick += interval;
+        pnp_telemetry_skipped++;
+    }
+    return due_tick;
+}
+
+/******************************************************************************
+ * Function Name: log_telemetry_summary
+ ******************************************************************************
+ * Summary:
+ *  Function to print the count, minimum, maximum and mean of the telemetry
+ *  samples of every thermostat, and of all thermostats together.
+ *
+ * Parameters:
+ *  void
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+static void log_telemetry_summary(void)
+{
+    iot_stats_value means[PNP_THERMOSTAT_COUNT];
+    iot_stats_value min;
+    iot_stats_value max;
+    iot_stats_value mean;
+
+    if ((pnp_channel_stats == NULL) || !iot_channel_stats_summary(pnp_channel_stats, &min, &max, &mean))
+    {
+        return;
+    }
+
+    iot_channel_stats_means(pnp_channel_stats, means);
+    for (uint32_t i = 0; i < PNP_THERMOSTAT_COUNT; i++)
+    {
+        IOT_SAMPLE_LOG("Telemetry of %s: %lu samples, min %.2f, max %.2f, mean %.2f",
+                pnp_thermostat_name(&pnp_thermostats[i]),
+                (unsigned long)pnp_channel_stats->counts[i],
+                IOT_STATS_VALUE_TO_DOUBLE(pnp_channel_stats->mins[i]),
+                IOT_STATS_VALUE_TO_DOUBLE(pnp_channel_stats->maxes[i]),
+                IOT_STATS_VALUE_TO_DOUBLE(means[i]));
+    }
+    IOT_SAMPLE_LOG("Telemetry of all thermostats: min %.2f, max %.2f, mean %.2f",
+            IOT_STATS_VALUE_TO_DOUBLE(min), IOT_STATS_VALUE_TO_DOUBLE(max), IOT_STATS_VALUE_TO_DOUBLE(mean));
+}
+
+/******************************************************************************
+ * Function Name: update_device_temperature_property
+ ******************************************************************************
+ * Summary:
+ *  Function to update device temperature property based on device twin message
+ *  from Azure Hub.
+ *
+ * Parameters:
+ *  thermostat: Thermostat instance.
+ *
+ *  temperature: Value of temperature property.
+ *
+ *  out_is_max_temp_changed: Flag for temperature change limit.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+static void update_device_temperature_property(pnp_thermostat_t* thermostat, iot_stats_value temperature,
+        bool* out_is_max_temp_changed)
+{
+    iot_stats_value previous_maximum = thermostat->stats.lifetime.max;
+
+    thermostat->current_temperature = temperature;
+
+    /* Update the maximum, minimum and average temperatures. */
+    iot_window_stats_add(&thermostat->stats, iot_time_sync_uptime(), temperature);
+
+    /* The first sample is the maximum, even below the initial value 0. */
+    *out_is_max_temp_changed = ((thermostat->stats.lifetime.count == 1) ||
+            (thermostat->stats.lifetime.max > previous_maximum));
+
+    /* Cached getMaxMinReport responses report the old statistics. */
+    invalidate_cached_command(thermostat, pnp_thermostat_command_names[PNP_THERMOSTAT_COMMAND_GET_MAX_MIN_REPORT]);
+
+    IOT_SAMPLE_LOG_SUCCESS("Client updated desired temperature variables of %s locally.",
+            pnp_thermostat_name(thermostat));
+    IOT_SAMPLE_LOG("Current Temperature: %2f", IOT_STATS_VALUE_TO_DOUBLE(thermostat->current_temperature));
+    IOT_SAMPLE_LOG("Maximum Temperature: %2f", IOT_STATS_VALUE_TO_DOUBLE(thermostat->stats.lifetime.max));
+    IOT_SAMPLE_LOG("Minimum Temperature: %2f", IOT_STATS_VALUE_TO_DOUBLE(thermostat->stats.lifetime.min));
+    IOT_SAMPLE_LOG("Average Temperature: %2f",
+            IOT_STATS_VALUE_TO_DOUBLE(iot_running_stats_mean(&thermostat->stats.lifetime)));
+}
+
+/******************************************************************************
+ * Function Name: process_device_twin_message
+ ******************************************************************************
+ * Summary:
+ *  Function to apply a desired temperature received from the Azure Hub to a
+ *  thermostat.
+ *
+ * Parameters:
+ *  thermostat: Index of the thermostat in pnp_thermostats.
+ *
+ *  desired_temperature: Parsed desired temperature.
+ *
+ *  version_number: Twin version of the desired temperature.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+static void process_device_twin_message(uint32_t thermostat, double desired_temperature, int32_t version_number)
+{
+    IOT_SAMPLE_LOG(" "); /* Formatting */
+    bool is_max_temp_changed = false;
+    iot_property_value value;
+
+    /* Update device temperature locally and queue the report to server. The
+     * properties that changed on any thermostat are sent in one patch by the
+     * reported property writer.
+     */
+    update_device_temperature_property(&pnp_thermostats[thermostat],
+            IOT_STATS_VALUE_FROM_DOUBLE(desired_temperature), &is_max_temp_changed);
+    pnp_thermostats[thermostat].reported_target_temperature_version = version_number;
+    value.i = version_number;
+    iot_reported_writer_set(&pnp_reported_writer,
+            PNP_REPORTED_FIELD(thermostat, PNP_REPORTED_FIELD_TARGET_TEMPERATURE), IOT_PROPERTY_INT32, value);
+    set_reported_max_temperature(thermostat);
+}
+
+#if PNP_TWIN_SNAPSHOT_PERSIST
+/******************************************************************************
+ * Function Name: load_twin_snapshot
+ ******************************************************************************
+ * Summary:
+ *  Function to read the desired state snapshot from protected storage. A
+ *  missing snapshot, or one written in another format, is ignored.
+ *
+ * Parameters:
+ *  void
+ *
+ * Return:
+ *  bool: true if pnp_twin_snapshot holds a valid snapshot.
+ *
+ ******************************************************************************/
+static bool load_twin_snapshot(void)
+{
+    psa_status_t status;
+    size_t read_len = 0;
+
+    status = psa_ps_get(PSA_PNP_TWIN_SNAPSHOT_UID, 0, sizeof(pnp_twin_snapshot), &pnp_twin_snapshot, &read_len);
+    if (status != PSA_SUCCESS)
+    {
+        TEST_INFO(("\r\npsa_ps_get for twin snapshot failed with %d\n", (int)status));
+        return false;
+    }
+
+    return ((read_len == sizeof(pnp_twin_snapshot)) && (pnp_twin_snapshot.format == PNP_TWIN_SNAPSHOT_FORMAT));
+}
+
+/******************************************************************************
+ * Function Name: save_twin_snapshot
+ ******************************************************************************
+ * Summary:
+ *  Function to write the desired section of pnp_twin_store and the ack
+ *  version of each targetTemperature to protected storage. Nothing is
+ *  written if neither the values nor the $version changed since the last
+ *  snapshot.
+ *
+ * Parameters:
+ *  changed: Bit n set if the desired value of field n changed.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+static void save_twin_snapshot(uint32_t changed)
+{
+    psa_status_t status;
 
-    /* Device twin get response OR desired property response:
-     * Parse for the desired temperature property
-     */
-    bool temp_found = false;
-    bool version_found = false;
+    if ((changed == 0) && (pnp_twin_snapshot.format == PNP_TWIN_SNAPSHOT_FORMAT) &&
+        (pnp_twin_snapshot.desired.version == pnp_twin_store.desired.version))
+    {
+        return;
+    }
 
-    rc = az_json_reader_next_token(&jr);
-    while (!(temp_found && version_found) && (jr.token.kind != AZ_JSON_TOKEN_END_OBJECT))
+    pnp_twin_snapshot.format = PNP_TWIN_SNAPSHOT_FORMAT;
+    pnp_twin_snapshot.desired = pnp_twin_store.desired;
+    for (uint32_t i = 0; i < PNP_THERMOSTAT_COUNT; i++)
     {
-        if (az_json_token_is_text_equal(&jr.token, twin_desired_temperature_property_name))
-        {
-            rc = az_json_reader_next_token(&jr);
-            if (az_result_failed(rc))
-            {
-                IOT_SAMPLE_LOG_ERROR("Failed to parse_desired_temperature_property");
-                return false;
-            }
-            rc = az_json_token_get_double(&jr.token, out_parsed_temperature);
-            if (az_result_failed(rc))
-            {
-                IOT_SAMPLE_LOG_ERROR("Failed to parse_desired_temperature_property");
-                return false;
-            }
-            temp_found = true;
-        }
-        else if (az_json_token_is_text_equal(&jr.token, twin_version_name))
-        {
-            rc = az_json_reader_next_token(&jr);
-            if (az_result_failed(rc))
-            {
-                IOT_SAMPLE_LOG_ERROR("Failed to parse_desired_temperature_property");
-                return false;
-            }
-            rc = az_json_token_get_int32(&jr.token, out_parsed_version_number);
-            if (az_result_failed(rc))
-            {
-                IOT_SAMPLE_LOG_ERROR("Failed to parse_desired_temperature_property");
-                return false;
-            }
-            version_found = true;
-        }
-        else
-        {
-            rc = az_json_reader_skip_children(&jr);
-            if (az_result_failed(rc))
-            {
-                IOT_SAMPLE_LOG_ERROR("Failed to parse_desired_temperature_property");
-                return false;
-            }
-        }
-        rc = az_json_reader_next_token(&jr);
-        if (az_result_failed(rc))
-        {
-            IOT_SAMPLE_LOG_ERROR("Failed to parse_desired_temperature_property");
-            return false;
-        }
+        pnp_twin_snapshot.target_temperature_version[i] = pnp_thermostats[i].reported_target_temperature_version;
     }
 
-    if (temp_found && version_found)
+    status = psa_ps_set(PSA_PNP_TWIN_SNAPSHOT_UID, sizeof(pnp_twin_snapshot), &pnp_twin_snapshot,
+            PSA_STORAGE_FLAG_NONE);
+    if (status != PSA_SUCCESS)
     {
-        IOT_SAMPLE_LOG(
-                "Parsed desired `%.*s`: %2f",
-                (int)az_span_size(property),
-                az_span_ptr(property),
-                *out_parsed_temperature);
-        IOT_SAMPLE_LOG(
-                "Parsed `%.*s` number: %d",
-                (int)az_span_size(twin_version_name),
-                az_span_ptr(twin_version_name),
-                (int)*out_parsed_version_number);
+        TEST_INFO(("\r\npsa_ps_set for twin snapshot failed with %d\n", (int)status));
     }
-    else
+}
+
+/******************************************************************************
+ * Function Name: apply_twin_snapshot
+ ******************************************************************************
+ * Summary:
+ *  Function to apply the desired state of the snapshot of a previous boot
+ *  before the device twin is received. The reported properties already
+ *  acknowledge this state, so nothing is reported. The values seed
+ *  pnp_twin_store but its $version stays unknown: the first twin document
+ *  of a run is applied whatever its $version, since a twin that was
+ *  re-created starts over at a lower one, and only the values that differ
+ *  from the snapshot are applied again.
+ *
+ * Parameters:
+ *  void
+ *
+ * Return:
+ *  bool: true if a snapshot was applied.
+ *
+ ******************************************************************************/
+static bool apply_twin_snapshot(void)
+{
+    bool is_max_temp_changed = false;
+    iot_twin_value value;
+
+    if (!load_twin_snapshot())
     {
-        IOT_SAMPLE_LOG(
-                "Either `%.*s` or `%.*s` were not found in desired property response.",
-                (int)az_span_size(property),
-                az_span_ptr(property),
-                (int)az_span_size(twin_version_name),
-                az_span_ptr(twin_version_name));
+        memset(&pnp_twin_snapshot, 0x00, sizeof(pnp_twin_snapshot));
         return false;
     }
 
+    pnp_twin_store.desired.present = pnp_twin_snapshot.desired.present;
+    memcpy(pnp_twin_store.desired.value, pnp_twin_snapshot.desired.value, sizeof(pnp_twin_store.desired.value));
+    for (uint8_t i = 0; i < PNP_THERMOSTAT_COUNT; i++)
+    {
+        if (iot_twin_store_get(&pnp_twin_store.desired, i, &value))
+        {
+            update_device_temperature_property(&pnp_thermostats[i],
+                    IOT_STATS_VALUE_FROM_DOUBLE(value.d), &is_max_temp_changed);
+            pnp_thermostats[i].reported_target_temperature_version =
+                    pnp_twin_snapshot.target_temperature_version[i];
+            IOT_SAMPLE_LOG("Applied twin snapshot: `%s` %2f", pnp_desired_properties[i].name, value.d);
+        }
+    }
+    IOT_SAMPLE_LOG("Applied twin snapshot: `%.*s` %d",
+            (int)az_span_size(twin_version_name),
+            az_span_ptr(twin_version_name),
+            (int)pnp_twin_snapshot.desired.version);
     return true;
 }
+#endif /* PNP_TWIN_SNAPSHOT_PERSIST */
 
 /******************************************************************************
- * Function Name: process_device_twin_message
+ * Function Name: on_target_temperature_changed
  ******************************************************************************
  * Summary:
- *  Function to process the device twin message received from the Azure Hub.
+ *  Twin store callback for a changed desired targetTemperature. Applies the
+ *  value to its thermostat and reports it with the desired $version of the
+ *  store, which already holds the new section.
  *
  * Parameters:
- *  message_span: Structure to hold the received message.
+ *  context: Unused.
  *
- *  is_twin_get: Flag for message event.
+ *  field: Field of pnp_twin_store, the index of the thermostat.
+ *
+ *  old_value: Previous desired value, NULL if there was none.
+ *
+ *  new_value: New desired value, NULL if the property was removed.
  *
  * Return:
  *  void
  *
  ******************************************************************************/
-static void process_device_twin_message(az_span message_span, bool is_twin_get)
+static void on_target_temperature_changed(void* context, uint8_t field, iot_twin_value const* old_value,
+        iot_twin_value const* new_value)
 {
-    double desired_temperature;
-    int32_t version_number;
-
-    /* Parse for the desired temperature property. */
-    if (parse_desired_temperature_property(
-            message_span, is_twin_get, &desired_temperature, &version_number))
-    {
-        IOT_SAMPLE_LOG(" "); /* Formatting */
-        bool confirm = true;
-        bool is_max_temp_changed = false;
-        /* Update device temperature locally and report update to server. */
-        update_device_temperature_property(desired_temperature, &is_max_temp_changed);
-        send_reported_property(twin_desired_temperature_property_name, desired_temperature, version_number, confirm);
-        if(is_max_temp_changed)
-        {
-            confirm = false;
-            send_reported_property(twin_reported_maximum_temperature_property_name, device_maximum_temperature, -1, confirm);
-        }
+    (void)context;
+    (void)old_value;
+
+    if (new_value == NULL)
+    {
+        IOT_SAMPLE_LOG("Desired `%s` was removed.", pnp_desired_properties[field].name);
+        return;
     }
+
+    IOT_SAMPLE_LOG("Parsed desired `%s`: %2f", pnp_desired_properties[field].name, new_value->d);
+    process_device_twin_message(field, new_value->d, pnp_twin_store.desired.version);
 }
 
 /******************************************************************************
  * Function Name: handle_device_twin_message
  ******************************************************************************
  * Summary:
- *  Handle for Device Twin type message.
+ *  Handle for a twin GET response or a desired property update. The
+ *  payload is applied to pnp_twin_store, which ignores messages older than
+ *  its desired $version and requests the twin document through
+ *  request_twin_resync() when a patch was missed. The targetTemperature
+ *  values that changed are applied by their subscriptions.
  *
  * Parameters:
- *  message: MQTT publish information structure.
+ *  payload: Twin document or desired property patch.
  *
- *  twin_response: Structure for Twin response.
+ *  payload_len: Length of the payload.
+ *
+ *  is_twin_get: Flag for message event.
  *
  * Return:
  *  void
  *
  ******************************************************************************/
-static void handle_device_twin_message(cy_mqtt_publish_info_t *message,
-        az_iot_hub_client_twin_response *twin_response)
+static void handle_device_twin_message(uint8_t const* payload, size_t payload_len, bool is_twin_get)
 {
-    az_span message_span = az_span_create((uint8_t*)message->payload, message->payload_len);
-    pnp_msg_event_t *msg_event = NULL;
+    uint32_t changed = 0;
+    iot_twin_patch_result result;
 
-    msg_event = (pnp_msg_event_t *) malloc(sizeof(pnp_msg_event_t));
-    if(msg_event == NULL)
+    IOT_SAMPLE_LOG(is_twin_get ? "Message Type: GET" : "Message Type: Desired Properties");
+
+    /* The MQTT library delivers the whole PUBLISH in its network buffer and
+     * the message event holds a copy of it, so the payload is parsed in
+     * place by az_json_reader.
+     */
+    if (is_twin_get)
     {
-        IOT_SAMPLE_LOG("Memory not available...");
-        return;
+        result = iot_twin_store_apply_document(&pnp_twin_store, payload, payload_len, &changed);
+    }
+    else
+    {
+        result = iot_twin_store_apply_desired_patch(&pnp_twin_store, payload, payload_len, &changed);
     }
-    msg_event->msg_type = device_twin_message;
 
-    /* Invoke appropriate action per response type (3 types only). */
-    switch(twin_response->response_type)
+    switch (result)
     {
-    case AZ_IOT_HUB_CLIENT_TWIN_RESPONSE_TYPE_GET:
-        IOT_SAMPLE_LOG("Message Type: GET");
-        memcpy(&(msg_event->message_span), &message_span, sizeof(az_span));
-        msg_event->is_twin_get = true;
-        break;
+    case IOT_TWIN_PATCH_STALE:
+        IOT_SAMPLE_LOG("Ignoring twin %s older than desired `%.*s` %d.",
+                is_twin_get ? "document" : "patch",
+                (int)az_span_size(twin_version_name),
+                az_span_ptr(twin_version_name),
+                (int)pnp_twin_store.desired.version);
+        return;
 
-    case AZ_IOT_HUB_CLIENT_TWIN_RESPONSE_TYPE_REPORTED_PROPERTIES:
-        IOT_SAMPLE_LOG("Message Type: Reported Properties");
-        free(msg_event);
-        msg_event = NULL;
-        break;
+    case IOT_TWIN_PATCH_ERROR:
+        IOT_SAMPLE_LOG_ERROR("Failed to parse the twin %s.", is_twin_get ? "document" : "patch");
+        return;
 
-    case AZ_IOT_HUB_CLIENT_TWIN_RESPONSE_TYPE_DESIRED_PROPERTIES:
-        IOT_SAMPLE_LOG("Message Type: Desired Properties");
-        memcpy(&(msg_event->message_span), &message_span, sizeof(az_span));
-        msg_event->is_twin_get = false;
+    default:
+        /* A patch after a $version gap is applied too, its values are
+         * current; the twin store already requested the twin document.
+         */
         break;
     }
 
-    if(msg_event != NULL)
-    {
-        TEST_INFO(("Pushing to PNP message(device_twin_message) event queue...\n"));
-        if( xQueueSend( pnp_msg_event_queue, (void *)&msg_event, pdMS_TO_TICKS(PNP_MSG_EVENT_QUEUE_MSEC) ) != pdPASS )
-        {
-            TEST_INFO(("Pushing to PNP message event queue failed with Error\n"));
-            free(msg_event);
-            return;
-        }
-        TEST_INFO(("Message(device_twin_message) queued to PNP message event queue...\n"));
-    }
+#if PNP_TWIN_SNAPSHOT_PERSIST
+    /* Patches that change no targetTemperature advance the $version too */
+    save_twin_snapshot(changed);
+#endif
 }
 
 /******************************************************************************
  * Function Name: on_message_received
  ******************************************************************************
  * Summary:
- *  Function to handle the method invocation or device twin message from the
- *  Azure Hub.
+ *  Function to handle the method invocation from the Azure Hub.
  *
  * Parameters:
  *  topic: Topic of the received message.
  *
  *  topic_len: Topic length of the received message.
  *
- *  message: MQTT publish/subscribe information structure.
+ *  message_span: Payload of the received message.
  *
  * Return:
  *  void
  *
  ******************************************************************************/
-static void on_message_received(char* topic, uint16_t topic_len, cy_mqtt_publish_info_t *message)
+static void on_message_received(char* topic, uint16_t topic_len, az_span message_span)
 {
     az_result rc;
 
     az_span const topic_span = az_span_create((uint8_t*)topic, topic_len);
-    az_span const message_span = az_span_create((uint8_t*)message->payload, message->payload_len);
 
-    az_iot_hub_client_twin_response twin_response;
     az_iot_hub_client_method_request command_request;
 
     /* Parse the incoming message topic and handle appropriately. */
-    rc = az_iot_hub_client_twin_parse_received_topic(&hub_client, topic_span, &twin_response);
+    rc = az_iot_hub_client_methods_parse_received_topic(&hub_client, topic_span, &command_request);
     if (az_result_succeeded(rc))
     {
         IOT_SAMPLE_LOG_SUCCESS("Client received a valid topic response.");
         IOT_SAMPLE_LOG_AZ_SPAN("Topic:", topic_span);
         IOT_SAMPLE_LOG_AZ_SPAN("Payload:", message_span);
-        IOT_SAMPLE_LOG("Status: %d", twin_response.status);
-        handle_device_twin_message(message, &twin_response);
+        handle_command_request(message_span, &command_request);
     }
     else
     {
-        rc = az_iot_hub_client_methods_parse_received_topic(&hub_client, topic_span, &command_request);
-        if (az_result_succeeded(rc))
+        IOT_SAMPLE_LOG_ERROR("Message from unknown topic: az_result return code 0x%08x.", (unsigned int)rc);
+        IOT_SAMPLE_LOG_AZ_SPAN("Topic:", topic_span);
+    }
+}
+
+/******************************************************************************
+ * Function Name: classify_message
+ ******************************************************************************
+ * Summary:
+ *  Function to find the PnP message class of a received message from its
+ *  topic. Responses to reported property updates complete the patch of the
+ *  reported property writer and are not assigned a class.
+ *
+ * Parameters:
+ *  topic: Topic of the received message.
+ *
+ *  topic_len: Topic length of the received message.
+ *
+ *  out_msg_class: Message class of the received message.
+ *
+ * Return:
+ *  bool: true if the message has to be queued for the PnP app task.
+ *
+ ******************************************************************************/
+static bool classify_message(char const* topic, uint16_t topic_len, pnp_msg_class_t* out_msg_class)
+{
+    az_span const topic_span = az_span_create((uint8_t*)topic, topic_len);
+    az_iot_hub_client_twin_response twin_response;
+    az_iot_hub_client_method_request command_request;
+    bool matched = false;
+
+    if (az_result_succeeded(az_iot_hub_client_twin_parse_received_topic(&hub_client, topic_span, &twin_response)))
+    {
+        /* Responses to GET and reported property requests carry the request ID */
+        if (twin_response.response_type != AZ_IOT_HUB_CLIENT_TWIN_RESPONSE_TYPE_DESIRED_PROPERTIES)
         {
-            IOT_SAMPLE_LOG_SUCCESS("Client received a valid topic response.");
-            IOT_SAMPLE_LOG_AZ_SPAN("Topic:", topic_span);
-            IOT_SAMPLE_LOG_AZ_SPAN("Payload:", message_span);
-            handle_command_request(message, &command_request);
+            matched = iot_request_tracker_complete(&pnp_request_tracker,
+                    (char const*)az_span_ptr(twin_response.request_id),
+                    (size_t)az_span_size(twin_response.request_id), NULL);
+            if (!matched)
+            {
+                IOT_SAMPLE_LOG("Twin response to an unknown or expired request.");
+            }
         }
-        else
+
+        switch(twin_response.response_type)
         {
-            IOT_SAMPLE_LOG_ERROR("Message from unknown topic: az_result return code 0x%08x.", (unsigned int)rc);
-            IOT_SAMPLE_LOG_AZ_SPAN("Topic:", topic_span);
+        case AZ_IOT_HUB_CLIENT_TWIN_RESPONSE_TYPE_GET:
+            *out_msg_class = PNP_MSG_CLASS_TWIN_GET;
+            return true;
+
+        case AZ_IOT_HUB_CLIENT_TWIN_RESPONSE_TYPE_DESIRED_PROPERTIES:
+            *out_msg_class = PNP_MSG_CLASS_TWIN_DESIRED;
+            return true;
+
+        default:
+            IOT_SAMPLE_LOG("Message Type: Reported Properties, Status: %d", twin_response.status);
+            /* A late response to an expired patch belongs to no patch in flight */
+            if (matched &&
+                iot_reported_writer_complete(&pnp_reported_writer, az_iot_status_succeeded(twin_response.status)))
+            {
+                /* Changes made while the patch was in flight are pending */
+                iot_event_queue_wake(&pnp_msg_event_queue);
+            }
+            return false;
         }
     }
+
+    if (az_result_succeeded(az_iot_hub_client_methods_parse_received_topic(&hub_client, topic_span, &command_request)))
+    {
+        *out_msg_class = PNP_MSG_CLASS_COMMAND;
+        return true;
+    }
+
+    IOT_SAMPLE_LOG_ERROR("Message from unknown topic.");
+    IOT_SAMPLE_LOG_AZ_SPAN("Topic:", topic_span);
+    return false;
 }
 
 /******************************************************************************
@@ -1163,6 +2308,8 @@ static void on_message_received(char* topic, uint16_t topic_len, cy_mqtt_publish
 static void mqtt_event_cb(cy_mqtt_t mqtt_handle, cy_mqtt_event_t event, void *arg)
 {
     cy_mqtt_publish_info_t *received_msg;
+    void *msg_event;
+    pnp_msg_class_t msg_class;
 
     TEST_INFO(("\r\nMQTT App callback with handle : %p \n", mqtt_handle));
 
@@ -1178,12 +2325,38 @@ static void mqtt_event_cb(cy_mqtt_t mqtt_handle, cy_mqtt_event_t event, void *ar
             TEST_INFO(("\r\nCY_MQTT_DISCONN_REASON_NETWORK_DISCONNECTION .....\n"));
         }
         connect_state = false;
+        iot_event_queue_wake(&pnp_msg_event_queue);
         break;
 
     case CY_MQTT_EVENT_TYPE_PUBLISH_RECEIVE :
         received_msg = &(event.data.pub_msg.received_message);
         TEST_INFO(("\r\nMessage received from broker...\n"));
-        on_message_received((char*)received_msg->topic, received_msg->topic_len, received_msg);
+        if(!classify_message(received_msg->topic, received_msg->topic_len, &msg_class))
+        {
+            break;
+        }
+
+        /* The network buffer is reused once this callback returns, so the
+         * message is copied and handed to the PnP task without blocking. Twin
+         * documents are parsed there, not here.
+         */
+        msg_event = iot_mqtt_message_event_create(msg_class, received_msg->topic, received_msg->topic_len,
+                received_msg->payload, received_msg->payload_len);
+        if(msg_event == NULL)
+        {
+            IOT_SAMPLE_LOG("Memory not available...");
+            break;
+        }
+        if(!iot_event_queue_post(&pnp_msg_event_queue, msg_class, msg_event))
+        {
+            TEST_INFO(("Dropped %s message, PNP message event queue full\n", pnp_msg_class_name[msg_class]));
+            if(msg_class == PNP_MSG_CLASS_TWIN_DESIRED)
+            {
+                /* The PnP task fetches the twin document to recover the patch */
+                pnp_twin_desired_dropped = true;
+                iot_event_queue_wake(&pnp_msg_event_queue);
+            }
+        }
         break;
 
     default :
@@ -1250,19 +2423,19 @@ static cy_rslt_t disconnect_and_delete_mqtt_client(void)
 }
 
 /******************************************************************************
- * Function Name: request_device_twin_document
+ * Function Name: publish_twin_document_request
  ******************************************************************************
  * Summary:
- *  Function to request device twin from the Azure hub.
+ *  Function to publish a device twin request to the Azure hub.
  *
  * Parameters:
- *  void
+ *  request_id: Request ID allocated by the request tracker.
  *
  * Return:
  *  cy_rslt_t: Provides the result of an operation as a structured bitfield.
  *
  ******************************************************************************/
-static cy_rslt_t request_device_twin_document(void)
+static cy_rslt_t publish_twin_document_request(char const* request_id)
 {
     int rc;
     uint16_t topic_len = 0;
@@ -1276,7 +2449,7 @@ static cy_rslt_t request_device_twin_document(void)
 
     rc = az_iot_hub_client_twin_document_get_publish_topic(
             &hub_client,
-            get_request_id(),
+            az_span_create_from_str((char*)request_id),
             twin_document_topic_buffer,
             sizeof(twin_document_topic_buffer),
             (size_t *)&topic_len);
@@ -1306,6 +2479,93 @@ static cy_rslt_t request_device_twin_document(void)
     return result;
 }
 
+/******************************************************************************
+ * Function Name: request_device_twin_document
+ ******************************************************************************
+ * Summary:
+ *  Function to request device twin from the Azure hub. The request is
+ *  tracked, and published again if no response arrives in time.
+ *
+ * Parameters:
+ *  void
+ *
+ * Return:
+ *  cy_rslt_t: Provides the result of an operation as a structured bitfield.
+ *
+ ******************************************************************************/
+static cy_rslt_t request_device_twin_document(void)
+{
+    cy_rslt_t result;
+    char request_id[IOT_REQUEST_ID_SIZE];
+
+    if (!iot_request_tracker_begin(&pnp_request_tracker, PNP_REQUEST_OP_TWIN_GET,
+            PNP_TWIN_GET_TIMEOUT_MSEC, PNP_TWIN_GET_MAX_RETRIES, request_id))
+    {
+        IOT_SAMPLE_LOG_ERROR("No free twin request ID.");
+        return TEST_FAIL;
+    }
+
+    result = publish_twin_document_request(request_id);
+    if (result != CY_RSLT_SUCCESS)
+    {
+        iot_request_tracker_cancel(&pnp_request_tracker, request_id);
+    }
+    return result;
+}
+
+/******************************************************************************
+ * Function Name: resend_twin_request
+ ******************************************************************************
+ * Summary:
+ *  Request tracker callback that publishes a twin GET again after its
+ *  response timed out. Reported property patches are resent by the reported
+ *  property writer instead, with the latest values.
+ *
+ * Parameters:
+ *  context: Unused.
+ *
+ *  op: PNP_REQUEST_OP_* of the lost request.
+ *
+ *  request_id: Request ID of the lost request.
+ *
+ * Return:
+ *  cy_rslt_t: Result of the publish.
+ *
+ ******************************************************************************/
+static cy_rslt_t resend_twin_request(void* context, uint8_t op, char const* request_id)
+{
+    (void)context;
+
+    if (op != PNP_REQUEST_OP_TWIN_GET)
+    {
+        return TEST_FAIL;
+    }
+
+    return publish_twin_document_request(request_id);
+}
+
+/******************************************************************************
+ * Function Name: request_twin_resync
+ ******************************************************************************
+ * Summary:
+ *  Twin store callback for a desired $version gap. Requests the twin
+ *  document.
+ *
+ * Parameters:
+ *  context: Unused.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+static void request_twin_resync(void* context)
+{
+    (void)context;
+
+    IOT_SAMPLE_LOG("Desired property patch missed, requesting the twin document.");
+    (void)request_device_twin_document();
+}
+
 /******************************************************************************
  * Function Name: subscribe_mqtt_client_to_iot_hub_topics
  ******************************************************************************
@@ -1467,6 +2727,7 @@ static cy_rslt_t create_and_configure_mqtt_client(void)
     cy_awsport_ssl_credentials_t credentials;
     cy_awsport_ssl_credentials_t *security = NULL;
     cy_mqtt_broker_info_t broker_info;
+    az_iot_hub_client_options options;
 
     memset(&mqtt_endpoint_buffer, 0x00, sizeof(mqtt_endpoint_buffer));
 
@@ -1474,8 +2735,10 @@ static cy_rslt_t create_and_configure_mqtt_client(void)
             mqtt_endpoint_buffer,
             sizeof(mqtt_endpoint_buffer));
 
-    /* Initialize the hub client with the default connection options */
-    rc = az_iot_hub_client_init(&hub_client, env_vars.hub_hostname, env_vars.hub_device_id, NULL);
+    /* Initialize the hub client with the model ID of the PnP device */
+    options = az_iot_hub_client_options_default();
+    options.model_id = AZ_SPAN_FROM_STR(PNP_MODEL_ID);
+    rc = az_iot_hub_client_init(&hub_client, env_vars.hub_hostname, env_vars.hub_device_id, &options);
     if(az_result_failed(rc))
     {
         TEST_INFO(("\r\nFailed to initialize hub client: az_result return code 0x%08x.", (unsigned int)rc));
@@ -1600,8 +2863,17 @@ void Azure_hub_pnp_app(void *arg)
 {
     cy_rslt_t TestRes = TEST_PASS ;
     uint8_t Failcount = 0, Passcount = 0;
-    uint32_t time_ms = 0;
-    pnp_msg_event_t *msg_event = NULL;
+    TimeOut_t deadline;
+    TickType_t ticks_left = 0;
+    TimeOut_t wait_start;
+    TickType_t wait_ticks = 0;
+    TickType_t poll_ticks = 0;
+    void *msg_event = NULL;
+    iot_mqtt_message_event *message_event;
+    uint8_t msg_class;
+    bool telemetry_enabled = false;
+    TickType_t telemetry_due_tick = 0;
+    bool commands_handled = false;
 #ifdef CY_TFM_PSA_SUPPORTED
     psa_status_t uxStatus = PSA_SUCCESS;
     size_t read_len = 0;
@@ -1609,10 +2881,38 @@ void Azure_hub_pnp_app(void *arg)
     (void)read_len;
 #endif
 
-    /* Initialize the queue for hub methods events. */
-    pnp_msg_event_queue = xQueueCreate( PNP_MSG_EVENT_QUEUE_LENGTH, sizeof( unsigned long ) );
-    if(pnp_msg_event_queue != NULL)
+    iot_method_cache_init(&pnp_command_response_cache);
+    /* Statistics start with the default temperature, the history is empty */
+    for(uint32_t i = 0; i < PNP_THERMOSTAT_COUNT; i++)
+    {
+        iot_window_stats_init(&pnp_thermostats[i].stats, PNP_STATS_BUCKET_SEC);
+        iot_window_stats_add(&pnp_thermostats[i].stats, iot_time_sync_uptime(), pnp_thermostats[i].current_temperature);
+        iot_time_series_init(&pnp_thermostats[i].history);
+    }
+    if(!iot_twin_store_init(&pnp_twin_store, pnp_desired_properties,
+            (uint8_t)(sizeof(pnp_desired_properties) / sizeof(pnp_desired_properties[0]))))
+    {
+        TEST_INFO(("pnp_twin_store init ----------- Fail\n"));
+        Failcount++;
+        goto exit;
+    }
+    /* Field n of the store is the targetTemperature of thermostat n */
+    for(uint32_t i = 0; i < PNP_THERMOSTAT_COUNT; i++)
+    {
+        (void)iot_twin_store_subscribe(&pnp_twin_store, pnp_desired_properties[i].name,
+                on_target_temperature_changed, NULL);
+    }
+    iot_twin_store_set_resync(&pnp_twin_store, request_twin_resync, NULL);
+    iot_reported_writer_init(&pnp_reported_writer, PNP_REPORTED_DEBOUNCE_MSEC,
+            PNP_REPORTED_RESPONSE_TIMEOUT_MSEC, send_reported_properties, NULL);
+    (void)iot_request_tracker_init(&pnp_request_tracker, pnp_request_op_names, PNP_REQUEST_OP_COUNT,
+            resend_twin_request, NULL);
+
+    /* Initialize the queue for PnP message events. */
+    if(iot_event_queue_init(&pnp_msg_event_queue, PNP_MSG_EVENT_QUEUE_LENGTH,
+            pnp_msg_class_policy, PNP_MSG_CLASS_COUNT))
     {
+        iot_event_queue_set_consumer(&pnp_msg_event_queue, xTaskGetCurrentTaskHandle());
         TEST_INFO(("pnp_msg_event_queue create ----------- Pass\n"));
         Passcount++;
     }
@@ -1623,6 +2923,24 @@ void Azure_hub_pnp_app(void *arg)
         goto exit;
     }
 
+    /* Start the worker of deferred commands, it wakes this task when a
+     * response is ready.
+     */
+    pnp_history_mutex = xSemaphoreCreateMutex();
+    if((pnp_history_mutex != NULL) &&
+       iot_async_command_init(&pnp_async_commands, &pnp_async_command_ops, NULL, "pnp_commands",
+            AZURE_TASK_STACK_PNP_COMMANDS, AZURE_TASK_PRIORITY_PNP_COMMANDS))
+    {
+        TEST_INFO(("pnp_async_commands create ----------- Pass\n"));
+        Passcount++;
+    }
+    else
+    {
+        TEST_INFO(("pnp_async_commands create ----------- Fail\n"));
+        Failcount++;
+        goto exit;
+    }
+
 #if SAS_TOKEN_AUTH
     (void)device_id_buffer;
     (void)sas_token_buffer;
@@ -1671,6 +2989,16 @@ void Azure_hub_pnp_app(void *arg)
 
 #endif /* SAS_TOKEN_AUTH */
 
+    /* The getMaxMinReport windows are UTC times */
+    if(iot_time_sync_query(PNP_TIME_SYNC_SERVER))
+    {
+        TEST_INFO(("\r\niot_time_sync_query ----------- Pass \n"));
+    }
+    else
+    {
+        IOT_SAMPLE_LOG("Clock not synchronized, getMaxMinReport reports the statistics since boot.");
+    }
+
     TestRes = configure_hub_environment_variables();
     if(TestRes == TEST_PASS)
     {
@@ -1719,6 +3047,12 @@ void Azure_hub_pnp_app(void *arg)
         Failcount++;
     }
 
+#if PNP_TWIN_SNAPSHOT_PERSIST
+    /* A snapshot of the desired state is applied right away, the twin
+     * document then applies only the values that changed meanwhile.
+     */
+    (void)apply_twin_snapshot();
+#endif
     TestRes = request_device_twin_document();
     if(TestRes == TEST_PASS)
     {
@@ -1731,36 +3065,94 @@ void Azure_hub_pnp_app(void *arg)
         Failcount++;
     }
 
-    /* Delay Loop for Azure hub pnp app task */
-    time_ms = ( MESSAGE_WAIT_LOOP_DURATION_MSEC );
-    while((connect_state) && (time_ms > 0))
+    if(PNP_TELEMETRY_INTERVAL_MSEC > 0)
     {
-        if(xQueueReceive( pnp_msg_event_queue, (void *)&msg_event, pdMS_TO_TICKS(GET_QUEUE_TIMEOUT_MSEC) ) != pdPASS)
+        TestRes = init_telemetry_topics();
+        if(TestRes == TEST_PASS)
         {
-            /* No need to do anything */
+            TEST_INFO(("\r\ninit_telemetry_topics ----------- Pass \n"));
+            Passcount++;
+            telemetry_enabled = true;
+            pnp_channel_stats = (iot_channel_stats*)malloc(sizeof(iot_channel_stats));
+            if((pnp_channel_stats != NULL) && !iot_channel_stats_init(pnp_channel_stats, PNP_THERMOSTAT_COUNT))
+            {
+                free(pnp_channel_stats);
+                pnp_channel_stats = NULL;
+            }
+            telemetry_due_tick = xTaskGetTickCount() + pdMS_TO_TICKS(PNP_TELEMETRY_INTERVAL_MSEC);
         }
         else
         {
-            if(msg_event != NULL)
+            TEST_INFO(("\r\ninit_telemetry_topics ----------- Fail \n"));
+            Failcount++;
+        }
+    }
+
+    /* Delay Loop for Azure hub pnp app task */
+    /* The task sleeps until a message is posted, the client disconnects,
+     * pending reported properties or telemetry are due, a deferred command
+     * finishes or times out or the loop deadline expires. Telemetry is
+     * published with QoS 0 between messages; commands and twin messages that
+     * arrive meanwhile wait in the event queue.
+     */
+    vTaskSetTimeOutState(&deadline);
+    ticks_left = pdMS_TO_TICKS(MESSAGE_WAIT_LOOP_DURATION_MSEC);
+    while((connect_state) && (ticks_left > 0))
+    {
+        if(telemetry_enabled && (ticks_until(telemetry_due_tick) == 0))
+        {
+            telemetry_due_tick = send_scheduled_telemetry(telemetry_due_tick, commands_handled);
+            commands_handled = false;
+        }
+
+        wait_ticks = iot_reported_writer_poll(&pnp_reported_writer);
+        poll_ticks = iot_request_tracker_poll(&pnp_request_tracker);
+        if(poll_ticks < wait_ticks)
+        {
+            wait_ticks = poll_ticks;
+        }
+        poll_ticks = iot_async_command_poll(&pnp_async_commands);
+        if(poll_ticks < wait_ticks)
+        {
+            wait_ticks = poll_ticks;
+        }
+        if(telemetry_enabled && (ticks_until(telemetry_due_tick) < wait_ticks))
+        {
+            wait_ticks = ticks_until(telemetry_due_tick);
+        }
+        if(wait_ticks > ticks_left)
+        {
+            wait_ticks = ticks_left;
+        }
+        vTaskSetTimeOutState(&wait_start);
+        msg_event = iot_event_queue_wait(&pnp_msg_event_queue, &wait_start, &wait_ticks, &msg_class);
+        if(xTaskCheckForTimeOut(&deadline, &ticks_left) != pdFALSE)
+        {
+            ticks_left = 0;
+        }
+        if(msg_event != NULL)
+        {
+            message_event = (iot_mqtt_message_event*)msg_event;
+            if(msg_class == PNP_MSG_CLASS_COMMAND)
+            {
+                on_message_received(message_event->topic, message_event->topic_len,
+                        az_span_create((uint8_t*)message_event->payload, (int32_t)message_event->payload_len));
+                commands_handled = true;
+            }
+            else
             {
-                if(msg_event->msg_type == device_twin_message)
-                {
-                    process_device_twin_message(msg_event->message_span, msg_event->is_twin_get);
-                }
-                else if(msg_event->msg_type == device_command_request)
-                {
-                    send_command_response(msg_event->method_req, msg_event->status, msg_event->command_response_payload);
-                }
-                else
-                {
-                    TEST_INFO(("\r\nInvalid PNP event message type... \n"));
-                }
-
-                free(msg_event);
-                msg_event = NULL;
+                handle_device_twin_message((uint8_t const*)message_event->payload,
+                        message_event->payload_len, (msg_class == PNP_MSG_CLASS_TWIN_GET));
             }
+            free(msg_event);
+            msg_event = NULL;
+        }
+        if(pnp_twin_desired_dropped)
+        {
+            pnp_twin_desired_dropped = false;
+            IOT_SAMPLE_LOG("Desired property patch dropped, requesting the twin document.");
+            (void)request_device_twin_document();
         }
-        time_ms = time_ms - PNP_APP_TIMEOUT_MSEC;
     }
 
     exit :
@@ -1769,6 +3161,11 @@ void Azure_hub_pnp_app(void *arg)
             "PnP (Plug and Play demo Ends\n"
             "################################\n");
 
+    /* Stop the command worker before the client goes away, unanswered
+     * deferred commands time out on the hub.
+     */
+    iot_async_command_deinit(&pnp_async_commands);
+
     TestRes = disconnect_and_delete_mqtt_client();
     if(TestRes == TEST_PASS)
     {
@@ -1781,6 +3178,29 @@ void Azure_hub_pnp_app(void *arg)
         Failcount++;
     }
 
+    iot_event_queue_log_stats(&pnp_msg_event_queue, pnp_msg_class_name);
+    iot_method_cache_log_stats("Command", &pnp_command_response_cache);
+    iot_reported_writer_log_stats("PnP", &pnp_reported_writer);
+    iot_request_tracker_log_stats(&pnp_request_tracker);
+    iot_twin_store_log_stats("PnP", &pnp_twin_store);
+    iot_async_command_log_stats("PnP", &pnp_async_commands);
+    /* Telemetry published later than scheduled, while idle and while commands were handled */
+    iot_event_latency_log("tlm_idle", &pnp_telemetry_jitter[PNP_TELEMETRY_JITTER_IDLE]);
+    iot_event_latency_log("tlm_cmds", &pnp_telemetry_jitter[PNP_TELEMETRY_JITTER_COMMANDS]);
+    if(pnp_telemetry_skipped > 0)
+    {
+        TEST_INFO(("\r\nTelemetry samples skipped: %lu\n", (unsigned long)pnp_telemetry_skipped));
+    }
+    log_telemetry_summary();
+    free(pnp_channel_stats);
+    pnp_channel_stats = NULL;
+    iot_event_queue_deinit(&pnp_msg_event_queue);
+    if(pnp_history_mutex != NULL)
+    {
+        vSemaphoreDelete(pnp_history_mutex);
+        pnp_history_mutex = NULL;
+    }
+
     TEST_INFO(("\r\nCompleted MQTT Client Test Cases --------------------------\n"));
     TEST_INFO(("\r\nTotal Test Cases   ---------------------- %d\n", (Failcount + Passcount)));
     TEST_INFO(("\r\nTest Cases passed  ---------------------- %d\n", Passcount));
@@ -0,0 +1,543 @@
+/******************************************************************************
+ * File Name: mqtt_iot_json_path.c
+ *
+ * Description: This file contains the compiled JSON path queries. Paths are
+ * split into hashed member names and array indices once, and a query
+ * tracks the paths matching the current position of the JSON walk over
+ * az_json_reader, so many nested values are extracted in one pass without
+ * building a document tree.
+ *
+ ********************************************************************************
+ * Copyright 2024, Cypress Semiconductor Corporation (an Infineon company) or
+ * an affiliate of Cypress Semiconductor Corporation.  All rights reserved.
+ *
+ * This software, including source code, documentation and related
+ * materials ("Software") is owned by Cypress Semiconductor Corporation
+ * or one of its affiliates ("Cypress") and is protected by and subject to
+ * worldwide patent protection (United States and foreign),
+ * United States copyright laws and international treaty provisions.
+ * Therefore, you may use this Software only as provided in the license
+ * agreement accompanying the software package from which you
+ * obtained this Software ("EULA").
+ * If no EULA applies, Cypress hereby grants you a personal, non-exclusive,
+ * non-transferable license to copy, modify, and compile the Software
+ * source code solely for use in connection with Cypress's
+ * integrated circuit products.  Any reproduction, modification, translation,
+ * compilation, or representation of this Software except as specified
+ * above is prohibited without the express written permission of Cypress.
+ *
+ * Disclaimer: THIS SOFTWARE IS PROVIDED AS-IS, WITH NO WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING, BUT NOT LIMITED TO, NONINFRINGEMENT, IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. Cypress
+ * reserves the right to make changes to the Software without notice. Cypress
+ * does not assume any liability arising out of the application or use of the
+ * Software or any product or circuit described in the Software. Cypress does
+ * not authorize its products for use in any products where a malfunction or
+ * failure of the Cypress product may reasonably be expected to result in
+ * significant property damage, injury or death ("High Risk Product"). By
+ * including Cypress's product in a High Risk Product, the manufacturer
+ * of such system or application assumes all risk of such use and in doing
+ * so agrees to indemnify Cypress against all liability.
+ *******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cyabs_rtos.h"
+#include "azure_common.h"
+#include "mqtt_iot_common.h"
+#include "mqtt_iot_json_path.h"
+
+/*******************************************************************************
+ * Macros
+ ********************************************************************************/
+#define FNV1A_32_OFFSET_BASIS               (0x811c9dc5UL)
+#define FNV1A_32_PRIME                      (0x01000193UL)
+
+/* Generated document sizes and the time each size is measured for */
+#define JSON_PATH_BENCHMARK_SIZES           (4)
+#define JSON_PATH_BENCHMARK_MAX_SIZE        (8 * 1024)
+#define JSON_PATH_BENCHMARK_MSEC            (250)
+#define USEC_PER_MSEC                       (1000)
+
+/*******************************************************************************
+ * Global Variables
+ ********************************************************************************/
+static uint16_t const json_path_benchmark_size[JSON_PATH_BENCHMARK_SIZES] = { 1024, 2048, 4096, 8192 };
+
+/* Paths of the benchmark, the last one is not in the document */
+static char const* const json_path_benchmark_text[] =
+{
+    "desired.config.sampling.rateHz",
+    "desired.config.alarms[2].threshold",
+    "desired.config.alarms[0].enabled",
+    "desired.$version",
+    "reported.config.sampling.rateHz",
+    "desired.config.calibration.offset",
+};
+
+#define JSON_PATH_BENCHMARK_PATHS           (sizeof(json_path_benchmark_text) / sizeof(json_path_benchmark_text[0]))
+
+/******************************************************************************
+ * Function Name: iot_json_path_hash
+ ******************************************************************************
+ * Summary:
+ *  Computes the 32-bit FNV-1a hash of a member name.
+ *
+ * Parameters:
+ *  name: Member name.
+ *
+ *  name_len: Length of the name.
+ *
+ * Return:
+ *  uint32_t: Hash of the name.
+ *
+ ******************************************************************************/
+uint32_t iot_json_path_hash(char const* name, size_t name_len)
+{
+    uint32_t hash = FNV1A_32_OFFSET_BASIS;
+
+    for( size_t i = 0; i < name_len; i++ )
+    {
+        hash ^= (uint8_t)name[i];
+        hash *= FNV1A_32_PRIME;
+    }
+
+    return hash;
+}
+
+/******************************************************************************
+ * Function Name: iot_json_path_compile
+ ******************************************************************************
+ * Summary:
+ *  Splits a path into member names and array indices.
+ *
+ * Parameters:
+ *  path: Compiled path.
+ *
+ *  text: Path text.
+ *
+ * Return:
+ *  bool: false if the path is malformed.
+ *
+ ******************************************************************************/
+bool iot_json_path_compile(iot_json_path* path, char const* text)
+{
+    iot_json_path_segment* segment;
+    char const* cursor = text;
+    size_t key_len;
+    uint32_t index;
+
+    memset( path, 0x00, sizeof(iot_json_path) );
+
+    while( *cursor != '\0' )
+    {
+        if( path->count >= IOT_JSON_PATH_MAX_SEGMENTS )
+        {
+            return false;
+        }
+        segment = &path->segments[path->count];
+
+        if( *cursor == '[' )
+        {
+            /* Array index */
+            cursor++;
+            index = 0;
+            if( (*cursor < '0') || (*cursor > '9') )
+            {
+                return false;
+            }
+            while( (*cursor >= '0') && (*cursor <= '9') )
+            {
+                index = (index * 10) + (uint32_t)(*cursor - '0');
+                if( index > UINT16_MAX )
+                {
+                    return false;
+                }
+                cursor++;
+            }
+            if( *cursor != ']' )
+            {
+                return false;
+            }
+            cursor++;
+            segment->key = NULL;
+            segment->value = (uint16_t)index;
+        }
+        else
+        {
+            /* Member name, a '.' separates it from a preceding segment */
+            if( (*cursor == '.') && (path->count > 0) )
+            {
+                cursor++;
+            }
+            key_len = strcspn( cursor, ".[" );
+            if( (key_len == 0) || (key_len > UINT16_MAX) )
+            {
+                return false;
+            }
+            segment->key = cursor;
+            segment->value = (uint16_t)key_len;
+            segment->hash = iot_json_path_hash( cursor, key_len );
+            cursor += key_len;
+        }
+
+        path->count++;
+    }
+
+    return ( path->count > 0 );
+}
+
+/******************************************************************************
+ * Function Name: iot_json_path_query_init
+ ******************************************************************************
+ * Summary:
+ *  Prepares a query for a new document.
+ *
+ * Parameters:
+ *  query: Query state.
+ *
+ *  paths: Compiled paths.
+ *
+ *  count: Number of paths.
+ *
+ *  base_depth: Depth of the object the paths are relative to.
+ *
+ *  callback: Called for every value found.
+ *
+ *  context: Passed to the callback.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_json_path_query_init(iot_json_path_query* query, iot_json_path const* paths, uint8_t count,
+        uint8_t base_depth, iot_json_path_callback callback, void* context)
+{
+    memset( query, 0x00, sizeof(iot_json_path_query) );
+    if( count > IOT_JSON_PATH_MAX_PATHS )
+    {
+        count = IOT_JSON_PATH_MAX_PATHS;
+    }
+    query->paths = paths;
+    query->count = count;
+    query->base_depth = base_depth;
+    query->callback = callback;
+    query->context = context;
+
+    /* Every path matches the empty prefix */
+    query->prefix[0] = ( count == 32 ) ? UINT32_MAX : ((1UL << count) - 1);
+}
+
+/******************************************************************************
+ * Function Name: iot_json_path_on_token
+ ******************************************************************************
+ * Summary:
+ *  Matches a token against the paths whose leading segments match its
+ *  parent, and reports the paths that end at the token. The key hash is
+ *  computed only if a candidate path expects a member name there.
+ *
+ * Parameters:
+ *  context: Query state.
+ *
+ *  token: JSON token read by az_json_reader.
+ *
+ * Return:
+ *  bool: false if the path callback stopped parsing.
+ *
+ ******************************************************************************/
+bool iot_json_path_on_token(void* context, iot_json_walk_token const* token)
+{
+    iot_json_path_query* query = (iot_json_path_query*)context;
+    iot_json_path_segment const* segment;
+    uint32_t candidates;
+    uint32_t matched = 0;
+    uint32_t ends = 0;
+    uint32_t hash = 0;
+    bool hashed = false;
+    bool is_element;
+    uint16_t element = 0;
+    uint8_t level;
+
+    if( (token->kind == AZ_JSON_TOKEN_END_OBJECT) || (token->kind == AZ_JSON_TOKEN_END_ARRAY) )
+    {
+        return true;
+    }
+
+    if( token->depth <= query->base_depth )
+    {
+        if( (token->depth == query->base_depth) && (token->kind == AZ_JSON_TOKEN_BEGIN_ARRAY) )
+        {
+            query->element[1] = 0;
+        }
+        return true;
+    }
+
+    level = token->depth - query->base_depth;
+
+    /* Array elements carry no key; count them even if no path needs them */
+    is_element = ( az_span_ptr( token->key ) == NULL );
+    if( is_element )
+    {
+        element = query->element[level]++;
+    }
+    if( (token->kind == AZ_JSON_TOKEN_BEGIN_ARRAY) && (level < IOT_JSON_WALK_MAX_DEPTH) )
+    {
+        query->element[level + 1] = 0;
+    }
+
+    candidates = query->prefix[level - 1];
+    for( uint8_t i = 0; (i < query->count) && (candidates != 0); i++ )
+    {
+        if( (candidates & (1UL << i)) == 0 )
+        {
+            continue;
+        }
+        candidates &= ~(1UL << i);
+
+        if( query->paths[i].count < level )
+        {
+            continue;
+        }
+        segment = &query->paths[i].segments[level - 1];
+
+        if( segment->key == NULL )
+        {
+            if( !is_element || (segment->value != element) )
+            {
+                continue;
+            }
+        }
+        else
+        {
+            if( is_element || (segment->value != az_span_size( token->key )) )
+            {
+                continue;
+            }
+            if( !hashed )
+            {
+                hash = iot_json_path_hash( (char const*)az_span_ptr( token->key ), (size_t)az_span_size( token->key ) );
+                hashed = true;
+            }
+            if( (segment->hash != hash) || (memcmp( segment->key, az_span_ptr( token->key ), segment->value ) != 0) )
+            {
+                continue;
+            }
+        }
+
+        if( query->paths[i].count == level )
+        {
+            ends |= (1UL << i);
+        }
+        else
+        {
+            matched |= (1UL << i);
+        }
+    }
+
+    if( level < IOT_JSON_WALK_MAX_DEPTH )
+    {
+        query->prefix[level] = matched;
+    }
+
+    for( uint8_t i = 0; ends != 0; i++ )
+    {
+        if( ends & (1UL << i) )
+        {
+            ends &= ~(1UL << i);
+            query->found |= (1UL << i);
+            if( !query->callback( query->context, i, token ) )
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/******************************************************************************
+ * Function Name: iot_json_path_extract
+ ******************************************************************************
+ * Summary:
+ *  Runs a query over a whole document.
+ *
+ * Parameters:
+ *  query: Query state.
+ *
+ *  payload: JSON document.
+ *
+ *  payload_len: Length of the document.
+ *
+ * Return:
+ *  bool: false if the document is malformed.
+ *
+ ******************************************************************************/
+bool iot_json_path_extract(iot_json_path_query* query, uint8_t const* payload, size_t payload_len)
+{
+    return ( iot_json_walk( payload, payload_len, iot_json_path_on_token, query ) != IOT_JSON_WALK_ERROR );
+}
+
+/******************************************************************************
+ * Function Name: benchmark_match_cb
+ ******************************************************************************
+ * Summary:
+ *  Query callback of the benchmark, counts the values found.
+ *
+ * Parameters:
+ *  context: Match counter.
+ *
+ *  path: Index of the path.
+ *
+ *  token: Value token.
+ *
+ * Return:
+ *  bool: true, the whole document is parsed.
+ *
+ ******************************************************************************/
+static bool benchmark_match_cb(void* context, uint8_t path, iot_json_walk_token const* token)
+{
+    (void)path;
+    (void)token;
+
+    (*(uint32_t*)context)++;
+    return true;
+}
+
+/******************************************************************************
+ * Function Name: build_benchmark_document
+ ******************************************************************************
+ * Summary:
+ *  Writes a twin document of about the requested size. Filler properties
+ *  with nested objects and arrays precede the nested configuration, so the
+ *  query has to pass over them.
+ *
+ * Parameters:
+ *  buffer: Destination buffer.
+ *
+ *  size: Requested size of the document.
+ *
+ * Return:
+ *  size_t: Length of the document.
+ *
+ ******************************************************************************/
+static size_t build_benchmark_document(char* buffer, size_t size)
+{
+    static char const head[] = "{\"desired\":{";
+    static char const tail[] =
+            "\"config\":{\"sampling\":{\"rateHz\":10,\"window\":5},"
+            "\"alarms\":[{\"threshold\":1.5,\"enabled\":true},{\"threshold\":2.5,\"enabled\":false},"
+            "{\"threshold\":3.5,\"enabled\":true}]},\"$version\":7},"
+            "\"reported\":{\"config\":{\"sampling\":{\"rateHz\":10}},\"$version\":3}}";
+    char filler[96];
+    size_t length = sizeof(head) - 1;
+    int filler_len;
+
+    memcpy( buffer, head, length );
+    for( uint32_t i = 0; ; i++ )
+    {
+        filler_len = snprintf( filler, sizeof(filler),
+                "\"p%lu\":{\"name\":\"filler%04lu\",\"value\":%lu,\"flags\":[1,2,3]},",
+                (unsigned long)i, (unsigned long)i, (unsigned long)(i * 7) );
+        if( (length + (size_t)filler_len + sizeof(tail)) > size )
+        {
+            break;
+        }
+        memcpy( buffer + length, filler, (size_t)filler_len );
+        length += (size_t)filler_len;
+    }
+    memcpy( buffer + length, tail, sizeof(tail) - 1 );
+
+    return length + sizeof(tail) - 1;
+}
+
+/******************************************************************************
+ * Function Name: iot_json_path_build_benchmark_report
+ ******************************************************************************
+ * Summary:
+ *  Extracts the benchmark paths from generated documents of each size for
+ *  JSON_PATH_BENCHMARK_MSEC, and reports the average time per document.
+ *
+ * Parameters:
+ *  buffer: Destination buffer.
+ *
+ *  out_report: JSON text written to the buffer.
+ *
+ * Return:
+ *  az_result: AZ_OK, AZ_ERROR_NOT_ENOUGH_SPACE or AZ_ERROR_OUT_OF_MEMORY.
+ *
+ ******************************************************************************/
+az_result iot_json_path_build_benchmark_report(az_span buffer, az_span* out_report)
+{
+    iot_json_path paths[JSON_PATH_BENCHMARK_PATHS];
+    iot_json_path_query query;
+    uint32_t usec_per_doc[JSON_PATH_BENCHMARK_SIZES];
+    uint32_t matches[JSON_PATH_BENCHMARK_SIZES];
+    size_t length[JSON_PATH_BENCHMARK_SIZES];
+    TickType_t start_tick;
+    TickType_t elapsed;
+    uint32_t iterations;
+    az_json_writer jw;
+    char* document;
+
+    for( uint8_t i = 0; i < JSON_PATH_BENCHMARK_PATHS; i++ )
+    {
+        (void)iot_json_path_compile( &paths[i], json_path_benchmark_text[i] );
+    }
+
+    document = (char*)malloc( JSON_PATH_BENCHMARK_MAX_SIZE );
+    if( document == NULL )
+    {
+        return AZ_ERROR_OUT_OF_MEMORY;
+    }
+
+    for( uint8_t s = 0; s < JSON_PATH_BENCHMARK_SIZES; s++ )
+    {
+        length[s] = build_benchmark_document( document, json_path_benchmark_size[s] );
+        iterations = 0;
+        start_tick = xTaskGetTickCount();
+        do
+        {
+            matches[s] = 0;
+            iot_json_path_query_init( &query, paths, JSON_PATH_BENCHMARK_PATHS, 0, benchmark_match_cb, &matches[s] );
+            (void)iot_json_path_extract( &query, (uint8_t const*)document, length[s] );
+            iterations++;
+            elapsed = xTaskGetTickCount() - start_tick;
+        } while( elapsed < pdMS_TO_TICKS( JSON_PATH_BENCHMARK_MSEC ) );
+
+        usec_per_doc[s] = (uint32_t)((elapsed * portTICK_PERIOD_MS * USEC_PER_MSEC) / iterations);
+    }
+
+    free( document );
+
+    IOT_RETURN_IF_FAILED( az_json_writer_init( &jw, buffer, NULL ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_begin_object( &jw ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("bytes") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_begin_array( &jw ) );
+    for( uint8_t s = 0; s < JSON_PATH_BENCHMARK_SIZES; s++ )
+    {
+        IOT_RETURN_IF_FAILED( az_json_writer_append_int32( &jw, (int32_t)length[s] ) );
+    }
+    IOT_RETURN_IF_FAILED( az_json_writer_append_end_array( &jw ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("usPerDoc") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_begin_array( &jw ) );
+    for( uint8_t s = 0; s < JSON_PATH_BENCHMARK_SIZES; s++ )
+    {
+        IOT_RETURN_IF_FAILED( az_json_writer_append_int32( &jw, (int32_t)usec_per_doc[s] ) );
+    }
+    IOT_RETURN_IF_FAILED( az_json_writer_append_end_array( &jw ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("matches") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_begin_array( &jw ) );
+    for( uint8_t s = 0; s < JSON_PATH_BENCHMARK_SIZES; s++ )
+    {
+        IOT_RETURN_IF_FAILED( az_json_writer_append_int32( &jw, (int32_t)matches[s] ) );
+    }
+    IOT_RETURN_IF_FAILED( az_json_writer_append_end_array( &jw ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_end_object( &jw ) );
+
+    *out_report = az_json_writer_get_bytes_used_in_destination( &jw );
+    return AZ_OK;
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,161 @@
+/******************************************************************************
+ * File Name: mqtt_iot_json_path.h
+ *
+ * Description: This file contains the declarations of the compiled JSON path
+ * queries, which extract nested values such as config.alarms[2].threshold
+ * from a JSON document in one pass of az_json_reader.
+ *
+ ********************************************************************************
+ * Copyright 2024, Cypress Semiconductor Corporation (an Infineon company) or
+ * an affiliate of Cypress Semiconductor Corporation.  All rights reserved.
+ *
+ * This software, including source code, documentation and related
+ * materials ("Software") is owned by Cypress Semiconductor Corporation
+ * or one of its affiliates ("Cypress") and is protected by and subject to
+ * worldwide patent protection (United States and foreign),
+ * United States copyright laws and international treaty provisions.
+ * Therefore, you may use this Software only as provided in the license
+ * agreement accompanying the software package from which you
+ * obtained this Software ("EULA").
+ * If no EULA applies, Cypress hereby grants you a personal, non-exclusive,
+ * non-transferable license to copy, modify, and compile the Software
+ * source code solely for use in connection with Cypress's
+ * integrated circuit products.  Any reproduction, modification, translation,
+ * compilation, or representation of this Software except as specified
+ * above is prohibited without the express written permission of Cypress.
+ *
+ * Disclaimer: THIS SOFTWARE IS PROVIDED AS-IS, WITH NO WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING, BUT NOT LIMITED TO, NONINFRINGEMENT, IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. Cypress
+ * reserves the right to make changes to the Software without notice. Cypress
+ * does not assume any liability arising out of the application or use of the
+ * Software or any product or circuit described in the Software. Cypress does
+ * not authorize its products for use in any products where a malfunction or
+ * failure of the Cypress product may reasonably be expected to result in
+ * significant property damage, injury or death ("High Risk Product"). By
+ * including Cypress's product in a High Risk Product, the manufacturer
+ * of such system or application assumes all risk of such use and in doing
+ * so agrees to indemnify Cypress against all liability.
+ *******************************************************************************/
+
+#ifndef MQTT_IOT_JSON_PATH_H_
+#define MQTT_IOT_JSON_PATH_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <az_core.h>
+#include "mqtt_iot_json_walk.h"
+
+/*******************************************************************************
+ * Macros
+ ********************************************************************************/
+/* Maximum number of member names and array indices in a path */
+#define IOT_JSON_PATH_MAX_SEGMENTS              (8)
+
+/* Maximum number of paths of a query */
+#define IOT_JSON_PATH_MAX_PATHS                 (32)
+
+/*******************************************************************************
+ * Global Variables
+ ********************************************************************************/
+/* Member name or array index of a path */
+typedef struct
+{
+    char const*     key;            /* Points into the path text, NULL for an array index */
+    uint32_t        hash;           /* FNV-1a hash of the key */
+    uint16_t        value;          /* Length of the key, or the array index */
+} iot_json_path_segment;
+
+/* Compiled path, e.g. config.sampling.rateHz or config.alarms[2].threshold */
+typedef struct
+{
+    iot_json_path_segment   segments[IOT_JSON_PATH_MAX_SEGMENTS];
+    uint8_t                 count;
+} iot_json_path;
+
+/*
+ * Called for the value at the end of a path: a scalar, null, or the
+ * beginning of an object or array. Return false to stop parsing.
+ */
+typedef bool (*iot_json_path_callback)(void* context, uint8_t path, iot_json_walk_token const* token);
+
+/* State of a query across the tokens of a JSON walk. Matching keeps, for
+ * every level of the current position, the paths whose leading segments
+ * match, so each token is compared only with the paths still possible
+ * there.
+ */
+typedef struct
+{
+    iot_json_path const*    paths;
+    uint8_t                 count;
+    uint8_t                 base_depth;     /* Depth of the object the paths start in */
+    iot_json_path_callback  callback;
+    void*                   context;
+    uint32_t                prefix[IOT_JSON_WALK_MAX_DEPTH + 1];     /* Bit n set if path n matches down to the level */
+    uint16_t                element[IOT_JSON_WALK_MAX_DEPTH + 1];    /* Index of the next element of an array */
+    uint32_t                found;          /* Bit n set if path n matched */
+} iot_json_path_query;
+
+/******************************************************************************
+ * Function Prototypes
+ *******************************************************************************/
+/*
+ * @brief Computes the 32-bit FNV-1a hash of a member name.
+ * @param[in] name Member name.
+ * @param[in] name_len Length of \p name.
+ * @return Hash of the name.
+ */
+uint32_t iot_json_path_hash(char const* name, size_t name_len);
+
+/*
+ * @brief Compiles a path of member names separated by '.' with optional
+ * array indices in brackets.
+ * @param[out] path Compiled path.
+ * @param[in] text Path text, must remain valid as the keys point into it.
+ * @return false if the path is empty, malformed or has too many segments.
+ */
+bool iot_json_path_compile(iot_json_path* path, char const* text);
+
+/*
+ * @brief Prepares a query for a new document.
+ * @param[out] query Query state.
+ * @param[in] paths Compiled paths, must remain valid.
+ * @param[in] count Number of paths, at most IOT_JSON_PATH_MAX_PATHS.
+ * @param[in] base_depth Depth of the object the paths are relative to, 0
+ * for the root object.
+ * @param[in] callback Called for every value found.
+ * @param[in] context Passed to \p callback.
+ */
+void iot_json_path_query_init(iot_json_path_query* query, iot_json_path const* paths, uint8_t count,
+        uint8_t base_depth, iot_json_path_callback callback, void* context);
+
+/*
+ * @brief JSON walk callback of a query. Pass it with the query to
+ * iot_json_walk(), or call it from another token callback.
+ * @param[in] context Query state.
+ * @param[in] token JSON token read by az_json_reader.
+ * @return false if the path callback stopped parsing.
+ */
+bool iot_json_path_on_token(void* context, iot_json_walk_token const* token);
+
+/*
+ * @brief Runs a query over a whole document.
+ * @param[in] query Initialized query state.
+ * @param[in] payload JSON document.
+ * @param[in] payload_len Length of \p payload.
+ * @return false if the document is malformed.
+ */
+bool iot_json_path_extract(iot_json_path_query* query, uint8_t const* payload, size_t payload_len);
+
+/*
+ * @brief Measures queries of nested paths on generated twin documents of
+ * 1 KB to 8 KB and builds {"bytes":[..],"usPerDoc":[..],"matches":[..]}.
+ * Blocks the caller for about one second.
+ */
+az_result iot_json_path_build_benchmark_report(az_span buffer, az_span* out_report);
+
+#endif /* MQTT_IOT_JSON_PATH_H_ */
+
+/* [] END OF FILE */
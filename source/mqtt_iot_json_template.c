@@ -0,0 +1,377 @@
+/******************************************************************************
+ * File Name: mqtt_iot_json_template.c
+ *
+ * Description: This file contains the precompiled JSON templates:
+ * constant text fixed at build time with numeric and string slots filled at
+ * run time, and their benchmark against az_json_writer.
+ *
+ ********************************************************************************
+ * Copyright 2024, Cypress Semiconductor Corporation (an Infineon company) or
+ * an affiliate of Cypress Semiconductor Corporation.  All rights reserved.
+ *
+ * This software, including source code, documentation and related
+ * materials ("Software") is owned by Cypress Semiconductor Corporation
+ * or one of its affiliates ("Cypress") and is protected by and subject to
+ * worldwide patent protection (United States and foreign),
+ * United States copyright laws and international treaty provisions.
+ * Therefore, you may use this Software only as provided in the license
+ * agreement accompanying the software package from which you
+ * obtained this Software ("EULA").
+ * If no EULA applies, Cypress hereby grants you a personal, non-exclusive,
+ * non-transferable license to copy, modify, and compile the Software
+ * source code solely for use in connection with Cypress's
+ * integrated circuit products.  Any reproduction, modification, translation,
+ * compilation, or representation of this Software except as specified
+ * above is prohibited without the express written permission of Cypress.
+ *
+ * Disclaimer: THIS SOFTWARE IS PROVIDED AS-IS, WITH NO WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING, BUT NOT LIMITED TO, NONINFRINGEMENT, IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. Cypress
+ * reserves the right to make changes to the Software without notice. Cypress
+ * does not assume any liability arising out of the application or use of the
+ * Software or any product or circuit described in the Software. Cypress does
+ * not authorize its products for use in any products where a malfunction or
+ * failure of the Cypress product may reasonably be expected to result in
+ * significant property damage, injury or death ("High Risk Product"). By
+ * including Cypress's product in a High Risk Product, the manufacturer
+ * of such system or application assumes all risk of such use and in doing
+ * so agrees to indemnify Cypress against all liability.
+ *******************************************************************************/
+
+#include <string.h>
+
+#include "mqtt_iot_common.h"
+#include "mqtt_iot_json_template.h"
+
+/*******************************************************************************
+ * Macros
+ ********************************************************************************/
+/* Builds of each kind that are measured, and the size of one property */
+#define TEMPLATE_BENCHMARK_ITERATIONS       (1000)
+#define TEMPLATE_BENCHMARK_PAYLOAD_SIZE     (128)
+#define TEMPLATE_NUMBER_SIZE                (24)
+#define TEMPLATE_DECIMALS                   (2)
+
+/*******************************************************************************
+ * Global Variables
+ ********************************************************************************/
+static char const hex_digits[] = "0123456789abcdef";
+
+/* Reported property with its acknowledgment, as the PnP app sends it */
+static iot_json_template_part const benchmark_property_parts[] =
+{
+    IOT_JSON_TEMPLATE_PART("{\"targetTemperature\":{\"value\":", IOT_JSON_SLOT_NUMBER),
+    IOT_JSON_TEMPLATE_PART(",\"ac\":", IOT_JSON_SLOT_INT32),
+    IOT_JSON_TEMPLATE_PART(",\"av\":", IOT_JSON_SLOT_INT32),
+    IOT_JSON_TEMPLATE_PART(",\"ad\":", IOT_JSON_SLOT_STRING),
+    IOT_JSON_TEMPLATE_PART("}}", IOT_JSON_SLOT_NONE)
+};
+static iot_json_template const benchmark_property_template = IOT_JSON_TEMPLATE(benchmark_property_parts);
+
+static az_span const benchmark_description = AZ_SPAN_LITERAL_FROM_STR("success");
+
+/******************************************************************************
+ * Function Name: iot_json_template_append_text
+ ******************************************************************************
+ * Summary:
+ *  Copies JSON text at the start of a buffer.
+ *
+ * Parameters:
+ *  text: JSON text.
+ *
+ *  remainder: Buffer, advanced past the text.
+ *
+ * Return:
+ *  az_result: AZ_OK on success.
+ *
+ ******************************************************************************/
+az_result iot_json_template_append_text(az_span text, az_span* remainder)
+{
+    if( az_span_size( text ) > az_span_size( *remainder ) )
+    {
+        return AZ_ERROR_NOT_ENOUGH_SPACE;
+    }
+
+    *remainder = az_span_copy( *remainder, text );
+    return AZ_OK;
+}
+
+/******************************************************************************
+ * Function Name: append_string
+ ******************************************************************************
+ * Summary:
+ *  Writes a JSON string with the escapes of az_json_writer_append_string().
+ *
+ * Parameters:
+ *  text: Unescaped string.
+ *
+ *  remainder: Buffer, advanced past the string.
+ *
+ * Return:
+ *  az_result: AZ_OK on success.
+ *
+ ******************************************************************************/
+static az_result append_string(az_span text, az_span* remainder)
+{
+    uint8_t const* source = az_span_ptr( text );
+    uint8_t* destination = az_span_ptr( *remainder );
+    int32_t size = az_span_size( *remainder );
+    int32_t length = 0;
+    uint8_t escape;
+
+    if( size < 2 )
+    {
+        return AZ_ERROR_NOT_ENOUGH_SPACE;
+    }
+    destination[length++] = '"';
+
+    for( int32_t i = 0; i < az_span_size( text ); i++ )
+    {
+        switch( source[i] )
+        {
+            case '"':  escape = '"';  break;
+            case '\\': escape = '\\'; break;
+            case '\b': escape = 'b';  break;
+            case '\f': escape = 'f';  break;
+            case '\n': escape = 'n';  break;
+            case '\r': escape = 'r';  break;
+            case '\t': escape = 't';  break;
+            default:   escape = ( source[i] < 0x20 ) ? 'u' : 0; break;
+        }
+
+        if( escape == 0 )
+        {
+            if( length + 1 >= size )
+            {
+                return AZ_ERROR_NOT_ENOUGH_SPACE;
+            }
+            destination[length++] = source[i];
+        }
+        else if( escape != 'u' )
+        {
+            if( length + 2 >= size )
+            {
+                return AZ_ERROR_NOT_ENOUGH_SPACE;
+            }
+            destination[length++] = '\\';
+            destination[length++] = escape;
+        }
+        else
+        {
+            if( length + 6 >= size )
+            {
+                return AZ_ERROR_NOT_ENOUGH_SPACE;
+            }
+            destination[length++] = '\\';
+            destination[length++] = 'u';
+            destination[length++] = '0';
+            destination[length++] = '0';
+            destination[length++] = (uint8_t)hex_digits[source[i] >> 4];
+            destination[length++] = (uint8_t)hex_digits[source[i] & 0x0F];
+        }
+    }
+
+    destination[length++] = '"';
+    *remainder = az_span_slice_to_end( *remainder, length );
+    return AZ_OK;
+}
+
+/******************************************************************************
+ * Function Name: iot_json_template_append
+ ******************************************************************************
+ * Summary:
+ *  Writes the literals of a template and fills its slots in order. No
+ *  property names or punctuation are produced at run time.
+ *
+ * Parameters:
+ *  json_template: Template.
+ *
+ *  slots: One value for each slot of the template.
+ *
+ *  remainder: Buffer, advanced past the text.
+ *
+ * Return:
+ *  az_result: AZ_OK on success.
+ *
+ ******************************************************************************/
+az_result iot_json_template_append(iot_json_template const* json_template, iot_json_slot const slots[],
+        az_span* remainder)
+{
+    iot_json_template_part const* part;
+    uint8_t slot = 0;
+
+    for( uint8_t i = 0; i < json_template->count; i++ )
+    {
+        part = &json_template->parts[i];
+        IOT_RETURN_IF_FAILED( iot_json_template_append_text(
+                az_span_create( (uint8_t*)part->literal, part->literal_len ), remainder ) );
+
+        switch( part->slot )
+        {
+            case IOT_JSON_SLOT_INT32:
+                IOT_RETURN_IF_FAILED( az_span_i32toa( *remainder, slots[slot++].i, remainder ) );
+                break;
+            case IOT_JSON_SLOT_NUMBER:
+                IOT_RETURN_IF_FAILED( iot_json_template_append_text( slots[slot++].text, remainder ) );
+                break;
+            case IOT_JSON_SLOT_STRING:
+                IOT_RETURN_IF_FAILED( append_string( slots[slot++].text, remainder ) );
+                break;
+            default:
+                break;
+        }
+    }
+
+    return AZ_OK;
+}
+
+/******************************************************************************
+ * Function Name: build_with_writer
+ ******************************************************************************
+ * Summary:
+ *  Builds the benchmark property with az_json_writer.
+ *
+ * Parameters:
+ *  value: Temperature.
+ *
+ *  version: Acknowledged version.
+ *
+ *  buffer: Destination buffer.
+ *
+ *  out_payload: JSON text written to the buffer.
+ *
+ * Return:
+ *  az_result: AZ_OK on success.
+ *
+ ******************************************************************************/
+static az_result build_with_writer(double value, int32_t version, az_span buffer, az_span* out_payload)
+{
+    az_json_writer jw;
+
+    IOT_RETURN_IF_FAILED( az_json_writer_init( &jw, buffer, NULL ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_begin_object( &jw ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("targetTemperature") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_begin_object( &jw ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("value") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_double( &jw, value, TEMPLATE_DECIMALS ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("ac") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_int32( &jw, 200 ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("av") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_int32( &jw, version ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("ad") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_string( &jw, benchmark_description ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_end_object( &jw ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_end_object( &jw ) );
+
+    *out_payload = az_json_writer_get_bytes_used_in_destination( &jw );
+    return AZ_OK;
+}
+
+/******************************************************************************
+ * Function Name: build_with_template
+ ******************************************************************************
+ * Summary:
+ *  Builds the benchmark property with its template.
+ *
+ * Parameters:
+ *  value: Temperature.
+ *
+ *  version: Acknowledged version.
+ *
+ *  buffer: Destination buffer.
+ *
+ *  out_payload: JSON text written to the buffer.
+ *
+ * Return:
+ *  az_result: AZ_OK on success.
+ *
+ ******************************************************************************/
+static az_result build_with_template(double value, int32_t version, az_span buffer, az_span* out_payload)
+{
+    uint8_t number[TEMPLATE_NUMBER_SIZE];
+    iot_json_slot slots[4];
+    az_span remainder;
+
+    IOT_RETURN_IF_FAILED( az_span_dtoa( AZ_SPAN_FROM_BUFFER( number ), value, TEMPLATE_DECIMALS, &remainder ) );
+    slots[0].text = az_span_create( number, (int32_t)sizeof(number) - az_span_size( remainder ) );
+    slots[1].i = 200;
+    slots[2].i = version;
+    slots[3].text = benchmark_description;
+
+    remainder = buffer;
+    IOT_RETURN_IF_FAILED( iot_json_template_append( &benchmark_property_template, slots, &remainder ) );
+
+    *out_payload = az_span_slice( buffer, 0, az_span_size( buffer ) - az_span_size( remainder ) );
+    return AZ_OK;
+}
+
+/******************************************************************************
+ * Function Name: iot_json_template_build_benchmark_report
+ ******************************************************************************
+ * Summary:
+ *  Counts the CPU cycles of TEMPLATE_BENCHMARK_ITERATIONS builds of a
+ *  reported property with az_json_writer and with a template, reports the
+ *  average cycles of each and whether both produce the same text. The
+ *  two loops run back to back without a critical section, and the texts
+ *  are compared only after both were timed.
+ *
+ * Parameters:
+ *  buffer: Destination buffer.
+ *
+ *  out_report: JSON text written to the buffer.
+ *
+ * Return:
+ *  az_result: AZ_OK on success.
+ *
+ ******************************************************************************/
+az_result iot_json_template_build_benchmark_report(az_span buffer, az_span* out_report)
+{
+    uint8_t payload[2][TEMPLATE_BENCHMARK_PAYLOAD_SIZE];
+    az_span built[2];
+    uint32_t cycles[2];
+    uint32_t start;
+    az_json_writer jw;
+
+    IOT_CYCLE_COUNTER_START();
+
+    start = IOT_CYCLE_COUNT();
+    for( int32_t i = 0; i < TEMPLATE_BENCHMARK_ITERATIONS; i++ )
+    {
+        IOT_RETURN_IF_FAILED( build_with_writer( 68.5, i, AZ_SPAN_FROM_BUFFER( payload[0] ), &built[0] ) );
+    }
+    cycles[0] = (uint32_t)( IOT_CYCLE_COUNT() - start ) / TEMPLATE_BENCHMARK_ITERATIONS;
+
+    start = IOT_CYCLE_COUNT();
+    for( int32_t i = 0; i < TEMPLATE_BENCHMARK_ITERATIONS; i++ )
+    {
+        IOT_RETURN_IF_FAILED( build_with_template( 68.5, i, AZ_SPAN_FROM_BUFFER( payload[1] ), &built[1] ) );
+    }
+    cycles[1] = (uint32_t)( IOT_CYCLE_COUNT() - start ) / TEMPLATE_BENCHMARK_ITERATIONS;
+
+    IOT_RETURN_IF_FAILED( az_json_writer_init( &jw, buffer, NULL ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_begin_object( &jw ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("iterations") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_int32( &jw, TEMPLATE_BENCHMARK_ITERATIONS ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("cycles") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_begin_array( &jw ) );
+    for( uint8_t b = 0; b < 2; b++ )
+    {
+        IOT_RETURN_IF_FAILED( az_json_writer_append_int32( &jw, (int32_t)cycles[b] ) );
+    }
+    IOT_RETURN_IF_FAILED( az_json_writer_append_end_array( &jw ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("bytes") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_begin_array( &jw ) );
+    for( uint8_t b = 0; b < 2; b++ )
+    {
+        IOT_RETURN_IF_FAILED( az_json_writer_append_int32( &jw, az_span_size( built[b] ) ) );
+    }
+    IOT_RETURN_IF_FAILED( az_json_writer_append_end_array( &jw ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("match") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_bool( &jw, az_span_is_content_equal( built[0], built[1] ) ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_end_object( &jw ) );
+
+    *out_report = az_json_writer_get_bytes_used_in_destination( &jw );
+    return AZ_OK;
+}
+
+/* [] END OF FILE */
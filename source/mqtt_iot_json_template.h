@@ -0,0 +1,125 @@
+/******************************************************************************
+ * File Name: mqtt_iot_json_template.h
+ *
+ * Description: This file contains the declarations of the precompiled
+ * JSON templates: constant text fixed at build time with numeric and string
+ * slots filled at run time.
+ *
+ ********************************************************************************
+ * Copyright 2024, Cypress Semiconductor Corporation (an Infineon company) or
+ * an affiliate of Cypress Semiconductor Corporation.  All rights reserved.
+ *
+ * This software, including source code, documentation and related
+ * materials ("Software") is owned by Cypress Semiconductor Corporation
+ * or one of its affiliates ("Cypress") and is protected by and subject to
+ * worldwide patent protection (United States and foreign),
+ * United States copyright laws and international treaty provisions.
+ * Therefore, you may use this Software only as provided in the license
+ * agreement accompanying the software package from which you
+ * obtained this Software ("EULA").
+ * If no EULA applies, Cypress hereby grants you a personal, non-exclusive,
+ * non-transferable license to copy, modify, and compile the Software
+ * source code solely for use in connection with Cypress's
+ * integrated circuit products.  Any reproduction, modification, translation,
+ * compilation, or representation of this Software except as specified
+ * above is prohibited without the express written permission of Cypress.
+ *
+ * Disclaimer: THIS SOFTWARE IS PROVIDED AS-IS, WITH NO WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING, BUT NOT LIMITED TO, NONINFRINGEMENT, IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. Cypress
+ * reserves the right to make changes to the Software without notice. Cypress
+ * does not assume any liability arising out of the application or use of the
+ * Software or any product or circuit described in the Software. Cypress does
+ * not authorize its products for use in any products where a malfunction or
+ * failure of the Cypress product may reasonably be expected to result in
+ * significant property damage, injury or death ("High Risk Product"). By
+ * including Cypress's product in a High Risk Product, the manufacturer
+ * of such system or application assumes all risk of such use and in doing
+ * so agrees to indemnify Cypress against all liability.
+ *******************************************************************************/
+
+#ifndef MQTT_IOT_JSON_TEMPLATE_H_
+#define MQTT_IOT_JSON_TEMPLATE_H_
+
+#include <stdint.h>
+
+#include <az_core.h>
+
+/*******************************************************************************
+ * Macros
+ ********************************************************************************/
+/* Part of a template: a string literal, whose length is computed by the
+ * compiler, followed by a slot of kind iot_json_slot_kind.
+ */
+#define IOT_JSON_TEMPLATE_PART(literal, slot)   { (literal), (uint16_t)(sizeof(literal) - 1), (slot) }
+
+/* Template made of an array of parts */
+#define IOT_JSON_TEMPLATE(parts)                { (parts), (uint8_t)(sizeof(parts) / sizeof((parts)[0])) }
+
+/*******************************************************************************
+ * Global Variables
+ ********************************************************************************/
+typedef enum
+{
+    IOT_JSON_SLOT_NONE,             /* No slot after the literal */
+    IOT_JSON_SLOT_INT32,            /* iot_json_slot.i as a number */
+    IOT_JSON_SLOT_NUMBER,           /* iot_json_slot.text, a formatted JSON number copied as is */
+    IOT_JSON_SLOT_STRING            /* iot_json_slot.text, quoted and escaped */
+} iot_json_slot_kind;
+
+typedef struct
+{
+    char const*     literal;
+    uint16_t        literal_len;
+    uint8_t         slot;           /* iot_json_slot_kind */
+} iot_json_template_part;
+
+typedef struct
+{
+    iot_json_template_part const*   parts;
+    uint8_t                         count;
+} iot_json_template;
+
+/* Value of a slot, the slots of a template are filled in order */
+typedef union
+{
+    int32_t     i;
+    az_span     text;
+} iot_json_slot;
+
+/*******************************************************************************
+ * Function Prototypes
+ ********************************************************************************/
+/*
+ * @brief Writes a template with its slots filled at the start of a buffer.
+ * @param[in] json_template Template.
+ * @param[in] slots One value for each slot of the template, in order.
+ * @param[in,out] remainder Buffer; on success, the part after the text.
+ * @return AZ_OK, or AZ_ERROR_NOT_ENOUGH_SPACE if the buffer is too small.
+ */
+az_result iot_json_template_append(iot_json_template const* json_template, iot_json_slot const slots[],
+        az_span* remainder);
+
+/*
+ * @brief Copies JSON text, e.g. "{" or ",", at the start of a buffer.
+ * @param[in] text JSON text.
+ * @param[in,out] remainder Buffer; on success, the part after the text.
+ * @return AZ_OK, or AZ_ERROR_NOT_ENOUGH_SPACE if the buffer is too small.
+ */
+az_result iot_json_template_append_text(az_span text, az_span* remainder);
+
+/*
+ * @brief Measures the CPU cycles of building a reported property with its
+ * acknowledgment, {"targetTemperature":{"value":68.5,"ac":200,"av":7,
+ * "ad":"success"}}, with az_json_writer and with a template, and writes the
+ * report, e.g. {"iterations":1000,"cycles":[...],"bytes":[...],
+ * "match":true} with the writer result first.
+ * @param[in] buffer Destination buffer.
+ * @param[out] out_report JSON text written to \p buffer.
+ * @return AZ_OK, or AZ_ERROR_NOT_ENOUGH_SPACE if \p buffer is too small.
+ */
+az_result iot_json_template_build_benchmark_report(az_span buffer, az_span* out_report);
+
+#endif /* MQTT_IOT_JSON_TEMPLATE_H_ */
+
+/* [] END OF FILE */
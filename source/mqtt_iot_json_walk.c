@@ -0,0 +1,213 @@
+/******************************************************************************
+ * File Name: mqtt_iot_json_walk.c
+ *
+ * Description: This file contains the JSON walker. It reads a document with
+ * az_json_reader, keeps the depth and property name of every value, and adds
+ * the checks for trailing text and leading zeros.
+ *
+ ********************************************************************************
+ * Copyright 2024, Cypress Semiconductor Corporation (an Infineon company) or
+ * an affiliate of Cypress Semiconductor Corporation.  All rights reserved.
+ *
+ * This software, including source code, documentation and related
+ * materials ("Software") is owned by Cypress Semiconductor Corporation
+ * or one of its affiliates ("Cypress") and is protected by and subject to
+ * worldwide patent protection (United States and foreign),
+ * United States copyright laws and international treaty provisions.
+ * Therefore, you may use this Software only as provided in the license
+ * agreement accompanying the software package from which you
+ * obtained this Software ("EULA").
+ * If no EULA applies, Cypress hereby grants you a personal, non-exclusive,
+ * non-transferable license to copy, modify, and compile the Software
+ * source code solely for use in connection with Cypress's
+ * integrated circuit products.  Any reproduction, modification, translation,
+ * compilation, or representation of this Software except as specified
+ * above is prohibited without the express written permission of Cypress.
+ *
+ * Disclaimer: THIS SOFTWARE IS PROVIDED AS-IS, WITH NO WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING, BUT NOT LIMITED TO, NONINFRINGEMENT, IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. Cypress
+ * reserves the right to make changes to the Software without notice. Cypress
+ * does not assume any liability arising out of the application or use of the
+ * Software or any product or circuit described in the Software. Cypress does
+ * not authorize its products for use in any products where a malfunction or
+ * failure of the Cypress product may reasonably be expected to result in
+ * significant property damage, injury or death ("High Risk Product"). By
+ * including Cypress's product in a High Risk Product, the manufacturer
+ * of such system or application assumes all risk of such use and in doing
+ * so agrees to indemnify Cypress against all liability.
+ *******************************************************************************/
+
+#include <string.h>
+
+#include "mqtt_iot_json_walk.h"
+
+/******************************************************************************
+ * Function Name: is_whitespace
+ ******************************************************************************
+ * Summary:
+ *  Checks for the whitespace characters allowed between JSON tokens.
+ *
+ * Parameters:
+ *  c: Character.
+ *
+ * Return:
+ *  bool: true for space, tab, line feed and carriage return.
+ *
+ ******************************************************************************/
+static bool is_whitespace(uint8_t c)
+{
+    return ( (c == ' ') || (c == '\t') || (c == '\n') || (c == '\r') );
+}
+
+/******************************************************************************
+ * Function Name: has_leading_zero
+ ******************************************************************************
+ * Summary:
+ *  Checks whether the integer part of a number starts with a zero that is
+ *  followed by another digit, e.g. 01 or -007.
+ *
+ * Parameters:
+ *  number: Text of a number token.
+ *
+ * Return:
+ *  bool: true if the number has a leading zero.
+ *
+ ******************************************************************************/
+static bool has_leading_zero(az_span number)
+{
+    uint8_t const* text = az_span_ptr( number );
+    int32_t const size = az_span_size( number );
+    int32_t i = ( (size > 0) && (text[0] == '-') ) ? 1 : 0;
+
+    return ( (size - i) >= 2 ) && ( text[i] == '0' ) && ( text[i + 1] >= '0' ) && ( text[i + 1] <= '9' );
+}
+
+/******************************************************************************
+ * Function Name: iot_json_walk
+ ******************************************************************************
+ * Summary:
+ *  Reads the document token by token and passes every value and every end
+ *  of an object or array to the callback. The property name preceding a
+ *  value is kept per level, so the end of an object also carries the name
+ *  of the object.
+ *
+ * Parameters:
+ *  payload: JSON document.
+ *
+ *  payload_len: Length of the document.
+ *
+ *  callback: Token callback.
+ *
+ *  context: Passed to the callback.
+ *
+ * Return:
+ *  iot_json_walk_result: Result of the walk.
+ *
+ ******************************************************************************/
+iot_json_walk_result iot_json_walk(uint8_t const* payload, size_t payload_len,
+        iot_json_walk_callback callback, void* context)
+{
+    az_json_reader reader;
+    iot_json_walk_token token;
+    az_span key[IOT_JSON_WALK_MAX_DEPTH + 1];
+    uint32_t in_object = 0;         /* Bit n set if level n is inside an object */
+    uint8_t level = 0;
+    uint8_t const* value_end = payload;
+    az_result rc;
+
+    if( (payload_len == 0) || (payload_len > INT32_MAX) ||
+        az_result_failed( az_json_reader_init( &reader,
+                az_span_create( (uint8_t*)payload, (int32_t)payload_len ), NULL ) ) )
+    {
+        return IOT_JSON_WALK_ERROR;
+    }
+
+    token.value = &reader.token;
+    while( az_result_succeeded( rc = az_json_reader_next_token( &reader ) ) )
+    {
+        token.kind = reader.token.kind;
+        if( token.kind == AZ_JSON_TOKEN_PROPERTY_NAME )
+        {
+            key[level] = reader.token.slice;
+            continue;
+        }
+
+        /* The end of a container is reported at the level of its begin */
+        if( (token.kind == AZ_JSON_TOKEN_END_OBJECT) || (token.kind == AZ_JSON_TOKEN_END_ARRAY) )
+        {
+            in_object &= ~(1UL << level);
+            level--;
+        }
+        token.depth = level;
+        token.key = ( in_object & (1UL << level) ) ? key[level] : AZ_SPAN_EMPTY;
+
+        if( (token.kind == AZ_JSON_TOKEN_BEGIN_OBJECT) || (token.kind == AZ_JSON_TOKEN_BEGIN_ARRAY) )
+        {
+            if( level >= IOT_JSON_WALK_MAX_DEPTH )
+            {
+                return IOT_JSON_WALK_ERROR;
+            }
+            level++;
+            if( token.kind == AZ_JSON_TOKEN_BEGIN_OBJECT )
+            {
+                in_object |= (1UL << level);
+            }
+        }
+        else if( (token.kind == AZ_JSON_TOKEN_NUMBER) && has_leading_zero( reader.token.slice ) )
+        {
+            return IOT_JSON_WALK_ERROR;
+        }
+
+        /* The slice of a string leaves out the closing quote */
+        value_end = az_span_ptr( reader.token.slice ) + az_span_size( reader.token.slice ) +
+                ( (token.kind == AZ_JSON_TOKEN_STRING) ? 1 : 0 );
+
+        if( !callback( context, &token ) )
+        {
+            return IOT_JSON_WALK_STOPPED;
+        }
+    }
+
+    if( rc != AZ_ERROR_JSON_READER_DONE )
+    {
+        return IOT_JSON_WALK_ERROR;
+    }
+
+    /* az_json_reader ends at the root value, the rest must be whitespace */
+    for( ; value_end < (payload + payload_len); value_end++ )
+    {
+        if( !is_whitespace( *value_end ) )
+        {
+            return IOT_JSON_WALK_ERROR;
+        }
+    }
+
+    return IOT_JSON_WALK_COMPLETE;
+}
+
+/******************************************************************************
+ * Function Name: iot_json_walk_key_equals
+ ******************************************************************************
+ * Summary:
+ *  Compares the property name of a token.
+ *
+ * Parameters:
+ *  token: Token passed to the callback.
+ *
+ *  name: NUL terminated property name.
+ *
+ * Return:
+ *  bool: true if the token is a member named name.
+ *
+ ******************************************************************************/
+bool iot_json_walk_key_equals(iot_json_walk_token const* token, char const* name)
+{
+    size_t const name_len = strlen( name );
+
+    return ( az_span_ptr( token->key ) != NULL ) &&
+           ( (size_t)az_span_size( token->key ) == name_len ) &&
+           ( memcmp( az_span_ptr( token->key ), name, name_len ) == 0 );
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,110 @@
+/******************************************************************************
+ * File Name: mqtt_iot_json_walk.h
+ *
+ * Description: This file contains the declarations of the JSON walker, which
+ * passes the tokens of az_json_reader to a callback with their depth and
+ * property name.
+ *
+ ********************************************************************************
+ * Copyright 2024, Cypress Semiconductor Corporation (an Infineon company) or
+ * an affiliate of Cypress Semiconductor Corporation.  All rights reserved.
+ *
+ * This software, including source code, documentation and related
+ * materials ("Software") is owned by Cypress Semiconductor Corporation
+ * or one of its affiliates ("Cypress") and is protected by and subject to
+ * worldwide patent protection (United States and foreign),
+ * United States copyright laws and international treaty provisions.
+ * Therefore, you may use this Software only as provided in the license
+ * agreement accompanying the software package from which you
+ * obtained this Software ("EULA").
+ * If no EULA applies, Cypress hereby grants you a personal, non-exclusive,
+ * non-transferable license to copy, modify, and compile the Software
+ * source code solely for use in connection with Cypress's
+ * integrated circuit products.  Any reproduction, modification, translation,
+ * compilation, or representation of this Software except as specified
+ * above is prohibited without the express written permission of Cypress.
+ *
+ * Disclaimer: THIS SOFTWARE IS PROVIDED AS-IS, WITH NO WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING, BUT NOT LIMITED TO, NONINFRINGEMENT, IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. Cypress
+ * reserves the right to make changes to the Software without notice. Cypress
+ * does not assume any liability arising out of the application or use of the
+ * Software or any product or circuit described in the Software. Cypress does
+ * not authorize its products for use in any products where a malfunction or
+ * failure of the Cypress product may reasonably be expected to result in
+ * significant property damage, injury or death ("High Risk Product"). By
+ * including Cypress's product in a High Risk Product, the manufacturer
+ * of such system or application assumes all risk of such use and in doing
+ * so agrees to indemnify Cypress against all liability.
+ *******************************************************************************/
+
+#ifndef MQTT_IOT_JSON_WALK_H_
+#define MQTT_IOT_JSON_WALK_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <az_core.h>
+
+/*******************************************************************************
+ * Macros
+ ********************************************************************************/
+/* Maximum nesting of objects and arrays */
+#define IOT_JSON_WALK_MAX_DEPTH                 (16)
+
+/*******************************************************************************
+ * Global Variables
+ ********************************************************************************/
+/* Token passed to the callback, only valid during the callback */
+typedef struct
+{
+    az_json_token_kind      kind;       /* Any kind but AZ_JSON_TOKEN_PROPERTY_NAME */
+    uint8_t                 depth;      /* 0 for the root value, 1 for its members */
+    az_span                 key;        /* Property name as written, AZ_SPAN_EMPTY unless the parent is an object */
+    az_json_token const*    value;      /* Reader token, for the az_json_token_get_*() functions */
+} iot_json_walk_token;
+
+/*
+ * Called for every value, and for the end of every object and array; the
+ * end token has the depth and property name of its begin token. Return
+ * false to stop parsing, e.g. once all wanted properties were found.
+ */
+typedef bool (*iot_json_walk_callback)(void* context, iot_json_walk_token const* token);
+
+typedef enum
+{
+    IOT_JSON_WALK_COMPLETE,         /* The whole document was passed to the callback */
+    IOT_JSON_WALK_STOPPED,          /* The callback returned false */
+    IOT_JSON_WALK_ERROR             /* Malformed or too deeply nested document */
+} iot_json_walk_result;
+
+/******************************************************************************
+ * Function Prototypes
+ *******************************************************************************/
+/*
+ * @brief Parses a document with az_json_reader and passes every token to
+ * the callback. Besides what az_json_reader rejects, the document is
+ * rejected if anything but whitespace follows the root value or a number has
+ * a leading zero.
+ * @param[in] payload JSON document.
+ * @param[in] payload_len Length of \p payload.
+ * @param[in] callback Token callback.
+ * @param[in] context Passed to \p callback.
+ * @return Result of the walk. Tokens passed before an error was found are
+ * not taken back.
+ */
+iot_json_walk_result iot_json_walk(uint8_t const* payload, size_t payload_len,
+        iot_json_walk_callback callback, void* context);
+
+/*
+ * @brief Compares the property name of a token.
+ * @param[in] token Token passed to the callback.
+ * @param[in] name NUL terminated property name.
+ * @return true if the token is a member named \p name.
+ */
+bool iot_json_walk_key_equals(iot_json_walk_token const* token, char const* name);
+
+#endif /* MQTT_IOT_JSON_WALK_H_ */
+
+/* [] END OF FILE */
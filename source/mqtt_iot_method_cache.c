@@ -0,0 +1,338 @@
+/******************************************************************************
+ * File Name: mqtt_iot_method_cache.c
+ *
+ * Description: This file contains the response cache for idempotent direct
+ * methods. A repeated invocation with the same method name and payload is
+ * answered from the cache until the entry expires or is invalidated.
+ *
+ ********************************************************************************
+ * Copyright 2024, Cypress Semiconductor Corporation (an Infineon company) or
+ * an affiliate of Cypress Semiconductor Corporation.  All rights reserved.
+ *
+ * This software, including source code, documentation and related
+ * materials ("Software") is owned by Cypress Semiconductor Corporation
+ * or one of its affiliates ("Cypress") and is protected by and subject to
+ * worldwide patent protection (United States and foreign),
+ * United States copyright laws and international treaty provisions.
+ * Therefore, you may use this Software only as provided in the license
+ * agreement accompanying the software package from which you
+ * obtained this Software ("EULA").
+ * If no EULA applies, Cypress hereby grants you a personal, non-exclusive,
+ * non-transferable license to copy, modify, and compile the Software
+ * source code solely for use in connection with Cypress's
+ * integrated circuit products.  Any reproduction, modification, translation,
+ * compilation, or representation of this Software except as specified
+ * above is prohibited without the express written permission of Cypress.
+ *
+ * Disclaimer: THIS SOFTWARE IS PROVIDED AS-IS, WITH NO WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING, BUT NOT LIMITED TO, NONINFRINGEMENT, IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. Cypress
+ * reserves the right to make changes to the Software without notice. Cypress
+ * does not assume any liability arising out of the application or use of the
+ * Software or any product or circuit described in the Software. Cypress does
+ * not authorize its products for use in any products where a malfunction or
+ * failure of the Cypress product may reasonably be expected to result in
+ * significant property damage, injury or death ("High Risk Product"). By
+ * including Cypress's product in a High Risk Product, the manufacturer
+ * of such system or application assumes all risk of such use and in doing
+ * so agrees to indemnify Cypress against all liability.
+ *******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "azure_common.h"
+#include "mqtt_iot_method_cache.h"
+
+/*******************************************************************************
+ * Macros
+ ********************************************************************************/
+#define FNV1A_64_OFFSET_BASIS               (0xcbf29ce484222325ULL)
+#define FNV1A_64_PRIME                      (0x00000100000001b3ULL)
+
+/******************************************************************************
+ * Function Name: hash_request
+ ******************************************************************************
+ * Summary:
+ *  Computes the 64-bit FNV-1a hash of a method name followed by its request
+ *  payload. A zero byte separates the two, so that moving bytes between name
+ *  and payload changes the key.
+ *
+ * Parameters:
+ *  name: Method name.
+ *
+ *  name_len: Length of the method name.
+ *
+ *  payload: Request payload.
+ *
+ *  payload_len: Length of the request payload.
+ *
+ * Return:
+ *  uint64_t: Cache key of the request.
+ *
+ ******************************************************************************/
+static uint64_t hash_request(uint8_t const* name, size_t name_len, uint8_t const* payload, size_t payload_len)
+{
+    uint64_t hash = FNV1A_64_OFFSET_BASIS;
+
+    for( size_t i = 0; i < name_len; i++ )
+    {
+        hash ^= name[i];
+        hash *= FNV1A_64_PRIME;
+    }
+    hash *= FNV1A_64_PRIME;
+    for( size_t i = 0; i < payload_len; i++ )
+    {
+        hash ^= payload[i];
+        hash *= FNV1A_64_PRIME;
+    }
+
+    return hash;
+}
+
+/******************************************************************************
+ * Function Name: name_equals
+ ******************************************************************************
+ * Summary:
+ *  Compares the method name of an entry.
+ *
+ * Parameters:
+ *  entry: Valid cache entry.
+ *
+ *  name: Method name.
+ *
+ *  name_len: Length of the method name.
+ *
+ * Return:
+ *  bool: true if the entry is of the method.
+ *
+ ******************************************************************************/
+static bool name_equals(iot_method_cache_entry const* entry, uint8_t const* name, size_t name_len)
+{
+    return ( (entry->name_len == name_len) && (memcmp( entry->name, name, name_len ) == 0) );
+}
+
+/******************************************************************************
+ * Function Name: is_expired
+ ******************************************************************************
+ * Summary:
+ *  Checks whether an entry has outlived its time to live.
+ *
+ * Parameters:
+ *  entry: Valid cache entry.
+ *
+ *  now: Current tick count.
+ *
+ * Return:
+ *  bool: true if the entry must not be served any more.
+ *
+ ******************************************************************************/
+static bool is_expired(iot_method_cache_entry const* entry, TickType_t now)
+{
+    return ( (TickType_t)(now - entry->stored_tick) >= entry->ttl_ticks );
+}
+
+/******************************************************************************
+ * Function Name: iot_method_cache_init
+ ******************************************************************************
+ * Summary:
+ *  Empties the cache and clears its counters.
+ *
+ * Parameters:
+ *  cache: Cache to initialize.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_method_cache_init(iot_method_cache* cache)
+{
+    memset( cache, 0x00, sizeof(iot_method_cache) );
+}
+
+/******************************************************************************
+ * Function Name: iot_method_cache_lookup
+ ******************************************************************************
+ * Summary:
+ *  Finds the unexpired response of an earlier identical invocation. The key
+ *  selects the candidates, and the stored name and request confirm them, so
+ *  a hash collision is a miss. Expired entries that are met are released.
+ *
+ * Parameters:
+ *  cache: Cache.
+ *
+ *  name: Method name.
+ *
+ *  name_len: Length of the method name.
+ *
+ *  payload: Request payload.
+ *
+ *  payload_len: Length of the request payload.
+ *
+ * Return:
+ *  iot_method_cache_entry const*: Cached entry, or NULL.
+ *
+ ******************************************************************************/
+iot_method_cache_entry const* iot_method_cache_lookup(iot_method_cache* cache,
+        uint8_t const* name, size_t name_len, uint8_t const* payload, size_t payload_len)
+{
+    uint64_t key = hash_request( name, name_len, payload, payload_len );
+    TickType_t now = xTaskGetTickCount();
+    iot_method_cache_entry* entry;
+
+    cache->lookups++;
+
+    for( uint32_t i = 0; i < IOT_METHOD_CACHE_ENTRIES; i++ )
+    {
+        entry = &cache->entries[i];
+        if( !entry->valid || (entry->key != key) || !name_equals( entry, name, name_len ) ||
+            (entry->request_len != payload_len) ||
+            ( (payload_len > 0) && (memcmp( entry->request, payload, payload_len ) != 0) ) )
+        {
+            continue;
+        }
+
+        if( is_expired( entry, now ) )
+        {
+            entry->valid = false;
+            cache->expired++;
+            return NULL;
+        }
+
+        cache->hits++;
+        return entry;
+    }
+
+    return NULL;
+}
+
+/******************************************************************************
+ * Function Name: iot_method_cache_store
+ ******************************************************************************
+ * Summary:
+ *  Stores the response of a method invocation in a free or expired entry, or
+ *  else in place of the oldest entry.
+ *
+ * Parameters:
+ *  cache: Cache.
+ *
+ *  name: Method name.
+ *
+ *  name_len: Length of the method name.
+ *
+ *  payload: Request payload.
+ *
+ *  payload_len: Length of the request payload.
+ *
+ *  ttl_msec: Time for which the response may be served again.
+ *
+ *  status: Method status code.
+ *
+ *  response: Response payload.
+ *
+ *  response_len: Length of the response payload.
+ *
+ * Return:
+ *  bool: true if the response was stored.
+ *
+ ******************************************************************************/
+bool iot_method_cache_store(iot_method_cache* cache,
+        uint8_t const* name, size_t name_len, uint8_t const* payload, size_t payload_len,
+        uint32_t ttl_msec, uint16_t status, uint8_t const* response, size_t response_len)
+{
+    TickType_t now = xTaskGetTickCount();
+    iot_method_cache_entry* entry = &cache->entries[0];
+
+    if( (name_len > IOT_METHOD_CACHE_NAME_SIZE) || (payload_len > IOT_METHOD_CACHE_REQUEST_SIZE) ||
+        (response_len > IOT_METHOD_CACHE_RESPONSE_SIZE) || (ttl_msec == 0) )
+    {
+        return false;
+    }
+
+    for( uint32_t i = 0; i < IOT_METHOD_CACHE_ENTRIES; i++ )
+    {
+        if( !cache->entries[i].valid || is_expired( &cache->entries[i], now ) )
+        {
+            entry = &cache->entries[i];
+            break;
+        }
+        if( (TickType_t)(now - cache->entries[i].stored_tick) > (TickType_t)(now - entry->stored_tick) )
+        {
+            entry = &cache->entries[i];
+        }
+    }
+
+    entry->valid = true;
+    entry->key = hash_request( name, name_len, payload, payload_len );
+    entry->stored_tick = now;
+    entry->ttl_ticks = pdMS_TO_TICKS( ttl_msec );
+    entry->status = status;
+    entry->name_len = (uint8_t)name_len;
+    memcpy( entry->name, name, name_len );
+    entry->request_len = (uint8_t)payload_len;
+    if( payload_len > 0 )
+    {
+        memcpy( entry->request, payload, payload_len );
+    }
+    entry->response_len = (uint16_t)response_len;
+    memcpy( entry->response, response, response_len );
+
+    return true;
+}
+
+/******************************************************************************
+ * Function Name: iot_method_cache_invalidate
+ ******************************************************************************
+ * Summary:
+ *  Drops every stored response of a method.
+ *
+ * Parameters:
+ *  cache: Cache.
+ *
+ *  name: Method name.
+ *
+ *  name_len: Length of the method name.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_method_cache_invalidate(iot_method_cache* cache, uint8_t const* name, size_t name_len)
+{
+    for( uint32_t i = 0; i < IOT_METHOD_CACHE_ENTRIES; i++ )
+    {
+        if( cache->entries[i].valid && name_equals( &cache->entries[i], name, name_len ) )
+        {
+            cache->entries[i].valid = false;
+            cache->invalidated++;
+        }
+    }
+}
+
+/******************************************************************************
+ * Function Name: iot_method_cache_log_stats
+ ******************************************************************************
+ * Summary:
+ *  Prints the lookup, hit, expiry and invalidation counters.
+ *
+ * Parameters:
+ *  name: Printable name of the cache.
+ *
+ *  cache: Cache.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_method_cache_log_stats(char const* name, iot_method_cache const* cache)
+{
+    TEST_INFO(( "\r\n%s response cache lookups: %lu, hits: %lu (%lu%%), expired: %lu, invalidated: %lu\n",
+            name,
+            (unsigned long)cache->lookups,
+            (unsigned long)cache->hits,
+            (unsigned long)( ( cache->lookups == 0 ) ? 0 : ( cache->hits * 100UL ) / cache->lookups ),
+            (unsigned long)cache->expired,
+            (unsigned long)cache->invalidated ));
+}
+
+/* [] END OF FILE */
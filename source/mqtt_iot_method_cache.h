@@ -0,0 +1,151 @@
+/******************************************************************************
+ * File Name: mqtt_iot_method_cache.h
+ *
+ * Description: This file contains the declarations of the response cache
+ * for idempotent direct methods.
+ *
+ ********************************************************************************
+ * Copyright 2024, Cypress Semiconductor Corporation (an Infineon company) or
+ * an affiliate of Cypress Semiconductor Corporation.  All rights reserved.
+ *
+ * This software, including source code, documentation and related
+ * materials ("Software") is owned by Cypress Semiconductor Corporation
+ * or one of its affiliates ("Cypress") and is protected by and subject to
+ * worldwide patent protection (United States and foreign),
+ * United States copyright laws and international treaty provisions.
+ * Therefore, you may use this Software only as provided in the license
+ * agreement accompanying the software package from which you
+ * obtained this Software ("EULA").
+ * If no EULA applies, Cypress hereby grants you a personal, non-exclusive,
+ * non-transferable license to copy, modify, and compile the Software
+ * source code solely for use in connection with Cypress's
+ * integrated circuit products.  Any reproduction, modification, translation,
+ * compilation, or representation of this Software except as specified
+ * above is prohibited without the express written permission of Cypress.
+ *
+ * Disclaimer: THIS SOFTWARE IS PROVIDED AS-IS, WITH NO WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING, BUT NOT LIMITED TO, NONINFRINGEMENT, IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. Cypress
+ * reserves the right to make changes to the Software without notice. Cypress
+ * does not assume any liability arising out of the application or use of the
+ * Software or any product or circuit described in the Software. Cypress does
+ * not authorize its products for use in any products where a malfunction or
+ * failure of the Cypress product may reasonably be expected to result in
+ * significant property damage, injury or death ("High Risk Product"). By
+ * including Cypress's product in a High Risk Product, the manufacturer
+ * of such system or application assumes all risk of such use and in doing
+ * so agrees to indemnify Cypress against all liability.
+ *******************************************************************************/
+
+#ifndef MQTT_IOT_METHOD_CACHE_H_
+#define MQTT_IOT_METHOD_CACHE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cyabs_rtos.h"
+
+/*******************************************************************************
+ * Macros
+ ********************************************************************************/
+/* Number of cached responses, the oldest one is replaced when full */
+#define IOT_METHOD_CACHE_ENTRIES                (4)
+
+/* Largest cached response payload, larger responses are not cached */
+#define IOT_METHOD_CACHE_RESPONSE_SIZE          (256)
+
+/* Longest method name and request payload of a cached invocation. They are
+ * kept to confirm a match of the key, so invocations with a longer name or
+ * payload are not cached.
+ */
+#define IOT_METHOD_CACHE_NAME_SIZE              (64)
+#define IOT_METHOD_CACHE_REQUEST_SIZE           (128)
+
+/*******************************************************************************
+ * Global Variables
+ ********************************************************************************/
+/* Response of one method invocation */
+typedef struct
+{
+    bool        valid;
+    uint64_t    key;                        /* Hash of method name and request payload */
+    TickType_t  stored_tick;
+    TickType_t  ttl_ticks;
+    uint16_t    status;
+    uint8_t     name_len;
+    uint8_t     request_len;
+    uint16_t    response_len;
+    uint8_t     name[IOT_METHOD_CACHE_NAME_SIZE];
+    uint8_t     request[IOT_METHOD_CACHE_REQUEST_SIZE];
+    uint8_t     response[IOT_METHOD_CACHE_RESPONSE_SIZE];
+} iot_method_cache_entry;
+
+typedef struct
+{
+    iot_method_cache_entry  entries[IOT_METHOD_CACHE_ENTRIES];
+    uint32_t                lookups;
+    uint32_t                hits;
+    uint32_t                expired;
+    uint32_t                invalidated;
+} iot_method_cache;
+
+/******************************************************************************
+ * Function Prototypes
+ *******************************************************************************/
+/*
+ * @brief Empties the cache and clears its counters.
+ * @param[out] cache Cache to initialize.
+ */
+void iot_method_cache_init(iot_method_cache* cache);
+
+/*
+ * @brief Finds the stored response of an earlier invocation with the same
+ * method name and request payload that has not expired.
+ * @param[in] cache Cache.
+ * @param[in] name Method name.
+ * @param[in] name_len Length of \p name.
+ * @param[in] payload Request payload.
+ * @param[in] payload_len Length of \p payload.
+ * @return Cached entry, valid until the next store or invalidation, or NULL.
+ */
+iot_method_cache_entry const* iot_method_cache_lookup(iot_method_cache* cache,
+        uint8_t const* name, size_t name_len, uint8_t const* payload, size_t payload_len);
+
+/*
+ * @brief Stores the response of a method invocation.
+ * @param[in] cache Cache.
+ * @param[in] name Method name.
+ * @param[in] name_len Length of \p name.
+ * @param[in] payload Request payload.
+ * @param[in] payload_len Length of \p payload.
+ * @param[in] ttl_msec Time for which the response may be served again.
+ * @param[in] status Method status code.
+ * @param[in] response Response payload.
+ * @param[in] response_len Length of \p response.
+ * @return true if the response was stored, false if the name, request or
+ * response is too large.
+ */
+bool iot_method_cache_store(iot_method_cache* cache,
+        uint8_t const* name, size_t name_len, uint8_t const* payload, size_t payload_len,
+        uint32_t ttl_msec, uint16_t status, uint8_t const* response, size_t response_len);
+
+/*
+ * @brief Drops every stored response of a method, e.g. when the state that
+ * its responses report has changed.
+ * @param[in] cache Cache.
+ * @param[in] name Method name.
+ * @param[in] name_len Length of \p name.
+ */
+void iot_method_cache_invalidate(iot_method_cache* cache, uint8_t const* name, size_t name_len);
+
+/*
+ * @brief Prints the lookup, hit, expiry and invalidation counters.
+ * @param[in] name Printable name of the cache.
+ * @param[in] cache Cache.
+ */
+void iot_method_cache_log_stats(char const* name, iot_method_cache const* cache);
+
+#endif /* MQTT_IOT_METHOD_CACHE_H_ */
+
+/* [] END OF FILE */
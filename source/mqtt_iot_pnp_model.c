@@ -0,0 +1,163 @@
+/******************************************************************************
+ * File Name: mqtt_iot_pnp_model.c
+ *
+ * Description: This file contains the telemetry, property and command
+ * tables, the request parsers and the response serializers of the DTDL
+ * interface dtmi:com:example:Thermostat;1. Reports current temperature and
+ * provides desired temperature control.
+ *
+ * Generated by scripts/pnp_dtdl_codegen.py from
+ * scripts/dtdl/Thermostat.json, do not edit.
+ *
+ ********************************************************************************
+ * Copyright 2024, Cypress Semiconductor Corporation (an Infineon company) or
+ * an affiliate of Cypress Semiconductor Corporation.  All rights reserved.
+ *
+ * This software, including source code, documentation and related
+ * materials ("Software") is owned by Cypress Semiconductor Corporation
+ * or one of its affiliates ("Cypress") and is protected by and subject to
+ * worldwide patent protection (United States and foreign),
+ * United States copyright laws and international treaty provisions.
+ * Therefore, you may use this Software only as provided in the license
+ * agreement accompanying the software package from which you
+ * obtained this Software ("EULA").
+ * If no EULA applies, Cypress hereby grants you a personal, non-exclusive,
+ * non-transferable license to copy, modify, and compile the Software
+ * source code solely for use in connection with Cypress's
+ * integrated circuit products.  Any reproduction, modification, translation,
+ * compilation, or representation of this Software except as specified
+ * above is prohibited without the express written permission of Cypress.
+ *
+ * Disclaimer: THIS SOFTWARE IS PROVIDED AS-IS, WITH NO WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING, BUT NOT LIMITED TO, NONINFRINGEMENT, IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. Cypress
+ * reserves the right to make changes to the Software without notice. Cypress
+ * does not assume any liability arising out of the application or use of the
+ * Software or any product or circuit described in the Software. Cypress does
+ * not authorize its products for use in any products where a malfunction or
+ * failure of the Cypress product may reasonably be expected to result in
+ * significant property damage, injury or death ("High Risk Product"). By
+ * including Cypress's product in a High Risk Product, the manufacturer
+ * of such system or application assumes all risk of such use and in doing
+ * so agrees to indemnify Cypress against all liability.
+ *******************************************************************************/
+
+#include <string.h>
+
+#include "mqtt_iot_pnp_model.h"
+
+/*******************************************************************************
+ * Global Variables
+ ********************************************************************************/
+az_span const pnp_thermostat_telemetry_names[PNP_THERMOSTAT_TELEMETRY_COUNT] =
+{
+    AZ_SPAN_LITERAL_FROM_STR("temperature")
+};
+
+az_span const pnp_thermostat_property_names[PNP_THERMOSTAT_PROPERTY_COUNT] =
+{
+    AZ_SPAN_LITERAL_FROM_STR("targetTemperature"),
+    AZ_SPAN_LITERAL_FROM_STR("maxTempSinceLastReboot")
+};
+
+az_span const pnp_thermostat_command_names[PNP_THERMOSTAT_COMMAND_COUNT] =
+{
+    AZ_SPAN_LITERAL_FROM_STR("getMaxMinReport")
+};
+
+static iot_json_template_part const target_temperature_report_parts[] =
+{
+    IOT_JSON_TEMPLATE_PART("\"targetTemperature\":{\"value\":", IOT_JSON_SLOT_NUMBER),
+    IOT_JSON_TEMPLATE_PART(",\"ac\":", IOT_JSON_SLOT_INT32),
+    IOT_JSON_TEMPLATE_PART(",\"av\":", IOT_JSON_SLOT_INT32),
+    IOT_JSON_TEMPLATE_PART(",\"ad\":", IOT_JSON_SLOT_STRING),
+    IOT_JSON_TEMPLATE_PART("}", IOT_JSON_SLOT_NONE)
+};
+static iot_json_template_part const max_temp_since_last_reboot_report_parts[] =
+{
+    IOT_JSON_TEMPLATE_PART("\"maxTempSinceLastReboot\":", IOT_JSON_SLOT_NUMBER)
+};
+
+iot_json_template const pnp_thermostat_property_templates[PNP_THERMOSTAT_PROPERTY_COUNT] =
+{
+    IOT_JSON_TEMPLATE(target_temperature_report_parts),
+    IOT_JSON_TEMPLATE(max_temp_since_last_reboot_report_parts)
+};
+
+/******************************************************************************
+ * Function Name: pnp_thermostat_get_max_min_report_request_parse
+ ******************************************************************************
+ * Summary:
+ *  Parses the request payload of getMaxMinReport.
+ *
+ * Parameters:
+ *  payload: Request payload.
+ *
+ *  out_request: Request fields.
+ *
+ * Return:
+ *  bool: false if the payload does not match the request schema.
+ *
+ ******************************************************************************/
+bool pnp_thermostat_get_max_min_report_request_parse(az_span payload,
+        pnp_thermostat_get_max_min_report_request_t* out_request)
+{
+    az_json_reader jr;
+    az_result rc;
+
+    memset(out_request, 0x00, sizeof(*out_request));
+    rc = az_json_reader_init(&jr, payload, NULL);
+    if (az_result_succeeded(rc))
+    {
+        rc = az_json_reader_next_token(&jr);
+    }
+    if (az_result_succeeded(rc))
+    {
+        rc = az_json_token_get_string(&jr.token, out_request->since,
+                (int32_t)sizeof(out_request->since), &out_request->since_len);
+    }
+
+    return az_result_succeeded(rc);
+}
+
+static iot_json_template_part const get_max_min_report_response_parts[] =
+{
+    IOT_JSON_TEMPLATE_PART("{\"maxTemp\":", IOT_JSON_SLOT_NUMBER),
+    IOT_JSON_TEMPLATE_PART(",\"minTemp\":", IOT_JSON_SLOT_NUMBER),
+    IOT_JSON_TEMPLATE_PART(",\"avgTemp\":", IOT_JSON_SLOT_NUMBER),
+    IOT_JSON_TEMPLATE_PART(",\"startTime\":", IOT_JSON_SLOT_STRING),
+    IOT_JSON_TEMPLATE_PART(",\"endTime\":", IOT_JSON_SLOT_STRING),
+    IOT_JSON_TEMPLATE_PART("}", IOT_JSON_SLOT_NONE)
+};
+static iot_json_template const get_max_min_report_response_template = IOT_JSON_TEMPLATE(get_max_min_report_response_parts);
+
+/******************************************************************************
+ * Function Name: pnp_thermostat_get_max_min_report_response_append
+ ******************************************************************************
+ * Summary:
+ *  Writes the response payload of getMaxMinReport at the start of a buffer.
+ *
+ * Parameters:
+ *  response: Response fields.
+ *
+ *  remainder: Buffer; on success, the part after the payload.
+ *
+ * Return:
+ *  az_result: AZ_OK, or AZ_ERROR_NOT_ENOUGH_SPACE if the buffer is too small.
+ *
+ ******************************************************************************/
+az_result pnp_thermostat_get_max_min_report_response_append(
+        pnp_thermostat_get_max_min_report_response_t const* response, az_span* remainder)
+{
+    iot_json_slot slots[5];
+
+    slots[0].text = response->max_temp;
+    slots[1].text = response->min_temp;
+    slots[2].text = response->avg_temp;
+    slots[3].text = response->start_time;
+    slots[4].text = response->end_time;
+
+    return iot_json_template_append(&get_max_min_report_response_template, slots, remainder);
+}
+
+/* [] END OF FILE */
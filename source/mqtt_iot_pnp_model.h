@@ -0,0 +1,158 @@
+/******************************************************************************
+ * File Name: mqtt_iot_pnp_model.h
+ *
+ * Description: This file contains the telemetry, property and command tables
+ * of the DTDL interface dtmi:com:example:Thermostat;1. Reports current
+ * temperature and provides desired temperature control.
+ *
+ * Generated by scripts/pnp_dtdl_codegen.py from
+ * scripts/dtdl/Thermostat.json, do not edit.
+ *
+ ********************************************************************************
+ * Copyright 2024, Cypress Semiconductor Corporation (an Infineon company) or
+ * an affiliate of Cypress Semiconductor Corporation.  All rights reserved.
+ *
+ * This software, including source code, documentation and related
+ * materials ("Software") is owned by Cypress Semiconductor Corporation
+ * or one of its affiliates ("Cypress") and is protected by and subject to
+ * worldwide patent protection (United States and foreign),
+ * United States copyright laws and international treaty provisions.
+ * Therefore, you may use this Software only as provided in the license
+ * agreement accompanying the software package from which you
+ * obtained this Software ("EULA").
+ * If no EULA applies, Cypress hereby grants you a personal, non-exclusive,
+ * non-transferable license to copy, modify, and compile the Software
+ * source code solely for use in connection with Cypress's
+ * integrated circuit products.  Any reproduction, modification, translation,
+ * compilation, or representation of this Software except as specified
+ * above is prohibited without the express written permission of Cypress.
+ *
+ * Disclaimer: THIS SOFTWARE IS PROVIDED AS-IS, WITH NO WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING, BUT NOT LIMITED TO, NONINFRINGEMENT, IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. Cypress
+ * reserves the right to make changes to the Software without notice. Cypress
+ * does not assume any liability arising out of the application or use of the
+ * Software or any product or circuit described in the Software. Cypress does
+ * not authorize its products for use in any products where a malfunction or
+ * failure of the Cypress product may reasonably be expected to result in
+ * significant property damage, injury or death ("High Risk Product"). By
+ * including Cypress's product in a High Risk Product, the manufacturer
+ * of such system or application assumes all risk of such use and in doing
+ * so agrees to indemnify Cypress against all liability.
+ *******************************************************************************/
+
+#ifndef MQTT_IOT_PNP_MODEL_H_
+#define MQTT_IOT_PNP_MODEL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <az_core.h>
+#include "mqtt_iot_json_template.h"
+#include "mqtt_iot_property_parser.h"
+
+/*******************************************************************************
+ * Macros
+ ********************************************************************************/
+#define PNP_THERMOSTAT_MODEL_ID                     "dtmi:com:example:Thermostat;1"
+
+/* Writable properties come first in pnp_thermostat_property_t */
+#define PNP_THERMOSTAT_WRITABLE_PROPERTY_COUNT      (1)
+
+/* Size of a string field of a command request, with its terminator */
+#define PNP_THERMOSTAT_STRING_SIZE                  (64)
+
+/* Declares the writable properties of one interface instance for
+ * iot_property_parse(). prefix is "" for the default component or
+ * "<component>.", base is the offsetof() the pnp_thermostat_writable_t of the
+ * instance in the parse output. The application defines
+ * PNP_THERMOSTAT_<PROPERTY>_RANGE as "has_range, min, max" for each property.
+ */
+#define PNP_THERMOSTAT_WRITABLE_PROPERTY_DEFS(prefix, base)             \
+    { prefix "targetTemperature", IOT_PROPERTY_DOUBLE,                  \
+      (base) + offsetof(pnp_thermostat_writable_t, target_temperature), \
+      PNP_THERMOSTAT_TARGET_TEMPERATURE_RANGE }
+
+/*******************************************************************************
+ * Global Variables
+ ********************************************************************************/
+typedef enum
+{
+    PNP_THERMOSTAT_TELEMETRY_TEMPERATURE = 0, /* double, degreeCelsius */
+    PNP_THERMOSTAT_TELEMETRY_COUNT
+} pnp_thermostat_telemetry_t;
+
+typedef enum
+{
+    PNP_THERMOSTAT_PROPERTY_TARGET_TEMPERATURE = 0,     /* double, degreeCelsius, writable */
+    PNP_THERMOSTAT_PROPERTY_MAX_TEMP_SINCE_LAST_REBOOT, /* double, degreeCelsius */
+    PNP_THERMOSTAT_PROPERTY_COUNT
+} pnp_thermostat_property_t;
+
+typedef enum
+{
+    PNP_THERMOSTAT_COMMAND_GET_MAX_MIN_REPORT = 0, /* request since, response tempReport */
+    PNP_THERMOSTAT_COMMAND_COUNT
+} pnp_thermostat_command_t;
+
+/* Writable properties, the output of iot_property_parse() */
+typedef struct
+{
+    double target_temperature;
+} pnp_thermostat_writable_t;
+
+/* Request of getMaxMinReport. Period to return the max-min report. */
+typedef struct
+{
+    char since[PNP_THERMOSTAT_STRING_SIZE];
+    int32_t since_len;
+} pnp_thermostat_get_max_min_report_request_t;
+
+/* Response of getMaxMinReport. Numbers and booleans are formatted JSON text,
+ * so that the caller chooses the format.
+ */
+typedef struct
+{
+    az_span max_temp;
+    az_span min_temp;
+    az_span avg_temp;
+    az_span start_time;
+    az_span end_time;
+} pnp_thermostat_get_max_min_report_response_t;
+
+extern az_span const pnp_thermostat_telemetry_names[PNP_THERMOSTAT_TELEMETRY_COUNT];
+extern az_span const pnp_thermostat_property_names[PNP_THERMOSTAT_PROPERTY_COUNT];
+extern az_span const pnp_thermostat_command_names[PNP_THERMOSTAT_COMMAND_COUNT];
+
+/* Reported value of each property: "<name>":<value> with one slot for a
+ * read-only property, and
+ * "<name>":{"value":<value>,"ac":<code>,"av":<version>,"ad":<description>}
+ * with four slots for a writable one.
+ */
+extern iot_json_template const pnp_thermostat_property_templates[PNP_THERMOSTAT_PROPERTY_COUNT];
+
+/******************************************************************************
+ * Function Prototypes
+ *******************************************************************************/
+/*
+ * @brief Parses the request payload of getMaxMinReport.
+ * @param[in] payload Request payload.
+ * @param[out] out_request Request fields.
+ * @return false if the payload does not match the request schema.
+ */
+bool pnp_thermostat_get_max_min_report_request_parse(az_span payload,
+        pnp_thermostat_get_max_min_report_request_t* out_request);
+
+/*
+ * @brief Writes the response payload of getMaxMinReport at the start of a buffer.
+ * @param[in] response Response fields.
+ * @param[in,out] remainder Buffer; on success, the part after the payload.
+ * @return AZ_OK, or AZ_ERROR_NOT_ENOUGH_SPACE if the buffer is too small.
+ */
+az_result pnp_thermostat_get_max_min_report_response_append(
+        pnp_thermostat_get_max_min_report_response_t const* response, az_span* remainder);
+
+#endif /* MQTT_IOT_PNP_MODEL_H_ */
+
+/* [] END OF FILE */
@@ -0,0 +1,527 @@
+/******************************************************************************
+ * File Name: mqtt_iot_property_parser.c
+ *
+ * Description: This file contains the table-driven property parser. Property
+ * names are looked up through a hash index built once per table, and nested
+ * properties are matched by compiled JSON path queries, so a document is
+ * parsed in one pass whatever the number of declared properties.
+ *
+ ********************************************************************************
+ * Copyright 2024, Cypress Semiconductor Corporation (an Infineon company) or
+ * an affiliate of Cypress Semiconductor Corporation.  All rights reserved.
+ *
+ * This software, including source code, documentation and related
+ * materials ("Software") is owned by Cypress Semiconductor Corporation
+ * or one of its affiliates ("Cypress") and is protected by and subject to
+ * worldwide patent protection (United States and foreign),
+ * United States copyright laws and international treaty provisions.
+ * Therefore, you may use this Software only as provided in the license
+ * agreement accompanying the software package from which you
+ * obtained this Software ("EULA").
+ * If no EULA applies, Cypress hereby grants you a personal, non-exclusive,
+ * non-transferable license to copy, modify, and compile the Software
+ * source code solely for use in connection with Cypress's
+ * integrated circuit products.  Any reproduction, modification, translation,
+ * compilation, or representation of this Software except as specified
+ * above is prohibited without the express written permission of Cypress.
+ *
+ * Disclaimer: THIS SOFTWARE IS PROVIDED AS-IS, WITH NO WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING, BUT NOT LIMITED TO, NONINFRINGEMENT, IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. Cypress
+ * reserves the right to make changes to the Software without notice. Cypress
+ * does not assume any liability arising out of the application or use of the
+ * Software or any product or circuit described in the Software. Cypress does
+ * not authorize its products for use in any products where a malfunction or
+ * failure of the Cypress product may reasonably be expected to result in
+ * significant property damage, injury or death ("High Risk Product"). By
+ * including Cypress's product in a High Risk Product, the manufacturer
+ * of such system or application assumes all risk of such use and in doing
+ * so agrees to indemnify Cypress against all liability.
+ *******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include <az_core.h>
+#include "mqtt_iot_property_parser.h"
+
+/*******************************************************************************
+ * Macros
+ ********************************************************************************/
+#define PROPERTY_INDEX_MASK                 (IOT_PROPERTY_TABLE_INDEX_SIZE - 1)
+
+#define PROPERTY_VERSION_NAME               "$version"
+
+/*******************************************************************************
+ * Global Variables
+ ********************************************************************************/
+/* State of iot_property_parse() across the tokens of a document */
+typedef struct
+{
+    iot_property_table const*   table;
+    char const*                 section;
+    bool                        in_section;
+    uint8_t*                    out;
+    iot_property_parse_result*  result;
+    iot_json_path_query         nested;
+} property_parse_context;
+
+/******************************************************************************
+ * Function Name: find_name
+ ******************************************************************************
+ * Summary:
+ *  Probes the hash index for a property name.
+ *
+ * Parameters:
+ *  table: Property table.
+ *
+ *  name: Property name.
+ *
+ *  name_len: Length of the name.
+ *
+ * Return:
+ *  int32_t: Index of the entry, or -1 if the name is not declared.
+ *
+ ******************************************************************************/
+static int32_t find_name(iot_property_table const* table, char const* name, size_t name_len)
+{
+    uint32_t const hash = iot_json_path_hash( name, name_len );
+    uint32_t slot = hash & PROPERTY_INDEX_MASK;
+    uint8_t entry;
+
+    while( table->index[slot] != 0 )
+    {
+        entry = table->index[slot] - 1;
+        if( (table->hash[entry] == hash) &&
+            (strncmp( table->defs[entry].name, name, name_len ) == 0) &&
+            (table->defs[entry].name[name_len] == '\0') )
+        {
+            return entry;
+        }
+        slot = (slot + 1) & PROPERTY_INDEX_MASK;
+    }
+
+    return -1;
+}
+
+/******************************************************************************
+ * Function Name: iot_property_table_init
+ ******************************************************************************
+ * Summary:
+ *  Hashes the property names and inserts them into the open addressing
+ *  index, with linear probing.
+ *
+ * Parameters:
+ *  table: Property table.
+ *
+ *  defs: Declared properties.
+ *
+ *  count: Number of declared properties.
+ *
+ * Return:
+ *  bool: false if there are too many entries or duplicate names.
+ *
+ ******************************************************************************/
+bool iot_property_table_init(iot_property_table* table, iot_property_def const* defs, uint8_t count)
+{
+    uint32_t slot;
+
+    memset( table, 0x00, sizeof(iot_property_table) );
+    if( count > IOT_PROPERTY_TABLE_MAX_ENTRIES )
+    {
+        return false;
+    }
+    table->defs = defs;
+
+    for( uint8_t i = 0; i < count; i++ )
+    {
+        if( find_name( table, defs[i].name, strlen( defs[i].name ) ) >= 0 )
+        {
+            return false;
+        }
+
+        if( strpbrk( defs[i].name, ".[" ) != NULL )
+        {
+            if( (table->nested_count >= IOT_PROPERTY_TABLE_MAX_NESTED) ||
+                !iot_json_path_compile( &table->nested[table->nested_count], defs[i].name ) )
+            {
+                return false;
+            }
+            table->nested_entry[table->nested_count++] = i;
+            table->nested_mask |= (1UL << i);
+        }
+
+        /* Nested paths are indexed by their text for iot_property_table_find_name() */
+        table->hash[i] = iot_json_path_hash( defs[i].name, strlen( defs[i].name ) );
+        slot = table->hash[i] & PROPERTY_INDEX_MASK;
+        while( table->index[slot] != 0 )
+        {
+            slot = (slot + 1) & PROPERTY_INDEX_MASK;
+        }
+        table->index[slot] = i + 1;
+        table->count = i + 1;
+    }
+
+    return true;
+}
+
+/******************************************************************************
+ * Function Name: iot_property_table_find
+ ******************************************************************************
+ * Summary:
+ *  Looks up the top-level property named by a JSON token.
+ *
+ * Parameters:
+ *  table: Property table.
+ *
+ *  token: Member token.
+ *
+ * Return:
+ *  int32_t: Index of the entry, or -1 if the property is not declared.
+ *
+ ******************************************************************************/
+int32_t iot_property_table_find(iot_property_table const* table, iot_json_walk_token const* token)
+{
+    int32_t entry;
+
+    if( az_span_ptr( token->key ) == NULL )
+    {
+        return -1;
+    }
+
+    entry = find_name( table, (char const*)az_span_ptr( token->key ), (size_t)az_span_size( token->key ) );
+    if( (entry >= 0) && (table->nested_mask & (1UL << entry)) )
+    {
+        return -1;
+    }
+    return entry;
+}
+
+/******************************************************************************
+ * Function Name: iot_property_table_find_name
+ ******************************************************************************
+ * Summary:
+ *  Looks up a property by name, or a nested property by its path.
+ *
+ * Parameters:
+ *  table: Property table.
+ *
+ *  name: Null-terminated property name.
+ *
+ * Return:
+ *  int32_t: Index of the entry, or -1 if the property is not declared.
+ *
+ ******************************************************************************/
+int32_t iot_property_table_find_name(iot_property_table const* table, char const* name)
+{
+    return find_name( table, name, strlen( name ) );
+}
+
+/******************************************************************************
+ * Function Name: iot_property_decode
+ ******************************************************************************
+ * Summary:
+ *  Converts the value token of a declared property and checks its range.
+ *
+ * Parameters:
+ *  def: Declared property.
+ *
+ *  token: Value token.
+ *
+ *  out_value: Converted value.
+ *
+ * Return:
+ *  iot_property_value_result: Result of the conversion.
+ *
+ ******************************************************************************/
+iot_property_value_result iot_property_decode(iot_property_def const* def, iot_json_walk_token const* token,
+        iot_property_value* out_value)
+{
+    iot_property_value value;
+    double number;
+
+    if( token->kind == AZ_JSON_TOKEN_NULL )
+    {
+        return IOT_PROPERTY_VALUE_NULL;
+    }
+
+    switch( def->type )
+    {
+    case IOT_PROPERTY_INT32:
+        if( (token->kind != AZ_JSON_TOKEN_NUMBER) ||
+            az_result_failed( az_json_token_get_int32( token->value, &value.i ) ) )
+        {
+            return IOT_PROPERTY_VALUE_REJECTED;
+        }
+        number = value.i;
+        break;
+
+    case IOT_PROPERTY_DOUBLE:
+        if( (token->kind != AZ_JSON_TOKEN_NUMBER) ||
+            az_result_failed( az_json_token_get_double( token->value, &value.d ) ) )
+        {
+            return IOT_PROPERTY_VALUE_REJECTED;
+        }
+        number = value.d;
+        break;
+
+    case IOT_PROPERTY_BOOL:
+        if( (token->kind != AZ_JSON_TOKEN_TRUE) && (token->kind != AZ_JSON_TOKEN_FALSE) )
+        {
+            return IOT_PROPERTY_VALUE_REJECTED;
+        }
+        value.b = ( token->kind == AZ_JSON_TOKEN_TRUE );
+        *out_value = value;
+        return IOT_PROPERTY_VALUE_OK;
+
+    default:
+        return IOT_PROPERTY_VALUE_REJECTED;
+    }
+
+    if( def->has_range && ((number < def->min) || (number > def->max)) )
+    {
+        return IOT_PROPERTY_VALUE_REJECTED;
+    }
+
+    *out_value = value;
+    return IOT_PROPERTY_VALUE_OK;
+}
+
+/******************************************************************************
+ * Function Name: iot_property_value_equals
+ ******************************************************************************
+ * Summary:
+ *  Compares the member of two values selected by the property type.
+ *
+ * Parameters:
+ *  type: Type of both values.
+ *
+ *  a: First value.
+ *
+ *  b: Second value.
+ *
+ * Return:
+ *  bool: true if the values are equal.
+ *
+ ******************************************************************************/
+bool iot_property_value_equals(iot_property_type type, iot_property_value const* a, iot_property_value const* b)
+{
+    switch( type )
+    {
+    case IOT_PROPERTY_INT32:
+        return ( a->i == b->i );
+    case IOT_PROPERTY_DOUBLE:
+        return ( a->d == b->d );
+    default:
+        return ( a->b == b->b );
+    }
+}
+
+/******************************************************************************
+ * Function Name: store_value
+ ******************************************************************************
+ * Summary:
+ *  Writes a converted value to its target in the output structure.
+ *
+ * Parameters:
+ *  def: Declared property.
+ *
+ *  out: Output structure.
+ *
+ *  value: Converted value.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+static void store_value(iot_property_def const* def, uint8_t* out, iot_property_value const* value)
+{
+    switch( def->type )
+    {
+    case IOT_PROPERTY_INT32:
+        memcpy( out + def->offset, &value->i, sizeof(value->i) );
+        break;
+    case IOT_PROPERTY_DOUBLE:
+        memcpy( out + def->offset, &value->d, sizeof(value->d) );
+        break;
+    case IOT_PROPERTY_BOOL:
+        memcpy( out + def->offset, &value->b, sizeof(value->b) );
+        break;
+    }
+}
+
+/******************************************************************************
+ * Function Name: parse_entry
+ ******************************************************************************
+ * Summary:
+ *  Converts the value token of a table entry, stores it and records the
+ *  outcome in the parse result.
+ *
+ * Parameters:
+ *  parse: property_parse_context of the document.
+ *
+ *  entry: Index of the entry.
+ *
+ *  token: Value token.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+static void parse_entry(property_parse_context* parse, uint8_t entry, iot_json_walk_token const* token)
+{
+    iot_property_value value;
+
+    switch( iot_property_decode( &parse->table->defs[entry], token, &value ) )
+    {
+    case IOT_PROPERTY_VALUE_OK:
+        store_value( &parse->table->defs[entry], parse->out, &value );
+        parse->result->found |= (1UL << entry);
+        break;
+    case IOT_PROPERTY_VALUE_NULL:
+        parse->result->cleared |= (1UL << entry);
+        break;
+    case IOT_PROPERTY_VALUE_REJECTED:
+        parse->result->rejected |= (1UL << entry);
+        break;
+    }
+}
+
+/******************************************************************************
+ * Function Name: nested_path_cb
+ ******************************************************************************
+ * Summary:
+ *  JSON path callback that parses the value of a nested property.
+ *
+ * Parameters:
+ *  context: property_parse_context of the document.
+ *
+ *  path: Index of the nested path.
+ *
+ *  token: Value token.
+ *
+ * Return:
+ *  bool: true, the whole section is parsed.
+ *
+ ******************************************************************************/
+static bool nested_path_cb(void* context, uint8_t path, iot_json_walk_token const* token)
+{
+    property_parse_context* parse = (property_parse_context*)context;
+
+    parse_entry( parse, parse->table->nested_entry[path], token );
+    return true;
+}
+
+/******************************************************************************
+ * Function Name: property_token_cb
+ ******************************************************************************
+ * Summary:
+ *  JSON walk callback that stores the declared properties and $version of
+ *  the parsed section. Tokens of the section are also passed to the nested
+ *  path query.
+ *
+ * Parameters:
+ *  context: property_parse_context of the document.
+ *
+ *  token: JSON token.
+ *
+ * Return:
+ *  bool: true, the whole document is parsed.
+ *
+ ******************************************************************************/
+static bool property_token_cb(void* context, iot_json_walk_token const* token)
+{
+    property_parse_context* parse = (property_parse_context*)context;
+    uint8_t const property_depth = ( parse->section != NULL ) ? 2 : 1;
+    int32_t entry;
+
+    if( (parse->section != NULL) && (token->depth == 1) )
+    {
+        if( (token->kind == AZ_JSON_TOKEN_BEGIN_OBJECT) &&
+            iot_json_walk_key_equals( token, parse->section ) )
+        {
+            parse->in_section = true;
+        }
+        else if( token->kind == AZ_JSON_TOKEN_END_OBJECT )
+        {
+            parse->in_section = false;
+        }
+        return true;
+    }
+
+    if( (parse->section != NULL) && !parse->in_section )
+    {
+        return true;
+    }
+
+    if( parse->table->nested_count > 0 )
+    {
+        (void)iot_json_path_on_token( &parse->nested, token );
+    }
+
+    if( token->depth != property_depth )
+    {
+        return true;
+    }
+
+    if( iot_json_walk_key_equals( token, PROPERTY_VERSION_NAME ) )
+    {
+        if( (token->kind == AZ_JSON_TOKEN_NUMBER) &&
+            az_result_succeeded( az_json_token_get_int32( token->value, &parse->result->version ) ) )
+        {
+            parse->result->version_found = true;
+        }
+        return true;
+    }
+
+    entry = iot_property_table_find( parse->table, token );
+    if( entry >= 0 )
+    {
+        parse_entry( parse, (uint8_t)entry, token );
+    }
+
+    return true;
+}
+
+/******************************************************************************
+ * Function Name: iot_property_parse
+ ******************************************************************************
+ * Summary:
+ *  Extracts every declared property and the $version of one section of a
+ *  twin document in a single pass.
+ *
+ * Parameters:
+ *  table: Property table.
+ *
+ *  section: Root member holding the properties, NULL for the root object.
+ *
+ *  payload: Twin document.
+ *
+ *  payload_len: Length of the twin document.
+ *
+ *  out: Output structure.
+ *
+ *  out_result: Found, cleared and rejected properties.
+ *
+ * Return:
+ *  bool: false if the document is malformed.
+ *
+ ******************************************************************************/
+bool iot_property_parse(iot_property_table const* table, char const* section,
+        uint8_t const* payload, size_t payload_len, void* out, iot_property_parse_result* out_result)
+{
+    property_parse_context parse;
+
+    memset( out_result, 0x00, sizeof(iot_property_parse_result) );
+    memset( &parse, 0x00, sizeof(parse) );
+    parse.table = table;
+    parse.section = section;
+    parse.out = (uint8_t*)out;
+    parse.result = out_result;
+    iot_json_path_query_init( &parse.nested, table->nested, table->nested_count,
+            ( section != NULL ) ? 1 : 0, nested_path_cb, &parse );
+
+    return ( iot_json_walk( payload, payload_len, property_token_cb, &parse ) != IOT_JSON_WALK_ERROR );
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,197 @@
+/******************************************************************************
+ * File Name: mqtt_iot_property_parser.h
+ *
+ * Description: This file contains the declarations of the table-driven
+ * property parser, which extracts every declared property of a twin
+ * document in one pass.
+ *
+ ********************************************************************************
+ * Copyright 2024, Cypress Semiconductor Corporation (an Infineon company) or
+ * an affiliate of Cypress Semiconductor Corporation.  All rights reserved.
+ *
+ * This software, including source code, documentation and related
+ * materials ("Software") is owned by Cypress Semiconductor Corporation
+ * or one of its affiliates ("Cypress") and is protected by and subject to
+ * worldwide patent protection (United States and foreign),
+ * United States copyright laws and international treaty provisions.
+ * Therefore, you may use this Software only as provided in the license
+ * agreement accompanying the software package from which you
+ * obtained this Software ("EULA").
+ * If no EULA applies, Cypress hereby grants you a personal, non-exclusive,
+ * non-transferable license to copy, modify, and compile the Software
+ * source code solely for use in connection with Cypress's
+ * integrated circuit products.  Any reproduction, modification, translation,
+ * compilation, or representation of this Software except as specified
+ * above is prohibited without the express written permission of Cypress.
+ *
+ * Disclaimer: THIS SOFTWARE IS PROVIDED AS-IS, WITH NO WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING, BUT NOT LIMITED TO, NONINFRINGEMENT, IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. Cypress
+ * reserves the right to make changes to the Software without notice. Cypress
+ * does not assume any liability arising out of the application or use of the
+ * Software or any product or circuit described in the Software. Cypress does
+ * not authorize its products for use in any products where a malfunction or
+ * failure of the Cypress product may reasonably be expected to result in
+ * significant property damage, injury or death ("High Risk Product"). By
+ * including Cypress's product in a High Risk Product, the manufacturer
+ * of such system or application assumes all risk of such use and in doing
+ * so agrees to indemnify Cypress against all liability.
+ *******************************************************************************/
+
+#ifndef MQTT_IOT_PROPERTY_PARSER_H_
+#define MQTT_IOT_PROPERTY_PARSER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mqtt_iot_json_path.h"
+#include "mqtt_iot_json_walk.h"
+
+/*******************************************************************************
+ * Macros
+ ********************************************************************************/
+/* Maximum number of properties in a table */
+#define IOT_PROPERTY_TABLE_MAX_ENTRIES          (16)
+
+/* Slots of the name hash index, a power of two of at least twice the
+ * number of entries so that probe sequences stay short.
+ */
+#define IOT_PROPERTY_TABLE_INDEX_SIZE           (32)
+
+/* Maximum number of nested properties in a table */
+#define IOT_PROPERTY_TABLE_MAX_NESTED           (4)
+
+/*******************************************************************************
+ * Global Variables
+ ********************************************************************************/
+typedef enum
+{
+    IOT_PROPERTY_INT32,
+    IOT_PROPERTY_DOUBLE,
+    IOT_PROPERTY_BOOL
+} iot_property_type;
+
+typedef union
+{
+    int32_t i;
+    double  d;
+    bool    b;
+} iot_property_value;
+
+/* Declared property. A name with '.' or '[' is a nested path such as
+ * config.alarms[2].threshold. A number outside [min, max] is rejected if
+ * has_range is set.
+ */
+typedef struct
+{
+    char const*         name;
+    iot_property_type   type;
+    size_t              offset;         /* offsetof() the target in the output structure */
+    bool                has_range;
+    double              min;
+    double              max;
+} iot_property_def;
+
+/* Property table with the precomputed name hash index */
+typedef struct
+{
+    iot_property_def const* defs;
+    uint8_t                 count;
+    uint32_t                hash[IOT_PROPERTY_TABLE_MAX_ENTRIES];
+    uint8_t                 index[IOT_PROPERTY_TABLE_INDEX_SIZE];   /* Entry + 1, 0 if the slot is free */
+    uint32_t                nested_mask;    /* Bit n set if entry n is a nested path */
+    uint8_t                 nested_count;
+    uint8_t                 nested_entry[IOT_PROPERTY_TABLE_MAX_NESTED];
+    iot_json_path           nested[IOT_PROPERTY_TABLE_MAX_NESTED];
+} iot_property_table;
+
+typedef enum
+{
+    IOT_PROPERTY_VALUE_OK,          /* Value converted */
+    IOT_PROPERTY_VALUE_NULL,        /* Property set to null, i.e. removed */
+    IOT_PROPERTY_VALUE_REJECTED     /* Wrong type or out of range */
+} iot_property_value_result;
+
+/* Outcome of iot_property_parse(), one bit per table entry */
+typedef struct
+{
+    uint32_t    found;              /* Stored in the output structure */
+    uint32_t    cleared;            /* Set to null */
+    uint32_t    rejected;           /* Wrong type or out of range, not stored */
+    bool        version_found;
+    int32_t     version;            /* $version of the parsed section */
+} iot_property_parse_result;
+
+/******************************************************************************
+ * Function Prototypes
+ *******************************************************************************/
+/*
+ * @brief Builds the name hash index of a property table and compiles the
+ * nested paths.
+ * @param[out] table Property table.
+ * @param[in] defs Declared properties, must remain valid.
+ * @param[in] count Number of entries in \p defs.
+ * @return false if there are too many entries or nested paths, duplicate
+ * names, or a malformed path.
+ */
+bool iot_property_table_init(iot_property_table* table, iot_property_def const* defs, uint8_t count);
+
+/*
+ * @brief Looks up the top-level property named by a JSON token.
+ * @param[in] table Property table.
+ * @param[in] token Member token.
+ * @return Index of the entry, or -1 if no top-level property has the name.
+ */
+int32_t iot_property_table_find(iot_property_table const* table, iot_json_walk_token const* token);
+
+/*
+ * @brief Looks up a property by name, or a nested property by its path.
+ * @param[in] table Property table.
+ * @param[in] name Null-terminated property name.
+ * @return Index of the entry, or -1 if the property is not declared.
+ */
+int32_t iot_property_table_find_name(iot_property_table const* table, char const* name);
+
+/*
+ * @brief Converts the value token of a declared property and checks its
+ * range.
+ * @param[in] def Declared property.
+ * @param[in] token Value token.
+ * @param[out] out_value Converted value, set if IOT_PROPERTY_VALUE_OK.
+ * @return Result of the conversion.
+ */
+iot_property_value_result iot_property_decode(iot_property_def const* def, iot_json_walk_token const* token,
+        iot_property_value* out_value);
+
+/*
+ * @brief Compares two values of a property.
+ * @param[in] type Type of both values.
+ * @param[in] a First value.
+ * @param[in] b Second value.
+ * @return true if the values are equal.
+ */
+bool iot_property_value_equals(iot_property_type type, iot_property_value const* a, iot_property_value const* b);
+
+/*
+ * @brief Extracts every declared property and the $version of one section
+ * of a twin document in a single pass. Values are written to \p out at the
+ * offset of their entry; properties that are not found leave \p out
+ * unchanged.
+ * @param[in] table Property table.
+ * @param[in] section Name of the root member that holds the properties,
+ * e.g. "desired" for a twin GET response, or NULL if they are members of the
+ * root object as in a desired property patch. The rest of the document is
+ * still parsed, so that a malformed document is rejected as a whole.
+ * @param[in] payload Twin document.
+ * @param[in] payload_len Length of \p payload.
+ * @param[out] out Output structure.
+ * @param[out] out_result Found, cleared and rejected properties.
+ * @return false if the document is malformed.
+ */
+bool iot_property_parse(iot_property_table const* table, char const* section,
+        uint8_t const* payload, size_t payload_len, void* out, iot_property_parse_result* out_result);
+
+#endif /* MQTT_IOT_PROPERTY_PARSER_H_ */
+
+/* [] END OF FILE */
@@ -60,6 +60,7 @@
 #include <az_core.h>
 #include <az_iot.h>
 #include "mqtt_iot_common.h"
+#include "mqtt_iot_event_queue.h"
 
 #ifdef CY_TFM_PSA_SUPPORTED
 #include "tfm_multi_core_api.h"
@@ -75,21 +76,21 @@
 /***********************************************************************
  * Macros
  ************************************************************************/
-/* Wait duration between messages, should be in multiples of 500 */
+/* Duration for which the DPS app task waits for the registration to complete */
 #define MESSAGE_WAIT_LOOP_DURATION_MSEC             (120 * 1000)
 
 #define SAS_KEY_DURATION_MINUTES                    (240)
 
 #define MQTT_CLIENT_ID_BUFFER_SIZE                  (128)
 
-#define GET_QUEUE_TIMEOUT_MSEC                      (500)
-
-#define DPS_APP_TIMEOUT_MSEC                        (500)
-
-#define DPS_OPERATION_EVENT_QUEUE_MSEC              (500)
-
 #define DPS_OPERATION_QUERY_EVENT_QUEUE_LENGTH      (10)
 
+/* Overflow policy of the registration status queue. The MQTT event callback
+ * never blocks; only the latest registration status is of interest, so a
+ * pending status message is replaced by a newer one.
+ */
+#define DPS_OPERATION_EVENT_OVERFLOW_POLICY         (IOT_EVENT_OVERFLOW_COALESCE)
+
 /*String that describes the MQTT handle that is being created in order to uniquely identify it*/
 #define MQTT_HANDLE_DESCRIPTOR                      "MQTThandleID"
 
@@ -98,7 +99,7 @@
  ************************************************************/
 /* Enable RTOS-aware debugging */
 static cy_mqtt_t                mqtthandle;
-static cy_queue_t               dps_operation_query_event_queue = NULL;
+static iot_event_queue          dps_operation_query_event_queue;
 static volatile bool            connect_state = false;
 
 static iot_sample_environment_variables      env_vars;
@@ -117,6 +118,9 @@ static uint8_t                             *buffer = NULL;
 
 static bool dps_app_task_end_flag=0;
 
+static iot_event_overflow_policy const dps_operation_event_policy = DPS_OPERATION_EVENT_OVERFLOW_POLICY;
+static char const* const dps_operation_event_class_name = "dps_status";
+
 /******************************************************************************
  * Function Name: send_operation_query_message
  ******************************************************************************
@@ -158,7 +162,7 @@ static cy_rslt_t send_operation_query_message(az_iot_provisioning_client_registe
      * query.
      */
     IOT_SAMPLE_LOG( "Querying after %u seconds...", (unsigned int)register_response->retry_after_seconds );
-    vTaskDelay(pdMS_TO_TICKS(register_response->retry_after_seconds));
+    vTaskDelay(pdMS_TO_TICKS(register_response->retry_after_seconds * 1000));
 
     /* Publish the query status request .*/
 
@@ -208,10 +212,10 @@ static cy_rslt_t handle_device_registration_status_message(az_iot_provisioning_c
     {
         IOT_SAMPLE_LOG( "Operation is still pending." );
 
-        TEST_INFO(( "Pushing to DPS operation query queue....\n" ));
-        if( xQueueSend( dps_operation_query_event_queue, (void *)&register_response, pdMS_TO_TICKS(DPS_OPERATION_EVENT_QUEUE_MSEC) ) != pdPASS )
+        result = send_operation_query_message( register_response );
+        if( result == CY_RSLT_SUCCESS )
         {
-            TEST_INFO(( "Pushing to DPS operation query queue failed\n"));
+            IOT_SAMPLE_LOG_SUCCESS( "Client sent operation query message." );
         }
     }
     else /* Operation is complete. */
@@ -253,7 +257,7 @@ static cy_rslt_t handle_device_registration_status_message(az_iot_provisioning_c
  *
  *  topic_len: Length of received message topic.
  *
- *  message: MQTT publish/receive information structure.
+ *  message_span: Payload of received message.
  *
  *  out_register_response: Register or query operation response.
  *
@@ -262,12 +266,11 @@ static cy_rslt_t handle_device_registration_status_message(az_iot_provisioning_c
  *
  ******************************************************************************/
 static cy_rslt_t parse_device_registration_status_message(char* topic, int topic_len,
-        cy_mqtt_publish_info_t *message,
+        az_span message_span,
         az_iot_provisioning_client_register_response* out_register_response)
 {
     az_result rc;
     az_span const topic_span = az_span_create( (uint8_t*)topic, topic_len );
-    az_span const message_span = az_span_create( (uint8_t*)message->payload, message->payload_len );
 
     /* Parse the message and retrieve the register_response info. */
     rc = az_iot_provisioning_client_parse_received_topic_and_payload( &provisioning_client, topic_span,
@@ -305,8 +308,7 @@ static cy_rslt_t parse_device_registration_status_message(char* topic, int topic
 static void mqtt_event_cb(cy_mqtt_t mqtt_handle, cy_mqtt_event_t event, void *arg)
 {
     cy_mqtt_received_msg_info_t *received_msg = NULL;
-    bool is_operation_complete = false;
-    az_iot_provisioning_client_register_response *register_response = NULL;
+    iot_mqtt_message_event *status_event = NULL;
 
     TEST_INFO(( "\r\nMQTT App callback with handle : %p \n", mqtt_handle ));
     switch( event.type )
@@ -321,22 +323,25 @@ static void mqtt_event_cb(cy_mqtt_t mqtt_handle, cy_mqtt_event_t event, void *ar
             TEST_INFO(( "\r\nCY_MQTT_DISCONN_REASON_NETWORK_DISCONNECTION .....\n" ));
         }
         connect_state = false;
+        iot_event_queue_wake( &dps_operation_query_event_queue );
         break;
 
     case CY_MQTT_EVENT_TYPE_PUBLISH_RECEIVE :
         received_msg = &(event.data.pub_msg.received_message);
-        register_response = (az_iot_provisioning_client_register_response *)malloc( sizeof( az_iot_provisioning_client_register_response ) );
-        if( register_response == NULL )
+
+        /* The network buffer is reused once this callback returns, so the
+         * status message is copied and handed to the DPS app task without
+         * blocking.
+         */
+        status_event = iot_mqtt_message_event_create( 0, received_msg->topic, received_msg->topic_len,
+                received_msg->payload, received_msg->payload_len );
+        if( status_event == NULL )
         {
-            IOT_SAMPLE_LOG( "Memory not available for register_response." );
+            IOT_SAMPLE_LOG( "Memory not available for registration status message." );
         }
-        else
+        else if( !iot_event_queue_post( &dps_operation_query_event_queue, 0, status_event ) )
         {
-            /* Parse the registration status message. */
-            parse_device_registration_status_message( (char*)received_msg->topic, received_msg->topic_len,
-                    received_msg, register_response );
-            IOT_SAMPLE_LOG_SUCCESS( "Client parsed registration status message." );
-            handle_device_registration_status_message( register_response, &is_operation_complete );
+            TEST_INFO(( "Pushing to DPS operation query queue failed\n" ));
         }
         break;
 
@@ -733,8 +738,11 @@ void Azure_dps_app_task(void *arg)
 {
     cy_rslt_t TestRes = TEST_PASS ;
     uint8_t Failcount = 0, Passcount = 0;
-    uint32_t time_ms = 0;
-    az_iot_provisioning_client_register_response *register_response = NULL;
+    TimeOut_t deadline;
+    TickType_t ticks_left = 0;
+    bool is_operation_complete = false;
+    iot_mqtt_message_event *status_event = NULL;
+    az_iot_provisioning_client_register_response register_response;
 #ifdef CY_TFM_PSA_SUPPORTED
     psa_status_t uxStatus = PSA_SUCCESS;
     size_t read_len = 0;
@@ -742,10 +750,11 @@ void Azure_dps_app_task(void *arg)
     (void)read_len;
 #endif
 
-    /* Initialize the queue for hub method events */
-    dps_operation_query_event_queue = xQueueCreate( DPS_OPERATION_QUERY_EVENT_QUEUE_LENGTH, sizeof( az_iot_provisioning_client_register_response ) );
-    if(dps_operation_query_event_queue != NULL)
+    /* Initialize the queue for registration status events */
+    if( iot_event_queue_init( &dps_operation_query_event_queue, DPS_OPERATION_QUERY_EVENT_QUEUE_LENGTH,
+            &dps_operation_event_policy, 1 ) )
     {
+        iot_event_queue_set_consumer( &dps_operation_query_event_queue, xTaskGetCurrentTaskHandle() );
         TEST_INFO(( "dps_operation_query_event_queue create ----------- Pass \n" ));
         Passcount++;
     }
@@ -870,24 +879,29 @@ void Azure_dps_app_task(void *arg)
     }
 
     /* Delay Loop for Azure dps app task */
-    time_ms = ( MESSAGE_WAIT_LOOP_DURATION_MSEC );
-    while( connect_state && (time_ms > 0) && (!dps_app_task_end_flag) )
+    /* The task sleeps until a status message is posted, the client
+     * disconnects or the loop deadline expires.
+     */
+    vTaskSetTimeOutState( &deadline );
+    ticks_left = pdMS_TO_TICKS( MESSAGE_WAIT_LOOP_DURATION_MSEC );
+    while( connect_state && (ticks_left > 0) && (!dps_app_task_end_flag) )
     {
-        if(xQueueReceive( dps_operation_query_event_queue, (void *)&register_response, pdMS_TO_TICKS(GET_QUEUE_TIMEOUT_MSEC) ) != pdPASS)
+        status_event = iot_event_queue_wait( &dps_operation_query_event_queue, &deadline, &ticks_left, NULL );
+        if( status_event != NULL )
         {
-            /* No need to do anything */
-        }
-        else
-        {
-            if( register_response != NULL )
+            /* Parse the registration status message. The register response
+             * spans point into the event, keep it until the message is handled.
+             */
+            if( parse_device_registration_status_message( status_event->topic, status_event->topic_len,
+                    az_span_create( (uint8_t*)status_event->payload, (int32_t)status_event->payload_len ),
+                    &register_response ) == CY_RSLT_SUCCESS )
             {
-                send_operation_query_message( register_response );
-                IOT_SAMPLE_LOG_SUCCESS( "Client sent operation query message." );
-                free( register_response );
-                register_response = NULL;
+                IOT_SAMPLE_LOG_SUCCESS( "Client parsed registration status message." );
+                handle_device_registration_status_message( &register_response, &is_operation_complete );
             }
+            free( status_event );
+            status_event = NULL;
         }
-        time_ms = time_ms - DPS_APP_TIMEOUT_MSEC;
     }
 
     exit:
@@ -908,6 +922,9 @@ void Azure_dps_app_task(void *arg)
         Failcount++;
     }
 
+    iot_event_queue_log_stats( &dps_operation_query_event_queue, &dps_operation_event_class_name );
+    iot_event_queue_deinit( &dps_operation_query_event_queue );
+
     TEST_INFO(( "\r\nCompleted MQTT Client Test Cases --------------------------\n" ));
     TEST_INFO(( "\r\nTotal Test Cases   ---------------------- %d\n", ( Failcount + Passcount ) ));
     TEST_INFO(( "\r\nTest Cases passed  ---------------------- %d\n", Passcount ));
@@ -0,0 +1,374 @@
+/******************************************************************************
+ * File Name: mqtt_iot_reported_writer.c
+ *
+ * Description: This file contains the reported property writer. Changed
+ * fields are marked dirty and merged into one device twin patch per debounce
+ * window, with at most one patch waiting for the response of the hub.
+ *
+ ********************************************************************************
+ * Copyright 2024, Cypress Semiconductor Corporation (an Infineon company) or
+ * an affiliate of Cypress Semiconductor Corporation.  All rights reserved.
+ *
+ * This software, including source code, documentation and related
+ * materials ("Software") is owned by Cypress Semiconductor Corporation
+ * or one of its affiliates ("Cypress") and is protected by and subject to
+ * worldwide patent protection (United States and foreign),
+ * United States copyright laws and international treaty provisions.
+ * Therefore, you may use this Software only as provided in the license
+ * agreement accompanying the software package from which you
+ * obtained this Software ("EULA").
+ * If no EULA applies, Cypress hereby grants you a personal, non-exclusive,
+ * non-transferable license to copy, modify, and compile the Software
+ * source code solely for use in connection with Cypress's
+ * integrated circuit products.  Any reproduction, modification, translation,
+ * compilation, or representation of this Software except as specified
+ * above is prohibited without the express written permission of Cypress.
+ *
+ * Disclaimer: THIS SOFTWARE IS PROVIDED AS-IS, WITH NO WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING, BUT NOT LIMITED TO, NONINFRINGEMENT, IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. Cypress
+ * reserves the right to make changes to the Software without notice. Cypress
+ * does not assume any liability arising out of the application or use of the
+ * Software or any product or circuit described in the Software. Cypress does
+ * not authorize its products for use in any products where a malfunction or
+ * failure of the Cypress product may reasonably be expected to result in
+ * significant property damage, injury or death ("High Risk Product"). By
+ * including Cypress's product in a High Risk Product, the manufacturer
+ * of such system or application assumes all risk of such use and in doing
+ * so agrees to indemnify Cypress against all liability.
+ *******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "azure_common.h"
+#include "mqtt_iot_reported_writer.h"
+
+/******************************************************************************
+ * Function Name: iot_reported_writer_init
+ ******************************************************************************
+ * Summary:
+ *  Initializes a writer with no pending fields.
+ *
+ * Parameters:
+ *  writer: Reported property writer.
+ *
+ *  debounce_msec: Time from the first change to the patch.
+ *
+ *  response_timeout_msec: Time after which a patch is considered lost.
+ *
+ *  send: Builds and publishes a patch.
+ *
+ *  context: Passed to send.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_reported_writer_init(iot_reported_writer* writer, uint32_t debounce_msec,
+        uint32_t response_timeout_msec, iot_reported_writer_send send, void* context)
+{
+    memset( writer, 0x00, sizeof(iot_reported_writer) );
+    writer->send = send;
+    writer->context = context;
+    writer->debounce_ticks = pdMS_TO_TICKS( debounce_msec );
+    writer->response_timeout_ticks = pdMS_TO_TICKS( response_timeout_msec );
+}
+
+/******************************************************************************
+ * Function Name: iot_reported_writer_mark_dirty
+ ******************************************************************************
+ * Summary:
+ *  Marks fields as changed, and opens the debounce window if it is closed.
+ *
+ * Parameters:
+ *  writer: Reported property writer.
+ *
+ *  fields: Bit n set for each changed field n.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_reported_writer_mark_dirty(iot_reported_writer* writer, uint32_t fields)
+{
+    TickType_t const now = xTaskGetTickCount();
+
+    taskENTER_CRITICAL();
+    writer->dirty |= fields;
+    writer->marks++;
+    if( !writer->window_open )
+    {
+        writer->window_open = true;
+        writer->due_tick = now + writer->debounce_ticks;
+    }
+    taskEXIT_CRITICAL();
+}
+
+/******************************************************************************
+ * Function Name: iot_reported_writer_set
+ ******************************************************************************
+ * Summary:
+ *  Sets the value of a field, and marks it dirty unless the hub already
+ *  acknowledged that value. A patch in flight may still change the
+ *  acknowledged value, so the field is compared again when it is sent.
+ *
+ * Parameters:
+ *  writer: Reported property writer.
+ *
+ *  field: Index of the field.
+ *
+ *  type: Type of the value.
+ *
+ *  value: Current value of the field.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_reported_writer_set(iot_reported_writer* writer, uint8_t field, iot_property_type type,
+        iot_property_value value)
+{
+    uint32_t const bit = (1UL << field);
+    bool acknowledged;
+
+    if( field >= IOT_REPORTED_WRITER_MAX_FIELDS )
+    {
+        return;
+    }
+
+    taskENTER_CRITICAL();
+    writer->type[field] = type;
+    writer->current[field] = value;
+    writer->valued |= bit;
+    acknowledged = ( (writer->acked & bit) && ((writer->in_flight & bit) == 0) &&
+            iot_property_value_equals( type, &writer->acked_value[field], &value ) );
+    if( acknowledged )
+    {
+        writer->dirty &= ~bit;
+        writer->unchanged++;
+    }
+    taskEXIT_CRITICAL();
+
+    if( !acknowledged )
+    {
+        iot_reported_writer_mark_dirty( writer, bit );
+    }
+}
+
+/******************************************************************************
+ * Function Name: unchanged_fields
+ ******************************************************************************
+ * Summary:
+ *  Finds the fields set by value that equal their acknowledged value. Must
+ *  be called in a critical section.
+ *
+ * Parameters:
+ *  writer: Reported property writer.
+ *
+ *  fields: Fields to check.
+ *
+ * Return:
+ *  uint32_t: Bit n set if field n needs not be sent.
+ *
+ ******************************************************************************/
+static uint32_t unchanged_fields(iot_reported_writer const* writer, uint32_t fields)
+{
+    uint32_t unchanged = 0;
+
+    fields &= ( writer->valued & writer->acked );
+    for( uint8_t i = 0; (i < IOT_REPORTED_WRITER_MAX_FIELDS) && (fields != 0); i++ )
+    {
+        if( (fields & (1UL << i)) &&
+            iot_property_value_equals( writer->type[i], &writer->acked_value[i], &writer->current[i] ) )
+        {
+            unchanged |= (1UL << i);
+        }
+    }
+
+    return unchanged;
+}
+
+/******************************************************************************
+ * Function Name: iot_reported_writer_poll
+ ******************************************************************************
+ * Summary:
+ *  Expires a lost patch, and sends the pending fields once the debounce
+ *  window has ended and no patch is in flight. The send callback is invoked
+ *  outside the critical section.
+ *
+ * Parameters:
+ *  writer: Reported property writer.
+ *
+ * Return:
+ *  TickType_t: Ticks until the next poll, portMAX_DELAY if nothing is pending.
+ *
+ ******************************************************************************/
+TickType_t iot_reported_writer_poll(iot_reported_writer* writer)
+{
+    TickType_t const now = xTaskGetTickCount();
+    TickType_t wait_ticks = portMAX_DELAY;
+    TickType_t elapsed;
+    TickType_t remaining;
+    uint32_t fields = 0;
+    uint32_t unchanged;
+
+    taskENTER_CRITICAL();
+    if( writer->waiting_response )
+    {
+        elapsed = now - writer->sent_tick;
+        if( elapsed >= writer->response_timeout_ticks )
+        {
+            /* The response was lost, send the fields with the next patch */
+            writer->timeouts++;
+            writer->dirty |= writer->in_flight;
+            writer->in_flight = 0;
+            writer->waiting_response = false;
+            if( !writer->window_open )
+            {
+                writer->window_open = true;
+                writer->due_tick = now;
+            }
+        }
+        else
+        {
+            wait_ticks = writer->response_timeout_ticks - elapsed;
+        }
+    }
+
+    if( !writer->waiting_response && writer->window_open )
+    {
+        /* Differences beyond half the tick range are due ticks in the past. */
+        remaining = writer->due_tick - now;
+        if( (remaining == 0) || (remaining > (portMAX_DELAY / 2)) )
+        {
+            /* Send the difference to the acknowledged state, if any */
+            unchanged = unchanged_fields( writer, writer->dirty );
+            fields = writer->dirty & ~unchanged;
+            writer->dirty = 0;
+            writer->window_open = false;
+            while( unchanged != 0 )
+            {
+                writer->unchanged++;
+                unchanged &= ( unchanged - 1 );
+            }
+            if( fields != 0 )
+            {
+                memcpy( writer->sent, writer->current, sizeof(writer->sent) );
+                writer->in_flight = fields;
+                writer->waiting_response = true;
+                writer->sent_tick = now;
+                wait_ticks = writer->response_timeout_ticks;
+            }
+        }
+        else
+        {
+            wait_ticks = remaining;
+        }
+    }
+    taskEXIT_CRITICAL();
+
+    if( fields == 0 )
+    {
+        return wait_ticks;
+    }
+
+    if( writer->send( writer->context, fields ) == CY_RSLT_SUCCESS )
+    {
+        writer->patches++;
+        return wait_ticks;
+    }
+
+    /* Not published, retry after another debounce window */
+    taskENTER_CRITICAL();
+    writer->waiting_response = false;
+    writer->in_flight = 0;
+    writer->dirty |= fields;
+    if( !writer->window_open )
+    {
+        writer->window_open = true;
+        writer->due_tick = now + writer->debounce_ticks;
+    }
+    wait_ticks = writer->due_tick - now;
+    taskEXIT_CRITICAL();
+
+    return wait_ticks;
+}
+
+/******************************************************************************
+ * Function Name: iot_reported_writer_complete
+ ******************************************************************************
+ * Summary:
+ *  Completes the patch in flight on the response of the hub. The values of
+ *  an accepted patch become the acknowledged values. The fields of a
+ *  rejected patch are dropped, as resending the same patch would most
+ *  likely be rejected again.
+ *
+ * Parameters:
+ *  writer: Reported property writer.
+ *
+ *  accepted: false if the hub rejected the patch.
+ *
+ * Return:
+ *  bool: true if fields are pending.
+ *
+ ******************************************************************************/
+bool iot_reported_writer_complete(iot_reported_writer* writer, bool accepted)
+{
+    bool pending;
+
+    taskENTER_CRITICAL();
+    if( writer->waiting_response )
+    {
+        if( !accepted )
+        {
+            writer->rejected++;
+        }
+        else
+        {
+            for( uint8_t i = 0; i < IOT_REPORTED_WRITER_MAX_FIELDS; i++ )
+            {
+                if( writer->in_flight & writer->valued & (1UL << i) )
+                {
+                    writer->acked_value[i] = writer->sent[i];
+                    writer->acked |= (1UL << i);
+                }
+            }
+        }
+        writer->in_flight = 0;
+        writer->waiting_response = false;
+    }
+    pending = writer->window_open;
+    taskEXIT_CRITICAL();
+
+    return pending;
+}
+
+/******************************************************************************
+ * Function Name: iot_reported_writer_log_stats
+ ******************************************************************************
+ * Summary:
+ *  Prints the number of changes, unchanged fields left out, patches,
+ *  rejected and lost patches.
+ *
+ * Parameters:
+ *  name: Printable name of the writer.
+ *
+ *  writer: Reported property writer.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_reported_writer_log_stats(char const* name, iot_reported_writer const* writer)
+{
+    TEST_INFO(( "\r\n%s reported properties: %lu changes sent in %lu patches, %lu unchanged not sent, %lu rejected, %lu lost\n",
+            name,
+            (unsigned long)writer->marks,
+            (unsigned long)writer->patches,
+            (unsigned long)writer->unchanged,
+            (unsigned long)writer->rejected,
+            (unsigned long)writer->timeouts ));
+}
+
+/* [] END OF FILE */
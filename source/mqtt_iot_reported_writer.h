@@ -0,0 +1,164 @@
+/******************************************************************************
+ * File Name: mqtt_iot_reported_writer.h
+ *
+ * Description: This file contains the declarations of the reported property
+ * writer, which merges reported property changes into one device twin patch
+ * per debounce window.
+ *
+ ********************************************************************************
+ * Copyright 2024, Cypress Semiconductor Corporation (an Infineon company) or
+ * an affiliate of Cypress Semiconductor Corporation.  All rights reserved.
+ *
+ * This software, including source code, documentation and related
+ * materials ("Software") is owned by Cypress Semiconductor Corporation
+ * or one of its affiliates ("Cypress") and is protected by and subject to
+ * worldwide patent protection (United States and foreign),
+ * United States copyright laws and international treaty provisions.
+ * Therefore, you may use this Software only as provided in the license
+ * agreement accompanying the software package from which you
+ * obtained this Software ("EULA").
+ * If no EULA applies, Cypress hereby grants you a personal, non-exclusive,
+ * non-transferable license to copy, modify, and compile the Software
+ * source code solely for use in connection with Cypress's
+ * integrated circuit products.  Any reproduction, modification, translation,
+ * compilation, or representation of this Software except as specified
+ * above is prohibited without the express written permission of Cypress.
+ *
+ * Disclaimer: THIS SOFTWARE IS PROVIDED AS-IS, WITH NO WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING, BUT NOT LIMITED TO, NONINFRINGEMENT, IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. Cypress
+ * reserves the right to make changes to the Software without notice. Cypress
+ * does not assume any liability arising out of the application or use of the
+ * Software or any product or circuit described in the Software. Cypress does
+ * not authorize its products for use in any products where a malfunction or
+ * failure of the Cypress product may reasonably be expected to result in
+ * significant property damage, injury or death ("High Risk Product"). By
+ * including Cypress's product in a High Risk Product, the manufacturer
+ * of such system or application assumes all risk of such use and in doing
+ * so agrees to indemnify Cypress against all liability.
+ *******************************************************************************/
+
+#ifndef MQTT_IOT_REPORTED_WRITER_H_
+#define MQTT_IOT_REPORTED_WRITER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cyabs_rtos.h"
+#include "mqtt_iot_property_parser.h"
+
+/*******************************************************************************
+ * Macros
+ ********************************************************************************/
+/* Fields 0 to IOT_REPORTED_WRITER_MAX_FIELDS - 1 can be set by value */
+#define IOT_REPORTED_WRITER_MAX_FIELDS          (8)
+
+/*******************************************************************************
+ * Global Variables
+ ********************************************************************************/
+/*
+ * @brief Builds and publishes one reported property patch.
+ * @param[in] context Context passed to iot_reported_writer_init().
+ * @param[in] fields Bit n set if field n has to be included in the patch.
+ * @return CY_RSLT_SUCCESS if the patch was published.
+ */
+typedef cy_rslt_t (*iot_reported_writer_send)(void* context, uint32_t fields);
+
+/* Reported property patches are sent one at a time. Fields marked dirty
+ * while a patch is in flight or within the debounce window are merged into
+ * the next patch. Fields set by value are compared with the value last
+ * acknowledged by the hub, and only the fields that differ are sent.
+ */
+typedef struct
+{
+    iot_reported_writer_send    send;
+    void*                       context;
+    TickType_t                  debounce_ticks;
+    TickType_t                  response_timeout_ticks;
+    uint32_t                    dirty;          /* Fields waiting for the next patch */
+    uint32_t                    in_flight;      /* Fields of the unacknowledged patch */
+    uint32_t                    valued;         /* Fields set by value */
+    uint32_t                    acked;          /* Fields with an acknowledged value */
+    iot_property_type           type[IOT_REPORTED_WRITER_MAX_FIELDS];
+    iot_property_value          current[IOT_REPORTED_WRITER_MAX_FIELDS];
+    iot_property_value          sent[IOT_REPORTED_WRITER_MAX_FIELDS];       /* Values of the patch in flight */
+    iot_property_value          acked_value[IOT_REPORTED_WRITER_MAX_FIELDS];
+    bool                        window_open;
+    bool                        waiting_response;
+    TickType_t                  due_tick;       /* End of the debounce window */
+    TickType_t                  sent_tick;
+    uint32_t                    marks;
+    uint32_t                    unchanged;      /* Fields not sent as the hub has the value */
+    uint32_t                    patches;
+    uint32_t                    rejected;
+    uint32_t                    timeouts;
+} iot_reported_writer;
+
+/******************************************************************************
+ * Function Prototypes
+ *******************************************************************************/
+/*
+ * @brief Initializes a writer with no pending fields.
+ * @param[out] writer Reported property writer.
+ * @param[in] debounce_msec Time from the first change to the patch.
+ * @param[in] response_timeout_msec Time after which an unacknowledged patch
+ * is considered lost and its fields are sent again.
+ * @param[in] send Builds and publishes a patch.
+ * @param[in] context Passed to \p send.
+ */
+void iot_reported_writer_init(iot_reported_writer* writer, uint32_t debounce_msec,
+        uint32_t response_timeout_msec, iot_reported_writer_send send, void* context);
+
+/*
+ * @brief Marks fields as changed. The first change opens the debounce window.
+ * @param[in] writer Reported property writer.
+ * @param[in] fields Bit n set for each changed field n.
+ */
+void iot_reported_writer_mark_dirty(iot_reported_writer* writer, uint32_t fields);
+
+/*
+ * @brief Sets the value of a field. The field is marked dirty unless the
+ * hub already acknowledged this value; a field whose value returns to the
+ * acknowledged one before the patch is sent is left out of the patch. The
+ * send callback reports the value the owner holds, which must be the last
+ * value set.
+ * @param[in] writer Reported property writer.
+ * @param[in] field Index of the field, below IOT_REPORTED_WRITER_MAX_FIELDS.
+ * @param[in] type Type of the value.
+ * @param[in] value Current value of the field.
+ */
+void iot_reported_writer_set(iot_reported_writer* writer, uint8_t field, iot_property_type type,
+        iot_property_value value);
+
+/*
+ * @brief Sends the pending fields if the debounce window has ended and no
+ * patch is in flight. Must be called from the task that owns the writer,
+ * after every wake-up.
+ * @param[in] writer Reported property writer.
+ * @return Ticks until the writer has to be polled again, portMAX_DELAY if
+ * nothing is pending.
+ */
+TickType_t iot_reported_writer_poll(iot_reported_writer* writer);
+
+/*
+ * @brief Completes the patch in flight on the response of the hub. Can be
+ * called from the MQTT event callback.
+ * @param[in] writer Reported property writer.
+ * @param[in] accepted false if the hub rejected the patch. Its fields are
+ * not sent again until they are marked dirty again. The values of an
+ * accepted patch become the acknowledged values.
+ * @return true if fields are pending, i.e. the owner task has to be woken.
+ */
+bool iot_reported_writer_complete(iot_reported_writer* writer, bool accepted);
+
+/*
+ * @brief Prints the number of changes, unchanged fields left out, patches,
+ * rejected and lost patches.
+ * @param[in] name Printable name of the writer.
+ * @param[in] writer Reported property writer.
+ */
+void iot_reported_writer_log_stats(char const* name, iot_reported_writer const* writer);
+
+#endif /* MQTT_IOT_REPORTED_WRITER_H_ */
+
+/* [] END OF FILE */
@@ -0,0 +1,386 @@
+/******************************************************************************
+ * File Name: mqtt_iot_request_tracker.c
+ *
+ * Description: This file contains the pending request table. Requests are
+ * keyed by their request ID, responses are matched back to them, and
+ * requests without a response are published again or given up.
+ *
+ ********************************************************************************
+ * Copyright 2024, Cypress Semiconductor Corporation (an Infineon company) or
+ * an affiliate of Cypress Semiconductor Corporation.  All rights reserved.
+ *
+ * This software, including source code, documentation and related
+ * materials ("Software") is owned by Cypress Semiconductor Corporation
+ * or one of its affiliates ("Cypress") and is protected by and subject to
+ * worldwide patent protection (United States and foreign),
+ * United States copyright laws and international treaty provisions.
+ * Therefore, you may use this Software only as provided in the license
+ * agreement accompanying the software package from which you
+ * obtained this Software ("EULA").
+ * If no EULA applies, Cypress hereby grants you a personal, non-exclusive,
+ * non-transferable license to copy, modify, and compile the Software
+ * source code solely for use in connection with Cypress's
+ * integrated circuit products.  Any reproduction, modification, translation,
+ * compilation, or representation of this Software except as specified
+ * above is prohibited without the express written permission of Cypress.
+ *
+ * Disclaimer: THIS SOFTWARE IS PROVIDED AS-IS, WITH NO WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING, BUT NOT LIMITED TO, NONINFRINGEMENT, IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. Cypress
+ * reserves the right to make changes to the Software without notice. Cypress
+ * does not assume any liability arising out of the application or use of the
+ * Software or any product or circuit described in the Software. Cypress does
+ * not authorize its products for use in any products where a malfunction or
+ * failure of the Cypress product may reasonably be expected to result in
+ * significant property damage, injury or death ("High Risk Product"). By
+ * including Cypress's product in a High Risk Product, the manufacturer
+ * of such system or application assumes all risk of such use and in doing
+ * so agrees to indemnify Cypress against all liability.
+ *******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "azure_common.h"
+#include "mqtt_iot_request_tracker.h"
+
+/******************************************************************************
+ * Function Name: find_entry
+ ******************************************************************************
+ * Summary:
+ *  Finds the pending request with a request ID. Must be called in a
+ *  critical section.
+ *
+ * Parameters:
+ *  tracker: Request table.
+ *
+ *  request_id: Request ID, not terminated.
+ *
+ *  request_id_len: Length of the request ID.
+ *
+ * Return:
+ *  iot_request_entry*: Pending request, NULL if there is none.
+ *
+ ******************************************************************************/
+static iot_request_entry* find_entry(iot_request_tracker* tracker, char const* request_id, size_t request_id_len)
+{
+    iot_request_entry* entry;
+
+    if( request_id_len >= IOT_REQUEST_ID_SIZE )
+    {
+        return NULL;
+    }
+
+    for( uint8_t i = 0; i < IOT_REQUEST_TRACKER_ENTRIES; i++ )
+    {
+        entry = &tracker->entries[i];
+        if( entry->in_use && (strncmp( entry->id, request_id, request_id_len ) == 0) &&
+            (entry->id[request_id_len] == '\0') )
+        {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+/******************************************************************************
+ * Function Name: iot_request_tracker_init
+ ******************************************************************************
+ * Summary:
+ *  Initializes an empty request table.
+ *
+ * Parameters:
+ *  tracker: Request table.
+ *
+ *  op_names: Printable name of each operation type.
+ *
+ *  op_count: Number of operation types.
+ *
+ *  resend: Publishes a lost request again.
+ *
+ *  context: Passed to resend.
+ *
+ * Return:
+ *  bool: false if op_count is too large.
+ *
+ ******************************************************************************/
+bool iot_request_tracker_init(iot_request_tracker* tracker, char const* const* op_names, uint8_t op_count,
+        iot_request_tracker_resend resend, void* context)
+{
+    memset( tracker, 0x00, sizeof(iot_request_tracker) );
+    if( op_count > IOT_REQUEST_TRACKER_MAX_OPS )
+    {
+        return false;
+    }
+
+    tracker->op_names = op_names;
+    tracker->op_count = op_count;
+    tracker->resend = resend;
+    tracker->context = context;
+    tracker->next_id = 1;
+    return true;
+}
+
+/******************************************************************************
+ * Function Name: iot_request_tracker_begin
+ ******************************************************************************
+ * Summary:
+ *  Allocates a request ID and starts the response timer.
+ *
+ * Parameters:
+ *  tracker: Request table.
+ *
+ *  op: Operation type.
+ *
+ *  timeout_msec: Time to wait for the response.
+ *
+ *  max_retries: Number of times a lost request is published again.
+ *
+ *  out_request_id: Request ID, IOT_REQUEST_ID_SIZE bytes.
+ *
+ * Return:
+ *  bool: false if the table is full.
+ *
+ ******************************************************************************/
+bool iot_request_tracker_begin(iot_request_tracker* tracker, uint8_t op, uint32_t timeout_msec,
+        uint8_t max_retries, char* out_request_id)
+{
+    iot_request_entry* entry = NULL;
+    char id[IOT_REQUEST_ID_SIZE];
+    uint32_t id_number;
+
+    if( op >= tracker->op_count )
+    {
+        return false;
+    }
+
+    /* The ID is formatted outside the critical section, which then only
+     * claims the slot and copies the ID. An ID taken when the table is
+     * full is not reused.
+     */
+    taskENTER_CRITICAL();
+    id_number = tracker->next_id++;
+    taskEXIT_CRITICAL();
+    snprintf( id, sizeof(id), "%lu", (unsigned long)id_number );
+
+    taskENTER_CRITICAL();
+    for( uint8_t i = 0; i < IOT_REQUEST_TRACKER_ENTRIES; i++ )
+    {
+        if( !tracker->entries[i].in_use )
+        {
+            entry = &tracker->entries[i];
+            break;
+        }
+    }
+
+    if( entry == NULL )
+    {
+        tracker->table_full++;
+        taskEXIT_CRITICAL();
+        return false;
+    }
+
+    entry->in_use = true;
+    entry->op = op;
+    entry->retries_left = max_retries;
+    entry->sent_tick = xTaskGetTickCount();
+    entry->timeout_ticks = pdMS_TO_TICKS( timeout_msec );
+    memcpy( entry->id, id, sizeof(entry->id) );
+    tracker->ops[op].sent++;
+    taskEXIT_CRITICAL();
+
+    memcpy( out_request_id, id, sizeof(id) );
+
+    return true;
+}
+
+/******************************************************************************
+ * Function Name: iot_request_tracker_cancel
+ ******************************************************************************
+ * Summary:
+ *  Removes a request that could not be published.
+ *
+ * Parameters:
+ *  tracker: Request table.
+ *
+ *  request_id: Request ID returned by iot_request_tracker_begin().
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_request_tracker_cancel(iot_request_tracker* tracker, char const* request_id)
+{
+    iot_request_entry* entry;
+
+    taskENTER_CRITICAL();
+    entry = find_entry( tracker, request_id, strlen( request_id ) );
+    if( entry != NULL )
+    {
+        tracker->ops[entry->op].sent--;
+        entry->in_use = false;
+    }
+    taskEXIT_CRITICAL();
+}
+
+/******************************************************************************
+ * Function Name: iot_request_tracker_complete
+ ******************************************************************************
+ * Summary:
+ *  Matches a response to its request, records the round-trip latency since
+ *  the request was last published and removes the request.
+ *
+ * Parameters:
+ *  tracker: Request table.
+ *
+ *  request_id: Request ID of the response.
+ *
+ *  request_id_len: Length of the request ID.
+ *
+ *  out_op: Operation type of the request, can be NULL.
+ *
+ * Return:
+ *  bool: false if no request with this ID is pending.
+ *
+ ******************************************************************************/
+bool iot_request_tracker_complete(iot_request_tracker* tracker, char const* request_id, size_t request_id_len,
+        uint8_t* out_op)
+{
+    iot_request_entry* entry;
+    iot_request_op_stats* stats;
+
+    taskENTER_CRITICAL();
+    entry = find_entry( tracker, request_id, request_id_len );
+    if( entry == NULL )
+    {
+        tracker->unmatched++;
+        taskEXIT_CRITICAL();
+        return false;
+    }
+
+    stats = &tracker->ops[entry->op];
+    stats->completed++;
+    iot_event_latency_record( &stats->rtt, entry->sent_tick );
+    if( out_op != NULL )
+    {
+        *out_op = entry->op;
+    }
+    entry->in_use = false;
+    taskEXIT_CRITICAL();
+
+    return true;
+}
+
+/******************************************************************************
+ * Function Name: iot_request_tracker_poll
+ ******************************************************************************
+ * Summary:
+ *  Publishes requests whose response timed out again, or gives them up once
+ *  their retries are used. The resend callback is invoked outside the
+ *  critical section.
+ *
+ * Parameters:
+ *  tracker: Request table.
+ *
+ * Return:
+ *  TickType_t: Ticks until the next response timeout, portMAX_DELAY if no
+ *  request is pending.
+ *
+ ******************************************************************************/
+TickType_t iot_request_tracker_poll(iot_request_tracker* tracker)
+{
+    TickType_t wait_ticks = portMAX_DELAY;
+    TickType_t now;
+    TickType_t elapsed;
+    iot_request_entry* entry;
+    char request_id[IOT_REQUEST_ID_SIZE];
+    uint8_t op;
+    bool resend;
+
+    for( uint8_t i = 0; i < IOT_REQUEST_TRACKER_ENTRIES; i++ )
+    {
+        entry = &tracker->entries[i];
+        resend = false;
+
+        taskENTER_CRITICAL();
+        now = xTaskGetTickCount();
+        elapsed = now - entry->sent_tick;
+        if( !entry->in_use )
+        {
+            /* Free slot */
+        }
+        else if( elapsed < entry->timeout_ticks )
+        {
+            if( (entry->timeout_ticks - elapsed) < wait_ticks )
+            {
+                wait_ticks = entry->timeout_ticks - elapsed;
+            }
+        }
+        else if( entry->retries_left > 0 )
+        {
+            /* Restart the timer with the same request ID, so that a late
+             * response to the first attempt still completes the request.
+             */
+            entry->retries_left--;
+            entry->sent_tick = now;
+            tracker->ops[entry->op].retries++;
+            memcpy( request_id, entry->id, sizeof(request_id) );
+            op = entry->op;
+            resend = true;
+            if( entry->timeout_ticks < wait_ticks )
+            {
+                wait_ticks = entry->timeout_ticks;
+            }
+        }
+        else
+        {
+            tracker->ops[entry->op].lost++;
+            entry->in_use = false;
+        }
+        taskEXIT_CRITICAL();
+
+        if( resend && (tracker->resend != NULL) )
+        {
+            TEST_INFO(( "Request %s (%s) timed out, publishing it again\n", request_id, tracker->op_names[op] ));
+            (void)tracker->resend( tracker->context, op, request_id );
+        }
+    }
+
+    return wait_ticks;
+}
+
+/******************************************************************************
+ * Function Name: iot_request_tracker_log_stats
+ ******************************************************************************
+ * Summary:
+ *  Prints the counters and round-trip latency of each operation type.
+ *
+ * Parameters:
+ *  tracker: Request table.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_request_tracker_log_stats(iot_request_tracker const* tracker)
+{
+    iot_request_op_stats const* stats;
+
+    for( uint8_t i = 0; i < tracker->op_count; i++ )
+    {
+        stats = &tracker->ops[i];
+        TEST_INFO(( "\r\n%-10s requests sent: %lu, retried: %lu, answered: %lu, lost: %lu\n",
+                tracker->op_names[i],
+                (unsigned long)stats->sent,
+                (unsigned long)stats->retries,
+                (unsigned long)stats->completed,
+                (unsigned long)stats->lost ));
+        iot_event_latency_log( tracker->op_names[i], &stats->rtt );
+    }
+
+    TEST_INFO(( "\r\nUnmatched responses: %lu, requests refused with a full table: %lu\n",
+            (unsigned long)tracker->unmatched, (unsigned long)tracker->table_full ));
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,175 @@
+/******************************************************************************
+ * File Name: mqtt_iot_request_tracker.h
+ *
+ * Description: This file contains the declarations of the pending request
+ * table, which matches responses to requests by request ID, retries lost
+ * requests and records the round-trip latency of each operation type.
+ *
+ ********************************************************************************
+ * Copyright 2024, Cypress Semiconductor Corporation (an Infineon company) or
+ * an affiliate of Cypress Semiconductor Corporation.  All rights reserved.
+ *
+ * This software, including source code, documentation and related
+ * materials ("Software") is owned by Cypress Semiconductor Corporation
+ * or one of its affiliates ("Cypress") and is protected by and subject to
+ * worldwide patent protection (United States and foreign),
+ * United States copyright laws and international treaty provisions.
+ * Therefore, you may use this Software only as provided in the license
+ * agreement accompanying the software package from which you
+ * obtained this Software ("EULA").
+ * If no EULA applies, Cypress hereby grants you a personal, non-exclusive,
+ * non-transferable license to copy, modify, and compile the Software
+ * source code solely for use in connection with Cypress's
+ * integrated circuit products.  Any reproduction, modification, translation,
+ * compilation, or representation of this Software except as specified
+ * above is prohibited without the express written permission of Cypress.
+ *
+ * Disclaimer: THIS SOFTWARE IS PROVIDED AS-IS, WITH NO WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING, BUT NOT LIMITED TO, NONINFRINGEMENT, IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. Cypress
+ * reserves the right to make changes to the Software without notice. Cypress
+ * does not assume any liability arising out of the application or use of the
+ * Software or any product or circuit described in the Software. Cypress does
+ * not authorize its products for use in any products where a malfunction or
+ * failure of the Cypress product may reasonably be expected to result in
+ * significant property damage, injury or death ("High Risk Product"). By
+ * including Cypress's product in a High Risk Product, the manufacturer
+ * of such system or application assumes all risk of such use and in doing
+ * so agrees to indemnify Cypress against all liability.
+ *******************************************************************************/
+
+#ifndef MQTT_IOT_REQUEST_TRACKER_H_
+#define MQTT_IOT_REQUEST_TRACKER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cyabs_rtos.h"
+#include "mqtt_iot_event_queue.h"
+
+/*******************************************************************************
+ * Macros
+ ********************************************************************************/
+/* Maximum number of requests waiting for a response */
+#define IOT_REQUEST_TRACKER_ENTRIES             (8)
+
+/* Maximum number of operation types */
+#define IOT_REQUEST_TRACKER_MAX_OPS             (4)
+
+/* Size of a request ID string, a 32-bit decimal counter and its terminator */
+#define IOT_REQUEST_ID_SIZE                     (11)
+
+/*******************************************************************************
+ * Global Variables
+ ********************************************************************************/
+/*
+ * @brief Publishes a request again after its response timed out.
+ * @param[in] context Context passed to iot_request_tracker_init().
+ * @param[in] op Operation type of the request.
+ * @param[in] request_id Request ID of the lost request, to be reused.
+ * @return CY_RSLT_SUCCESS if the request was published.
+ */
+typedef cy_rslt_t (*iot_request_tracker_resend)(void* context, uint8_t op, char const* request_id);
+
+/* Request waiting for its response */
+typedef struct
+{
+    bool        in_use;
+    uint8_t     op;
+    uint8_t     retries_left;
+    TickType_t  sent_tick;
+    TickType_t  timeout_ticks;
+    char        id[IOT_REQUEST_ID_SIZE];
+} iot_request_entry;
+
+/* Counters and round-trip latency of one operation type */
+typedef struct
+{
+    uint32_t                sent;
+    uint32_t                retries;
+    uint32_t                completed;
+    uint32_t                lost;
+    iot_event_latency_stats rtt;
+} iot_request_op_stats;
+
+typedef struct
+{
+    iot_request_entry           entries[IOT_REQUEST_TRACKER_ENTRIES];
+    iot_request_op_stats        ops[IOT_REQUEST_TRACKER_MAX_OPS];
+    char const* const*          op_names;
+    uint8_t                     op_count;
+    iot_request_tracker_resend  resend;
+    void*                       context;
+    uint32_t                    next_id;
+    uint32_t                    unmatched;      /* Responses to unknown or expired requests */
+    uint32_t                    table_full;
+} iot_request_tracker;
+
+/******************************************************************************
+ * Function Prototypes
+ *******************************************************************************/
+/*
+ * @brief Initializes an empty request table.
+ * @param[out] tracker Request table.
+ * @param[in] op_names Printable name of each operation type, must remain valid.
+ * @param[in] op_count Number of operation types, at most IOT_REQUEST_TRACKER_MAX_OPS.
+ * @param[in] resend Publishes a lost request again.
+ * @param[in] context Passed to \p resend.
+ * @return false if \p op_count is too large.
+ */
+bool iot_request_tracker_init(iot_request_tracker* tracker, char const* const* op_names, uint8_t op_count,
+        iot_request_tracker_resend resend, void* context);
+
+/*
+ * @brief Allocates a request ID and starts the response timer. Call it
+ * before the request is published, so that a fast response finds it.
+ * @param[in] tracker Request table.
+ * @param[in] op Operation type.
+ * @param[in] timeout_msec Time to wait for the response.
+ * @param[in] max_retries Number of times a lost request is published again
+ * before it is given up.
+ * @param[out] out_request_id Request ID, IOT_REQUEST_ID_SIZE bytes.
+ * @return false if the table is full.
+ */
+bool iot_request_tracker_begin(iot_request_tracker* tracker, uint8_t op, uint32_t timeout_msec,
+        uint8_t max_retries, char* out_request_id);
+
+/*
+ * @brief Removes a request that could not be published.
+ * @param[in] tracker Request table.
+ * @param[in] request_id Request ID returned by iot_request_tracker_begin().
+ */
+void iot_request_tracker_cancel(iot_request_tracker* tracker, char const* request_id);
+
+/*
+ * @brief Matches a response to its request, records the round-trip latency
+ * and removes the request. Can be called from the MQTT event callback.
+ * @param[in] tracker Request table.
+ * @param[in] request_id Request ID of the response, not terminated.
+ * @param[in] request_id_len Length of \p request_id.
+ * @param[out] out_op Operation type of the request, can be NULL.
+ * @return false if no request with this ID is pending.
+ */
+bool iot_request_tracker_complete(iot_request_tracker* tracker, char const* request_id, size_t request_id_len,
+        uint8_t* out_op);
+
+/*
+ * @brief Publishes requests whose response timed out again, or gives them up
+ * once their retries are used. Must be called from the task that owns the
+ * table.
+ * @param[in] tracker Request table.
+ * @return Ticks until the next response timeout, portMAX_DELAY if no
+ * request is pending.
+ */
+TickType_t iot_request_tracker_poll(iot_request_tracker* tracker);
+
+/*
+ * @brief Prints the counters and round-trip latency of each operation type.
+ * @param[in] tracker Request table.
+ */
+void iot_request_tracker_log_stats(iot_request_tracker const* tracker);
+
+#endif /* MQTT_IOT_REQUEST_TRACKER_H_ */
+
+/* [] END OF FILE */
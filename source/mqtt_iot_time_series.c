@@ -0,0 +1,391 @@
+/******************************************************************************
+ * File Name: mqtt_iot_time_series.c
+ *
+ * Description: This file contains the time-series store that keeps
+ * timestamped samples in a fixed-size ring of delta-encoded records with a
+ * sparse time index.
+ *
+ ********************************************************************************
+ * Copyright 2024, Cypress Semiconductor Corporation (an Infineon company) or
+ * an affiliate of Cypress Semiconductor Corporation.  All rights reserved.
+ *
+ * This software, including source code, documentation and related
+ * materials ("Software") is owned by Cypress Semiconductor Corporation
+ * or one of its affiliates ("Cypress") and is protected by and subject to
+ * worldwide patent protection (United States and foreign),
+ * United States copyright laws and international treaty provisions.
+ * Therefore, you may use this Software only as provided in the license
+ * agreement accompanying the software package from which you
+ * obtained this Software ("EULA").
+ * If no EULA applies, Cypress hereby grants you a personal, non-exclusive,
+ * non-transferable license to copy, modify, and compile the Software
+ * source code solely for use in connection with Cypress's
+ * integrated circuit products.  Any reproduction, modification, translation,
+ * compilation, or representation of this Software except as specified
+ * above is prohibited without the express written permission of Cypress.
+ *
+ * Disclaimer: THIS SOFTWARE IS PROVIDED AS-IS, WITH NO WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING, BUT NOT LIMITED TO, NONINFRINGEMENT, IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. Cypress
+ * reserves the right to make changes to the Software without notice. Cypress
+ * does not assume any liability arising out of the application or use of the
+ * Software or any product or circuit described in the Software. Cypress does
+ * not authorize its products for use in any products where a malfunction or
+ * failure of the Cypress product may reasonably be expected to result in
+ * significant property damage, injury or death ("High Risk Product"). By
+ * including Cypress's product in a High Risk Product, the manufacturer
+ * of such system or application assumes all risk of such use and in doing
+ * so agrees to indemnify Cypress against all liability.
+ *******************************************************************************/
+
+#include <string.h>
+
+#include "mqtt_iot_time_series.h"
+
+/*******************************************************************************
+ * Global Variables
+ ********************************************************************************/
+/* State of a downsampled range while its samples are scanned */
+typedef struct
+{
+    time_t                      from;
+    uint32_t                    step_sec;
+    iot_time_series_bucket      bucket;
+    iot_time_series_bucket_cb   callback;
+    void*                       context;
+    uint32_t                    emitted;
+    bool                        stopped;
+} downsample_state;
+
+/******************************************************************************
+ * Function Name: iot_time_series_init
+ ******************************************************************************
+ * Summary:
+ *  Empties the store.
+ *
+ * Parameters:
+ *  series: Time series.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_time_series_init(iot_time_series* series)
+{
+    memset( series, 0x00, sizeof(*series) );
+}
+
+/******************************************************************************
+ * Function Name: drop_oldest_block
+ ******************************************************************************
+ * Summary:
+ *  Removes the oldest block and its records.
+ *
+ * Parameters:
+ *  series: Time series.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+static void drop_oldest_block(iot_time_series* series)
+{
+    iot_time_series_block const* block = &series->blocks[series->oldest_block];
+
+    series->oldest_record = (uint16_t)( ( series->oldest_record + block->count ) % IOT_TIME_SERIES_RECORDS );
+    series->records_used = (uint16_t)( series->records_used - block->count );
+    series->oldest_block = (uint16_t)( ( series->oldest_block + 1 ) % IOT_TIME_SERIES_BLOCKS );
+    series->blocks_used--;
+}
+
+/******************************************************************************
+ * Function Name: block_at
+ ******************************************************************************
+ * Summary:
+ *  Gets a block by its position from the oldest one.
+ *
+ * Parameters:
+ *  series: Time series.
+ *
+ *  position: 0 for the oldest block.
+ *
+ * Return:
+ *  iot_time_series_block const*: Block.
+ *
+ ******************************************************************************/
+static iot_time_series_block const* block_at(iot_time_series const* series, uint16_t position)
+{
+    return &series->blocks[( series->oldest_block + position ) % IOT_TIME_SERIES_BLOCKS];
+}
+
+/******************************************************************************
+ * Function Name: iot_time_series_append
+ ******************************************************************************
+ * Summary:
+ *  Appends a sample as a delta record of the newest block, or else as the
+ *  index entry of a new block. The oldest block is dropped when the records
+ *  or the index entries are all in use.
+ *
+ * Parameters:
+ *  series: Time series.
+ *
+ *  when: Time of the sample.
+ *
+ *  value: Sample.
+ *
+ * Return:
+ *  bool: false if the sample is older than the newest sample.
+ *
+ ******************************************************************************/
+bool iot_time_series_append(iot_time_series* series, time_t when, int32_t value)
+{
+    iot_time_series_block* block = NULL;
+    iot_time_series_record* record;
+    int64_t delta_value = (int64_t)value - (int64_t)series->last_value;
+    time_t delta_time = when - series->last_time;
+
+    if( series->blocks_used > 0 )
+    {
+        if( delta_time < 0 )
+        {
+            return false;
+        }
+        block = &series->blocks[( series->oldest_block + series->blocks_used - 1 ) % IOT_TIME_SERIES_BLOCKS];
+    }
+
+    if( ( block == NULL ) || ( block->count >= IOT_TIME_SERIES_BLOCK_RECORDS ) ||
+        ( delta_time > UINT16_MAX ) || ( delta_value < INT16_MIN ) || ( delta_value > INT16_MAX ) )
+    {
+        if( series->blocks_used == IOT_TIME_SERIES_BLOCKS )
+        {
+            drop_oldest_block( series );
+        }
+        block = &series->blocks[( series->oldest_block + series->blocks_used ) % IOT_TIME_SERIES_BLOCKS];
+        block->time = when;
+        block->value = value;
+        block->first = (uint16_t)( ( series->oldest_record + series->records_used ) % IOT_TIME_SERIES_RECORDS );
+        block->count = 0;
+        series->blocks_used++;
+    }
+    else
+    {
+        /* The newest block is never the oldest one here, as a block is
+         * shorter than the ring.
+         */
+        if( series->records_used == IOT_TIME_SERIES_RECORDS )
+        {
+            drop_oldest_block( series );
+        }
+        record = &series->records[( series->oldest_record + series->records_used ) % IOT_TIME_SERIES_RECORDS];
+        record->delta_time = (uint16_t)delta_time;
+        record->delta_value = (int16_t)delta_value;
+        series->records_used++;
+        block->count++;
+    }
+
+    series->last_time = when;
+    series->last_value = value;
+    return true;
+}
+
+/******************************************************************************
+ * Function Name: iot_time_series_count
+ ******************************************************************************
+ * Summary:
+ *  Counts the samples in the store, one for each index entry and record.
+ *
+ * Parameters:
+ *  series: Time series.
+ *
+ * Return:
+ *  uint32_t: Number of samples.
+ *
+ ******************************************************************************/
+uint32_t iot_time_series_count(iot_time_series const* series)
+{
+    return (uint32_t)series->blocks_used + (uint32_t)series->records_used;
+}
+
+/******************************************************************************
+ * Function Name: iot_time_series_scan
+ ******************************************************************************
+ * Summary:
+ *  Finds the newest block that starts at or before the start of the range
+ *  with a binary search of the index, then decodes the samples from there
+ *  until the end of the range.
+ *
+ * Parameters:
+ *  series: Time series.
+ *
+ *  from: Start of the range.
+ *
+ *  to: End of the range, excluded.
+ *
+ *  callback: Receives each sample.
+ *
+ *  context: Passed to the callback.
+ *
+ * Return:
+ *  uint32_t: Number of samples passed to the callback.
+ *
+ ******************************************************************************/
+uint32_t iot_time_series_scan(iot_time_series const* series, time_t from, time_t to,
+        iot_time_series_sample_cb callback, void* context)
+{
+    iot_time_series_block const* block;
+    iot_time_series_record const* record;
+    uint16_t low = 0;
+    uint16_t high = series->blocks_used;
+    uint16_t middle;
+    uint32_t visited = 0;
+    time_t time;
+    int32_t value;
+
+    /* First block that starts after the start of the range */
+    while( low < high )
+    {
+        middle = (uint16_t)( ( low + high ) / 2 );
+        if( block_at( series, middle )->time <= from )
+        {
+            low = (uint16_t)( middle + 1 );
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    for( uint16_t b = ( low > 0 ) ? (uint16_t)( low - 1 ) : 0; b < series->blocks_used; b++ )
+    {
+        block = block_at( series, b );
+        time = block->time;
+        value = block->value;
+
+        for( uint16_t r = 0; r <= block->count; r++ )
+        {
+            if( r > 0 )
+            {
+                record = &series->records[( block->first + r - 1 ) % IOT_TIME_SERIES_RECORDS];
+                time += record->delta_time;
+                value += record->delta_value;
+            }
+            if( time >= to )
+            {
+                return visited;
+            }
+            if( time >= from )
+            {
+                visited++;
+                if( !callback( context, time, value ) )
+                {
+                    return visited;
+                }
+            }
+        }
+    }
+
+    return visited;
+}
+
+/******************************************************************************
+ * Function Name: downsample_sample_cb
+ ******************************************************************************
+ * Summary:
+ *  Adds a sample of a downsampled range to its bucket, and passes the
+ *  previous bucket to the callback when the sample is in a later step.
+ *
+ * Parameters:
+ *  context: State of the downsampled range.
+ *
+ *  time: Time of the sample.
+ *
+ *  value: Sample.
+ *
+ * Return:
+ *  bool: false if the callback stopped the query.
+ *
+ ******************************************************************************/
+static bool downsample_sample_cb(void* context, time_t time, int32_t value)
+{
+    downsample_state* state = (downsample_state*)context;
+    iot_time_series_bucket* bucket = &state->bucket;
+    time_t start = state->from + ( ( time - state->from ) / (time_t)state->step_sec ) * (time_t)state->step_sec;
+
+    if( ( bucket->count > 0 ) && ( bucket->start != start ) )
+    {
+        state->emitted++;
+        if( !state->callback( state->context, bucket ) )
+        {
+            state->stopped = true;
+            return false;
+        }
+        bucket->count = 0;
+    }
+
+    if( bucket->count == 0 )
+    {
+        bucket->start = start;
+        bucket->min = value;
+        bucket->max = value;
+        bucket->sum = 0;
+    }
+    else if( value < bucket->min )
+    {
+        bucket->min = value;
+    }
+    else if( value > bucket->max )
+    {
+        bucket->max = value;
+    }
+    bucket->count++;
+    bucket->sum += value;
+
+    return true;
+}
+
+/******************************************************************************
+ * Function Name: iot_time_series_downsample
+ ******************************************************************************
+ * Summary:
+ *  Scans a range and combines its samples into one bucket per step.
+ *
+ * Parameters:
+ *  series: Time series.
+ *
+ *  from: Start of the range and of the first step.
+ *
+ *  to: End of the range, excluded.
+ *
+ *  step_sec: Duration of a step.
+ *
+ *  callback: Receives each bucket.
+ *
+ *  context: Passed to the callback.
+ *
+ * Return:
+ *  uint32_t: Number of buckets passed to the callback.
+ *
+ ******************************************************************************/
+uint32_t iot_time_series_downsample(iot_time_series const* series, time_t from, time_t to,
+        uint32_t step_sec, iot_time_series_bucket_cb callback, void* context)
+{
+    downsample_state state;
+
+    memset( &state, 0x00, sizeof(state) );
+    state.from = from;
+    state.step_sec = ( step_sec > 0 ) ? step_sec : 1;
+    state.callback = callback;
+    state.context = context;
+
+    (void)iot_time_series_scan( series, from, to, downsample_sample_cb, &state );
+
+    if( !state.stopped && ( state.bucket.count > 0 ) )
+    {
+        state.emitted++;
+        (void)callback( context, &state.bucket );
+    }
+
+    return state.emitted;
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,175 @@
+/******************************************************************************
+ * File Name: mqtt_iot_time_series.h
+ *
+ * Description: This file contains the declarations of the time-series
+ * store that keeps timestamped samples in a fixed-size ring of delta-encoded
+ * records with a sparse time index.
+ *
+ ********************************************************************************
+ * Copyright 2024, Cypress Semiconductor Corporation (an Infineon company) or
+ * an affiliate of Cypress Semiconductor Corporation.  All rights reserved.
+ *
+ * This software, including source code, documentation and related
+ * materials ("Software") is owned by Cypress Semiconductor Corporation
+ * or one of its affiliates ("Cypress") and is protected by and subject to
+ * worldwide patent protection (United States and foreign),
+ * United States copyright laws and international treaty provisions.
+ * Therefore, you may use this Software only as provided in the license
+ * agreement accompanying the software package from which you
+ * obtained this Software ("EULA").
+ * If no EULA applies, Cypress hereby grants you a personal, non-exclusive,
+ * non-transferable license to copy, modify, and compile the Software
+ * source code solely for use in connection with Cypress's
+ * integrated circuit products.  Any reproduction, modification, translation,
+ * compilation, or representation of this Software except as specified
+ * above is prohibited without the express written permission of Cypress.
+ *
+ * Disclaimer: THIS SOFTWARE IS PROVIDED AS-IS, WITH NO WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING, BUT NOT LIMITED TO, NONINFRINGEMENT, IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. Cypress
+ * reserves the right to make changes to the Software without notice. Cypress
+ * does not assume any liability arising out of the application or use of the
+ * Software or any product or circuit described in the Software. Cypress does
+ * not authorize its products for use in any products where a malfunction or
+ * failure of the Cypress product may reasonably be expected to result in
+ * significant property damage, injury or death ("High Risk Product"). By
+ * including Cypress's product in a High Risk Product, the manufacturer
+ * of such system or application assumes all risk of such use and in doing
+ * so agrees to indemnify Cypress against all liability.
+ *******************************************************************************/
+
+#ifndef MQTT_IOT_TIME_SERIES_H_
+#define MQTT_IOT_TIME_SERIES_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/*******************************************************************************
+ * Macros
+ ********************************************************************************/
+/* Delta records kept, 4 bytes each. With the samples of the index entries,
+ * the store holds at least an hour of samples taken every 5 seconds. The
+ * oldest block is dropped to make room.
+ */
+#define IOT_TIME_SERIES_RECORDS                 (720)
+
+/* Index entries kept, one for each block of samples */
+#define IOT_TIME_SERIES_BLOCKS                  (64)
+
+/* Delta records of a block at most, a scan decodes at most this many
+ * samples before the start of its range.
+ */
+#define IOT_TIME_SERIES_BLOCK_RECORDS           (16)
+
+#if ( IOT_TIME_SERIES_BLOCK_RECORDS >= IOT_TIME_SERIES_RECORDS )
+#error "A block must be shorter than the record ring."
+#endif
+
+/*******************************************************************************
+ * Global Variables
+ ********************************************************************************/
+/* Sample stored as the difference from the previous sample of its block */
+typedef struct
+{
+    uint16_t    delta_time;     /* Seconds */
+    int16_t     delta_value;
+} iot_time_series_record;
+
+/* Index entry: first sample of a block and the delta records that follow it */
+typedef struct
+{
+    time_t      time;
+    int32_t     value;
+    uint16_t    first;          /* Index of the first record of the block */
+    uint16_t    count;          /* Number of records of the block */
+} iot_time_series_block;
+
+typedef struct
+{
+    iot_time_series_record  records[IOT_TIME_SERIES_RECORDS];
+    iot_time_series_block   blocks[IOT_TIME_SERIES_BLOCKS];
+    uint16_t                oldest_record;
+    uint16_t                records_used;
+    uint16_t                oldest_block;
+    uint16_t                blocks_used;
+    time_t                  last_time;      /* Newest sample */
+    int32_t                 last_value;
+} iot_time_series;
+
+/* Samples of a downsampled range taken in [start, start + step) */
+typedef struct
+{
+    time_t      start;
+    uint32_t    count;
+    int32_t     min;
+    int32_t     max;
+    int64_t     sum;
+} iot_time_series_bucket;
+
+/* Receives the samples of a range scan in time order, returns false to stop */
+typedef bool (*iot_time_series_sample_cb)(void* context, time_t time, int32_t value);
+
+/* Receives the buckets of a downsampled range in time order, returns false to
+ * stop
+ */
+typedef bool (*iot_time_series_bucket_cb)(void* context, iot_time_series_bucket const* bucket);
+
+/*******************************************************************************
+ * Function Prototypes
+ ********************************************************************************/
+/*
+ * @brief Empties the store.
+ * @param[out] series Time series.
+ */
+void iot_time_series_init(iot_time_series* series);
+
+/*
+ * @brief Appends a sample. A sample whose time or value is too far from the
+ * previous one, or that would make the block longer than
+ * IOT_TIME_SERIES_BLOCK_RECORDS, starts a new block.
+ * @param[in,out] series Time series.
+ * @param[in] when Time of the sample, not before the newest sample.
+ * @param[in] value Sample.
+ * @return false if the sample is older than the newest sample.
+ */
+bool iot_time_series_append(iot_time_series* series, time_t when, int32_t value);
+
+/*
+ * @brief Counts the samples in the store.
+ * @param[in] series Time series.
+ * @return Number of samples.
+ */
+uint32_t iot_time_series_count(iot_time_series const* series);
+
+/*
+ * @brief Passes the samples taken in [from, to) to a callback in time order.
+ * The start is found with a binary search of the index.
+ * @param[in] series Time series.
+ * @param[in] from Start of the range.
+ * @param[in] to End of the range, excluded.
+ * @param[in] callback Receives each sample.
+ * @param[in] context Passed to \p callback.
+ * @return Number of samples passed to \p callback.
+ */
+uint32_t iot_time_series_scan(iot_time_series const* series, time_t from, time_t to,
+        iot_time_series_sample_cb callback, void* context);
+
+/*
+ * @brief Passes the count, minimum, maximum and sum of the samples of each
+ * step of [from, to) to a callback in time order. Steps without samples are
+ * skipped.
+ * @param[in] series Time series.
+ * @param[in] from Start of the range and of the first step.
+ * @param[in] to End of the range, excluded.
+ * @param[in] step_sec Duration of a step, at least 1.
+ * @param[in] callback Receives each bucket.
+ * @param[in] context Passed to \p callback.
+ * @return Number of buckets passed to \p callback.
+ */
+uint32_t iot_time_series_downsample(iot_time_series const* series, time_t from, time_t to,
+        uint32_t step_sec, iot_time_series_bucket_cb callback, void* context);
+
+#endif /* MQTT_IOT_TIME_SERIES_H_ */
+
+/* [] END OF FILE */
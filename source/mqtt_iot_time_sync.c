@@ -0,0 +1,327 @@
+/******************************************************************************
+ * File Name: mqtt_iot_time_sync.c
+ *
+ * Description: This file contains the clock synchronization. The uptime is
+ * extended from the tick count and its overflow count, and one SNTP request
+ * (RFC 4330) over an lwIP UDP connection gives the offset of UTC to it.
+ *
+ ********************************************************************************
+ * Copyright 2024, Cypress Semiconductor Corporation (an Infineon company) or
+ * an affiliate of Cypress Semiconductor Corporation.  All rights reserved.
+ *
+ * This software, including source code, documentation and related
+ * materials ("Software") is owned by Cypress Semiconductor Corporation
+ * or one of its affiliates ("Cypress") and is protected by and subject to
+ * worldwide patent protection (United States and foreign),
+ * United States copyright laws and international treaty provisions.
+ * Therefore, you may use this Software only as provided in the license
+ * agreement accompanying the software package from which you
+ * obtained this Software ("EULA").
+ * If no EULA applies, Cypress hereby grants you a personal, non-exclusive,
+ * non-transferable license to copy, modify, and compile the Software
+ * source code solely for use in connection with Cypress's
+ * integrated circuit products.  Any reproduction, modification, translation,
+ * compilation, or representation of this Software except as specified
+ * above is prohibited without the express written permission of Cypress.
+ *
+ * Disclaimer: THIS SOFTWARE IS PROVIDED AS-IS, WITH NO WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING, BUT NOT LIMITED TO, NONINFRINGEMENT, IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. Cypress
+ * reserves the right to make changes to the Software without notice. Cypress
+ * does not assume any liability arising out of the application or use of the
+ * Software or any product or circuit described in the Software. Cypress does
+ * not authorize its products for use in any products where a malfunction or
+ * failure of the Cypress product may reasonably be expected to result in
+ * significant property damage, injury or death ("High Risk Product"). By
+ * including Cypress's product in a High Risk Product, the manufacturer
+ * of such system or application assumes all risk of such use and in doing
+ * so agrees to indemnify Cypress against all liability.
+ *******************************************************************************/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <FreeRTOS.h>
+#include <task.h>
+#include <lwip/api.h>
+
+#include "mqtt_iot_common.h"
+#include "mqtt_iot_time_sync.h"
+
+/*******************************************************************************
+ * Macros
+ ********************************************************************************/
+#define NTP_PORT                                (123)
+#define NTP_PACKET_SIZE                         (48)
+
+/* First byte of a request: no leap warning, version 4, client mode */
+#define NTP_VERSION                             (4)
+#define NTP_MODE_CLIENT                         (3)
+#define NTP_MODE_SERVER                         (4)
+#define NTP_MODE_MASK                           (0x07)
+
+/* Byte offsets in the packet. The server copies the transmit timestamp of
+ * the request into the originate timestamp of its answer.
+ */
+#define NTP_STRATUM_OFFSET                      (1)
+#define NTP_ORIGINATE_FRACTION_OFFSET           (28)
+#define NTP_TRANSMIT_SECONDS_OFFSET             (40)
+#define NTP_TRANSMIT_FRACTION_OFFSET            (44)
+
+/* Stratum 0 is a kiss-of-death answer, 16 an unsynchronized server */
+#define NTP_STRATUM_MAX                         (15)
+
+/* Seconds from 1900, the NTP epoch, to 1970 */
+#define NTP_UNIX_EPOCH_OFFSET                   (2208988800UL)
+
+/*******************************************************************************
+ * Global Variables
+ ********************************************************************************/
+/* UTC minus uptime, valid once time_synced is set */
+static time_t           time_offset = 0;
+static volatile bool    time_synced = false;
+
+/******************************************************************************
+ * Function Name: read_be32
+ ******************************************************************************
+ * Summary:
+ *  Reads a big-endian 32-bit field of a packet.
+ *
+ * Parameters:
+ *  data: First byte of the field.
+ *
+ * Return:
+ *  uint32_t: Value of the field.
+ *
+ ******************************************************************************/
+static uint32_t read_be32(uint8_t const* data)
+{
+    return ( (uint32_t)data[0] << 24 ) | ( (uint32_t)data[1] << 16 ) | ( (uint32_t)data[2] << 8 ) | data[3];
+}
+
+/******************************************************************************
+ * Function Name: write_be32
+ ******************************************************************************
+ * Summary:
+ *  Writes a big-endian 32-bit field of a packet.
+ *
+ * Parameters:
+ *  data: First byte of the field.
+ *
+ *  value: Value of the field.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+static void write_be32(uint8_t* data, uint32_t value)
+{
+    data[0] = (uint8_t)( value >> 24 );
+    data[1] = (uint8_t)( value >> 16 );
+    data[2] = (uint8_t)( value >> 8 );
+    data[3] = (uint8_t)value;
+}
+
+/******************************************************************************
+ * Function Name: query_server
+ ******************************************************************************
+ * Summary:
+ *  Sends one SNTP request and waits for its answer. Answers whose
+ *  originate timestamp does not match the request, e.g. late answers to an
+ *  earlier attempt, are skipped. The request carries no time of the kit, so
+ *  a random value in the transmit fraction identifies it. The offset has
+ *  the resolution of a second, so the round trip is not compensated.
+ *
+ * Parameters:
+ *  conn: UDP connection with a receive timeout.
+ *
+ *  addr: Address of the server.
+ *
+ * Return:
+ *  bool: true if a valid answer arrived in time.
+ *
+ ******************************************************************************/
+static bool query_server(struct netconn* conn, ip_addr_t const* addr)
+{
+    uint8_t packet[NTP_PACKET_SIZE];
+    uint32_t nonce = (uint32_t)rand();
+    struct netbuf* buf;
+    void* data;
+    err_t err;
+    u16_t len;
+    time_t utc;
+
+    memset( packet, 0x00, sizeof(packet) );
+    packet[0] = (uint8_t)( ( NTP_VERSION << 3 ) | NTP_MODE_CLIENT );
+    write_be32( &packet[NTP_TRANSMIT_FRACTION_OFFSET], nonce );
+
+    buf = netbuf_new();
+    if( buf == NULL )
+    {
+        return false;
+    }
+    data = netbuf_alloc( buf, sizeof(packet) );
+    err = ( data != NULL ) ? ERR_OK : -1;
+    if( err == ERR_OK )
+    {
+        memcpy( data, packet, sizeof(packet) );
+        err = netconn_sendto( conn, buf, addr, NTP_PORT );
+    }
+    netbuf_delete( buf );
+    if( err != ERR_OK )
+    {
+        IOT_SAMPLE_LOG_ERROR( "Failed to send the SNTP request: %d.", (int)err );
+        return false;
+    }
+
+    while( netconn_recv( conn, &buf ) == ERR_OK )
+    {
+        len = netbuf_copy( buf, packet, sizeof(packet) );
+        netbuf_delete( buf );
+
+        if( ( len != NTP_PACKET_SIZE ) || ( ( packet[0] & NTP_MODE_MASK ) != NTP_MODE_SERVER ) ||
+            ( packet[NTP_STRATUM_OFFSET] == 0 ) || ( packet[NTP_STRATUM_OFFSET] > NTP_STRATUM_MAX ) ||
+            ( read_be32( &packet[NTP_ORIGINATE_FRACTION_OFFSET] ) != nonce ) )
+        {
+            continue;
+        }
+
+        /* The unsigned difference stays right after the NTP era rolls over
+         * in 2036.
+         */
+        utc = (time_t)(uint32_t)( read_be32( &packet[NTP_TRANSMIT_SECONDS_OFFSET] ) - NTP_UNIX_EPOCH_OFFSET );
+        time_offset = utc - iot_time_sync_uptime();
+        time_synced = true;
+        return true;
+    }
+
+    return false;
+}
+
+/******************************************************************************
+ * Function Name: iot_time_sync_uptime
+ ******************************************************************************
+ * Summary:
+ *  Returns the seconds since boot. The timeout state of the scheduler holds
+ *  the tick count together with the number of times it wrapped.
+ *
+ * Parameters:
+ *  void
+ *
+ * Return:
+ *  time_t: Uptime in seconds.
+ *
+ ******************************************************************************/
+time_t iot_time_sync_uptime(void)
+{
+    TimeOut_t now;
+    uint64_t ticks;
+
+    vTaskSetTimeOutState( &now );
+    ticks = (uint64_t)now.xOverflowCount * ( (uint64_t)portMAX_DELAY + 1 ) + now.xTimeOnEntering;
+    return (time_t)( ticks / configTICK_RATE_HZ );
+}
+
+/******************************************************************************
+ * Function Name: iot_time_sync_query
+ ******************************************************************************
+ * Summary:
+ *  Resolves the SNTP server and requests the time until it answers.
+ *
+ * Parameters:
+ *  server: Host name or address of the SNTP server.
+ *
+ * Return:
+ *  bool: true if the server answered.
+ *
+ ******************************************************************************/
+bool iot_time_sync_query(char const* server)
+{
+    struct netconn* conn;
+    ip_addr_t addr;
+    err_t err;
+    bool answered = false;
+
+    err = netconn_gethostbyname( server, &addr );
+    if( err != ERR_OK )
+    {
+        IOT_SAMPLE_LOG_ERROR( "Failed to resolve the SNTP server %s: %d.", server, (int)err );
+        return false;
+    }
+
+    conn = netconn_new( NETCONN_UDP );
+    if( conn == NULL )
+    {
+        IOT_SAMPLE_LOG_ERROR( "Failed to create the SNTP connection." );
+        return false;
+    }
+    netconn_set_recvtimeout( conn, IOT_TIME_SYNC_TIMEOUT_MSEC );
+
+    for( uint8_t i = 0; ( i < IOT_TIME_SYNC_ATTEMPTS ) && !answered; i++ )
+    {
+        answered = query_server( conn, &addr );
+    }
+    (void)netconn_delete( conn );
+
+    if( answered )
+    {
+        IOT_SAMPLE_LOG( "Clock synchronized with %s, UTC is uptime + %ld s.", server, (long)time_offset );
+    }
+    return answered;
+}
+
+/******************************************************************************
+ * Function Name: iot_time_sync_to_uptime
+ ******************************************************************************
+ * Summary:
+ *  Converts a UTC time to uptime seconds.
+ *
+ * Parameters:
+ *  utc: Seconds since the epoch.
+ *
+ *  out_uptime: Uptime at the UTC time.
+ *
+ * Return:
+ *  bool: false if the clock was never synchronized.
+ *
+ ******************************************************************************/
+bool iot_time_sync_to_uptime(time_t utc, time_t* out_uptime)
+{
+    if( !time_synced )
+    {
+        return false;
+    }
+
+    *out_uptime = utc - time_offset;
+    return true;
+}
+
+/******************************************************************************
+ * Function Name: iot_time_sync_to_utc
+ ******************************************************************************
+ * Summary:
+ *  Converts uptime seconds to UTC.
+ *
+ * Parameters:
+ *  uptime: Uptime.
+ *
+ *  out_utc: Seconds since the epoch at the uptime.
+ *
+ * Return:
+ *  bool: false if the clock was never synchronized.
+ *
+ ******************************************************************************/
+bool iot_time_sync_to_utc(time_t uptime, time_t* out_utc)
+{
+    if( !time_synced )
+    {
+        return false;
+    }
+
+    *out_utc = uptime + time_offset;
+    return true;
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,93 @@
+/******************************************************************************
+ * File Name: mqtt_iot_time_sync.h
+ *
+ * Description: This file contains the declarations of the clock
+ * synchronization, which keeps times as seconds of uptime and converts them
+ * to and from UTC with the offset learned from an SNTP server.
+ *
+ ********************************************************************************
+ * Copyright 2024, Cypress Semiconductor Corporation (an Infineon company) or
+ * an affiliate of Cypress Semiconductor Corporation.  All rights reserved.
+ *
+ * This software, including source code, documentation and related
+ * materials ("Software") is owned by Cypress Semiconductor Corporation
+ * or one of its affiliates ("Cypress") and is protected by and subject to
+ * worldwide patent protection (United States and foreign),
+ * United States copyright laws and international treaty provisions.
+ * Therefore, you may use this Software only as provided in the license
+ * agreement accompanying the software package from which you
+ * obtained this Software ("EULA").
+ * If no EULA applies, Cypress hereby grants you a personal, non-exclusive,
+ * non-transferable license to copy, modify, and compile the Software
+ * source code solely for use in connection with Cypress's
+ * integrated circuit products.  Any reproduction, modification, translation,
+ * compilation, or representation of this Software except as specified
+ * above is prohibited without the express written permission of Cypress.
+ *
+ * Disclaimer: THIS SOFTWARE IS PROVIDED AS-IS, WITH NO WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING, BUT NOT LIMITED TO, NONINFRINGEMENT, IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. Cypress
+ * reserves the right to make changes to the Software without notice. Cypress
+ * does not assume any liability arising out of the application or use of the
+ * Software or any product or circuit described in the Software. Cypress does
+ * not authorize its products for use in any products where a malfunction or
+ * failure of the Cypress product may reasonably be expected to result in
+ * significant property damage, injury or death ("High Risk Product"). By
+ * including Cypress's product in a High Risk Product, the manufacturer
+ * of such system or application assumes all risk of such use and in doing
+ * so agrees to indemnify Cypress against all liability.
+ *******************************************************************************/
+
+#ifndef MQTT_IOT_TIME_SYNC_H_
+#define MQTT_IOT_TIME_SYNC_H_
+
+#include <stdbool.h>
+#include <time.h>
+
+/*******************************************************************************
+ * Macros
+ ********************************************************************************/
+/* Time to wait for the answer of the SNTP server, and number of requests */
+#define IOT_TIME_SYNC_TIMEOUT_MSEC              (3 * 1000)
+#define IOT_TIME_SYNC_ATTEMPTS                  (3)
+
+/******************************************************************************
+ * Function Prototypes
+ *******************************************************************************/
+/*
+ * @brief Seconds since boot, from the tick count. Unlike time(), which
+ * reads the RTC of the kit, it starts at 0 and never steps, and unlike the
+ * tick count it does not wrap.
+ * @return Uptime in seconds.
+ */
+time_t iot_time_sync_uptime(void);
+
+/*
+ * @brief Requests the time from an SNTP server and records the offset of
+ * UTC to the uptime. Blocks for at most IOT_TIME_SYNC_ATTEMPTS times
+ * IOT_TIME_SYNC_TIMEOUT_MSEC. A failed query keeps the last offset.
+ * @param[in] server Host name or address of the SNTP server.
+ * @return true if the server answered.
+ */
+bool iot_time_sync_query(char const* server);
+
+/*
+ * @brief Converts a UTC time to uptime seconds, which are negative before
+ * boot.
+ * @param[in] utc Seconds since the epoch.
+ * @param[out] out_uptime Uptime at \p utc.
+ * @return false if the clock was never synchronized.
+ */
+bool iot_time_sync_to_uptime(time_t utc, time_t* out_uptime);
+
+/*
+ * @brief Converts uptime seconds to UTC.
+ * @param[in] uptime Uptime.
+ * @param[out] out_utc Seconds since the epoch at \p uptime.
+ * @return false if the clock was never synchronized.
+ */
+bool iot_time_sync_to_utc(time_t uptime, time_t* out_utc);
+
+#endif /* MQTT_IOT_TIME_SYNC_H_ */
+
+/* [] END OF FILE */
@@ -0,0 +1,684 @@
+/******************************************************************************
+ * File Name: mqtt_iot_twin_store.c
+ *
+ * Description: This file contains the local device twin state store. Twin
+ * documents and desired property patches are parsed with az_json_reader
+ * into typed fields, and the $version of every patch is checked against the
+ * stored version to detect missed updates.
+ *
+ ********************************************************************************
+ * Copyright 2024, Cypress Semiconductor Corporation (an Infineon company) or
+ * an affiliate of Cypress Semiconductor Corporation.  All rights reserved.
+ *
+ * This software, including source code, documentation and related
+ * materials ("Software") is owned by Cypress Semiconductor Corporation
+ * or one of its affiliates ("Cypress") and is protected by and subject to
+ * worldwide patent protection (United States and foreign),
+ * United States copyright laws and international treaty provisions.
+ * Therefore, you may use this Software only as provided in the license
+ * agreement accompanying the software package from which you
+ * obtained this Software ("EULA").
+ * If no EULA applies, Cypress hereby grants you a personal, non-exclusive,
+ * non-transferable license to copy, modify, and compile the Software
+ * source code solely for use in connection with Cypress's
+ * integrated circuit products.  Any reproduction, modification, translation,
+ * compilation, or representation of this Software except as specified
+ * above is prohibited without the express written permission of Cypress.
+ *
+ * Disclaimer: THIS SOFTWARE IS PROVIDED AS-IS, WITH NO WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING, BUT NOT LIMITED TO, NONINFRINGEMENT, IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. Cypress
+ * reserves the right to make changes to the Software without notice. Cypress
+ * does not assume any liability arising out of the application or use of the
+ * Software or any product or circuit described in the Software. Cypress does
+ * not authorize its products for use in any products where a malfunction or
+ * failure of the Cypress product may reasonably be expected to result in
+ * significant property damage, injury or death ("High Risk Product"). By
+ * including Cypress's product in a High Risk Product, the manufacturer
+ * of such system or application assumes all risk of such use and in doing
+ * so agrees to indemnify Cypress against all liability.
+ *******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "azure_common.h"
+#include <az_core.h>
+#include "mqtt_iot_json_walk.h"
+#include "mqtt_iot_twin_store.h"
+
+/*******************************************************************************
+ * Macros
+ ********************************************************************************/
+#define TWIN_DESIRED_NAME                   "desired"
+#define TWIN_REPORTED_NAME                  "reported"
+#define TWIN_VERSION_NAME                   "$version"
+
+/*******************************************************************************
+ * Global Variables
+ ********************************************************************************/
+/* Parsing state. Values are applied to copies of the sections, which are
+ * committed only if the whole payload parsed.
+ */
+typedef struct
+{
+    iot_twin_store const*   store;
+    bool                    is_document;
+    iot_twin_section        desired;
+    iot_twin_section        reported;
+    iot_twin_section*       section;        /* Section receiving the values, NULL outside */
+    bool                    version_found;
+    int32_t                 patch_version;
+    iot_json_path_query     nested;         /* Nested properties of the section */
+} twin_parse_context;
+
+/******************************************************************************
+ * Function Name: apply_value
+ ******************************************************************************
+ * Summary:
+ *  Stores the value token of a field in a section. A null value removes the
+ *  field, a value of another type or out of range is ignored.
+ *
+ * Parameters:
+ *  store: Twin store.
+ *
+ *  section: Section to update.
+ *
+ *  field: Index of the field.
+ *
+ *  token: Value token.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+static void apply_value(iot_twin_store const* store, iot_twin_section* section, uint8_t field,
+        iot_json_walk_token const* token)
+{
+    iot_twin_value value;
+
+    switch( iot_property_decode( &store->fields.defs[field], token, &value ) )
+    {
+    case IOT_PROPERTY_VALUE_OK:
+        section->value[field] = value;
+        section->present |= (1UL << field);
+        break;
+    case IOT_PROPERTY_VALUE_NULL:
+        section->present &= ~(1UL << field);
+        break;
+    case IOT_PROPERTY_VALUE_REJECTED:
+        break;
+    }
+}
+
+/******************************************************************************
+ * Function Name: twin_nested_cb
+ ******************************************************************************
+ * Summary:
+ *  JSON path callback that applies the value of a nested property to the
+ *  section being parsed.
+ *
+ * Parameters:
+ *  context: twin_parse_context of the payload.
+ *
+ *  path: Index of the nested path.
+ *
+ *  token: Value token.
+ *
+ * Return:
+ *  bool: true, the whole payload is parsed.
+ *
+ ******************************************************************************/
+static bool twin_nested_cb(void* context, uint8_t path, iot_json_walk_token const* token)
+{
+    twin_parse_context* parse = (twin_parse_context*)context;
+
+    apply_value( parse->store, parse->section, parse->store->fields.nested_entry[path], token );
+    return true;
+}
+
+/******************************************************************************
+ * Function Name: twin_token_cb
+ ******************************************************************************
+ * Summary:
+ *  JSON walk callback that applies the tracked properties and $version.
+ *  In a full document they are members of the "desired" and "reported"
+ *  objects, in a desired patch members of the root object. Nested
+ *  properties are matched by the path query of the section.
+ *
+ * Parameters:
+ *  context: twin_parse_context of the payload.
+ *
+ *  token: JSON token.
+ *
+ * Return:
+ *  bool: true, the whole payload is parsed.
+ *
+ ******************************************************************************/
+static bool twin_token_cb(void* context, iot_json_walk_token const* token)
+{
+    twin_parse_context* parse = (twin_parse_context*)context;
+    uint8_t const field_depth = parse->is_document ? 2 : 1;
+    int32_t field;
+    int32_t version;
+
+    if( parse->is_document && (token->depth == 1) )
+    {
+        if( token->kind == AZ_JSON_TOKEN_BEGIN_OBJECT )
+        {
+            if( iot_json_walk_key_equals( token, TWIN_DESIRED_NAME ) )
+            {
+                parse->section = &parse->desired;
+            }
+            else if( iot_json_walk_key_equals( token, TWIN_REPORTED_NAME ) )
+            {
+                parse->section = &parse->reported;
+            }
+
+            /* A full document replaces the section. */
+            if( parse->section != NULL )
+            {
+                memset( parse->section, 0x00, sizeof(iot_twin_section) );
+            }
+        }
+        else if( token->kind == AZ_JSON_TOKEN_END_OBJECT )
+        {
+            parse->section = NULL;
+        }
+        return true;
+    }
+
+    if( parse->section == NULL )
+    {
+        return true;
+    }
+
+    if( parse->store->fields.nested_count > 0 )
+    {
+        (void)iot_json_path_on_token( &parse->nested, token );
+    }
+
+    if( (token->depth != field_depth) || (az_span_ptr( token->key ) == NULL) )
+    {
+        return true;
+    }
+
+    if( iot_json_walk_key_equals( token, TWIN_VERSION_NAME ) )
+    {
+        if( (token->kind == AZ_JSON_TOKEN_NUMBER) &&
+            az_result_succeeded( az_json_token_get_int32( token->value, &version ) ) )
+        {
+            if( parse->is_document )
+            {
+                parse->section->version = version;
+            }
+            else
+            {
+                parse->patch_version = version;
+                parse->version_found = true;
+            }
+        }
+        return true;
+    }
+
+    field = iot_property_table_find( &parse->store->fields, token );
+    if( field >= 0 )
+    {
+        apply_value( parse->store, parse->section, (uint8_t)field, token );
+    }
+    return true;
+}
+
+/******************************************************************************
+ * Function Name: parse_twin_payload
+ ******************************************************************************
+ * Summary:
+ *  Parses a twin document or desired patch into the working sections.
+ *
+ * Parameters:
+ *  parse: Initialized parsing state.
+ *
+ *  payload: Twin payload.
+ *
+ *  payload_len: Length of the payload.
+ *
+ * Return:
+ *  bool: true if the payload is a complete JSON document.
+ *
+ ******************************************************************************/
+static bool parse_twin_payload(twin_parse_context* parse, uint8_t const* payload, size_t payload_len)
+{
+    iot_json_path_query_init( &parse->nested, parse->store->fields.nested, parse->store->fields.nested_count,
+            parse->is_document ? 1 : 0, twin_nested_cb, parse );
+
+    return ( iot_json_walk( payload, payload_len, twin_token_cb, parse ) == IOT_JSON_WALK_COMPLETE );
+}
+
+/******************************************************************************
+ * Function Name: changed_fields
+ ******************************************************************************
+ * Summary:
+ *  Compares two versions of a section.
+ *
+ * Parameters:
+ *  store: Twin store.
+ *
+ *  before: Section before the update.
+ *
+ *  after: Section after the update.
+ *
+ * Return:
+ *  uint32_t: Bit n set if field n was added, removed or changed.
+ *
+ ******************************************************************************/
+static uint32_t changed_fields(iot_twin_store const* store, iot_twin_section const* before,
+        iot_twin_section const* after)
+{
+    uint32_t changed = before->present ^ after->present;
+
+    for( uint8_t i = 0; i < store->fields.count; i++ )
+    {
+        if( (after->present & before->present & (1UL << i)) == 0 )
+        {
+            continue;
+        }
+
+        if( !iot_property_value_equals( store->fields.defs[i].type, &before->value[i], &after->value[i] ) )
+        {
+            changed |= (1UL << i);
+        }
+    }
+
+    return changed;
+}
+
+/******************************************************************************
+ * Function Name: notify_changes
+ ******************************************************************************
+ * Summary:
+ *  Calls the subscribers of the changed desired properties with the old and
+ *  new value. The store already holds the new section.
+ *
+ * Parameters:
+ *  store: Twin store.
+ *
+ *  before: Desired section before the update.
+ *
+ *  changed: Bit n set if field n changed.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+static void notify_changes(iot_twin_store* store, iot_twin_section const* before, uint32_t changed)
+{
+    iot_twin_subscription const* subscription;
+    uint32_t bit;
+
+    for( uint8_t i = 0; (i < store->subscription_count) && (changed != 0); i++ )
+    {
+        subscription = &store->subscriptions[i];
+        bit = (1UL << subscription->field);
+        if( (changed & bit) == 0 )
+        {
+            continue;
+        }
+
+        store->notifications++;
+        subscription->callback( subscription->context, subscription->field,
+                (before->present & bit) ? &before->value[subscription->field] : NULL,
+                (store->desired.present & bit) ? &store->desired.value[subscription->field] : NULL );
+    }
+}
+
+/******************************************************************************
+ * Function Name: iot_twin_store_init
+ ******************************************************************************
+ * Summary:
+ *  Empties the store.
+ *
+ * Parameters:
+ *  store: Twin store.
+ *
+ *  fields: Tracked properties.
+ *
+ *  field_count: Number of tracked properties.
+ *
+ * Return:
+ *  bool: false if there are too many fields or duplicate names.
+ *
+ ******************************************************************************/
+bool iot_twin_store_init(iot_twin_store* store, iot_property_def const* fields, uint8_t field_count)
+{
+    memset( store, 0x00, sizeof(iot_twin_store) );
+    if( field_count > IOT_TWIN_STORE_MAX_FIELDS )
+    {
+        return false;
+    }
+
+    return iot_property_table_init( &store->fields, fields, field_count );
+}
+
+/******************************************************************************
+ * Function Name: iot_twin_store_subscribe
+ ******************************************************************************
+ * Summary:
+ *  Registers a callback for changes of a desired property.
+ *
+ * Parameters:
+ *  store: Twin store.
+ *
+ *  name: Name of a tracked property.
+ *
+ *  callback: Change callback.
+ *
+ *  context: Passed to the callback.
+ *
+ * Return:
+ *  bool: false if the property is unknown or no subscription is free.
+ *
+ ******************************************************************************/
+bool iot_twin_store_subscribe(iot_twin_store* store, char const* name, iot_twin_change_cb callback,
+        void* context)
+{
+    int32_t field = iot_property_table_find_name( &store->fields, name );
+    iot_twin_subscription* subscription;
+
+    if( (field < 0) || (callback == NULL) || (store->subscription_count >= IOT_TWIN_STORE_MAX_SUBSCRIPTIONS) )
+    {
+        return false;
+    }
+
+    subscription = &store->subscriptions[store->subscription_count++];
+    subscription->field = (uint8_t)field;
+    subscription->callback = callback;
+    subscription->context = context;
+    return true;
+}
+
+/******************************************************************************
+ * Function Name: iot_twin_store_set_resync
+ ******************************************************************************
+ * Summary:
+ *  Sets the callback that requests a full twin GET after a version gap.
+ *
+ * Parameters:
+ *  store: Twin store.
+ *
+ *  callback: Resync callback.
+ *
+ *  context: Passed to the callback.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_twin_store_set_resync(iot_twin_store* store, iot_twin_resync_cb callback, void* context)
+{
+    store->resync = callback;
+    store->resync_context = context;
+}
+
+/******************************************************************************
+ * Function Name: iot_twin_store_apply_document
+ ******************************************************************************
+ * Summary:
+ *  Replaces both sections with a full twin document, unless its desired
+ *  $version is older than the stored one. The same check as for patches
+ *  keeps a late GET response from undoing newer patches.
+ *
+ * Parameters:
+ *  store: Twin store.
+ *
+ *  payload: Twin document.
+ *
+ *  payload_len: Length of the twin document.
+ *
+ *  out_changed: Desired fields whose value changed.
+ *
+ * Return:
+ *  iot_twin_patch_result: Result of the version check.
+ *
+ ******************************************************************************/
+iot_twin_patch_result iot_twin_store_apply_document(iot_twin_store* store, uint8_t const* payload,
+        size_t payload_len, uint32_t* out_changed)
+{
+    twin_parse_context parse;
+    iot_twin_section before;
+
+    memset( &parse, 0x00, sizeof(parse) );
+    parse.store = store;
+    parse.is_document = true;
+    parse.desired = store->desired;
+    parse.reported = store->reported;
+
+    *out_changed = 0;
+    if( !parse_twin_payload( &parse, payload, payload_len ) )
+    {
+        return IOT_TWIN_PATCH_ERROR;
+    }
+
+    if( parse.desired.version < store->desired.version )
+    {
+        store->stale_documents++;
+        /* The missed patches are still missing, ask for a current document */
+        if( store->gap && (store->resync != NULL) )
+        {
+            store->resync( store->resync_context );
+        }
+        return IOT_TWIN_PATCH_STALE;
+    }
+
+    *out_changed = changed_fields( store, &store->desired, &parse.desired );
+    before = store->desired;
+    store->desired = parse.desired;
+    store->reported = parse.reported;
+    store->synced = true;
+    store->gap = false;
+    store->full_syncs++;
+    notify_changes( store, &before, *out_changed );
+    return IOT_TWIN_PATCH_APPLIED;
+}
+
+/******************************************************************************
+ * Function Name: iot_twin_store_apply_desired_patch
+ ******************************************************************************
+ * Summary:
+ *  Applies a desired property patch after checking its $version. A patch
+ *  whose version is not newer than the stored one is a late duplicate and
+ *  is ignored. A patch that skips versions is applied, as its values are
+ *  current, but the properties changed by the missed patches are unknown
+ *  until the next full document.
+ *
+ * Parameters:
+ *  store: Twin store.
+ *
+ *  payload: Desired property patch.
+ *
+ *  payload_len: Length of the patch.
+ *
+ *  out_changed: Desired fields whose value changed.
+ *
+ * Return:
+ *  iot_twin_patch_result: Result of the version check.
+ *
+ ******************************************************************************/
+iot_twin_patch_result iot_twin_store_apply_desired_patch(iot_twin_store* store,
+        uint8_t const* payload, size_t payload_len, uint32_t* out_changed)
+{
+    twin_parse_context parse;
+    iot_twin_section before;
+    iot_twin_patch_result result = IOT_TWIN_PATCH_APPLIED;
+    bool resync = false;
+
+    memset( &parse, 0x00, sizeof(parse) );
+    parse.store = store;
+    parse.is_document = false;
+    parse.desired = store->desired;
+    parse.section = &parse.desired;
+
+    *out_changed = 0;
+    if( !parse_twin_payload( &parse, payload, payload_len ) || !parse.version_found )
+    {
+        return IOT_TWIN_PATCH_ERROR;
+    }
+
+    if( store->synced && (parse.patch_version <= store->desired.version) )
+    {
+        store->stale_patches++;
+        return IOT_TWIN_PATCH_STALE;
+    }
+
+    if( !store->synced )
+    {
+        /* No document to patch yet */
+        resync = !store->gap;
+        store->gap = true;
+        result = IOT_TWIN_PATCH_GAP;
+    }
+    else if( parse.patch_version != (store->desired.version + 1) )
+    {
+        /* One GET covers all patches missed until it is answered */
+        resync = !store->gap;
+        store->gap = true;
+        store->version_gaps++;
+        result = IOT_TWIN_PATCH_GAP;
+    }
+
+    parse.desired.version = parse.patch_version;
+    *out_changed = changed_fields( store, &store->desired, &parse.desired );
+    before = store->desired;
+    store->desired = parse.desired;
+    store->patches++;
+    notify_changes( store, &before, *out_changed );
+
+    if( resync && (store->resync != NULL) )
+    {
+        store->resync( store->resync_context );
+    }
+    return result;
+}
+
+/******************************************************************************
+ * Function Name: iot_twin_store_set_reported
+ ******************************************************************************
+ * Summary:
+ *  Records a reported value.
+ *
+ * Parameters:
+ *  store: Twin store.
+ *
+ *  field: Index of the field.
+ *
+ *  value: Reported value.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_twin_store_set_reported(iot_twin_store* store, uint8_t field, iot_twin_value value)
+{
+    if( field < store->fields.count )
+    {
+        store->reported.value[field] = value;
+        store->reported.present |= (1UL << field);
+    }
+}
+
+/******************************************************************************
+ * Function Name: iot_twin_store_set_reported_version
+ ******************************************************************************
+ * Summary:
+ *  Records the reported section version returned by the hub.
+ *
+ * Parameters:
+ *  store: Twin store.
+ *
+ *  version: New $version of the reported section.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_twin_store_set_reported_version(iot_twin_store* store, int32_t version)
+{
+    store->reported.version = version;
+}
+
+/******************************************************************************
+ * Function Name: iot_twin_store_get
+ ******************************************************************************
+ * Summary:
+ *  Reads a field of a section.
+ *
+ * Parameters:
+ *  section: Section to read.
+ *
+ *  field: Index of the field.
+ *
+ *  out_value: Value of the field.
+ *
+ * Return:
+ *  bool: false if the field has no value.
+ *
+ ******************************************************************************/
+bool iot_twin_store_get(iot_twin_section const* section, uint8_t field, iot_twin_value* out_value)
+{
+    if( (field >= IOT_TWIN_STORE_MAX_FIELDS) || ((section->present & (1UL << field)) == 0) )
+    {
+        return false;
+    }
+
+    *out_value = section->value[field];
+    return true;
+}
+
+/******************************************************************************
+ * Function Name: iot_twin_store_needs_full_sync
+ ******************************************************************************
+ * Summary:
+ *  Tells whether a full twin GET is needed.
+ *
+ * Parameters:
+ *  store: Twin store.
+ *
+ * Return:
+ *  bool: true before the first document and after a version gap.
+ *
+ ******************************************************************************/
+bool iot_twin_store_needs_full_sync(iot_twin_store const* store)
+{
+    return ( !store->synced || store->gap );
+}
+
+/******************************************************************************
+ * Function Name: iot_twin_store_log_stats
+ ******************************************************************************
+ * Summary:
+ *  Prints the section versions and the sync, patch, gap and notification
+ *  counters.
+ *
+ * Parameters:
+ *  name: Printable name of the store.
+ *
+ *  store: Twin store.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_twin_store_log_stats(char const* name, iot_twin_store const* store)
+{
+    TEST_INFO(( "\r\n%s twin desired $version: %ld, reported $version: %ld, full syncs: %lu, patches: %lu, stale: %lu, stale documents: %lu, gaps: %lu, notifications: %lu\n",
+            name,
+            (long)store->desired.version,
+            (long)store->reported.version,
+            (unsigned long)store->full_syncs,
+            (unsigned long)store->patches,
+            (unsigned long)store->stale_patches,
+            (unsigned long)store->stale_documents,
+            (unsigned long)store->version_gaps,
+            (unsigned long)store->notifications ));
+}
+
+/* [] END OF FILE */
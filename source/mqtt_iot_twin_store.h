@@ -0,0 +1,229 @@
+/******************************************************************************
+ * File Name: mqtt_iot_twin_store.h
+ *
+ * Description: This file contains the declarations of the local device twin
+ * state store, which keeps typed desired and reported properties with their
+ * versions and applies desired property patches incrementally.
+ *
+ ********************************************************************************
+ * Copyright 2024, Cypress Semiconductor Corporation (an Infineon company) or
+ * an affiliate of Cypress Semiconductor Corporation.  All rights reserved.
+ *
+ * This software, including source code, documentation and related
+ * materials ("Software") is owned by Cypress Semiconductor Corporation
+ * or one of its affiliates ("Cypress") and is protected by and subject to
+ * worldwide patent protection (United States and foreign),
+ * United States copyright laws and international treaty provisions.
+ * Therefore, you may use this Software only as provided in the license
+ * agreement accompanying the software package from which you
+ * obtained this Software ("EULA").
+ * If no EULA applies, Cypress hereby grants you a personal, non-exclusive,
+ * non-transferable license to copy, modify, and compile the Software
+ * source code solely for use in connection with Cypress's
+ * integrated circuit products.  Any reproduction, modification, translation,
+ * compilation, or representation of this Software except as specified
+ * above is prohibited without the express written permission of Cypress.
+ *
+ * Disclaimer: THIS SOFTWARE IS PROVIDED AS-IS, WITH NO WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING, BUT NOT LIMITED TO, NONINFRINGEMENT, IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. Cypress
+ * reserves the right to make changes to the Software without notice. Cypress
+ * does not assume any liability arising out of the application or use of the
+ * Software or any product or circuit described in the Software. Cypress does
+ * not authorize its products for use in any products where a malfunction or
+ * failure of the Cypress product may reasonably be expected to result in
+ * significant property damage, injury or death ("High Risk Product"). By
+ * including Cypress's product in a High Risk Product, the manufacturer
+ * of such system or application assumes all risk of such use and in doing
+ * so agrees to indemnify Cypress against all liability.
+ *******************************************************************************/
+
+#ifndef MQTT_IOT_TWIN_STORE_H_
+#define MQTT_IOT_TWIN_STORE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mqtt_iot_property_parser.h"
+
+/*******************************************************************************
+ * Macros
+ ********************************************************************************/
+/* Maximum number of twin properties tracked by a store */
+#define IOT_TWIN_STORE_MAX_FIELDS               (8)
+
+/* Maximum number of desired property subscriptions of a store */
+#define IOT_TWIN_STORE_MAX_SUBSCRIPTIONS        (8)
+
+/*******************************************************************************
+ * Global Variables
+ ********************************************************************************/
+typedef iot_property_value iot_twin_value;
+
+/* Last known state of the desired or reported section */
+typedef struct
+{
+    int32_t         version;        /* $version of the section, 0 if unknown */
+    uint32_t        present;        /* Bit n set if field n has a value */
+    iot_twin_value  value[IOT_TWIN_STORE_MAX_FIELDS];
+} iot_twin_section;
+
+/*
+ * Called when the desired value of a subscribed property changed. A value
+ * is NULL if the property is absent before or after the change.
+ */
+typedef void (*iot_twin_change_cb)(void* context, uint8_t field, iot_twin_value const* old_value,
+        iot_twin_value const* new_value);
+
+/* Called once per detected desired $version gap to request a full twin GET */
+typedef void (*iot_twin_resync_cb)(void* context);
+
+typedef struct
+{
+    uint8_t                     field;
+    iot_twin_change_cb          callback;
+    void*                       context;
+} iot_twin_subscription;
+
+typedef struct
+{
+    iot_property_table          fields;         /* Tracked properties and their name index */
+    bool                        synced;         /* A full document was applied */
+    bool                        gap;            /* A desired patch was missed */
+    iot_twin_section            desired;
+    iot_twin_section            reported;
+    iot_twin_subscription       subscriptions[IOT_TWIN_STORE_MAX_SUBSCRIPTIONS];
+    uint8_t                     subscription_count;
+    iot_twin_resync_cb          resync;
+    void*                       resync_context;
+    uint32_t                    full_syncs;
+    uint32_t                    patches;
+    uint32_t                    stale_patches;
+    uint32_t                    stale_documents;
+    uint32_t                    version_gaps;
+    uint32_t                    notifications;
+} iot_twin_store;
+
+typedef enum
+{
+    IOT_TWIN_PATCH_APPLIED,         /* Patch follows the stored version, or document applied */
+    IOT_TWIN_PATCH_STALE,           /* Older than the stored version, ignored */
+    IOT_TWIN_PATCH_GAP,             /* Patch applied, but earlier patches were missed */
+    IOT_TWIN_PATCH_ERROR            /* Malformed patch or document, or no $version, ignored */
+} iot_twin_patch_result;
+
+/******************************************************************************
+ * Function Prototypes
+ *******************************************************************************/
+/*
+ * @brief Empties the store. Until a full document is applied the store
+ * reports that a full twin GET is needed.
+ * @param[out] store Twin store.
+ * @param[in] fields Tracked properties of the desired and reported
+ * sections, top-level names or nested paths, must remain valid. The offset
+ * of the entries is not used, values are kept in the store. Values out of
+ * range are ignored.
+ * @param[in] field_count Number of entries in \p fields.
+ * @return false if \p field_count exceeds IOT_TWIN_STORE_MAX_FIELDS or a
+ * name is declared twice.
+ */
+bool iot_twin_store_init(iot_twin_store* store, iot_property_def const* fields, uint8_t field_count);
+
+/*
+ * @brief Registers a callback for changes of a desired property. It is
+ * called after a twin document or patch is applied, only if the value of
+ * the property changed, in the context of the apply call.
+ * @param[in] store Twin store.
+ * @param[in] name Name or nested path of a tracked property.
+ * @param[in] callback Change callback.
+ * @param[in] context Passed to \p callback.
+ * @return false if the property is not tracked or all subscriptions are
+ * in use.
+ */
+bool iot_twin_store_subscribe(iot_twin_store* store, char const* name, iot_twin_change_cb callback,
+        void* context);
+
+/*
+ * @brief Sets the callback that requests a full twin GET when a desired
+ * patch skips a $version. It is called once per gap; the gap is cleared by
+ * the next full document.
+ * @param[in] store Twin store.
+ * @param[in] callback Resync callback, NULL to only flag the gap.
+ * @param[in] context Passed to \p callback.
+ */
+void iot_twin_store_set_resync(iot_twin_store* store, iot_twin_resync_cb callback, void* context);
+
+/*
+ * @brief Replaces both sections with a full twin document (GET response)
+ * and clears a pending version gap. Subscribers of changed desired
+ * properties are notified. A document whose desired $version is older than
+ * the stored one, e.g. a late or repeated GET response, is ignored, and the
+ * resync callback is called again if a gap is still pending.
+ * @param[in] store Twin store.
+ * @param[in] payload Twin document.
+ * @param[in] payload_len Length of \p payload.
+ * @param[out] out_changed Bit n set if the desired value of field n changed.
+ * @return IOT_TWIN_PATCH_APPLIED, IOT_TWIN_PATCH_STALE, or
+ * IOT_TWIN_PATCH_ERROR if the document is malformed. The store is unchanged
+ * unless the document was applied.
+ */
+iot_twin_patch_result iot_twin_store_apply_document(iot_twin_store* store, uint8_t const* payload,
+        size_t payload_len, uint32_t* out_changed);
+
+/*
+ * @brief Applies a desired property patch. Properties set to null are
+ * removed, properties that are not tracked are ignored. Subscribers of
+ * changed properties are notified, and the resync callback is called when
+ * the patch skips a $version.
+ * @param[in] store Twin store.
+ * @param[in] payload Desired property patch.
+ * @param[in] payload_len Length of \p payload.
+ * @param[out] out_changed Bit n set if the desired value of field n changed.
+ * @return Result of the version check.
+ */
+iot_twin_patch_result iot_twin_store_apply_desired_patch(iot_twin_store* store,
+        uint8_t const* payload, size_t payload_len, uint32_t* out_changed);
+
+/*
+ * @brief Records a reported value once it was sent to the hub.
+ * @param[in] store Twin store.
+ * @param[in] field Index of the field.
+ * @param[in] value Reported value.
+ */
+void iot_twin_store_set_reported(iot_twin_store* store, uint8_t field, iot_twin_value value);
+
+/*
+ * @brief Records the reported section version returned by the hub in the
+ * response to a reported property update.
+ * @param[in] store Twin store.
+ * @param[in] version New $version of the reported section.
+ */
+void iot_twin_store_set_reported_version(iot_twin_store* store, int32_t version);
+
+/*
+ * @brief Reads a field of a section.
+ * @param[in] section store->desired or store->reported.
+ * @param[in] field Index of the field.
+ * @param[out] out_value Value of the field.
+ * @return false if the field has no value.
+ */
+bool iot_twin_store_get(iot_twin_section const* section, uint8_t field, iot_twin_value* out_value);
+
+/*
+ * @brief Tells whether the state has to be refreshed with a full twin GET,
+ * i.e. no document was applied yet or a version gap was detected.
+ * @param[in] store Twin store.
+ */
+bool iot_twin_store_needs_full_sync(iot_twin_store const* store);
+
+/*
+ * @brief Prints the section versions and the sync, patch and gap counters.
+ * @param[in] name Printable name of the store.
+ * @param[in] store Twin store.
+ */
+void iot_twin_store_log_stats(char const* name, iot_twin_store const* store);
+
+#endif /* MQTT_IOT_TWIN_STORE_H_ */
+
+/* [] END OF FILE */
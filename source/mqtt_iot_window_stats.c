@@ -0,0 +1,837 @@
+/******************************************************************************
+ * File Name: mqtt_iot_window_stats.c
+ *
+ * Description: This file contains the windowed statistics engine that
+ * keeps the minimum, maximum and mean of a measured value over time buckets,
+ * in double or Q16.16 fixed point.
+ *
+ ********************************************************************************
+ * Copyright 2024, Cypress Semiconductor Corporation (an Infineon company) or
+ * an affiliate of Cypress Semiconductor Corporation.  All rights reserved.
+ *
+ * This software, including source code, documentation and related
+ * materials ("Software") is owned by Cypress Semiconductor Corporation
+ * or one of its affiliates ("Cypress") and is protected by and subject to
+ * worldwide patent protection (United States and foreign),
+ * United States copyright laws and international treaty provisions.
+ * Therefore, you may use this Software only as provided in the license
+ * agreement accompanying the software package from which you
+ * obtained this Software ("EULA").
+ * If no EULA applies, Cypress hereby grants you a personal, non-exclusive,
+ * non-transferable license to copy, modify, and compile the Software
+ * source code solely for use in connection with Cypress's
+ * integrated circuit products.  Any reproduction, modification, translation,
+ * compilation, or representation of this Software except as specified
+ * above is prohibited without the express written permission of Cypress.
+ *
+ * Disclaimer: THIS SOFTWARE IS PROVIDED AS-IS, WITH NO WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING, BUT NOT LIMITED TO, NONINFRINGEMENT, IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. Cypress
+ * reserves the right to make changes to the Software without notice. Cypress
+ * does not assume any liability arising out of the application or use of the
+ * Software or any product or circuit described in the Software. Cypress does
+ * not authorize its products for use in any products where a malfunction or
+ * failure of the Cypress product may reasonably be expected to result in
+ * significant property damage, injury or death ("High Risk Product"). By
+ * including Cypress's product in a High Risk Product, the manufacturer
+ * of such system or application assumes all risk of such use and in doing
+ * so agrees to indemnify Cypress against all liability.
+ *******************************************************************************/
+
+#include <string.h>
+
+#include "mqtt_iot_common.h"
+#include "mqtt_iot_window_stats.h"
+
+/*******************************************************************************
+ * Macros
+ ********************************************************************************/
+#define SECONDS_PER_MINUTE                  (60L)
+#define SECONDS_PER_HOUR                    (60L * SECONDS_PER_MINUTE)
+#define SECONDS_PER_DAY                     (24L * SECONDS_PER_HOUR)
+
+/* Fraction digits of the serialized temperatures, as in the PnP app */
+#define STATS_DECIMALS                      (2)
+#define STATS_MAX_DECIMALS                  (4)
+
+/* Updates and serializations that are measured for each representation */
+#define STATS_BENCHMARK_ITERATIONS          (1000)
+#define STATS_BENCHMARK_SAMPLES             (8)
+#define STATS_BENCHMARK_PAYLOAD_SIZE        (96)
+
+/*******************************************************************************
+ * Global Variables
+ ********************************************************************************/
+/* Samples of the benchmark, a thermostat around 22 degrees Celsius */
+static double const stats_benchmark_double[STATS_BENCHMARK_SAMPLES] =
+{
+    21.5, 21.75, 22.0, 22.25, 22.4, 22.1, 21.9, 21.6
+};
+static int32_t const stats_benchmark_q16[STATS_BENCHMARK_SAMPLES] =
+{
+    IOT_STATS_Q16_FROM_DOUBLE(21.5), IOT_STATS_Q16_FROM_DOUBLE(21.75), IOT_STATS_Q16_FROM_DOUBLE(22.0),
+    IOT_STATS_Q16_FROM_DOUBLE(22.25), IOT_STATS_Q16_FROM_DOUBLE(22.4), IOT_STATS_Q16_FROM_DOUBLE(22.1),
+    IOT_STATS_Q16_FROM_DOUBLE(21.9), IOT_STATS_Q16_FROM_DOUBLE(21.6)
+};
+
+static az_span const stats_max_name = AZ_SPAN_LITERAL_FROM_STR("maxTemp");
+static az_span const stats_min_name = AZ_SPAN_LITERAL_FROM_STR("minTemp");
+static az_span const stats_avg_name = AZ_SPAN_LITERAL_FROM_STR("avgTemp");
+
+/******************************************************************************
+ * Function Name: running_stats_double_add
+ ******************************************************************************
+ * Summary:
+ *  Adds one sample. The mean moves by the difference of the sample from the
+ *  mean divided by the count, so no sum that grows with the uptime is kept.
+ *
+ * Parameters:
+ *  stats: Statistics.
+ *
+ *  value: Sample.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+static void running_stats_double_add(iot_running_stats_double* stats, double value)
+{
+    double delta;
+
+    if( stats->count == 0 )
+    {
+        stats->min = value;
+        stats->max = value;
+    }
+    else if( value < stats->min )
+    {
+        stats->min = value;
+    }
+    else if( value > stats->max )
+    {
+        stats->max = value;
+    }
+
+    stats->count++;
+    delta = value - stats->mean;
+    stats->mean += delta / (double)stats->count;
+    stats->m2 += delta * ( value - stats->mean );
+}
+
+/******************************************************************************
+ * Function Name: running_stats_q16_add
+ ******************************************************************************
+ * Summary:
+ *  Adds one Q16.16 sample with integer math only.
+ *
+ * Parameters:
+ *  stats: Statistics.
+ *
+ *  value: Sample.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+static void running_stats_q16_add(iot_running_stats_q16* stats, int32_t value)
+{
+    if( stats->count == 0 )
+    {
+        stats->min = value;
+        stats->max = value;
+    }
+    else if( value < stats->min )
+    {
+        stats->min = value;
+    }
+    else if( value > stats->max )
+    {
+        stats->max = value;
+    }
+
+    stats->count++;
+    stats->sum += value;
+}
+
+/******************************************************************************
+ * Function Name: running_stats_q16_mean
+ ******************************************************************************
+ * Summary:
+ *  Divides the sum of the Q16.16 samples by their count, rounded to nearest.
+ *
+ * Parameters:
+ *  stats: Statistics.
+ *
+ * Return:
+ *  int32_t: Mean, 0 if there are no samples.
+ *
+ ******************************************************************************/
+static int32_t running_stats_q16_mean(iot_running_stats_q16 const* stats)
+{
+    int64_t half;
+
+    if( stats->count == 0 )
+    {
+        return 0;
+    }
+
+    half = (int64_t)( stats->count / 2 );
+    return (int32_t)( ( ( stats->sum < 0 ) ? ( stats->sum - half ) : ( stats->sum + half ) ) /
+                      (int64_t)stats->count );
+}
+
+/******************************************************************************
+ * Function Name: iot_running_stats_reset
+ ******************************************************************************
+ * Summary:
+ *  Clears the statistics of a set of samples.
+ *
+ * Parameters:
+ *  stats: Statistics.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_running_stats_reset(iot_running_stats* stats)
+{
+    memset( stats, 0x00, sizeof(*stats) );
+}
+
+/******************************************************************************
+ * Function Name: iot_running_stats_add
+ ******************************************************************************
+ * Summary:
+ *  Adds one sample in the representation selected by IOT_STATS_FIXED_POINT.
+ *
+ * Parameters:
+ *  stats: Statistics.
+ *
+ *  value: Sample.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_running_stats_add(iot_running_stats* stats, iot_stats_value value)
+{
+#if IOT_STATS_FIXED_POINT
+    running_stats_q16_add( stats, value );
+#else
+    running_stats_double_add( stats, value );
+#endif
+}
+
+/******************************************************************************
+ * Function Name: iot_running_stats_merge
+ ******************************************************************************
+ * Summary:
+ *  Combines the statistics of two disjoint sets of samples, in double with
+ *  the pairwise update of Chan et al.
+ *
+ * Parameters:
+ *  into: Statistics that receive the samples.
+ *
+ *  from: Statistics of the other set.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_running_stats_merge(iot_running_stats* into, iot_running_stats const* from)
+{
+#if !IOT_STATS_FIXED_POINT
+    double count;
+    double delta;
+#endif
+
+    if( from->count == 0 )
+    {
+        return;
+    }
+    if( into->count == 0 )
+    {
+        *into = *from;
+        return;
+    }
+
+#if IOT_STATS_FIXED_POINT
+    into->sum += from->sum;
+#else
+    count = (double)into->count + (double)from->count;
+    delta = from->mean - into->mean;
+    into->mean += delta * ( (double)from->count / count );
+    into->m2 += from->m2 + delta * delta * ( (double)into->count * (double)from->count / count );
+#endif
+    into->count += from->count;
+    if( from->min < into->min )
+    {
+        into->min = from->min;
+    }
+    if( from->max > into->max )
+    {
+        into->max = from->max;
+    }
+}
+
+/******************************************************************************
+ * Function Name: iot_running_stats_mean
+ ******************************************************************************
+ * Summary:
+ *  Computes the mean of a set of samples.
+ *
+ * Parameters:
+ *  stats: Statistics.
+ *
+ * Return:
+ *  iot_stats_value: Mean, 0 if there are no samples.
+ *
+ ******************************************************************************/
+iot_stats_value iot_running_stats_mean(iot_running_stats const* stats)
+{
+#if IOT_STATS_FIXED_POINT
+    return running_stats_q16_mean( stats );
+#else
+    return stats->mean;
+#endif
+}
+
+/******************************************************************************
+ * Function Name: iot_window_stats_init
+ ******************************************************************************
+ * Summary:
+ *  Empties the engine.
+ *
+ * Parameters:
+ *  stats: Windowed statistics.
+ *
+ *  bucket_sec: Duration of a bucket.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_window_stats_init(iot_window_stats* stats, uint32_t bucket_sec)
+{
+    memset( stats, 0x00, sizeof(*stats) );
+    stats->bucket_sec = ( bucket_sec > 0 ) ? bucket_sec : 1;
+}
+
+/******************************************************************************
+ * Function Name: iot_window_stats_add
+ ******************************************************************************
+ * Summary:
+ *  Adds a sample to its bucket and to the lifetime statistics. A sample
+ *  after the newest bucket starts a new one in place of the oldest.
+ *
+ * Parameters:
+ *  stats: Windowed statistics.
+ *
+ *  when: Time of the sample.
+ *
+ *  value: Sample.
+ *
+ * Return:
+ *  void
+ *
+ ******************************************************************************/
+void iot_window_stats_add(iot_window_stats* stats, time_t when, iot_stats_value value)
+{
+    time_t start = when - ( when % (time_t)stats->bucket_sec );
+    iot_window_stats_bucket* bucket = &stats->buckets[stats->newest];
+
+    if( ( stats->used == 0 ) || ( start > bucket->start ) )
+    {
+        if( stats->used > 0 )
+        {
+            stats->newest = (uint8_t)( ( stats->newest + 1 ) % IOT_WINDOW_STATS_BUCKETS );
+            bucket = &stats->buckets[stats->newest];
+        }
+        if( stats->used < IOT_WINDOW_STATS_BUCKETS )
+        {
+            stats->used++;
+        }
+        bucket->start = start;
+        iot_running_stats_reset( &bucket->stats );
+    }
+
+    iot_running_stats_add( &bucket->stats, value );
+
+    if( stats->lifetime.count == 0 )
+    {
+        stats->first_time = when;
+    }
+    iot_running_stats_add( &stats->lifetime, value );
+}
+
+/******************************************************************************
+ * Function Name: iot_window_stats_query
+ ******************************************************************************
+ * Summary:
+ *  Combines the buckets that end after the start of a window, newest first.
+ *  Buckets are replaced only when all are in use, so a window that reaches
+ *  past the oldest bucket is truncated only then.
+ *
+ * Parameters:
+ *  stats: Windowed statistics.
+ *
+ *  since: Start of the window.
+ *
+ *  out_stats: Statistics of the samples in the window.
+ *
+ *  out_start: Start of the window covered.
+ *
+ * Return:
+ *  bool: false if the window has no samples.
+ *
+ ******************************************************************************/
+bool iot_window_stats_query(iot_window_stats const* stats, time_t since, iot_running_stats* out_stats,
+        time_t* out_start)
+{
+    iot_window_stats_bucket const* bucket = NULL;
+    uint8_t index = stats->newest;
+    uint8_t merged = 0;
+
+    iot_running_stats_reset( out_stats );
+    *out_start = since;
+
+    if( ( stats->lifetime.count > 0 ) && ( since <= stats->first_time ) )
+    {
+        *out_stats = stats->lifetime;
+        return true;
+    }
+
+    for( uint8_t i = 0; i < stats->used; i++ )
+    {
+        bucket = &stats->buckets[index];
+        if( bucket->start + (time_t)stats->bucket_sec <= since )
+        {
+            break;
+        }
+        iot_running_stats_merge( out_stats, &bucket->stats );
+        merged++;
+        index = (uint8_t)( ( index == 0 ) ? ( IOT_WINDOW_STATS_BUCKETS - 1 ) : ( index - 1 ) );
+    }
+
+    if( ( merged == IOT_WINDOW_STATS_BUCKETS ) && ( bucket->start > since ) )
+    {
+        *out_start = bucket->start;
+    }
+
+    return ( out_stats->count > 0 );
+}
+
+/******************************************************************************
+ * Function Name: parse_digits
+ ******************************************************************************
+ * Summary:
+ *  Converts a fixed number of decimal digits.
+ *
+ * Parameters:
+ *  text: First digit.
+ *
+ *  count: Number of digits.
+ *
+ *  out_value: Value of the digits.
+ *
+ * Return:
+ *  bool: false if a character is not a digit.
+ *
+ ******************************************************************************/
+static bool parse_digits(char const* text, size_t count, int32_t* out_value)
+{
+    int32_t value = 0;
+
+    for( size_t i = 0; i < count; i++ )
+    {
+        if( ( text[i] < '0' ) || ( text[i] > '9' ) )
+        {
+            return false;
+        }
+        value = value * 10 + ( text[i] - '0' );
+    }
+
+    *out_value = value;
+    return true;
+}
+
+/******************************************************************************
+ * Function Name: days_from_civil
+ ******************************************************************************
+ * Summary:
+ *  Counts the days from 1970-01-01 to a date of the proleptic Gregorian
+ *  calendar.
+ *
+ * Parameters:
+ *  year: Year.
+ *
+ *  month: Month, 1 to 12.
+ *
+ *  day: Day of the month, 1 to 31.
+ *
+ * Return:
+ *  int32_t: Days since the epoch, negative before it.
+ *
+ ******************************************************************************/
+static int32_t days_from_civil(int32_t year, int32_t month, int32_t day)
+{
+    int32_t era;
+    int32_t year_of_era;
+    int32_t day_of_year;
+    int32_t day_of_era;
+
+    /* Years start in March so that the leap day is the last day of a year */
+    year -= ( month <= 2 ) ? 1 : 0;
+    era = ( ( year >= 0 ) ? year : ( year - 399 ) ) / 400;
+    year_of_era = year - era * 400;
+    day_of_year = ( 153 * ( month + ( ( month > 2 ) ? -3 : 9 ) ) + 2 ) / 5 + day - 1;
+    day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+
+    return era * 146097 + day_of_era - 719468;
+}
+
+/******************************************************************************
+ * Function Name: iot_window_stats_parse_iso8601
+ ******************************************************************************
+ * Summary:
+ *  Converts an ISO 8601 date and time of the form
+ *  YYYY-MM-DDTHH:MM:SS[.fraction][Z|+HH:MM|+HHMM|+HH] to a time.
+ *
+ * Parameters:
+ *  text: Date and time.
+ *
+ *  text_len: Length of the date and time.
+ *
+ *  out_time: Seconds since the epoch.
+ *
+ * Return:
+ *  bool: false if the text is not a valid date and time.
+ *
+ ******************************************************************************/
+bool iot_window_stats_parse_iso8601(char const* text, size_t text_len, time_t* out_time)
+{
+    static uint8_t const days_in_month[12] = { 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    int32_t year, month, day, hour, minute, second;
+    int32_t offset_hour = 0, offset_minute = 0;
+    int32_t offset_sign = 0;
+    size_t pos = 19;
+    bool leap;
+
+    if( ( text_len < 19 ) ||
+        ( text[4] != '-' ) || ( text[7] != '-' ) || ( ( text[10] != 'T' ) && ( text[10] != ' ' ) ) ||
+        ( text[13] != ':' ) || ( text[16] != ':' ) ||
+        !parse_digits( &text[0], 4, &year ) || !parse_digits( &text[5], 2, &month ) ||
+        !parse_digits( &text[8], 2, &day ) || !parse_digits( &text[11], 2, &hour ) ||
+        !parse_digits( &text[14], 2, &minute ) || !parse_digits( &text[17], 2, &second ) )
+    {
+        return false;
+    }
+
+    leap = ( ( year % 4 ) == 0 ) && ( ( ( year % 100 ) != 0 ) || ( ( year % 400 ) == 0 ) );
+    if( ( month < 1 ) || ( month > 12 ) || ( day < 1 ) || ( day > days_in_month[month - 1] ) ||
+        ( ( month == 2 ) && ( day == 29 ) && !leap ) ||
+        ( hour > 23 ) || ( minute > 59 ) || ( second > 60 ) )
+    {
+        return false;
+    }
+
+    /* Fractional seconds */
+    if( ( pos < text_len ) && ( ( text[pos] == '.' ) || ( text[pos] == ',' ) ) )
+    {
+        pos++;
+        while( ( pos < text_len ) && ( text[pos] >= '0' ) && ( text[pos] <= '9' ) )
+        {
+            pos++;
+        }
+    }
+
+    /* UTC offset */
+    if( ( pos < text_len ) && ( ( text[pos] == 'Z' ) || ( text[pos] == 'z' ) ) )
+    {
+        pos++;
+    }
+    else if( ( pos < text_len ) && ( ( text[pos] == '+' ) || ( text[pos] == '-' ) ) )
+    {
+        offset_sign = ( text[pos] == '+' ) ? 1 : -1;
+        pos++;
+        if( ( pos + 2 > text_len ) || !parse_digits( &text[pos], 2, &offset_hour ) )
+        {
+            return false;
+        }
+        pos += 2;
+        if( ( pos < text_len ) && ( text[pos] == ':' ) )
+        {
+            pos++;
+        }
+        if( pos < text_len )
+        {
+            if( ( pos + 2 > text_len ) || !parse_digits( &text[pos], 2, &offset_minute ) )
+            {
+                return false;
+            }
+            pos += 2;
+        }
+        if( ( offset_hour > 23 ) || ( offset_minute > 59 ) )
+        {
+            return false;
+        }
+    }
+
+    if( pos != text_len )
+    {
+        return false;
+    }
+
+    *out_time = (time_t)days_from_civil( year, month, day ) * SECONDS_PER_DAY +
+                (time_t)hour * SECONDS_PER_HOUR + (time_t)minute * SECONDS_PER_MINUTE + (time_t)second -
+                (time_t)offset_sign * ( (time_t)offset_hour * SECONDS_PER_HOUR +
+                                        (time_t)offset_minute * SECONDS_PER_MINUTE );
+    return true;
+}
+
+/******************************************************************************
+ * Function Name: iot_stats_format_q16
+ ******************************************************************************
+ * Summary:
+ *  Formats a Q16.16 value as a JSON number with integer math. The value is
+ *  rounded to the number of fraction digits and trailing zeros are removed,
+ *  as az_json_writer_append_double() does for a double.
+ *
+ * Parameters:
+ *  value: Q16.16 value.
+ *
+ *  decimals: Number of fraction digits, at most STATS_MAX_DECIMALS.
+ *
+ *  text: Destination, at least IOT_STATS_Q16_TEXT_SIZE bytes.
+ *
+ * Return:
+ *  size_t: Length of the text, without the null terminator.
+ *
+ ******************************************************************************/
+size_t iot_stats_format_q16(int32_t value, uint8_t decimals, char* text)
+{
+    char digits[IOT_STATS_Q16_TEXT_SIZE];
+    uint64_t magnitude = ( value < 0 ) ? (uint64_t)( -(int64_t)value ) : (uint64_t)value;
+    uint32_t scale = 1;
+    uint32_t scaled;
+    size_t count = 0;
+    size_t length = 0;
+
+    if( decimals > STATS_MAX_DECIMALS )
+    {
+        decimals = STATS_MAX_DECIMALS;
+    }
+    for( uint8_t i = 0; i < decimals; i++ )
+    {
+        scale *= 10;
+    }
+
+    /* Value times 10^decimals, rounded half away from zero */
+    scaled = (uint32_t)( ( magnitude * scale + ( IOT_STATS_Q16_ONE / 2 ) ) >> IOT_STATS_Q16_FRACTION_BITS );
+
+    /* Trailing zeros of the fraction are not written */
+    while( ( decimals > 0 ) && ( ( scaled % 10 ) == 0 ) )
+    {
+        scaled /= 10;
+        decimals--;
+    }
+
+    /* Digits from the least significant, with the point after the fraction */
+    do
+    {
+        if( ( count == decimals ) && ( decimals > 0 ) )
+        {
+            digits[count++] = '.';
+        }
+        digits[count++] = (char)( '0' + ( scaled % 10 ) );
+        scaled /= 10;
+    } while( ( scaled > 0 ) || ( count <= decimals ) );
+
+    if( ( value < 0 ) && !( ( count == 1 ) && ( digits[0] == '0' ) ) )
+    {
+        text[length++] = '-';
+    }
+    while( count > 0 )
+    {
+        text[length++] = digits[--count];
+    }
+    text[length] = '\0';
+
+    return length;
+}
+
+/******************************************************************************
+ * Function Name: serialize_double
+ ******************************************************************************
+ * Summary:
+ *  Writes the maximum, minimum and mean of double statistics as a JSON
+ *  object, the way the PnP app reports them.
+ *
+ * Parameters:
+ *  stats: Statistics.
+ *
+ *  buffer: Destination buffer.
+ *
+ * Return:
+ *  az_result: AZ_OK on success.
+ *
+ ******************************************************************************/
+static az_result serialize_double(iot_running_stats_double const* stats, az_span buffer)
+{
+    az_json_writer jw;
+
+    IOT_RETURN_IF_FAILED( az_json_writer_init( &jw, buffer, NULL ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_begin_object( &jw ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, stats_max_name ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_double( &jw, stats->max, STATS_DECIMALS ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, stats_min_name ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_double( &jw, stats->min, STATS_DECIMALS ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, stats_avg_name ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_double( &jw, stats->mean, STATS_DECIMALS ) );
+    return az_json_writer_append_end_object( &jw );
+}
+
+/******************************************************************************
+ * Function Name: append_q16
+ ******************************************************************************
+ * Summary:
+ *  Appends a Q16.16 value as a JSON number.
+ *
+ * Parameters:
+ *  jw: JSON writer.
+ *
+ *  value: Q16.16 value.
+ *
+ * Return:
+ *  az_result: AZ_OK on success.
+ *
+ ******************************************************************************/
+static az_result append_q16(az_json_writer* jw, int32_t value)
+{
+    char text[IOT_STATS_Q16_TEXT_SIZE];
+    size_t length = iot_stats_format_q16( value, STATS_DECIMALS, text );
+
+    return az_json_writer_append_json_text( jw, az_span_create( (uint8_t*)text, (int32_t)length ) );
+}
+
+/******************************************************************************
+ * Function Name: serialize_q16
+ ******************************************************************************
+ * Summary:
+ *  Writes the maximum, minimum and mean of Q16.16 statistics as a JSON
+ *  object.
+ *
+ * Parameters:
+ *  stats: Statistics.
+ *
+ *  buffer: Destination buffer.
+ *
+ * Return:
+ *  az_result: AZ_OK on success.
+ *
+ ******************************************************************************/
+static az_result serialize_q16(iot_running_stats_q16 const* stats, az_span buffer)
+{
+    az_json_writer jw;
+
+    IOT_RETURN_IF_FAILED( az_json_writer_init( &jw, buffer, NULL ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_begin_object( &jw ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, stats_max_name ) );
+    IOT_RETURN_IF_FAILED( append_q16( &jw, stats->max ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, stats_min_name ) );
+    IOT_RETURN_IF_FAILED( append_q16( &jw, stats->min ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, stats_avg_name ) );
+    IOT_RETURN_IF_FAILED( append_q16( &jw, running_stats_q16_mean( stats ) ) );
+    return az_json_writer_append_end_object( &jw );
+}
+
+/******************************************************************************
+ * Function Name: iot_window_stats_build_benchmark_report
+ ******************************************************************************
+ * Summary:
+ *  Counts the CPU cycles of STATS_BENCHMARK_ITERATIONS statistics updates
+ *  and serializations with the DWT cycle counter, in double and in Q16.16,
+ *  and reports the average cycles of each. Both representations are always
+ *  measured, whichever IOT_STATS_FIXED_POINT selects. The loops run with
+ *  the scheduler active, so compare the double and Q16.16 numbers of one
+ *  report rather than numbers of different runs.
+ *
+ * Parameters:
+ *  buffer: Destination buffer.
+ *
+ *  out_report: JSON text written to the buffer.
+ *
+ * Return:
+ *  az_result: AZ_OK on success.
+ *
+ ******************************************************************************/
+az_result iot_window_stats_build_benchmark_report(az_span buffer, az_span* out_report)
+{
+    uint8_t payload[STATS_BENCHMARK_PAYLOAD_SIZE];
+    iot_running_stats_double stats_double;
+    iot_running_stats_q16 stats_q16;
+    uint32_t update_cycles[2];
+    uint32_t serialize_cycles[2];
+    uint32_t start;
+    az_json_writer jw;
+
+    IOT_CYCLE_COUNTER_START();
+
+    memset( &stats_double, 0x00, sizeof(stats_double) );
+    start = IOT_CYCLE_COUNT();
+    for( uint32_t i = 0; i < STATS_BENCHMARK_ITERATIONS; i++ )
+    {
+        running_stats_double_add( &stats_double, stats_benchmark_double[i % STATS_BENCHMARK_SAMPLES] );
+    }
+    update_cycles[0] = ( IOT_CYCLE_COUNT() - start ) / STATS_BENCHMARK_ITERATIONS;
+
+    memset( &stats_q16, 0x00, sizeof(stats_q16) );
+    start = IOT_CYCLE_COUNT();
+    for( uint32_t i = 0; i < STATS_BENCHMARK_ITERATIONS; i++ )
+    {
+        running_stats_q16_add( &stats_q16, stats_benchmark_q16[i % STATS_BENCHMARK_SAMPLES] );
+    }
+    update_cycles[1] = ( IOT_CYCLE_COUNT() - start ) / STATS_BENCHMARK_ITERATIONS;
+
+    start = IOT_CYCLE_COUNT();
+    for( uint32_t i = 0; i < STATS_BENCHMARK_ITERATIONS; i++ )
+    {
+        IOT_RETURN_IF_FAILED( serialize_double( &stats_double, AZ_SPAN_FROM_BUFFER( payload ) ) );
+    }
+    serialize_cycles[0] = ( IOT_CYCLE_COUNT() - start ) / STATS_BENCHMARK_ITERATIONS;
+
+    start = IOT_CYCLE_COUNT();
+    for( uint32_t i = 0; i < STATS_BENCHMARK_ITERATIONS; i++ )
+    {
+        IOT_RETURN_IF_FAILED( serialize_q16( &stats_q16, AZ_SPAN_FROM_BUFFER( payload ) ) );
+    }
+    serialize_cycles[1] = ( IOT_CYCLE_COUNT() - start ) / STATS_BENCHMARK_ITERATIONS;
+
+    IOT_RETURN_IF_FAILED( az_json_writer_init( &jw, buffer, NULL ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_begin_object( &jw ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("mode") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_string( &jw,
+                          IOT_STATS_FIXED_POINT ? AZ_SPAN_FROM_STR("q16") : AZ_SPAN_FROM_STR("double") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("iterations") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_int32( &jw, STATS_BENCHMARK_ITERATIONS ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("updateCycles") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_begin_array( &jw ) );
+    for( uint8_t m = 0; m < 2; m++ )
+    {
+        IOT_RETURN_IF_FAILED( az_json_writer_append_int32( &jw, (int32_t)update_cycles[m] ) );
+    }
+    IOT_RETURN_IF_FAILED( az_json_writer_append_end_array( &jw ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_property_name( &jw, AZ_SPAN_FROM_STR("serializeCycles") ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_begin_array( &jw ) );
+    for( uint8_t m = 0; m < 2; m++ )
+    {
+        IOT_RETURN_IF_FAILED( az_json_writer_append_int32( &jw, (int32_t)serialize_cycles[m] ) );
+    }
+    IOT_RETURN_IF_FAILED( az_json_writer_append_end_array( &jw ) );
+    IOT_RETURN_IF_FAILED( az_json_writer_append_end_object( &jw ) );
+
+    *out_report = az_json_writer_get_bytes_used_in_destination( &jw );
+    return AZ_OK;
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,239 @@
+/******************************************************************************
+ * File Name: mqtt_iot_window_stats.h
+ *
+ * Description: This file contains the declarations of the windowed
+ * statistics engine that keeps the minimum, maximum and mean of a measured
+ * value over time buckets, in double or Q16.16 fixed point.
+ *
+ ********************************************************************************
+ * Copyright 2024, Cypress Semiconductor Corporation (an Infineon company) or
+ * an affiliate of Cypress Semiconductor Corporation.  All rights reserved.
+ *
+ * This software, including source code, documentation and related
+ * materials ("Software") is owned by Cypress Semiconductor Corporation
+ * or one of its affiliates ("Cypress") and is protected by and subject to
+ * worldwide patent protection (United States and foreign),
+ * United States copyright laws and international treaty provisions.
+ * Therefore, you may use this Software only as provided in the license
+ * agreement accompanying the software package from which you
+ * obtained this Software ("EULA").
+ * If no EULA applies, Cypress hereby grants you a personal, non-exclusive,
+ * non-transferable license to copy, modify, and compile the Software
+ * source code solely for use in connection with Cypress's
+ * integrated circuit products.  Any reproduction, modification, translation,
+ * compilation, or representation of this Software except as specified
+ * above is prohibited without the express written permission of Cypress.
+ *
+ * Disclaimer: THIS SOFTWARE IS PROVIDED AS-IS, WITH NO WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING, BUT NOT LIMITED TO, NONINFRINGEMENT, IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. Cypress
+ * reserves the right to make changes to the Software without notice. Cypress
+ * does not assume any liability arising out of the application or use of the
+ * Software or any product or circuit described in the Software. Cypress does
+ * not authorize its products for use in any products where a malfunction or
+ * failure of the Cypress product may reasonably be expected to result in
+ * significant property damage, injury or death ("High Risk Product"). By
+ * including Cypress's product in a High Risk Product, the manufacturer
+ * of such system or application assumes all risk of such use and in doing
+ * so agrees to indemnify Cypress against all liability.
+ *******************************************************************************/
+
+#ifndef MQTT_IOT_WINDOW_STATS_H_
+#define MQTT_IOT_WINDOW_STATS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <az_core.h>
+
+/*******************************************************************************
+ * Macros
+ ********************************************************************************/
+/* Macro value 1 keeps the statistics in Q16.16 fixed point, and macro value
+ * 0 in double. The FPU of the Cortex-M4F is single precision, so double
+ * math is emulated in software. In fixed point, samples, minimum and
+ * maximum are int32_t with 16 fraction bits (-32768 to 32767.99998 in steps
+ * of 0.000015), and the mean is the exact 64-bit sum of the samples divided
+ * by their count.
+ */
+#ifndef IOT_STATS_FIXED_POINT
+#define IOT_STATS_FIXED_POINT                   (0)
+#endif
+
+#define IOT_STATS_Q16_FRACTION_BITS             (16)
+#define IOT_STATS_Q16_ONE                       (1L << IOT_STATS_Q16_FRACTION_BITS)
+
+/* Q16.16 value of a double, rounded to nearest; constant for a constant */
+#define IOT_STATS_Q16_FROM_DOUBLE(d)            \
+    ((int32_t)((d) * (double)IOT_STATS_Q16_ONE + (((d) >= 0) ? 0.5 : -0.5)))
+
+/* Conversions of iot_stats_value, for the input of samples and for logs */
+#if IOT_STATS_FIXED_POINT
+#define IOT_STATS_VALUE_FROM_DOUBLE(d)          IOT_STATS_Q16_FROM_DOUBLE(d)
+#define IOT_STATS_VALUE_TO_DOUBLE(v)            ((double)(v) / (double)IOT_STATS_Q16_ONE)
+#else
+#define IOT_STATS_VALUE_FROM_DOUBLE(d)          ((double)(d))
+#define IOT_STATS_VALUE_TO_DOUBLE(v)            (v)
+#endif
+
+/* Longest text of iot_stats_format_q16(), with the null terminator */
+#define IOT_STATS_Q16_TEXT_SIZE                 (16)
+
+/* Number of buckets kept, the oldest one is replaced when a sample starts a
+ * new bucket and all are in use. Buckets without samples take no slot.
+ */
+#define IOT_WINDOW_STATS_BUCKETS                (48)
+
+/*******************************************************************************
+ * Global Variables
+ ********************************************************************************/
+/* Count, minimum, maximum and mean of a set of samples in double. The mean
+ * and the sum of squared differences from the mean are updated with
+ * Welford's method, so they keep their precision for any number of samples.
+ */
+typedef struct
+{
+    uint32_t    count;
+    double      mean;
+    double      m2;
+    double      min;
+    double      max;
+} iot_running_stats_double;
+
+/* Count, minimum, maximum and sum of a set of Q16.16 samples. The sum is
+ * exact for up to 2^32 samples, so the mean loses no precision either.
+ */
+typedef struct
+{
+    uint32_t    count;
+    int64_t     sum;
+    int32_t     min;
+    int32_t     max;
+} iot_running_stats_q16;
+
+#if IOT_STATS_FIXED_POINT
+typedef int32_t                     iot_stats_value;
+typedef iot_running_stats_q16       iot_running_stats;
+#else
+typedef double                      iot_stats_value;
+typedef iot_running_stats_double    iot_running_stats;
+#endif
+
+/* Samples taken in [start, start + bucket_sec) */
+typedef struct
+{
+    time_t              start;
+    iot_running_stats   stats;
+} iot_window_stats_bucket;
+
+typedef struct
+{
+    uint32_t                bucket_sec;
+    uint8_t                 newest;         /* Index of the newest bucket */
+    uint8_t                 used;           /* Number of buckets in use */
+    time_t                  first_time;     /* Time of the first sample */
+    iot_running_stats       lifetime;       /* All samples since initialization */
+    iot_window_stats_bucket buckets[IOT_WINDOW_STATS_BUCKETS];
+} iot_window_stats;
+
+/******************************************************************************
+ * Function Prototypes
+ *******************************************************************************/
+/*
+ * @brief Clears the statistics of a set of samples.
+ * @param[out] stats Statistics.
+ */
+void iot_running_stats_reset(iot_running_stats* stats);
+
+/*
+ * @brief Adds one sample.
+ * @param[in,out] stats Statistics.
+ * @param[in] value Sample.
+ */
+void iot_running_stats_add(iot_running_stats* stats, iot_stats_value value);
+
+/*
+ * @brief Combines the statistics of two disjoint sets of samples, as if
+ * every sample of \p from had been added to \p into.
+ * @param[in,out] into Statistics that receive the samples.
+ * @param[in] from Statistics of the other set.
+ */
+void iot_running_stats_merge(iot_running_stats* into, iot_running_stats const* from);
+
+/*
+ * @brief Computes the mean of a set of samples.
+ * @param[in] stats Statistics.
+ * @return Mean, 0 if there are no samples.
+ */
+iot_stats_value iot_running_stats_mean(iot_running_stats const* stats);
+
+/*
+ * @brief Empties the engine.
+ * @param[out] stats Windowed statistics.
+ * @param[in] bucket_sec Duration of a bucket, the resolution of a window.
+ */
+void iot_window_stats_init(iot_window_stats* stats, uint32_t bucket_sec);
+
+/*
+ * @brief Adds a sample taken at \p when. A sample older than the newest
+ * bucket, e.g. after the clock was set back, is added to the newest bucket.
+ * @param[in,out] stats Windowed statistics.
+ * @param[in] when Time of the sample.
+ * @param[in] value Sample.
+ */
+void iot_window_stats_add(iot_window_stats* stats, time_t when, iot_stats_value value);
+
+/*
+ * @brief Combines the buckets that end after \p since in O(buckets). A
+ * window that starts at or before the first sample is answered from the
+ * lifetime statistics, and so is exact however old the samples are.
+ * Otherwise the window is rounded out to whole buckets, and limited to the
+ * buckets that are still kept.
+ * @param[in] stats Windowed statistics.
+ * @param[in] since Start of the window.
+ * @param[out] out_stats Statistics of the samples in the window.
+ * @param[out] out_start \p since, or the start of the oldest bucket kept if
+ * older buckets of the window were replaced, i.e. the window is truncated.
+ * @return false if the window has no samples.
+ */
+bool iot_window_stats_query(iot_window_stats const* stats, time_t since, iot_running_stats* out_stats,
+        time_t* out_start);
+
+/*
+ * @brief Converts an ISO 8601 date and time such as
+ * 2020-08-18T17:09:29-0700 to a time. Fractional seconds are ignored; a
+ * time without a UTC offset is taken as UTC.
+ * @param[in] text Date and time, not null-terminated.
+ * @param[in] text_len Length of \p text.
+ * @param[out] out_time Seconds since the epoch.
+ * @return false if \p text is not a valid date and time.
+ */
+bool iot_window_stats_parse_iso8601(char const* text, size_t text_len, time_t* out_time);
+
+/*
+ * @brief Formats a Q16.16 value as a JSON number with integer math, rounded
+ * to \p decimals fraction digits without trailing zeros, e.g. 68.5.
+ * @param[in] value Q16.16 value.
+ * @param[in] decimals Number of fraction digits, at most 4.
+ * @param[out] text Destination, at least IOT_STATS_Q16_TEXT_SIZE bytes.
+ * @return Length of the text, without the null terminator.
+ */
+size_t iot_stats_format_q16(int32_t value, uint8_t decimals, char* text);
+
+/*
+ * @brief Measures the CPU cycles of a statistics update and of serializing
+ * the maximum, minimum and mean to JSON, in double and in Q16.16, and
+ * writes the report, e.g. {"mode":"double","iterations":1000,
+ * "updateCycles":[...],"serializeCycles":[...]} with the double
+ * result first.
+ * @param[in] buffer Destination buffer.
+ * @param[out] out_report JSON text written to \p buffer.
+ * @return AZ_OK, or AZ_ERROR_NOT_ENOUGH_SPACE if \p buffer is too small.
+ */
+az_result iot_window_stats_build_benchmark_report(az_span buffer, az_span* out_report);
+
+#endif /* MQTT_IOT_WINDOW_STATS_H_ */
+
+/* [] END OF FILE */
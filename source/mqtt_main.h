@@ -133,6 +133,16 @@
 #define PSA_SAS_TOKEN_UID                       ( 3U )
 #endif
 
+#ifndef PSA_C2D_DEDUP_CACHE_UID
+/* UID for recently processed C2D message IDs */
+#define PSA_C2D_DEDUP_CACHE_UID                 ( 4U )
+#endif
+
+#ifndef PSA_PNP_TWIN_SNAPSHOT_UID
+/* UID for the last applied PnP desired properties */
+#define PSA_PNP_TWIN_SNAPSHOT_UID               ( 5U )
+#endif
+
 /* Length of client identifier */
 #define MQTT_CLIENT_IDENTIFIER_LENGTH               ( ( uint16_t ) ( sizeof( MQTT_CLIENT_IDENTIFIER ) - 1 ) )
 #define MQTT_CLIENT_IDENTIFIER_AWS_LENGTH           ( ( uint16_t ) ( sizeof( MQTT_CLIENT_IDENTIFIER_AWS ) - 1 ) )